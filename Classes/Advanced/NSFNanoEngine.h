@@ -299,6 +299,17 @@
 
 - (BOOL)beginDeferredTransaction;
 
+/** Starts an immediate transaction, acquiring the write lock right away.
+ * @return YES upon success, NO otherwise.
+ * @note Use it for read-modify-write sequences: no other connection can write until the transaction ends.
+ * @see - (BOOL)beginTransaction;
+ * @see - (BOOL)beginDeferredTransaction;
+ * @see - (BOOL)commitTransaction;
+ * @see - (BOOL)rollbackTransaction;
+ * @see - (BOOL)isTransactionActive;	*/
+
+- (BOOL)beginImmediateTransaction;
+
 /** Commits a transaction.
  * @return YES upon success, NO otherwise.
  * @see - (BOOL)beginTransaction;
@@ -393,6 +404,15 @@
 
 - (BOOL)createIndexForColumn:(NSString *)theColumn table:(NSString *)theTable isUnique:(BOOL)isUnique;
 
+/** Creates an index spanning several columns.
+ * @param theColumns is the list of column names, in index order. Must not be nil or empty.
+ * @param theTable is the name of the table.
+ * @param isUnique whether the index should be unique or allow duplicates.
+ * @return YES upon success, NO otherwise.
+ * @see - (void)dropIndex:(NSString *)indexName;	*/
+
+- (BOOL)createIndexForColumns:(NSArray *)theColumns table:(NSString *)theTable isUnique:(BOOL)isUnique;
+
 /** Returns a new array containing the indexes found in the main document store.
  * @return A new array containing the indexes in the main document store, or an empty array if none is found.	*/
 
@@ -29,18 +29,330 @@
 #import <stdio.h>
 #import <stdlib.h>
 #import <unistd.h>
+#import <math.h>
+#import <zlib.h>
 
 #pragma mark// ==================================
 #pragma mark// NSFNanoEngine C Declarations
 #pragma mark// ==================================
 
 int NSFP_commitCallback(void* nsfdb);
+void NSFP_rollbackCallback(void* nsfdb);
+void NSFP_updateCallback(void* nsfdb, int operation, const char *database, const char *table, sqlite3_int64 rowid);
+void NSFP_contentHashFunction(sqlite3_context *context, int argc, sqlite3_value **argv);
+void NSFP_mergePlistFunction(sqlite3_context *context, int argc, sqlite3_value **argv);
+void NSFP_compressPlistFunction(sqlite3_context *context, int argc, sqlite3_value **argv);
+void NSFP_timestampFromCalendarDateFunction(sqlite3_context *context, int argc, sqlite3_value **argv);
+void NSFP_approximatePercentileStep(sqlite3_context *context, int argc, sqlite3_value **argv);
+void NSFP_approximatePercentileFinal(sqlite3_context *context);
+void NSFP_histogramStep(sqlite3_context *context, int argc, sqlite3_value **argv);
+void NSFP_histogramFinal(sqlite3_context *context);
 
 static char     __NSFP_base64Table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+static char     __NSFP_base64PairTable[4096 * 2];
+static unsigned char __NSFP_base64DecodingTable[256];
 static NSArray  *__NSFP_SQLCommandsReturningData = nil;
 static NSArray  *__NSFPSharedROWIDKeywords = nil;
 static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
+static NSData   *__NSFP_BlobReferenceMarker = nil;
 
+static const int      __NSFP_MaximumHistogramBuckets = 65536;
+
+static const uint64_t __NSFP_XXH64Prime1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t __NSFP_XXH64Prime2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t __NSFP_XXH64Prime3 = 0x165667B19E3779F9ULL;
+static const uint64_t __NSFP_XXH64Prime4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t __NSFP_XXH64Prime5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t __NSFP_XXH64Rotate(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t __NSFP_XXH64Read64(const unsigned char *p)
+{
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint32_t __NSFP_XXH64Read32(const unsigned char *p)
+{
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t __NSFP_XXH64Round(uint64_t accumulator, uint64_t input)
+{
+    accumulator += input * __NSFP_XXH64Prime2;
+    accumulator = __NSFP_XXH64Rotate(accumulator, 31);
+    return accumulator * __NSFP_XXH64Prime1;
+}
+
+static inline uint64_t __NSFP_XXH64MergeRound(uint64_t accumulator, uint64_t value)
+{
+    accumulator ^= __NSFP_XXH64Round(0, value);
+    return accumulator * __NSFP_XXH64Prime1 + __NSFP_XXH64Prime4;
+}
+
+// XXH64 (little-endian reads, which is what every platform we run on uses)
+static uint64_t __NSFP_XXH64(const void *input, size_t length, uint64_t seed)
+{
+    const unsigned char *p = (const unsigned char *)input;
+    const unsigned char *end = p + length;
+    uint64_t hash;
+    
+    if (length >= 32) {
+        const unsigned char *limit = end - 32;
+        uint64_t v1 = seed + __NSFP_XXH64Prime1 + __NSFP_XXH64Prime2;
+        uint64_t v2 = seed + __NSFP_XXH64Prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - __NSFP_XXH64Prime1;
+        
+        do {
+            v1 = __NSFP_XXH64Round(v1, __NSFP_XXH64Read64(p)); p += 8;
+            v2 = __NSFP_XXH64Round(v2, __NSFP_XXH64Read64(p)); p += 8;
+            v3 = __NSFP_XXH64Round(v3, __NSFP_XXH64Read64(p)); p += 8;
+            v4 = __NSFP_XXH64Round(v4, __NSFP_XXH64Read64(p)); p += 8;
+        } while (p <= limit);
+        
+        hash = __NSFP_XXH64Rotate(v1, 1) + __NSFP_XXH64Rotate(v2, 7) + __NSFP_XXH64Rotate(v3, 12) + __NSFP_XXH64Rotate(v4, 18);
+        hash = __NSFP_XXH64MergeRound(hash, v1);
+        hash = __NSFP_XXH64MergeRound(hash, v2);
+        hash = __NSFP_XXH64MergeRound(hash, v3);
+        hash = __NSFP_XXH64MergeRound(hash, v4);
+    } else {
+        hash = seed + __NSFP_XXH64Prime5;
+    }
+    
+    hash += (uint64_t)length;
+    
+    while (p + 8 <= end) {
+        hash ^= __NSFP_XXH64Round(0, __NSFP_XXH64Read64(p));
+        hash = __NSFP_XXH64Rotate(hash, 27) * __NSFP_XXH64Prime1 + __NSFP_XXH64Prime4;
+        p += 8;
+    }
+    
+    if (p + 4 <= end) {
+        hash ^= (uint64_t)__NSFP_XXH64Read32(p) * __NSFP_XXH64Prime1;
+        hash = __NSFP_XXH64Rotate(hash, 23) * __NSFP_XXH64Prime2 + __NSFP_XXH64Prime3;
+        p += 4;
+    }
+    
+    while (p < end) {
+        hash ^= (*p) * __NSFP_XXH64Prime5;
+        hash = __NSFP_XXH64Rotate(hash, 11) * __NSFP_XXH64Prime1;
+        p++;
+    }
+    
+    hash ^= hash >> 33;
+    hash *= __NSFP_XXH64Prime2;
+    hash ^= hash >> 29;
+    hash *= __NSFP_XXH64Prime3;
+    hash ^= hash >> 32;
+    
+    return hash;
+}
+
+
+// Compressed plists: "NSFZ", the length of the XML (32-bit, big-endian) and a zlib stream, which may need a trained dictionary
+static const unsigned char  __NSFP_CompressedPlistMagic[4] = {'N', 'S', 'F', 'Z'};
+static const size_t         __NSFP_CompressedPlistHeaderLength = 8;
+static const size_t         __NSFP_MinimumCompressiblePlistLength = 128;
+static const NSUInteger     __NSFP_MaximumCompressionDictionaryLength = 32768;
+static NSString * const     __NSFP_PlistBufferThreadKey = @"NSFP_PlistBuffer";
+
+// Dictionaries are looked up by the Adler-32 checksum zlib records in the stream. Every dictionary ever used is kept,
+// so rows compressed before the dictionary was retrained can still be read.
+static NSMutableDictionary  *__NSFP_CompressionDictionaries = nil;
+
+static inline BOOL __NSFP_isCompressedPlist(const void *bytes, size_t length)
+{
+    return (length > __NSFP_CompressedPlistHeaderLength) && (0 == memcmp(bytes, __NSFP_CompressedPlistMagic, sizeof(__NSFP_CompressedPlistMagic)));
+}
+
+static NSData *__NSFP_compressPlist(const void *bytes, size_t length, NSData *dictionary)
+{
+    if ((length < __NSFP_MinimumCompressiblePlistLength) || (length > UINT32_MAX)) {
+        return nil;
+    }
+    
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (Z_OK != deflateInit(&stream, Z_DEFAULT_COMPRESSION)) {
+        return nil;
+    }
+    
+    if ((nil != dictionary) && (Z_OK != deflateSetDictionary(&stream, [dictionary bytes], (uInt)[dictionary length]))) {
+        deflateEnd(&stream);
+        return nil;
+    }
+    
+    uLong bound = deflateBound(&stream, (uLong)length);
+    NSMutableData *data = [NSMutableData dataWithLength:__NSFP_CompressedPlistHeaderLength + bound];
+    unsigned char *header = [data mutableBytes];
+    memcpy(header, __NSFP_CompressedPlistMagic, sizeof(__NSFP_CompressedPlistMagic));
+    header[4] = (unsigned char)(length >> 24);
+    header[5] = (unsigned char)(length >> 16);
+    header[6] = (unsigned char)(length >> 8);
+    header[7] = (unsigned char)length;
+    
+    stream.next_in = (Bytef *)bytes;
+    stream.avail_in = (uInt)length;
+    stream.next_out = header + __NSFP_CompressedPlistHeaderLength;
+    stream.avail_out = (uInt)bound;
+    
+    int status = deflate(&stream, Z_FINISH);
+    size_t compressedLength = __NSFP_CompressedPlistHeaderLength + stream.total_out;
+    deflateEnd(&stream);
+    
+    // Only worth it if it saves space: the plain XML is just as readable
+    if ((Z_STREAM_END != status) || (compressedLength >= length)) {
+        return nil;
+    }
+    
+    [data setLength:compressedLength];
+    
+    return data;
+}
+
+static int __NSFP_inflatePlist(const unsigned char *bytes, size_t length, unsigned char *buffer, size_t bufferLength, NSData *dictionary, uLong *outDictionaryIdentifier)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (Z_OK != inflateInit(&stream)) {
+        return Z_MEM_ERROR;
+    }
+    
+    stream.next_in = (Bytef *)bytes + __NSFP_CompressedPlistHeaderLength;
+    stream.avail_in = (uInt)(length - __NSFP_CompressedPlistHeaderLength);
+    stream.next_out = buffer;
+    stream.avail_out = (uInt)bufferLength;
+    
+    int status = inflate(&stream, Z_FINISH);
+    if ((Z_NEED_DICT == status) && (nil != dictionary)) {
+        status = inflateSetDictionary(&stream, [dictionary bytes], (uInt)[dictionary length]);
+        if (Z_OK == status) {
+            status = inflate(&stream, Z_FINISH);
+        }
+    }
+    
+    if (NULL != outDictionaryIdentifier) {
+        *outDictionaryIdentifier = stream.adler;
+    }
+    
+    if ((Z_STREAM_END == status) && (stream.total_out != bufferLength)) {
+        status = Z_DATA_ERROR;
+    }
+    
+    inflateEnd(&stream);
+    
+    return status;
+}
+
+// Decompresses into a buffer owned by the calling thread, which is reused by the next call made from that thread
+static NSData *__NSFP_decompressPlist(const void *bytes, size_t length)
+{
+    const unsigned char *header = bytes;
+    size_t plistLength = ((size_t)header[4] << 24) | ((size_t)header[5] << 16) | ((size_t)header[6] << 8) | (size_t)header[7];
+    
+    NSMutableDictionary *threadDictionary = [[NSThread currentThread]threadDictionary];
+    NSMutableData *buffer = [threadDictionary objectForKey:__NSFP_PlistBufferThreadKey];
+    if (nil == buffer) {
+        buffer = [NSMutableData dataWithCapacity:plistLength];
+        [threadDictionary setObject:buffer forKey:__NSFP_PlistBufferThreadKey];
+    }
+    [buffer setLength:plistLength];
+    
+    uLong dictionaryIdentifier = 0;
+    int status = __NSFP_inflatePlist(bytes, length, [buffer mutableBytes], plistLength, nil, &dictionaryIdentifier);
+    
+    if (Z_NEED_DICT == status) {
+        NSArray *dictionaries = nil;
+        @synchronized ([NSFNanoEngine class]) {
+            dictionaries = [[__NSFP_CompressionDictionaries objectForKey:[NSNumber numberWithUnsignedLong:dictionaryIdentifier]]copy];
+        }
+        
+        // Adler-32 can collide, so every dictionary sharing the checksum gets a chance
+        for (NSData *dictionary in dictionaries) {
+            status = __NSFP_inflatePlist(bytes, length, [buffer mutableBytes], plistLength, dictionary, NULL);
+            if (Z_STREAM_END == status) {
+                break;
+            }
+        }
+    }
+    
+    return (Z_STREAM_END == status) ? buffer : nil;
+}
+
+static void __NSFP_setupBase64Tables(void)
+{
+    // Every 12-bit pair of sextets maps to two characters, so three bytes are encoded with two lookups
+    for (int i = 0; i < 4096; i++) {
+        __NSFP_base64PairTable[i * 2] = __NSFP_base64Table[i >> 6];
+        __NSFP_base64PairTable[i * 2 + 1] = __NSFP_base64Table[i & 0x3F];
+    }
+    
+    // Characters outside the alphabet decode as zero, like the padding
+    memset (__NSFP_base64DecodingTable, 0, sizeof(__NSFP_base64DecodingTable));
+    for (int i = 0; i < 64; i++) {
+        __NSFP_base64DecodingTable[(unsigned char)__NSFP_base64Table[i]] = (unsigned char)i;
+    }
+}
+
+// Writes the padded encoding of the bytes to the output, which must hold ((length + 2) / 3) * 4 characters
+static size_t __NSFP_encodeBase64(const unsigned char *bytes, size_t length, char *output)
+{
+    char *start = output;
+    const unsigned char *end = bytes + (length - length % 3);
+    
+    while (bytes < end) {
+        uint32_t quantum = ((uint32_t)bytes[0] << 16) | ((uint32_t)bytes[1] << 8) | (uint32_t)bytes[2];
+        memcpy (output, &__NSFP_base64PairTable[(quantum >> 12) * 2], 2);
+        memcpy (output + 2, &__NSFP_base64PairTable[(quantum & 0xFFF) * 2], 2);
+        bytes += 3;
+        output += 4;
+    }
+    
+    switch (length % 3) {
+        case 1:
+            output[0] = __NSFP_base64Table[bytes[0] >> 2];
+            output[1] = __NSFP_base64Table[(bytes[0] & 0x03) << 4];
+            output[2] = '=';
+            output[3] = '=';
+            output += 4;
+            break;
+        case 2:
+            output[0] = __NSFP_base64Table[bytes[0] >> 2];
+            output[1] = __NSFP_base64Table[((bytes[0] & 0x03) << 4) | (bytes[1] >> 4)];
+            output[2] = __NSFP_base64Table[(bytes[1] & 0x0F) << 2];
+            output[3] = '=';
+            output += 4;
+            break;
+    }
+    
+    return (size_t)(output - start);
+}
+
+// Decodes whole quanta of four characters. The output must hold (length / 4) * 3 bytes.
+static void __NSFP_decodeBase64(const char *source, size_t length, unsigned char *output)
+{
+    const unsigned char *input = (const unsigned char *)source;
+    const unsigned char *end = input + (length - length % 4);
+    
+    while (input < end) {
+        uint32_t quantum = ((uint32_t)__NSFP_base64DecodingTable[input[0]] << 18) |
+                           ((uint32_t)__NSFP_base64DecodingTable[input[1]] << 12) |
+                           ((uint32_t)__NSFP_base64DecodingTable[input[2]] << 6) |
+                           (uint32_t)__NSFP_base64DecodingTable[input[3]];
+        output[0] = (unsigned char)(quantum >> 16);
+        output[1] = (unsigned char)(quantum >> 8);
+        output[2] = (unsigned char)quantum;
+        input += 4;
+        output += 3;
+    }
+}
 
 @implementation NSFNanoEngine
 {
@@ -51,8 +363,13 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
     
     /** \cond */
     NSMutableDictionary     *schema;
-    BOOL                    willCommitChangeSchema;
     unsigned int            busyTimeout;
+    NSMutableSet            *changedTables;
+    NSMutableDictionary     *tableGenerations;
+    char                    lastChangedTable[64];
+    BOOL                    tracksChangedTables;
+    BOOL                    compressesPlists;
+    NSData                  *compressionDictionary;
     /** \endcond */
 }
 
@@ -94,6 +411,8 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
 + (void)initialize
 {
     __NSFP_SQLCommandsReturningData = [[NSArray alloc]initWithObjects:@"SELECT", @"PRAGMA", @"EXPLAIN", nil];
+    __NSFP_BlobReferenceMarker = [NSF_Private_NSFNanoBlob_Hash dataUsingEncoding:NSUTF8StringEncoding];
+    __NSFP_setupBase64Tables();
 }
 
 - (id)init
@@ -101,6 +420,12 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
     if ((self = [super init])) {
         path = nil;
         schema = nil;
+        changedTables = [NSMutableSet new];
+        tableGenerations = [NSMutableDictionary new];
+        lastChangedTable[0] = '\0';
+        tracksChangedTables = NO;
+        compressesPlists = NO;
+        compressionDictionary = nil;
     }
     return self;
 }
@@ -178,6 +503,8 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
     
     [self NSFP_installCommitCallback];
     
+    [self NSFP_registerFunctions];
+    
     return YES;
 }
 
@@ -229,8 +556,6 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
     if (YES == [self isTransactionActive])
         return NO;
     
-    willCommitChangeSchema = NO;
-    
     return [self beginDeferredTransaction];
 }
 
@@ -239,43 +564,34 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
     if (YES == [self isTransactionActive])
         return NO;
     
-    willCommitChangeSchema = NO;
-    
     return [self NSFP_beginTransactionMode:@"BEGIN DEFERRED TRANSACTION;"];
 }
 
+- (BOOL)beginImmediateTransaction
+{
+    if (YES == [self isTransactionActive])
+        return NO;
+    
+    return [self NSFP_beginTransactionMode:@"BEGIN IMMEDIATE TRANSACTION;"];
+}
+
 - (BOOL)commitTransaction
 {
     if (NO == [self isTransactionActive]) {
-        willCommitChangeSchema = NO;
         return NO;
     }
     
-    if (NO == willCommitChangeSchema)
-        [self NSFP_uninstallCommitCallback];
-    
-    BOOL success = (nil == [[self executeSQL:@"COMMIT TRANSACTION;"]error]);
-    
-    if (NO == willCommitChangeSchema)
-        [self NSFP_installCommitCallback];
-    
-    willCommitChangeSchema = NO;
-    
-    return success;
+    // The commit hook stays installed so that the tables changed by this transaction are recorded
+    return (nil == [[self executeSQL:@"COMMIT TRANSACTION;"]error]);
 }
 
 - (BOOL)rollbackTransaction
 {
     if ([self isTransactionActive] == NO) {
-        willCommitChangeSchema = NO;
         return NO;
     }
     
-    BOOL success = (nil == [[self executeSQL:@"ROLLBACK TRANSACTION;"]error]);
-    
-    willCommitChangeSchema = NO;
-    
-    return success;
+    return (nil == [[self executeSQL:@"ROLLBACK TRANSACTION;"]error]);
 }
 
 - (BOOL)isTransactionActive
@@ -427,6 +743,24 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
     return indexWasCreated;
 }
 
+- (BOOL)createIndexForColumns:(NSArray *)columns table:(NSString *)table isUnique:(BOOL)flag
+{
+    if (0 == [columns count])
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: columns is nil or empty.", [self class], _cmd]
+                               userInfo:nil]raise];
+    if (nil == table)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: table is nil.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    NSString  *theSQLStatement = [[NSString alloc]initWithFormat:@"CREATE %@INDEX %@_%@_IDX ON %@ (%@);", (flag ? @"UNIQUE " : @""), table, [columns componentsJoinedByString:@"_"], table, [columns componentsJoinedByString:@", "]];
+    
+    BOOL indexWasCreated = (nil == [[self executeSQL:theSQLStatement]error]);
+    
+    return indexWasCreated;
+}
+
 - (void)dropIndex:(NSString *)indexName
 {
     if (nil == indexName)
@@ -445,9 +779,12 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
     if ([allTables count] == 0)
         return allTables;
     
-    // Remove NSF's private table
+    // Remove NSF's private tables
     NSMutableArray *tempTables = [NSMutableArray arrayWithArray:allTables];
     [tempTables removeObject:NSFP_SchemaTable];
+    [tempTables removeObject:NSFP_AggregatesTable];
+    [tempTables removeObject:NSFP_AggregateDefinitionsTable];
+    [tempTables removeObject:NSFP_CompressionDictionariesTable];
     
     return tempTables;
 }
@@ -598,13 +935,26 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
                     }
                     NSString *column = [[NSString alloc]initWithUTF8String:columnUTF8];
 
-                    // Sanity check: some queries return NULL, which would cause a crash below.
-                    char *valueUTF8 = (char *)sqlite3_column_text (theSQLiteStatement, columnIndex);
+                    // Compressed documents are returned as the XML they were made of. Only the document column is looked at:
+                    // any other blob, such as an NSData value in NSFValues, may just as well start with the same bytes.
                     NSString *value = nil;
-                    if (NULL != valueUTF8) {
-                        value = [[NSString alloc]initWithUTF8String:valueUTF8];
-                    } else {
-                        value = [[NSNull null]description];
+                    if ((SQLITE_BLOB == sqlite3_column_type (theSQLiteStatement, columnIndex)) && (NSOrderedSame == [column caseInsensitiveCompare:NSFPlist])) {
+                        const void *bytes = sqlite3_column_blob (theSQLiteStatement, columnIndex);
+                        int length = sqlite3_column_bytes (theSQLiteStatement, columnIndex);
+                        if (YES == __NSFP_isCompressedPlist(bytes, length)) {
+                            NSData *plistData = __NSFP_decompressPlist(bytes, length);
+                            value = (nil != plistData) ? [[NSString alloc]initWithData:plistData encoding:NSUTF8StringEncoding] : [[NSNull null]description];
+                        }
+                    }
+                    
+                    // Sanity check: some queries return NULL, which would cause a crash below.
+                    if (nil == value) {
+                        char *valueUTF8 = (char *)sqlite3_column_text (theSQLiteStatement, columnIndex);
+                        if (NULL != valueUTF8) {
+                            value = [[NSString alloc]initWithUTF8String:valueUTF8];
+                        } else {
+                            value = [[NSNull null]description];
+                        }
                     }
                     
                     // Obtain the array to collect the values. If the array doesn't exist, create it.
@@ -908,72 +1258,16 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
                                  reason:[NSString stringWithFormat:@"*** -[%@ %s]: data is nil.", [self class], _cmd]
                                userInfo:nil]raise];
     
-    NSInteger decodedDataSize = [data length];
-    unsigned char *bytes = (unsigned char *)malloc(decodedDataSize);
-    
-    // Extract the bytes
-    [data getBytes:bytes];
-    
-    unsigned char inBuffer[3];
-    unsigned char outBuffer[4];
-    NSInteger i;
-    NSInteger segments;
-    char *outputBuffer;
-    char *base64Buffer;
-    
-    base64Buffer = outputBuffer = (char *)malloc (decodedDataSize * 4 / 3 + 4);
-    if (NULL == outputBuffer) {
-        free (bytes);
+    NSUInteger decodedDataSize = [data length];
+    char *base64Buffer = (char *)malloc (((decodedDataSize + 2) / 3) * 4 + 1);
+    if (NULL == base64Buffer) {
         return nil;
     }
     
-    while (decodedDataSize > 0) {
-        for (i = segments = 0; i < 3; i++) {
-            if (decodedDataSize > 0) {
-                segments++;
-                inBuffer[i] = *(bytes + i);
-                decodedDataSize--;
-            } else
-                inBuffer[i] = 0;
-        }
-        
-        outBuffer [0] = (inBuffer [0] & 0xFC) >> 2;
-        outBuffer [1] = ((inBuffer [0] & 0x03) << 4) | ((inBuffer [1] & 0xF0) >> 4);
-        outBuffer [2] = ((inBuffer [1] & 0x0F) << 2) | ((inBuffer [2] & 0xC0) >> 6);
-        outBuffer [3] = inBuffer [2] & 0x3F;
-        
-        switch (segments) {
-            case 1:
-                sprintf(outputBuffer, "%c%c==",
-                        __NSFP_base64Table[outBuffer[0]],
-                        __NSFP_base64Table[outBuffer[1]]);
-                break;
-            case 2:
-                sprintf(outputBuffer, "%c%c%c=",
-                        __NSFP_base64Table[outBuffer[0]],
-                        __NSFP_base64Table[outBuffer[1]],
-                        __NSFP_base64Table[outBuffer[2]]);
-                break;
-            default:
-                sprintf(outputBuffer, "%c%c%c%c",
-                        __NSFP_base64Table[outBuffer[0]],
-                        __NSFP_base64Table[outBuffer[1]],
-                        __NSFP_base64Table[outBuffer[2]],
-                        __NSFP_base64Table[outBuffer[3]] );
-                break;
-        }
-        
-        outputBuffer += 4;
-    }
-    
-    *outputBuffer = 0;
+    // Encode straight from the data's bytes and hand the buffer over to the string
+    size_t encodedLength = __NSFP_encodeBase64 ([data bytes], decodedDataSize, base64Buffer);
     
-    NSString  *myBase64Data = [NSString stringWithUTF8String:base64Buffer];
-    
-    free (base64Buffer);
-    free (bytes);
-
-    return myBase64Data;
+    return [[NSString alloc]initWithBytesNoCopy:base64Buffer length:encodedLength encoding:NSASCIIStringEncoding freeWhenDone:YES];
 }
 
 + (NSData*)decodeDataFromBase64:(NSString *)encodedData
@@ -984,44 +1278,28 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
                                userInfo:nil]raise];
     
     const char* source = [encodedData UTF8String];
-    NSUInteger sourceLength = strlen(source);
-    char* destination = (char *)malloc(sourceLength * 3/4 + 8);
-    char* destinationPtr = destination;
     
-    NSInteger length = 0;
-    NSInteger pivot = 0;
-    NSInteger i;
-    NSInteger numSegments;
-    unsigned char lastSegment[3];
-    NSUInteger decodedLength = 0;
+    NSUInteger length = 0;
+    NSUInteger pivot = 0;
     
     while ((source[length] != '=') && source[length])
         length++;
     while (source[length+pivot] == '=')
         pivot++;
     
-    numSegments = (length + pivot) / 4;
-    
-    decodedLength = (numSegments * 3) - pivot;
-    
-    for (i = 0; i < numSegments - 1; i++) {
-        [self NSFP_decodeQuantum:(unsigned char *)destination andSource:source];
-        destination += 3;
-        source += 4;
+    NSUInteger numSegments = (length + pivot) / 4;
+    if ((0 == numSegments) || (pivot > 2)) {
+        return [NSData data];
     }
     
-    [self NSFP_decodeQuantum:lastSegment andSource:source];
-    
-    for (i = 0; i < 3 - pivot; i++)
-        destination[i] = lastSegment[i];
-    
-    // Construct a NSData with the decoded data
-    NSData* myDummyData = [NSData dataWithBytes:destinationPtr length:decodedLength];
+    unsigned char *destination = (unsigned char *)malloc(numSegments * 3);
+    if (NULL == destination) {
+        return nil;
+    }
     
-    // Cleanup
-    free (destinationPtr);
+    __NSFP_decodeBase64 (source, numSegments * 4, destination);
     
-    return myDummyData;
+    return [NSData dataWithBytesNoCopy:destination length:(numSegments * 3) - pivot freeWhenDone:YES];
 }
 
 #pragma mark// ==================================
@@ -1100,43 +1378,189 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
         return nil;
     }
     
+    // Blobs stored out-of-line are written as references: hand them out as NSFNanoBlob objects
+    if (NSNotFound != [aPlist rangeOfString:NSF_Private_NSFNanoBlob_Hash].location) {
+        dict = [NSFNanoBlob _collectionByResolvingReferences:dict];
+    }
+    
     return dict;
 }
 
-+ (void)NSFP_decodeQuantum:(unsigned char*)dest andSource:(const char *)src
++ (NSString *)NSFP_contentHashOfBytes:(const void *)bytes length:(NSUInteger)length
 {
-    if (nil == dest)
-        [[NSException exceptionWithName:NSFUnexpectedParameterException
-                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: dest is nil.", [self class], _cmd]
-                               userInfo:nil]raise];
+    return [NSString stringWithFormat:@"%016llx", (unsigned long long)__NSFP_XXH64(bytes, length, 0)];
+}
+
++ (NSDictionary *)NSFP_dictionaryForColumn:(int)column statement:(sqlite3_stmt *)aStatement
+{
+    // Parse the plist straight from the column bytes, which avoids the intermediate NSString (and its UTF-8 round trip.)
+    // The bytes are only valid until the statement is stepped again, so they're consumed right away.
+    const void *bytes = sqlite3_column_blob (aStatement, column);
+    int length = sqlite3_column_bytes (aStatement, column);
+    if ((NULL == bytes) || (length <= 0)) {
+        return nil;
+    }
+    
+    NSData *data = [[NSData alloc]initWithBytesNoCopy:(void *)bytes length:length freeWhenDone:NO];
+    
+    return [self NSFP_dictionaryFromPlistData:data];
+}
+
++ (NSDictionary *)NSFP_dictionaryFromPlistData:(NSData *)data
+{
+    // Safe to call from any thread
+    data = [self NSFP_plistDataFromBytes:[data bytes] length:[data length]];
+    if (nil == data) {
+        NSLog(@"*** -[%@ %@]: the compressed plist could not be decompressed.", [self class], NSStringFromSelector(_cmd));
+        return nil;
+    }
+    
+    NSError *error = nil;
+    id dict = [NSPropertyListSerialization propertyListWithData:data options:NSPropertyListImmutable format:NULL error:&error];
+    
+    if (NO == [dict isKindOfClass:[NSDictionary class]]) {
+        NSLog(@"*** -[%@ %@]: [NSPropertyListSerialization propertyListWithData] failure. %@", [self class], NSStringFromSelector(_cmd), error);
+        return nil;
+    }
     
-    if (nil == src)
+    // Blobs stored out-of-line are written as references: hand them out as NSFNanoBlob objects
+    if (NSNotFound != [data rangeOfData:__NSFP_BlobReferenceMarker options:0 range:NSMakeRange(0, [data length])].location) {
+        dict = [NSFNanoBlob _collectionByResolvingReferences:dict];
+    }
+    
+    return dict;
+}
+
++ (BOOL)NSFP_isCompressedPlistBytes:(const void *)bytes length:(NSUInteger)length
+{
+    return __NSFP_isCompressedPlist(bytes, length);
+}
+
++ (NSData *)NSFP_plistDataFromBytes:(const void *)bytes length:(NSUInteger)length
+{
+    // Plain XML is wrapped as is. Compressed plists are expanded into a per-thread buffer: the data returned
+    // is only valid until the next plist is decompressed on the same thread.
+    if (NO == __NSFP_isCompressedPlist(bytes, length)) {
+        return [[NSData alloc]initWithBytesNoCopy:(void *)bytes length:length freeWhenDone:NO];
+    }
+    
+    return __NSFP_decompressPlist(bytes, length);
+}
+
+- (NSData *)NSFP_compressedPlistFromBytes:(const void *)bytes length:(NSUInteger)length
+{
+    if (NO == compressesPlists) {
+        return nil;
+    }
+    
+    return __NSFP_compressPlist(bytes, length, compressionDictionary);
+}
+
+- (BOOL)NSFP_compressesPlists
+{
+    return compressesPlists;
+}
+
+- (void)NSFP_setCompressesPlists:(BOOL)flag
+{
+    compressesPlists = flag;
+}
+
+- (NSData *)NSFP_compressionDictionary
+{
+    return compressionDictionary;
+}
+
+- (void)NSFP_setCompressionDictionary:(NSData *)theDictionary
+{
+    if (nil != theDictionary) {
+        [NSFNanoEngine NSFP_registerCompressionDictionary:theDictionary];
+    }
+    
+    compressionDictionary = [theDictionary copy];
+}
+
++ (void)NSFP_registerCompressionDictionary:(NSData *)theDictionary
+{
+    if ([theDictionary length] == 0)
         [[NSException exceptionWithName:NSFUnexpectedParameterException
-                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: src is nil.", [self class], _cmd]
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theDictionary is empty.", [self class], _cmd]
                                userInfo:nil]raise];
     
-    NSUInteger x = 0;
-    NSInteger i;
-    for (i = 0; i < 4; i++) {
-        if (src[i] >= 'A' && src[i] <= 'Z')
-            x = (x << 6) + (NSUInteger)(src[i] - 'A' + 0);
-        else if (src[i] >= 'a' && src[i] <= 'z')
-            x = (x << 6) + (NSUInteger)(src[i] - 'a' + 26);
-        else if (src[i] >= '0' && src[i] <= '9')
-            x = (x << 6) + (NSUInteger)(src[i] - '0' + 52);
-        else if (src[i] == '+')
-            x = (x << 6) + 62;
-        else if (src[i] == '/')
-            x = (x << 6) + 63;
-        else if (src[i] == '=')
-            x = (x << 6);
-    }
-    
-    dest[2] = (unsigned char)(x & 255);
-    x >>= 8;
-    dest[1] = (unsigned char)(x & 255);
-    x >>= 8;
-    dest[0] = (unsigned char)(x & 255);
+    NSNumber *identifier = [NSNumber numberWithUnsignedLong:adler32(adler32(0L, Z_NULL, 0), [theDictionary bytes], (uInt)[theDictionary length])];
+    
+    @synchronized ([NSFNanoEngine class]) {
+        if (nil == __NSFP_CompressionDictionaries) {
+            __NSFP_CompressionDictionaries = [NSMutableDictionary new];
+        }
+        
+        NSMutableArray *dictionaries = [__NSFP_CompressionDictionaries objectForKey:identifier];
+        if (nil == dictionaries) {
+            dictionaries = [NSMutableArray new];
+            [__NSFP_CompressionDictionaries setObject:dictionaries forKey:identifier];
+        }
+        
+        if (NO == [dictionaries containsObject:theDictionary]) {
+            [dictionaries addObject:[theDictionary copy]];
+        }
+    }
+}
+
++ (NSData *)NSFP_compressionDictionaryFromSamples:(NSArray *)somePlists
+{
+    // Plists are line oriented (one key or value per line), so the lines shared by several documents are what
+    // the dictionary is made of. They're ranked by the bytes they would save and the most valuable ones are placed
+    // last, closest to the data, where zlib encodes the references to them with the shortest distances.
+    NSCountedSet *lines = [NSCountedSet new];
+    
+    for (NSData *plist in somePlists) {
+        NSString *plistString = [[NSString alloc]initWithData:plist encoding:NSUTF8StringEncoding];
+        NSSet *uniqueLines = [NSSet setWithArray:[plistString componentsSeparatedByString:@"\n"]];
+        for (NSString *line in uniqueLines) {
+            if ([line length] > 0) {
+                [lines addObject:line];
+            }
+        }
+    }
+    
+    NSMutableArray *sharedLines = [NSMutableArray array];
+    for (NSString *line in lines) {
+        if ([lines countForObject:line] > 1) {
+            [sharedLines addObject:line];
+        }
+    }
+    
+    [sharedLines sortUsingComparator:^NSComparisonResult(NSString *line1, NSString *line2) {
+        NSUInteger savings1 = [lines countForObject:line1] * [line1 length];
+        NSUInteger savings2 = [lines countForObject:line2] * [line2 length];
+        if (savings1 == savings2) {
+            return [line1 compare:line2];
+        }
+        return (savings1 > savings2) ? NSOrderedAscending : NSOrderedDescending;
+    }];
+    
+    NSMutableArray *selectedLines = [NSMutableArray array];
+    NSUInteger dictionaryLength = 0;
+    for (NSString *line in sharedLines) {
+        NSUInteger lineLength = [line lengthOfBytesUsingEncoding:NSUTF8StringEncoding] + 1;
+        if (dictionaryLength + lineLength > __NSFP_MaximumCompressionDictionaryLength) {
+            continue;
+        }
+        [selectedLines addObject:line];
+        dictionaryLength += lineLength;
+    }
+    
+    if (0 == dictionaryLength) {
+        return nil;
+    }
+    
+    NSMutableString *dictionary = [NSMutableString string];
+    for (NSString *line in [selectedLines reverseObjectEnumerator]) {
+        [dictionary appendString:line];
+        [dictionary appendString:@"\n"];
+    }
+    
+    return [dictionary dataUsingEncoding:NSUTF8StringEncoding];
 }
 
 - (NSFNanoDatatype)NSFP_datatypeForColumn:(NSString *)tableAndColumn
@@ -1761,18 +2185,421 @@ static NSSet    *__NSFPSharedNanoStoreEngineDatatypes = nil;
 - (void)NSFP_installCommitCallback
 {
     sqlite3_commit_hook( self.sqlite, NSFP_commitCallback, (__bridge void *)(self));
+    sqlite3_rollback_hook( self.sqlite, NSFP_rollbackCallback, (__bridge void *)(self));
+    
+    // The update hook runs for every row written, so it's only installed while someone needs the changed tables
+    if (YES == tracksChangedTables) {
+        sqlite3_update_hook( self.sqlite, NSFP_updateCallback, (__bridge void *)(self));
+    }
 }
 
 - (void)NSFP_uninstallCommitCallback
 {
     sqlite3_commit_hook( self.sqlite, NULL, NULL);
+    sqlite3_rollback_hook( self.sqlite, NULL, NULL);
+    sqlite3_update_hook( self.sqlite, NULL, NULL);
+}
+
+- (void)NSFP_registerFunctions
+{
+    sqlite3_create_function (self.sqlite, "NSFP_contentHash", 1, SQLITE_UTF8, NULL, NSFP_contentHashFunction, NULL, NULL);
+    sqlite3_create_function (self.sqlite, "NSFP_mergePlist", 2, SQLITE_UTF8, (__bridge void *)(self), NSFP_mergePlistFunction, NULL, NULL);
+    sqlite3_create_function (self.sqlite, "NSFP_compressPlist", 1, SQLITE_UTF8, (__bridge void *)(self), NSFP_compressPlistFunction, NULL, NULL);
+    sqlite3_create_function (self.sqlite, "NSFP_timestampFromCalendarDate", 1, SQLITE_UTF8, NULL, NSFP_timestampFromCalendarDateFunction, NULL, NULL);
+    sqlite3_create_function (self.sqlite, "NSFP_approximatePercentile", 2, SQLITE_UTF8, NULL, NULL, NSFP_approximatePercentileStep, NSFP_approximatePercentileFinal);
+    sqlite3_create_function (self.sqlite, "NSFP_histogram", 4, SQLITE_UTF8, NULL, NULL, NSFP_histogramStep, NSFP_histogramFinal);
+}
+
+- (BOOL)NSFP_tracksChangedTables
+{
+    return tracksChangedTables;
+}
+
+- (void)NSFP_setTracksChangedTables:(BOOL)flag
+{
+    tracksChangedTables = flag;
+    
+    if (NULL != self.sqlite) {
+        sqlite3_update_hook( self.sqlite, (YES == flag) ? NSFP_updateCallback : NULL, (YES == flag) ? (__bridge void *)(self) : NULL);
+    }
+    
+    if (NO == flag) {
+        [self NSFP_discardChangedTables];
+    }
+}
+
+- (void)NSFP_recordChangeForTable:(const char *)table
+{
+    // The update hook fires once per row, so skip the bookkeeping while the same table keeps changing
+    if (0 == strncmp(lastChangedTable, table, sizeof(lastChangedTable))) {
+        return;
+    }
+    
+    strncpy(lastChangedTable, table, sizeof(lastChangedTable) - 1);
+    lastChangedTable[sizeof(lastChangedTable) - 1] = '\0';
+    
+    NSString *tableName = [[NSString alloc]initWithUTF8String:table];
+    if (nil != tableName) {
+        [changedTables addObject:tableName];
+    }
+}
+
+- (void)NSFP_commitChangedTables
+{
+    for (NSString *table in changedTables) {
+        unsigned long long generation = [[tableGenerations objectForKey:table]unsignedLongLongValue];
+        [tableGenerations setObject:[NSNumber numberWithUnsignedLongLong:generation + 1] forKey:table];
+    }
+    
+    [self NSFP_discardChangedTables];
+}
+
+- (void)NSFP_discardChangedTables
+{
+    [changedTables removeAllObjects];
+    lastChangedTable[0] = '\0';
+}
+
+- (unsigned long long)NSFP_generationForTable:(NSString *)table
+{
+    return [[tableGenerations objectForKey:table]unsignedLongLongValue];
+}
+
+- (BOOL)NSFP_hasUncommittedChanges
+{
+    return ([changedTables count] > 0);
 }
 
 int NSFP_commitCallback(void* nsfdb)
 {
+    [(__bridge NSFNanoEngine *)nsfdb NSFP_commitChangedTables];
+    
     return SQLITE_OK;
 }
 
+void NSFP_rollbackCallback(void* nsfdb)
+{
+    [(__bridge NSFNanoEngine *)nsfdb NSFP_discardChangedTables];
+}
+
+void NSFP_updateCallback(void* nsfdb, int operation, const char *database, const char *table, sqlite3_int64 rowid)
+{
+    [(__bridge NSFNanoEngine *)nsfdb NSFP_recordChangeForTable:table];
+}
+
+void NSFP_contentHashFunction(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    if (SQLITE_NULL == sqlite3_value_type (argv[0])) {
+        sqlite3_result_null (context);
+        return;
+    }
+    
+    const void *bytes = sqlite3_value_blob (argv[0]);
+    size_t length = sqlite3_value_bytes (argv[0]);
+    
+    // The hash is always the one of the XML, compressed or not
+    if (YES == __NSFP_isCompressedPlist(bytes, length)) {
+        NSData *plistData = __NSFP_decompressPlist(bytes, length);
+        if (nil == plistData) {
+            sqlite3_result_error (context, "NSFP_contentHash: the compressed plist could not be decompressed", -1);
+            return;
+        }
+        bytes = [plistData bytes];
+        length = [plistData length];
+    }
+    
+    char hash[17];
+    snprintf (hash, sizeof(hash), "%016llx", (unsigned long long)__NSFP_XXH64(bytes, length, 0));
+    sqlite3_result_text (context, hash, 16, SQLITE_TRANSIENT);
+}
+
+void NSFP_mergePlistFunction(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    // Both arguments are XML plists of dictionaries: the entries of the second one replace those of the first one
+    if ((SQLITE_NULL == sqlite3_value_type (argv[0])) || (SQLITE_NULL == sqlite3_value_type (argv[1]))) {
+        sqlite3_result_value (context, argv[0]);
+        return;
+    }
+    
+    @autoreleasepool {
+        NSData *plistData = [NSFNanoEngine NSFP_plistDataFromBytes:sqlite3_value_blob (argv[0]) length:sqlite3_value_bytes (argv[0])];
+        NSData *patchData = [[NSData alloc]initWithBytesNoCopy:(void *)sqlite3_value_blob (argv[1]) length:sqlite3_value_bytes (argv[1]) freeWhenDone:NO];
+        
+        NSMutableDictionary *info = (nil != plistData) ? [NSPropertyListSerialization propertyListWithData:plistData options:NSPropertyListMutableContainers format:NULL error:nil] : nil;
+        NSDictionary *patch = [NSPropertyListSerialization propertyListWithData:patchData options:NSPropertyListImmutable format:NULL error:nil];
+        
+        if ((NO == [info isKindOfClass:[NSMutableDictionary class]]) || (NO == [patch isKindOfClass:[NSDictionary class]])) {
+            sqlite3_result_error (context, "NSFP_mergePlist: expected two dictionary plists", -1);
+            return;
+        }
+        
+        [info addEntriesFromDictionary:patch];
+        
+        NSData *mergedData = [NSPropertyListSerialization dataWithPropertyList:info format:NSPropertyListXMLFormat_v1_0 options:0 error:nil];
+        if (nil == mergedData) {
+            sqlite3_result_error (context, "NSFP_mergePlist: the merged plist could not be serialized", -1);
+            return;
+        }
+        
+        NSData *compressedData = [(__bridge NSFNanoEngine *)sqlite3_user_data (context) NSFP_compressedPlistFromBytes:[mergedData bytes] length:[mergedData length]];
+        if (nil != compressedData) {
+            sqlite3_result_blob (context, [compressedData bytes], (int)[compressedData length], SQLITE_TRANSIENT);
+        } else {
+            sqlite3_result_text (context, [mergedData bytes], (int)[mergedData length], SQLITE_TRANSIENT);
+        }
+    }
+}
+
+void NSFP_compressPlistFunction(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    // Rewrites a plist the way it would be stored now: compressed with the current dictionary, or as plain XML
+    if (SQLITE_NULL == sqlite3_value_type (argv[0])) {
+        sqlite3_result_null (context);
+        return;
+    }
+    
+    @autoreleasepool {
+        NSData *plistData = [NSFNanoEngine NSFP_plistDataFromBytes:sqlite3_value_blob (argv[0]) length:sqlite3_value_bytes (argv[0])];
+        if (nil == plistData) {
+            sqlite3_result_error (context, "NSFP_compressPlist: the compressed plist could not be decompressed", -1);
+            return;
+        }
+        
+        NSData *compressedData = [(__bridge NSFNanoEngine *)sqlite3_user_data (context) NSFP_compressedPlistFromBytes:[plistData bytes] length:[plistData length]];
+        if (nil != compressedData) {
+            sqlite3_result_blob (context, [compressedData bytes], (int)[compressedData length], SQLITE_TRANSIENT);
+        } else {
+            sqlite3_result_text (context, [plistData bytes], (int)[plistData length], SQLITE_TRANSIENT);
+        }
+    }
+}
+
+void NSFP_timestampFromCalendarDateFunction(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    // Converts the text written by +[NSFNanoStore _calendarDateToString:] to seconds since 1970. Anything else yields NULL.
+    if ((SQLITE_TEXT != sqlite3_value_type (argv[0])) || (23 != sqlite3_value_bytes (argv[0]))) {
+        sqlite3_result_null (context);
+        return;
+    }
+    
+    @autoreleasepool {
+        NSDate *date = [NSFNanoStore _calendarDateFromString:[[NSString alloc]initWithUTF8String:(const char *)sqlite3_value_text (argv[0])]];
+        if (nil == date) {
+            sqlite3_result_null (context);
+        } else {
+            sqlite3_result_double (context, [date timeIntervalSince1970]);
+        }
+    }
+}
+
+// t-digest (merging variant) used by NSFP_approximatePercentile: memory is fixed no matter how many values are fed
+#define __NSFP_TDigestCompression   200
+#define __NSFP_TDigestCapacity      (2 * __NSFP_TDigestCompression)
+#define __NSFP_TDigestBufferSize    512
+
+typedef struct {
+    double mean;
+    double weight;
+} __NSFPCentroid;
+
+typedef struct {
+    __NSFPCentroid centroids[__NSFP_TDigestCapacity + __NSFP_TDigestBufferSize];
+    int numberOfCentroids;
+    int numberOfBufferedValues;
+    double totalWeight;
+    double minimum;
+    double maximum;
+    double fraction;
+} __NSFPTDigest;
+
+static int __NSFP_compareCentroids(const void *a, const void *b)
+{
+    double meanA = ((const __NSFPCentroid *)a)->mean;
+    double meanB = ((const __NSFPCentroid *)b)->mean;
+    return (meanA < meanB) ? -1 : ((meanA > meanB) ? 1 : 0);
+}
+
+static inline double __NSFP_TDigestScale(double q)
+{
+    return __NSFP_TDigestCompression / (2.0 * M_PI) * asin(2.0 * q - 1.0);
+}
+
+static inline double __NSFP_TDigestInverseScale(double k)
+{
+    return (sin(k * 2.0 * M_PI / __NSFP_TDigestCompression) + 1.0) / 2.0;
+}
+
+static void __NSFP_TDigestCompress(__NSFPTDigest *digest)
+{
+    // The buffered values sit right after the centroids, each one with a weight of one
+    int count = digest->numberOfCentroids + digest->numberOfBufferedValues;
+    if (0 == digest->numberOfBufferedValues) {
+        return;
+    }
+    
+    qsort(digest->centroids, count, sizeof(__NSFPCentroid), __NSFP_compareCentroids);
+    
+    int merged = 0;
+    double weightSoFar = 0.0;
+    double limit = digest->totalWeight * __NSFP_TDigestInverseScale(__NSFP_TDigestScale(0.0) + 1.0);
+    
+    for (int i = 1; i < count; i++) {
+        __NSFPCentroid *current = &digest->centroids[merged];
+        __NSFPCentroid *next = &digest->centroids[i];
+        
+        if ((weightSoFar + current->weight + next->weight <= limit) || (merged == __NSFP_TDigestCapacity - 1)) {
+            current->mean += (next->mean - current->mean) * next->weight / (current->weight + next->weight);
+            current->weight += next->weight;
+        } else {
+            weightSoFar += current->weight;
+            limit = digest->totalWeight * __NSFP_TDigestInverseScale(__NSFP_TDigestScale(weightSoFar / digest->totalWeight) + 1.0);
+            digest->centroids[++merged] = *next;
+        }
+    }
+    
+    digest->numberOfCentroids = merged + 1;
+    digest->numberOfBufferedValues = 0;
+}
+
+static double __NSFP_TDigestQuantile(__NSFPTDigest *digest, double q)
+{
+    __NSFP_TDigestCompress(digest);
+    
+    int count = digest->numberOfCentroids;
+    __NSFPCentroid *centroids = digest->centroids;
+    if (1 == count) {
+        return centroids[0].mean;
+    }
+    
+    // Each centroid's mean is assumed to sit at the middle of its weight; interpolate between neighbouring middles
+    double target = q * digest->totalWeight;
+    double cumulative = centroids[0].weight / 2.0;
+    if (target <= cumulative) {
+        double ratio = (cumulative > 0.0) ? target / cumulative : 0.0;
+        return digest->minimum + (centroids[0].mean - digest->minimum) * ratio;
+    }
+    
+    for (int i = 1; i < count; i++) {
+        double nextCumulative = cumulative + (centroids[i - 1].weight + centroids[i].weight) / 2.0;
+        if (target <= nextCumulative) {
+            double ratio = (target - cumulative) / (nextCumulative - cumulative);
+            return centroids[i - 1].mean + (centroids[i].mean - centroids[i - 1].mean) * ratio;
+        }
+        cumulative = nextCumulative;
+    }
+    
+    double remaining = digest->totalWeight - cumulative;
+    double ratio = (remaining > 0.0) ? (target - cumulative) / remaining : 1.0;
+    return centroids[count - 1].mean + (digest->maximum - centroids[count - 1].mean) * ratio;
+}
+
+void NSFP_approximatePercentileStep(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    int type = sqlite3_value_type (argv[0]);
+    if ((SQLITE_INTEGER != type) && (SQLITE_FLOAT != type)) {
+        return;
+    }
+    
+    __NSFPTDigest *digest = sqlite3_aggregate_context (context, sizeof(__NSFPTDigest));
+    if (NULL == digest) {
+        sqlite3_result_error_nomem (context);
+        return;
+    }
+    
+    double value = sqlite3_value_double (argv[0]);
+    if (0.0 == digest->totalWeight) {
+        digest->minimum = value;
+        digest->maximum = value;
+        digest->fraction = sqlite3_value_double (argv[1]);
+    } else {
+        digest->minimum = fmin(digest->minimum, value);
+        digest->maximum = fmax(digest->maximum, value);
+    }
+    
+    __NSFPCentroid *slot = &digest->centroids[digest->numberOfCentroids + digest->numberOfBufferedValues];
+    slot->mean = value;
+    slot->weight = 1.0;
+    digest->numberOfBufferedValues++;
+    digest->totalWeight += 1.0;
+    
+    if (__NSFP_TDigestBufferSize == digest->numberOfBufferedValues) {
+        __NSFP_TDigestCompress(digest);
+    }
+}
+
+void NSFP_approximatePercentileFinal(sqlite3_context *context)
+{
+    __NSFPTDigest *digest = sqlite3_aggregate_context (context, 0);
+    if ((NULL == digest) || (0.0 == digest->totalWeight)) {
+        sqlite3_result_null (context);
+        return;
+    }
+    
+    double fraction = fmin(fmax(digest->fraction, 0.0), 1.0);
+    sqlite3_result_double (context, __NSFP_TDigestQuantile(digest, fraction));
+}
+
+// Fixed-width buckets between a lower and an upper bound (both inclusive), returned as a blob of native int64 counts
+typedef struct {
+    sqlite3_int64 *counts;
+    int numberOfBuckets;
+} __NSFPHistogram;
+
+void NSFP_histogramStep(sqlite3_context *context, int argc, sqlite3_value **argv)
+{
+    __NSFPHistogram *histogram = sqlite3_aggregate_context (context, sizeof(__NSFPHistogram));
+    if (NULL == histogram) {
+        sqlite3_result_error_nomem (context);
+        return;
+    }
+    
+    if (NULL == histogram->counts) {
+        int numberOfBuckets = sqlite3_value_int (argv[3]);
+        if ((numberOfBuckets < 1) || (numberOfBuckets > __NSFP_MaximumHistogramBuckets)) {
+            sqlite3_result_error (context, "NSFP_histogram: invalid number of buckets", -1);
+            return;
+        }
+        histogram->counts = sqlite3_malloc (numberOfBuckets * (int)sizeof(sqlite3_int64));
+        if (NULL == histogram->counts) {
+            sqlite3_result_error_nomem (context);
+            return;
+        }
+        memset(histogram->counts, 0, numberOfBuckets * sizeof(sqlite3_int64));
+        histogram->numberOfBuckets = numberOfBuckets;
+    }
+    
+    int type = sqlite3_value_type (argv[0]);
+    if ((SQLITE_INTEGER != type) && (SQLITE_FLOAT != type)) {
+        return;
+    }
+    
+    double value = sqlite3_value_double (argv[0]);
+    double lowerBound = sqlite3_value_double (argv[1]);
+    double upperBound = sqlite3_value_double (argv[2]);
+    if ((value < lowerBound) || (value > upperBound) || (upperBound <= lowerBound)) {
+        return;
+    }
+    
+    int bucket = (int)((value - lowerBound) / (upperBound - lowerBound) * histogram->numberOfBuckets);
+    if (bucket >= histogram->numberOfBuckets) {
+        bucket = histogram->numberOfBuckets - 1;
+    }
+    histogram->counts[bucket]++;
+}
+
+void NSFP_histogramFinal(sqlite3_context *context)
+{
+    __NSFPHistogram *histogram = sqlite3_aggregate_context (context, 0);
+    if ((NULL == histogram) || (NULL == histogram->counts)) {
+        sqlite3_result_null (context);
+        return;
+    }
+    
+    sqlite3_result_blob (context, histogram->counts, histogram->numberOfBuckets * (int)sizeof(sqlite3_int64), SQLITE_TRANSIENT);
+    sqlite3_free (histogram->counts);
+    histogram->counts = NULL;
+}
+
 /** \endcond */
 
 @end
\ No newline at end of file
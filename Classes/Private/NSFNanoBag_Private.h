@@ -31,6 +31,9 @@
 - (void)_setStore:(NSFNanoStore *)aStore;
 - (BOOL)_saveInStore:(NSFNanoStore *)someStore error:(out NSError **)outError;
 - (void)_inflateObjectsWithKeys:(NSArray *)someKeys;
+- (BOOL)_loadMemberKeysIfNeeded;
+- (NSArray *)_savedObjectKeys;
+- (NSString *)_SQLForSetOperation:(NSFSetOperation)theOperation withBagOrSearch:(id)theBagOrSearch bindingTexts:(NSMutableArray *)someBindings;
 @end
 
 /** \endcond */
\ No newline at end of file
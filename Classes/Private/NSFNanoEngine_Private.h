@@ -38,8 +38,19 @@
 - (NSString *)NSFP_cacheMethodToString;
 - (NSString*)NSFP_nestedDescriptionWithPrefixedSpace:(NSString *)prefixedSpace;
 + (NSDictionary *)_plistToDictionary:(NSString *)aPlist;
++ (NSDictionary *)NSFP_dictionaryForColumn:(int)column statement:(sqlite3_stmt *)aStatement;
++ (NSDictionary *)NSFP_dictionaryFromPlistData:(NSData *)data;
++ (NSString *)NSFP_contentHashOfBytes:(const void *)bytes length:(NSUInteger)length;
++ (BOOL)NSFP_isCompressedPlistBytes:(const void *)bytes length:(NSUInteger)length;
++ (NSData *)NSFP_plistDataFromBytes:(const void *)bytes length:(NSUInteger)length;
+- (NSData *)NSFP_compressedPlistFromBytes:(const void *)bytes length:(NSUInteger)length;
+- (BOOL)NSFP_compressesPlists;
+- (void)NSFP_setCompressesPlists:(BOOL)flag;
+- (NSData *)NSFP_compressionDictionary;
+- (void)NSFP_setCompressionDictionary:(NSData *)theDictionary;
++ (void)NSFP_registerCompressionDictionary:(NSData *)theDictionary;
++ (NSData *)NSFP_compressionDictionaryFromSamples:(NSArray *)somePlists;
 - (NSFNanoDatatype)NSFP_datatypeForTable:(NSString *)table column:(NSString *)column;
-+ (void)NSFP_decodeQuantum:(unsigned char *)dest andSource:(const char *)src;
 - (void)NSFP_setFullColumnNamesEnabled;
 - (NSArray *)NSFP_flattenAllTables;
 - (NSInteger)NSFP_prepareSQLite3Statement:(sqlite3_stmt **)aStatement theSQLStatement:(NSString *)aSQLQuery;
@@ -64,6 +75,14 @@
 
 - (void)NSFP_installCommitCallback;
 - (void)NSFP_uninstallCommitCallback;
+- (void)NSFP_registerFunctions;
+- (BOOL)NSFP_tracksChangedTables;
+- (void)NSFP_setTracksChangedTables:(BOOL)flag;
+- (void)NSFP_recordChangeForTable:(const char *)table;
+- (void)NSFP_commitChangedTables;
+- (void)NSFP_discardChangedTables;
+- (unsigned long long)NSFP_generationForTable:(NSString *)table;
+- (BOOL)NSFP_hasUncommittedChanges;
 @end
 
 /** \endcond */
\ No newline at end of file
@@ -60,12 +60,20 @@ extern NSString * const NSFDomainKey;
 
 extern NSString * const NSFKeys;
 extern NSString * const NSFValues;
+extern NSString * const NSFBagMembers;
+extern NSString * const NSFBlobs;
 extern NSString * const NSFKey;
 extern NSString * const NSFValue;
 extern NSString * const NSFDatatype;
 extern NSString * const NSFCalendarDate;
 extern NSString * const NSFObjectClass;
 extern NSString * const NSFPlist;
+extern NSString * const NSFHash;
+extern NSString * const NSFTimestamp;
+extern NSString * const NSFArrayElement;
+extern NSString * const NSFObjectKey;
+extern NSString * const NSFLength;
+extern NSString * const NSFData;
 extern NSString * const NSFAttribute;
 
 
@@ -77,7 +85,9 @@ extern NSString * const NSF_Private_NSFValues_NSFValue;
 extern NSString * const NSF_Private_NSFNanoBag_Name;
 extern NSString * const NSF_Private_NSFNanoBag_NSFKey;
 extern NSString * const NSF_Private_NSFNanoBag_NSFObjectKeys;
-extern NSString * const NSF_Private_ToDeleteTableKey;
+extern NSString * const NSF_Private_NSFNanoBlob_Hash;
+extern NSString * const NSF_Private_NSFNanoBlob_Length;
+extern NSString * const NSF_Private_MatchingKeysTableKey;
 
 extern NSInteger const NSF_Private_InvalidParameterDataCodeKey;
 extern NSInteger const NSF_Private_MacOSXErrorCodeKey;
@@ -91,5 +101,8 @@ extern NSString * const NSFP_FullDatatypeIdentifier;
 extern NSString * const NSFRowIDColumnName;         // SQLite's standard UID property
 
 extern NSString * const NSFP_SchemaTable;           // Private, reserved NSF table name to store datatypes
+extern NSString * const NSFP_AggregatesTable;       // Private, reserved NSF table name to store the materialized aggregates
+extern NSString * const NSFP_AggregateDefinitionsTable; // Private, reserved NSF table name to store how they are computed
+extern NSString * const NSFP_CompressionDictionariesTable; // Private, reserved NSF table name to store the dictionaries used to compress the plists
 
 /** \endcond */
\ No newline at end of file
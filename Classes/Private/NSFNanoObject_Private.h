@@ -27,8 +27,28 @@
 
 /** \cond */
 
+@class NSFNanoStore;
+
+/*
+ The faults returned by a search share batches: the first fault of a batch to be touched loads the info
+ of every fault of that batch with a single query. The info is handed over (and released by the batch)
+ as each fault fires.
+ */
+@interface NSFNanoFaultBatch : NSObject
+- (id)initWithStore:(NSFNanoStore *)aStore keys:(NSArray *)someKeys;
+- (NSDictionary *)infoForKey:(NSString *)aKey;
+@end
+
 @interface NSFNanoObject (Private)
 - (void)_setOriginalClassString:(NSString *)theClassString;
+- (void)_setFaultBatch:(NSFNanoFaultBatch *)aBatch;
+- (void)_fireFaultIfNeeded;
+- (BOOL)_isPersisted;
+- (void)_markSaved;
+- (BOOL)_tracksAllChanges;
+- (void)_recordSetOfAttribute:(NSString *)anAttribute;
+- (void)_recordRemovalOfAttribute:(NSString *)anAttribute;
+- (void)_recordAccessToValue:(id)aValue;
 @end
 
 /** \endcond */
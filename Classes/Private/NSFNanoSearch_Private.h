@@ -31,8 +31,16 @@
 - (NSDictionary *)_retrieveDataWithError:(out NSError **)outError;
 - (NSArray *)_dataWithKey:(NSString *)aKey attribute:(NSString *)anAttribute value:(NSString *)aValue matching:(NSFMatchType)match;
 - (NSArray *)_dataWithKey:(NSString *)aKey attribute:(NSString *)anAttribute value:(NSString *)aValue matching:(NSFMatchType)match returning:(NSFReturnType)returnedObjectType;
+- (NSMutableDictionary *)_projectedObjectsWithError:(out NSError **)outError;
+- (void)_setProjectedValue:(id)theValue forAttribute:(NSString *)anAttribute inSubset:(NSMutableDictionary *)subset;
 - (NSDictionary *)_retrieveDataAdded:(NSFDateMatchType)aDateMatch calendarDate:(NSDate *)aDate error:(out NSError **)outError;
 - (NSString *)_preparedSQL;
+- (NSString *)_preparedKeysSQL;
+- (NSNumber *)_scalarForSQL:(NSString *)aSQLQuery;
+- (NSString *)_matchingKeysClauseForColumn:(NSString *)aColumn;
+- (sqlite3_stmt *)_preparedSQLite3StatementForSQL:(NSString *)aSQLQuery selector:(SEL)aSelector error:(out NSError **)outError;
++ (id)_valueForColumn:(int)aColumn ofSQLite3Statement:(sqlite3_stmt *)aStatement;
++ (NSString *)_SQLExpressionForAggregateFunction:(NSFAggregateFunctionType)theFunctionType column:(NSString *)aColumn;
 - (NSString *)_prepareSQLQueryStringWithKey:(NSString *)aKey attribute:(NSString *)anAttribute value:(id)aValue matching:(NSFMatchType)match;
 - (NSString *)_prepareSQLQueryStringWithExpressions:(NSArray *)someExpressions;
 - (NSArray *)_resultsFromSQLQuery:(NSString *)theSQLStatement;
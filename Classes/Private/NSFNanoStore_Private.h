@@ -30,23 +30,74 @@
 @interface NSFNanoStore (Private)
 + (NSFNanoStore *)_createAndOpenDebugDatabase;
 - (NSFNanoResult *)_executeSQL:(NSString *)theSQLStatement;
+- (NSDictionary *)_objectsByKeyForKeys:(NSArray *)someKeys;
+- (id)_cachedObjectForKey:(NSString *)aKey;
+- (void)_cacheObject:(id)anObject forKey:(NSString *)aKey;
+- (void)_refreshCachedObject:(id)anObject forKey:(NSString *)aKey;
+- (void)_removeCachedObjectsWithKeys:(NSArray *)someKeys;
+- (NSDictionary *)_dictionariesForKeys:(NSArray *)someKeys;
+- (NSDictionary *)_cachedSearchResultsForKey:(NSString *)aKey;
+- (void)_cacheSearchResults:(NSDictionary *)someResults forKey:(NSString *)aKey SQL:(NSString *)aSQLQuery;
+- (NSDictionary *)_searchResultCacheTables;
 - (NSString*)_nestedDescriptionWithPrefixedSpace:(NSString *)prefixedSpace;
 - (BOOL)_initializePreparedStatementsWithError:(out NSError **)outError;
 - (void)_releasePreparedStatements;
 - (void)_setIsOurTransaction:(BOOL)value;
 - (BOOL)_isOurTransaction;
 - (BOOL)_setupCachingSchema;
-- (BOOL)_storeDictionary:(NSDictionary *)someInfo forKey:(NSString *)aKey forClassNamed:(NSString *)classType usingSQLite3Statement:(sqlite3_stmt *)storeValuesStatement error:(out NSError **)outError;
+- (NSArray *)_keysOfMembersOfBagWithKey:(NSString *)aBagKey;
+- (NSArray *)_keysOfMembersOfBagWithKey:(NSString *)aBagKey afterRowID:(long long)aRowID limit:(NSUInteger)aLimit;
+- (long long)_countOfMembersOfBagWithKey:(NSString *)aBagKey;
+- (BOOL)_createBagNamesIndex;
+- (void)_loadCompressionDictionaries;
+- (BOOL)_bindPlist:(const char *)dictXMLUTF8 parameterNumber:(int)aParamNumber usingSQLite3Statement:(sqlite3_stmt *)aStatement;
+- (NSDictionary *)_keysOfBagsNamed:(NSArray *)someNames;
+- (NSArray *)_keysForSQL:(NSString *)aSQLQuery bindingTexts:(NSArray *)someTexts;
+- (long long)_countForSQL:(NSString *)aSQLQuery bindingTexts:(NSArray *)someTexts;
+- (BOOL)_addMembersToBagWithKey:(NSString *)aBagKey fromSQL:(NSString *)aSQLQuery bindingTexts:(NSArray *)someTexts;
+- (BOOL)_storeMembersOfBagWithKey:(NSString *)aBagKey addingKeys:(NSArray *)addedKeys removingKeys:(NSArray *)removedKeys;
+- (BOOL)_setupMaterializedAggregatesSchema;
+- (NSArray *)_materializedAggregateDefinitions;
+- (BOOL)_installMaterializedAggregateTriggers;
+- (void)_dropMaterializedAggregateTriggersForIdentifier:(long long)anIdentifier;
+- (NSArray *)_materializedAggregateTriggersForIdentifier:(long long)anIdentifier name:(NSString *)aName attribute:(NSString *)anAttribute groupingAttribute:(NSString *)aGroupingAttribute;
+- (BOOL)_recomputeMaterializedAggregateNamed:(NSString *)aName attribute:(NSString *)anAttribute groupingAttribute:(NSString *)aGroupingAttribute;
+- (NSNumber *)_materializedCountOfObjectsOfClassNamed:(NSString *)aClassName;
+- (void)_bindMaterializedAggregateGroup:(id)aGroupValue parameterNumber:(int)aParamNumber usingSQLite3Statement:(sqlite3_stmt *)aStatement;
++ (NSNumber *)_valueOfMaterializedAggregateFunction:(NSFAggregateFunctionType)theFunctionType count:(long long)aCount total:(double)aTotal;
++ (NSString *)_SQLLiteralForString:(NSString *)aString;
+- (BOOL)_storeDictionary:(NSDictionary *)someInfo plist:(NSString *)dictXML hash:(NSString *)aHash forKey:(NSString *)aKey forClassNamed:(NSString *)classType usingSQLite3Statement:(sqlite3_stmt *)storeValuesStatement error:(out NSError **)outError;
+- (BOOL)_storeValuesOfDictionary:(NSDictionary *)someInfo forKey:(NSString *)aKey usingSQLite3Statement:(sqlite3_stmt *)storeValuesStatement;
+- (NSString *)_plistStringFromDictionary:(NSDictionary *)someInfo error:(out NSError **)outError;
+- (id)_storedFormOfCollection:(id)aCollection;
+- (long long)_rowIDOfBlobWithHash:(NSString *)aHash;
+- (sqlite3_blob *)_openBlob:(NSFNanoBlob *)theBlob error:(out NSError **)outError;
+- (BOOL)_updateStoredObject:(NSFNanoObject *)anObject plist:(NSString *)dictXML hash:(NSString *)aHash forClassNamed:(NSString *)className storedInfo:(NSDictionary *)storedInfo usingTrackedAttributes:(BOOL)useTrackedAttributes error:(out NSError **)outError;
+- (NSString *)_storedClassNameOfObject:(id)anObject;
+- (NSDictionary *)_storedHashesForKeys:(NSArray *)someKeys;
+- (sqlite3_stmt *)_deleteKeysStatementForTable:(NSString *)aTable batchSizeIndex:(NSUInteger)sizeIndex;
+- (BOOL)_removeObjectsWithKeysInArray:(NSArray *)someKeys keepingBagMembers:(BOOL)keepBagMembers error:(out NSError **)outError;
+- (BOOL)_deleteRowsForKeys:(NSArray *)someKeys keepingBagMembers:(BOOL)keepBagMembers;
+- (BOOL)_bindKeys:(NSArray *)someKeys inRange:(NSRange)aRange paddedTo:(NSUInteger)batchSize toSQLite3Statement:(sqlite3_stmt *)aStatement;
+- (sqlite3_stmt *)_selectKeysStatementForBatchSizeIndex:(NSUInteger)sizeIndex;
+- (NSDictionary *)_objectsForKeys:(NSArray *)someKeys ofClassNamed:(NSString *)aClassName;
+- (id)_objectWithInfo:(NSDictionary *)info forKey:(NSString *)aKey className:(NSString *)aClassName;
+- (BOOL)_stepSQLite3Statement:(sqlite3_stmt *)aStatement bindingTexts:(NSArray *)someTexts;
+- (BOOL)_collectKeysMatchingSearch:(NSFNanoSearch *)theSearch;
+- (BOOL)_finishMatchingKeysOperationWithSuccess:(BOOL)success transactionStartedHere:(BOOL)transactionStartedHere selector:(SEL)aSelector error:(out NSError **)outError;
 - (BOOL)__storeDictionaries:(NSArray *)someObjects forKeys:(NSArray *)someKeys error:(out NSError **)outError;
-- (BOOL)_bindValue:(id)aValue forAttribute:(NSString *)anAttribute parameterNumber:(NSInteger)aParamNumber usingSQLite3Statement:(sqlite3_stmt *)aStatement;
+- (BOOL)_bindValue:(id)aValue forAttribute:(NSString *)anAttribute isArrayElement:(BOOL)isArrayElement firstParameterNumber:(int)aParamNumber usingSQLite3Statement:(sqlite3_stmt *)aStatement;
 - (BOOL)_checkNanoStoreIsReadyAndReturnError:(out NSError **)outError;
 - (NSFNanoDatatype)_NSFDatatypeOfObject:(id)value;
 - (NSString *)_stringFromValue:(id)aValue;
++ (NSDateFormatter *)_calendarDateFormatter;
 + (NSString *)_calendarDateToString:(NSDate *)aDate;
++ (NSDate *)_calendarDateFromString:(NSString *)aString;
 - (void)_flattenCollection:(NSDictionary *)info keys:(NSMutableArray **)flattenedKeys values:(NSMutableArray **)flattenedValues;
-- (void)_flattenCollection:(id)someObject keyPath:(NSMutableArray **)aKeyPath keys:(NSMutableArray **)someKeys values:(NSMutableArray **)someValues;
+- (void)_flattenCollection:(NSDictionary *)info keys:(NSMutableArray **)flattenedKeys values:(NSMutableArray **)flattenedValues arrayElementIndexes:(NSMutableIndexSet *)arrayElementIndexes;
+- (void)_flattenCollection:(id)someObject keyPath:(NSMutableArray **)aKeyPath keys:(NSMutableArray **)someKeys values:(NSMutableArray **)someValues arrayElementIndexes:(NSMutableIndexSet *)arrayElementIndexes;
 - (BOOL)_prepareSQLite3Statement:(sqlite3_stmt **)aStatement theSQLStatement:(NSString *)aSQLQuery;
-- (void)_executeSQLite3StepUsingSQLite3Statement:(sqlite3_stmt *)aStatement;
+- (int)_executeSQLite3StepUsingSQLite3Statement:(sqlite3_stmt *)aStatement;
 - (BOOL)_addObjectsFromArray:(NSArray *)someObjects forceSave:(BOOL)forceSave error:(out NSError **)outError;
 + (NSDictionary *)_defaultTestData;
 - (BOOL)_backupFileStoreToDirectoryAtPath:(NSString *)aPath extension:(NSString *)anExtension compact:(BOOL)flag error:(out NSError **)outError;
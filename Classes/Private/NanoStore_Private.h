@@ -28,6 +28,7 @@
 #import "NSFNanoResult_Private.h"
 #import "NSFNanoStore_Private.h"
 #import "NSFNanoBag_Private.h"
+#import "NSFNanoBlob_Private.h"
 #import "NSFNanoPredicate_Private.h"
 #import "NSFNanoExpression_Private.h"
 #import "NSFNanoGlobals_Private.h"
@@ -63,6 +63,7 @@
 */
 
 #import "NSFNanoObjectProtocol.h"
+#import "NSFNanoGlobals.h"
 
 @interface NSFNanoBag : NSObject <NSFNanoObjectProtocol, NSCopying>
 
@@ -72,7 +73,10 @@
 @property (nonatomic, copy, readwrite) NSString *name;
 /** * The UUID of the bag.  */
 @property (nonatomic, copy, readonly) NSString *key;
-/** * Dictionary of NSString (key) and id<NSFNanoObjectProtocol> (value). */
+/** * Dictionary of NSString (key) and id<NSFNanoObjectProtocol> (value).
+ * @note Bags obtained from a document store are returned deflated: their objects are read the first time this property is accessed.
+ * Objects which no longer exist in the document store are left out. The document store must be open for the objects to be read: once it's closed,
+ * only the objects already loaded are returned. */
 @property (nonatomic, readonly) NSDictionary *savedObjects;
 /** * Dictionary of NSString (key) and id<NSFNanoObjectProtocol> (value). */
 @property (nonatomic, readonly) NSDictionary *unsavedObjects;
@@ -135,6 +139,7 @@
  * @param theObject is added to the bag.
  * @param outError is used if an error occurs. May be NULL.
  * @return YES upon success, NO otherwise.
+ * @note A bag obtained from a document store needs it to be open to load its members: once it's closed, the object can't be added until it's reopened.
  * @warning This value cannot be nil and it must be \link NSFNanoObjectProtocol::initNanoObjectFromDictionaryRepresentation:forKey:store: NSFNanoObjectProtocol\endlink-compliant.
  * @throws NSFNonConformingNanoObjectProtocolException is thrown if the object is non-\link NSFNanoObjectProtocol::initNanoObjectFromDictionaryRepresentation:forKey:store: NSFNanoObjectProtocol\endlink compliant.
  * @see \link addObjectsFromArray:error: - (BOOL)addObjectsFromArray:(NSArray *)theObjects error:(out NSError **)outError \endlink	*/
@@ -208,7 +213,7 @@
 /** * Saves the bag and its contents. Also, saves all the changes made since the last save.
  * @param outError is used if an error occurs. May be NULL.
  * @return YES upon success, NO otherwise.
- * @note Check property hasUnsavedChanges to find out whether the bag has unsaved contents.
+ * @note Check property hasUnsavedChanges to find out whether the bag has unsaved contents. Saving fails if the bag was renamed after another stored bag.
  * @see \link reloadBagWithError: - (BOOL)reloadBagWithError:(out NSError **)outError \endlink
  * @see \link undoChangesWithError: - (BOOL)undoChangesWithError:(out NSError **)outError \endlink	*/
 
@@ -240,6 +245,7 @@
 
 /** * Inflates the bag by reconstructing the objects flattened with - (void)deflateBag;
  * @note Check properties savedObjects, unsavedObjects and removedObjects to find out the current state of the bag.
+ * Nothing is read while the document store is closed.
  * @see \link deflateBag - (void)deflateBag \endlink	*/
 
 - (void)inflateBag;
@@ -250,6 +256,58 @@
 
 - (void)deflateBag;
 
+/** * Returns one page of the objects of the bag, without inflating it.
+ * @param thePageSize the maximum number of objects to be returned. Must be greater than zero.
+ * @param theToken the token returned with the previous page, or nil to obtain the first page.
+ * @param outNextToken is set to the token needed to obtain the next page, or to nil when there are no more objects. May be NULL.
+ * @return An array containing the objects of the page.
+ * @note Only the objects of the page are read from the document store, and the bag doesn't keep them. The stored objects are returned in the order
+ * they were added to the bag, followed by the unsaved ones. Once the bag has been changed or inflated, the objects are returned ordered by key.
+ * The token is only valid for the bag that produced it.
+ * @throws NSFUnexpectedParameterException is thrown if the page size is zero.
+ * @see \link inflateBag - (void)inflateBag \endlink	*/
+
+- (NSArray *)objectsWithPageSize:(NSUInteger)thePageSize continuationToken:(NSString *)theToken nextContinuationToken:(out NSString **)outNextToken;
+
+//@}
+
+/** @name Set Operations	*/
+
+//@{
+
+/** * Returns the keys resulting from combining the objects of the bag with those of another bag or a search.
+ * @param theOperation the set operation. Can be \link Globals::NSFSetIntersection NSFSetIntersection \endlink, \link Globals::NSFSetUnion NSFSetUnion \endlink or \link Globals::NSFSetDifference NSFSetDifference \endlink.
+ * @param theBagOrSearch an NSFNanoBag or an NSFNanoSearch using the same document store as the bag.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return An array containing the keys, or nil if an error occurs.
+ * @note The operation is evaluated by SQLite over the stored members of the bags: no objects are read, and unsaved changes are ignored.
+ * @throws NSFUnexpectedParameterException is thrown if the bag hasn't been stored, if the operation is unknown, or if theBagOrSearch isn't a bag or a search of the same document store.
+ * @see \link countOfObjectsBySetOperation:withBagOrSearch: - (long long)countOfObjectsBySetOperation:(NSFSetOperation)theOperation withBagOrSearch:(id)theBagOrSearch \endlink	*/
+
+- (NSArray *)keysBySetOperation:(NSFSetOperation)theOperation withBagOrSearch:(id)theBagOrSearch error:(out NSError **)outError;
+
+/** * Returns the number of objects resulting from combining the objects of the bag with those of another bag or a search.
+ * @param theOperation the set operation. Can be \link Globals::NSFSetIntersection NSFSetIntersection \endlink, \link Globals::NSFSetUnion NSFSetUnion \endlink or \link Globals::NSFSetDifference NSFSetDifference \endlink.
+ * @param theBagOrSearch an NSFNanoBag or an NSFNanoSearch using the same document store as the bag.
+ * @returns The number of objects, or -1 if the document store is closed or the operation fails.
+ * @note Runs a single count(*) over the set operation: neither keys nor objects are read. Unsaved changes are ignored.
+ * @throws NSFUnexpectedParameterException is thrown if the bag hasn't been stored, if the operation is unknown, or if theBagOrSearch isn't a bag or a search of the same document store.
+ * @see \link keysBySetOperation:withBagOrSearch:error: - (NSArray *)keysBySetOperation:(NSFSetOperation)theOperation withBagOrSearch:(id)theBagOrSearch error:(out NSError **)outError \endlink	*/
+
+- (long long)countOfObjectsBySetOperation:(NSFSetOperation)theOperation withBagOrSearch:(id)theBagOrSearch;
+
+/** * Stores a new bag holding the objects resulting from combining the objects of the bag with those of another bag or a search.
+ * @param theOperation the set operation. Can be \link Globals::NSFSetIntersection NSFSetIntersection \endlink, \link Globals::NSFSetUnion NSFSetUnion \endlink or \link Globals::NSFSetDifference NSFSetDifference \endlink.
+ * @param theBagOrSearch an NSFNanoBag or an NSFNanoSearch using the same document store as the bag.
+ * @param theName the name of the new bag. May be nil.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return The new bag, deflated, or nil if an error occurs.
+ * @note The members of the new bag are written by SQLite straight from the set operation: no objects are read. Unsaved changes are ignored.
+ * @throws NSFUnexpectedParameterException is thrown if the bag hasn't been stored, if the operation is unknown, or if theBagOrSearch isn't a bag or a search of the same document store.
+ * @see \link keysBySetOperation:withBagOrSearch:error: - (NSArray *)keysBySetOperation:(NSFSetOperation)theOperation withBagOrSearch:(id)theBagOrSearch error:(out NSError **)outError \endlink	*/
+
+- (NSFNanoBag *)bagBySetOperation:(NSFSetOperation)theOperation withBagOrSearch:(id)theBagOrSearch name:(NSString *)theName error:(out NSError **)outError;
+
 //@}
 
 /** @name Miscellaneous	*/
@@ -257,7 +315,8 @@
 //@{
 
 /** * Returns the number of objects currently in the bag.
- * @return The number of objects currently in the bag.	*/
+ * @return The number of objects currently in the bag.
+ * @note Counting the objects of a bag obtained from a document store doesn't inflate it.	*/
 
 - (NSUInteger)count;
 
@@ -37,6 +37,8 @@
     NSMutableDictionary     *savedObjects;
     NSMutableDictionary     *unsavedObjects;
     NSMutableDictionary     *removedObjects;
+    BOOL                    hasLoadedMemberKeys;
+    BOOL                    inflatesOnAccess;
     /** \endcond */
 }
 
@@ -91,6 +93,8 @@
         removedObjects = [NSMutableDictionary new];
         
         hasUnsavedChanges = NO;
+        hasLoadedMemberKeys = YES;
+        inflatesOnAccess = NO;
     }
     
     return self;
@@ -123,11 +127,126 @@
     return name;
 }
 
+- (NSDictionary *)savedObjects
+{
+    // Stored bags are read without their members: they are loaded the first time they're needed
+    [self _loadMemberKeysIfNeeded];
+    
+    if (YES == inflatesOnAccess) {
+        [self inflateBag];
+    }
+    
+    return savedObjects;
+}
+
 - (NSUInteger)count
 {
+    // Until the bag is changed, the stored membership is the whole story
+    if ((NO == hasLoadedMemberKeys) && (0 == [unsavedObjects count]) && (0 == [removedObjects count])) {
+        return (NSUInteger)[store _countOfMembersOfBagWithKey:key];
+    }
+    
+    [self _loadMemberKeysIfNeeded];
+    
     return savedObjects.count + unsavedObjects.count;
 }
 
+- (NSArray *)objectsWithPageSize:(NSUInteger)thePageSize continuationToken:(NSString *)theToken nextContinuationToken:(out NSString **)outNextToken
+{
+    if (0 == thePageSize) {
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: the page size must be greater than zero.", [self class], _cmd]
+                               userInfo:nil]raise];
+    }
+    
+    if (nil != outNextToken) {
+        *outNextToken = nil;
+    }
+    
+    // A bag whose members haven't been loaded is paged straight from NSFBagMembers, in the order the members were added,
+    // followed by the objects added since ("U"). Otherwise its keys are already in memory and are paged in sorted order ("K").
+    // The token holds the kind of page and the position reached: a row of NSFBagMembers or the last key returned.
+    NSMutableArray *pageKeys = [NSMutableArray arrayWithCapacity:thePageSize];
+    NSString *nextToken = nil;
+    unichar mode = (nil != theToken) ? [theToken characterAtIndex:0] : (((NO == hasLoadedMemberKeys) && (nil != store)) ? 'S' : 'K');
+    NSString *lastKey = ((nil != theToken) && ('S' != mode)) ? [theToken substringFromIndex:1] : nil;
+    
+    if ('S' == mode) {
+        long long rowID = (nil == theToken) ? 0 : [[theToken substringFromIndex:1]longLongValue];
+        while ([pageKeys count] < thePageSize) {
+            NSArray *rows = [store _keysOfMembersOfBagWithKey:key afterRowID:rowID limit:thePageSize - [pageKeys count]];
+            if (0 == [rows count]) {
+                break;
+            }
+            
+            for (NSArray *row in rows) {
+                NSString *objectKey = [row objectAtIndex:1];
+                rowID = [[row objectAtIndex:0]longLongValue];
+                if ((nil == [unsavedObjects objectForKey:objectKey]) && (nil == [removedObjects objectForKey:objectKey])) {
+                    [pageKeys addObject:objectKey];
+                }
+            }
+        }
+        nextToken = [NSString stringWithFormat:@"S%lld", rowID];
+        mode = 'U';
+    }
+    
+    if ([pageKeys count] < thePageSize) {
+        NSMutableArray *memoryKeys = [NSMutableArray arrayWithArray:[unsavedObjects allKeys]];
+        if ('K' == mode) {
+            [memoryKeys addObjectsFromArray:[savedObjects allKeys]];
+        }
+        [memoryKeys sortUsingSelector:@selector(compare:)];
+        
+        for (NSString *objectKey in memoryKeys) {
+            if ([pageKeys count] == thePageSize) {
+                break;
+            }
+            if ((nil == lastKey) || (NSOrderedDescending == [objectKey compare:lastKey])) {
+                [pageKeys addObject:objectKey];
+                nextToken = [NSString stringWithFormat:@"%C%@", mode, objectKey];
+            }
+        }
+    }
+    
+    // Only the objects of the page are decoded, and the bag doesn't keep them
+    NSMutableArray *page = [NSMutableArray arrayWithCapacity:[pageKeys count]];
+    NSMutableArray *missingKeys = [NSMutableArray array];
+    for (NSString *objectKey in pageKeys) {
+        id object = [unsavedObjects objectForKey:objectKey];
+        if (nil == object) {
+            object = [savedObjects objectForKey:objectKey];
+        }
+        if ((nil == object) || ([NSNull null] == object)) {
+            [missingKeys addObject:objectKey];
+        }
+    }
+    
+    NSMutableDictionary *fetchedObjects = [NSMutableDictionary dictionaryWithCapacity:[missingKeys count]];
+    for (id object in [store objectsWithKeysInArray:missingKeys]) {
+        [fetchedObjects setObject:object forKey:[object nanoObjectKey]];
+    }
+    
+    for (NSString *objectKey in pageKeys) {
+        id object = [unsavedObjects objectForKey:objectKey];
+        if (nil == object) {
+            object = [fetchedObjects objectForKey:objectKey];
+        }
+        if (nil == object) {
+            object = [savedObjects objectForKey:objectKey];
+        }
+        if ((nil != object) && ([NSNull null] != object)) {
+            [page addObject:object];
+        }
+    }
+    
+    if ((nil != outNextToken) && ([pageKeys count] == thePageSize)) {
+        *outNextToken = nextToken;
+    }
+    
+    return page;
+}
+
 - (NSString*)description
 {
     NSMutableString *description = [NSMutableString string];
@@ -137,7 +256,7 @@
     [description appendString:[NSString stringWithFormat:@"Name                 : %@\n", (nil != name) ? name : @"<untitled>"]];
     [description appendString:[NSString stringWithFormat:@"Document store       : 0x%x\n", store]];
     [description appendString:[NSString stringWithFormat:@"Has unsaved changes? : %@\n", (hasUnsavedChanges ? @"YES" : @"NO")]];
-    [description appendString:[NSString stringWithFormat:@"Saved objects        : %ld key/value pairs\n", [savedObjects count]]];
+    [description appendString:[NSString stringWithFormat:@"Saved objects        : %ld key/value pairs\n", [self count] - [unsavedObjects count]]];
     [description appendString:[NSString stringWithFormat:@"Unsaved objects      : %ld key/value pairs\n", [unsavedObjects count]]];
     [description appendString:[NSString stringWithFormat:@"Removed objects      : %ld key/value pairs\n", [removedObjects count]]];
 
@@ -152,8 +271,8 @@
     
     BOOL success = YES;
     
-    NSArray *sortedArraySelf = [[[self savedObjects]allKeys]sortedArrayUsingSelector:@selector(caseInsensitiveCompare:)];
-    NSArray *sortedArrayOther = [[[otherNanoBag savedObjects]allKeys]sortedArrayUsingSelector:@selector(caseInsensitiveCompare:)];
+    NSArray *sortedArraySelf = [[self _savedObjectKeys]sortedArrayUsingSelector:@selector(caseInsensitiveCompare:)];
+    NSArray *sortedArrayOther = [[otherNanoBag _savedObjectKeys]sortedArrayUsingSelector:@selector(caseInsensitiveCompare:)];
     if (NO == [sortedArraySelf isEqualToArray:sortedArrayOther]) {
         success = NO;
     } else {
@@ -177,7 +296,7 @@
 {
     // Iterate the objects collecting the object keys
     NSMutableArray *objectKeys = [NSMutableArray new];
-    for (NSString *objectKey in self.savedObjects) {
+    for (NSString *objectKey in [self _savedObjectKeys]) {
         [objectKeys addObject:objectKey];
     }
     for (NSString *objectKey in self.unsavedObjects) {
@@ -209,6 +328,15 @@
     NSDictionary *info = [(id)object dictionaryRepresentation];
     
     if (objectKey && info) {
+        if (NO == [self _loadMemberKeysIfNeeded]) {
+            if (nil != outError) {
+                *outError = [NSError errorWithDomain:NSFDomainKey
+                                                code:NSFNanoStoreErrorKey
+                                            userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the members of the bag cannot be loaded because the document store is closed.", [self class], _cmd]
+                                                                                 forKey:NSLocalizedFailureReasonErrorKey]];
+            }
+            return NO;
+        }
         [savedObjects removeObjectForKey:objectKey];
         [unsavedObjects setObject:object forKey:objectKey];
         [removedObjects removeObjectForKey:objectKey];
@@ -262,12 +390,12 @@
 
 - (void)removeAllObjects
 {
+    [self _loadMemberKeysIfNeeded];
+    
     NSMutableDictionary *objects = [[NSMutableDictionary alloc]initWithCapacity:(savedObjects.count + removedObjects.count)];
     
     // Save the object and its key
-    for (id object in savedObjects) {
-        [objects setObject:object forKey:[object performSelector:@selector(key)]];
-    }
+    [objects addEntriesFromDictionary:savedObjects];
     
     // Save the previously removed objects (if any)
     [objects addEntriesFromDictionary:removedObjects];
@@ -294,6 +422,8 @@
                                userInfo:nil]raise]; 
     }
     
+    [self _loadMemberKeysIfNeeded];
+    
     // Is the object an existing one?
     id object = [savedObjects objectForKey:objectKey];
     if (nil != object) {
@@ -337,6 +467,20 @@
         return NO;
     }
     
+    // Bag names are unique: a renamed bag can't take the name of another one
+    if (name.length > 0) {
+        NSString *bagKey = [[store _keysOfBagsNamed:[NSArray arrayWithObject:name]]objectForKey:name];
+        if ((nil != bagKey) && (NO == [bagKey isEqualToString:key])) {
+            if (nil != outError) {
+                *outError = [NSError errorWithDomain:NSFDomainKey
+                                                code:NSFNanoStoreErrorKey
+                                            userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: a bag named '%@' already exists.", [self class], _cmd, name]
+                                                                                 forKey:NSLocalizedFailureReasonErrorKey]];
+            }
+            return NO;
+        }
+    }
+    
     return [self _saveInStore:store error:outError];
 }
 
@@ -344,6 +488,9 @@
 
 - (void)deflateBag
 {
+    [self _loadMemberKeysIfNeeded];
+    inflatesOnAccess = NO;
+    
     NSArray *savedObjectsCopy = [[NSArray alloc]initWithArray:[savedObjects allKeys]];
     
     for (id saveObjectKey in savedObjectsCopy) {
@@ -354,7 +501,16 @@
 
 - (void)inflateBag
 {
-    NSArray *objectKeys = [savedObjects allKeys];
+    // The objects are read from the document store: nothing can be loaded while it's closed
+    if (YES == [store isClosed]) {
+        return;
+    }
+    
+    [self _loadMemberKeysIfNeeded];
+    inflatesOnAccess = NO;
+    
+    // Only the objects which aren't in memory yet are read
+    NSArray *objectKeys = [savedObjects allKeysForObject:[NSNull null]];
     [self _inflateObjectsWithKeys:objectKeys];
 }
 
@@ -365,15 +521,11 @@
         return YES;
     }
     
-    // Refresh the bag to match the contents stored on the database
-    [self _inflateObjectsWithKeys:[NSArray arrayWithObject:key]];
-    NSFNanoBag *savedBag = [savedObjects objectForKey:key];
-    if (nil != savedBag) {
+    // Refresh the bag to match the contents stored on the database. The members are read again once they're needed.
+    if (0 != [[store bagsWithKeysInArray:[NSArray arrayWithObject:key]]count]) {
         [savedObjects removeAllObjects];
-        [savedObjects addEntriesFromDictionary:savedBag.savedObjects];
-        for (NSString *objectKey in unsavedObjects) {
-            [savedObjects removeObjectForKey:objectKey];
-        }
+        hasLoadedMemberKeys = NO;
+        inflatesOnAccess = YES;
     } else {
         if (nil != outError) {
             *outError = [NSError errorWithDomain:NSFDomainKey
@@ -398,6 +550,71 @@
     return [self reloadBagWithError:outError];
 }
 
+#pragma mark -
+
+- (NSArray *)keysBySetOperation:(NSFSetOperation)theOperation withBagOrSearch:(id)theBagOrSearch error:(out NSError **)outError
+{
+    NSMutableArray *bindings = [NSMutableArray array];
+    NSString *theSQLStatement = [self _SQLForSetOperation:theOperation withBagOrSearch:theBagOrSearch bindingTexts:bindings];
+    
+    NSArray *keys = [store _keysForSQL:theSQLStatement bindingTexts:bindings];
+    if ((nil == keys) && (nil != outError)) {
+        *outError = [NSError errorWithDomain:NSFDomainKey
+                                        code:NSFNanoStoreErrorKey
+                                    userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the set operation could not be performed.", [self class], _cmd]
+                                                                         forKey:NSLocalizedFailureReasonErrorKey]];
+    }
+    
+    return keys;
+}
+
+- (long long)countOfObjectsBySetOperation:(NSFSetOperation)theOperation withBagOrSearch:(id)theBagOrSearch
+{
+    NSMutableArray *bindings = [NSMutableArray array];
+    NSString *theSQLStatement = [self _SQLForSetOperation:theOperation withBagOrSearch:theBagOrSearch bindingTexts:bindings];
+    
+    return [store _countForSQL:theSQLStatement bindingTexts:bindings];
+}
+
+- (NSFNanoBag *)bagBySetOperation:(NSFSetOperation)theOperation withBagOrSearch:(id)theBagOrSearch name:(NSString *)theName error:(out NSError **)outError
+{
+    NSMutableArray *bindings = [NSMutableArray array];
+    NSString *theSQLStatement = [self _SQLForSetOperation:theOperation withBagOrSearch:theBagOrSearch bindingTexts:bindings];
+    
+    // The new bag is stored first, so its members can be written straight from the set operation
+    NSFNanoBag *bag = [NSFNanoBag bagWithName:theName];
+    
+    BOOL transactionStartedHere = [store beginTransactionAndReturnError:nil];
+    
+    BOOL success = [store addObject:bag error:outError];
+    if ((YES == success) && (NO == [store _addMembersToBagWithKey:bag.key fromSQL:theSQLStatement bindingTexts:bindings])) {
+        success = NO;
+        if (nil != outError) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the members of the bag could not be saved.", [self class], _cmd]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        }
+    }
+    
+    if (YES == transactionStartedHere) {
+        if (YES == success) {
+            success = [store commitTransactionAndReturnError:outError];
+        } else {
+            [store rollbackTransactionAndReturnError:nil];
+        }
+    }
+    
+    if (NO == success) {
+        return nil;
+    }
+    
+    // Reloading leaves the bag deflated: nothing is read until its members are needed
+    [bag reloadBagWithError:nil];
+    
+    return bag;
+}
+
 #pragma mark - Private Methods
 #pragma mark -
 
@@ -413,11 +630,16 @@
         unsavedObjects = [NSMutableDictionary new];
         removedObjects = [NSMutableDictionary new];
         
+        // Stored bags keep their members in NSFBagMembers and are returned deflated: nothing is read until the members
+        // are needed. The keys are only part of the dictionary for copies and for bags saved before the membership table existed.
         NSArray *objectKeys = [dictionary objectForKey:NSF_Private_NSFNanoBag_NSFObjectKeys];
-        
-        [self _inflateObjectsWithKeys:objectKeys];
+        for (NSString *objectKey in objectKeys) {
+            [savedObjects setObject:[NSNull null] forKey:objectKey];
+        }
         
         hasUnsavedChanges = NO;
+        hasLoadedMemberKeys = ((nil != objectKeys) || (nil == aStore));
+        inflatesOnAccess = YES;
     }
     
     return self;
@@ -425,7 +647,15 @@
 
 - (NSDictionary *)nanoObjectDictionaryRepresentation
 {
-    return [self dictionaryRepresentation];
+    // The members are stored separately, so adding one doesn't rewrite the keys of all the others
+    NSMutableDictionary *info = [NSMutableDictionary dictionary];
+    
+    if (nil != name) {
+        [info setObject:name forKey:NSF_Private_NSFNanoBag_Name];
+    }
+    [info setObject:self.key forKey:NSF_Private_NSFNanoBag_NSFKey];
+    
+    return info;
 }
 
 - (NSString *)nanoObjectKey
@@ -440,27 +670,51 @@
 
 - (BOOL)_saveInStore:(NSFNanoStore *)someStore error:(out NSError **)outError
 {
+    // The bag, its unsaved objects and the changes to its membership are written together, or not at all
+    BOOL transactionStartedHere = [someStore beginTransactionAndReturnError:nil];
+    BOOL success = YES;
+    
     // Save the unsaved objects first...
     NSArray *contentsToBeSaved = [unsavedObjects allValues];
     if ([contentsToBeSaved count] > 0) {
-        [someStore _addObjectsFromArray:contentsToBeSaved forceSave:YES error:outError];
+        success = [someStore _addObjectsFromArray:contentsToBeSaved forceSave:YES error:outError];
     }
     
-    // Move the existing objects to the unsaved list, in order to save the bag
-    [unsavedObjects addEntriesFromDictionary:savedObjects];
-    [savedObjects removeAllObjects];
-    [removedObjects removeAllObjects];
-    
-    // Save the unsaved bag...
-    BOOL success = [someStore _addObjectsFromArray:[NSArray arrayWithObject:self] forceSave:YES error:outError];
+    // Save the unsaved bag, then the changes to its membership. A store other than the bag's own gets all of its members.
+    if (YES == success) {
+        success = [someStore _addObjectsFromArray:[NSArray arrayWithObject:self] forceSave:YES error:outError];
+    }
     
     if (YES == success) {
-        [unsavedObjects removeAllObjects];
-        success = [self reloadBagWithError:outError];
+        NSMutableArray *addedKeys = [NSMutableArray arrayWithArray:[unsavedObjects allKeys]];
+        if (someStore != store) {
+            // The members which are only in the bag's own document store can't be copied while it's closed
+            success = [self _loadMemberKeysIfNeeded];
+            [addedKeys addObjectsFromArray:[savedObjects allKeys]];
+        }
+        success = success && [someStore _storeMembersOfBagWithKey:key addingKeys:addedKeys removingKeys:[removedObjects allKeys]];
+        if ((NO == success) && (nil != outError)) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the members of the bag could not be saved.", [self class], _cmd]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        }
+    }
+    
+    if (YES == transactionStartedHere) {
         if (YES == success) {
-            hasUnsavedChanges = NO;
+            success = [someStore commitTransactionAndReturnError:outError];
+        } else {
+            [someStore rollbackTransactionAndReturnError:nil];
         }
-        return success;
+    }
+    
+    // ...and bring the bag up to date with what was just written, without reading it back
+    if (YES == success) {
+        [savedObjects addEntriesFromDictionary:unsavedObjects];
+        [unsavedObjects removeAllObjects];
+        [removedObjects removeAllObjects];
+        hasUnsavedChanges = NO;
     }
     
     return success;
@@ -468,19 +722,97 @@
 
 - (void)_inflateObjectsWithKeys:(NSArray *)someKeys
 {
-    if ([someKeys count] != 0) {
-        NSFNanoSearch *search = [NSFNanoSearch searchWithStore:store];
-        NSString *quotedString = [NSFNanoSearch _quoteStrings:someKeys joiningWithDelimiter:@","];
-        NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT NSFKey, NSFPlist, NSFObjectClass FROM NSFKeys WHERE NSFKey IN (%@)", quotedString];
-        
-        NSDictionary *results = [search executeSQL:theSQLStatement returnType:NSFReturnObjects error:nil];
-        
-        if (nil != results) {
-            [savedObjects addEntriesFromDictionary:results];
+    if (([someKeys count] != 0) && (nil != store)) {
+        // Read like any other lookup by key: the keys are bound rather than quoted, and the store's cache is used
+        [savedObjects addEntriesFromDictionary:[store _objectsByKeyForKeys:someKeys]];
+    }
+}
+
+- (BOOL)_loadMemberKeysIfNeeded
+{
+    if (YES == hasLoadedMemberKeys) {
+        return YES;
+    }
+    
+    // The members are read from the document store: they can't be loaded while it's closed
+    if (YES == [store isClosed]) {
+        return NO;
+    }
+    
+    hasLoadedMemberKeys = YES;
+    
+    // The keys are enough to change the bag: the objects stay deflated until they're asked for
+    for (NSString *objectKey in [store _keysOfMembersOfBagWithKey:key]) {
+        if ((nil == [savedObjects objectForKey:objectKey]) && (nil == [unsavedObjects objectForKey:objectKey]) && (nil == [removedObjects objectForKey:objectKey])) {
+            [savedObjects setObject:[NSNull null] forKey:objectKey];
         }
     }
 }
 
+- (NSString *)_SQLForSetOperation:(NSFSetOperation)theOperation withBagOrSearch:(id)theBagOrSearch bindingTexts:(NSMutableArray *)someBindings
+{
+    if (nil == store) {
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: the bag has not been stored.", [self class], _cmd]
+                               userInfo:nil]raise];
+    }
+    
+    NSString *operator = nil;
+    switch (theOperation) {
+        case NSFSetIntersection:
+            operator = @"INTERSECT";
+            break;
+        case NSFSetUnion:
+            operator = @"UNION";
+            break;
+        case NSFSetDifference:
+            operator = @"EXCEPT";
+            break;
+        default:
+            [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                     reason:[NSString stringWithFormat:@"*** -[%@ %s]: unknown set operation.", [self class], _cmd]
+                                   userInfo:nil]raise];
+            break;
+    }
+    
+    // Both sides are sets of keys: the members of the other bag or the keys of the objects matching the search
+    NSString *otherKeysSQL = nil;
+    if (YES == [theBagOrSearch isKindOfClass:[NSFNanoBag class]]) {
+        if ([(NSFNanoBag *)theBagOrSearch store] != store) {
+            [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                     reason:[NSString stringWithFormat:@"*** -[%@ %s]: the bags must be stored in the same document store.", [self class], _cmd]
+                                   userInfo:nil]raise];
+        }
+        otherKeysSQL = [NSString stringWithFormat:@"SELECT m.%@ FROM %@ m WHERE m.%@ = ?2 AND EXISTS (SELECT 1 FROM %@ k WHERE k.%@ = m.%@)", NSFObjectKey, NSFBagMembers, NSFKey, NSFKeys, NSFKey, NSFObjectKey];
+        [someBindings addObject:[(NSFNanoBag *)theBagOrSearch key]];
+    } else if (YES == [theBagOrSearch isKindOfClass:[NSFNanoSearch class]]) {
+        if ([(NSFNanoSearch *)theBagOrSearch nanoStore] != store) {
+            [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                     reason:[NSString stringWithFormat:@"*** -[%@ %s]: the bag and the search must use the same document store.", [self class], _cmd]
+                                   userInfo:nil]raise];
+        }
+        otherKeysSQL = [(NSFNanoSearch *)theBagOrSearch _preparedKeysSQL];
+    } else {
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: expected a bag or a search.", [self class], _cmd]
+                               userInfo:nil]raise];
+    }
+    
+    [someBindings insertObject:key atIndex:0];
+    
+    // The other side is wrapped so its own ordering or limits don't clash with the compound statement. As everywhere else,
+    // members whose objects were removed from the document store are left out.
+    return [NSString stringWithFormat:@"SELECT m.%@ FROM %@ m WHERE m.%@ = ?1 AND EXISTS (SELECT 1 FROM %@ k WHERE k.%@ = m.%@) %@ SELECT * FROM (%@)",
+            NSFObjectKey, NSFBagMembers, NSFKey, NSFKeys, NSFKey, NSFObjectKey, operator, otherKeysSQL];
+}
+
+- (NSArray *)_savedObjectKeys
+{
+    [self _loadMemberKeysIfNeeded];
+    
+    return [savedObjects allKeys];
+}
+
 /** \endcond */
 
 @end
\ No newline at end of file
@@ -0,0 +1,108 @@
+/*
+     NSFNanoBlob.h
+     NanoStore
+     
+     Copyright (c) 2010 Webbo, L.L.C. All rights reserved.
+     
+     Redistribution and use in source and binary forms, with or without modification, are permitted
+     provided that the following conditions are met:
+     
+     * Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+     * Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+     and the following disclaimer in the documentation and/or other materials provided with the distribution.
+     * Neither the name of Webbo nor the names of its contributors may be used to endorse or promote
+     products derived from this software without specific prior written permission.
+     
+     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+     WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+     PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+     DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+     PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+     CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+     OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+     SUCH DAMAGE.	*/
+
+#import <Foundation/Foundation.h>
+
+#import "NSFNanoGlobals.h"
+
+/*! @file NSFNanoBlob.h
+ @brief A reference to a blob stored out-of-line in the document store.	*/
+
+/** @class NSFNanoBlob
+ * A reference to a blob stored out-of-line, in the NSFBlobs table of the document store.
+ *
+ * Blobs are content-addressed: they're identified by the SHA-256 hash of their bytes, so storing the same bytes twice stores them once.
+ * A blob can be placed in the dictionary of any object, where it takes the place of the bytes. When NSFNanoStore::blobSizeThreshold is set,
+ * NSData values of at least that size are moved out-of-line automatically and read back as NSFNanoBlob references.
+ *
+ * The reference doesn't hold the bytes: they're read through the document store, whole or in chunks.
+ *
+ * @details <b>Example:</b>
+ @code
+ // Instantiate a NanoStore and open it
+ NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+ 
+ // Store the attachment in chunks and reference it from an object
+ NSInputStream *inputStream = [NSInputStream inputStreamWithFileAtPath:thePath];
+ NSFNanoBlob *attachment = [nanoStore addBlobFromInputStream:inputStream length:theLength error:nil];
+ NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObject:attachment forKey:@"Attachment"]];
+ [nanoStore addObject:object error:nil];
+ 
+ // Read the first kilobyte back
+ NSData *header = [nanoStore dataOfBlob:attachment inRange:NSMakeRange(0, 1024) error:nil];
+ 
+ // Close the document store
+ [nanoStore closeWithError:nil];
+ @endcode	*/
+
+@interface NSFNanoBlob : NSObject <NSCopying>
+
+/** * The SHA-256 hash of the bytes of the blob, as a lowercase hexadecimal string. */
+@property (nonatomic, readonly) NSString *contentHash;
+/** * The length of the blob, in bytes. */
+@property (nonatomic, readonly) unsigned long long length;
+
+/** @name Creating and Initializing Blobs	*/
+
+//@{
+
+/** * Creates and returns a reference to a blob.
+ * @param theHash the SHA-256 hash of the bytes of the blob. Must not be nil.
+ * @param theLength the length of the blob, in bytes.
+ * @return A reference to the blob.
+ * @note Blobs are normally obtained from NSFNanoStore, which computes the hash while it stores the bytes.
+ * @throws NSFUnexpectedParameterException is thrown if the hash is nil or empty.
+ * @see \link initWithContentHash:length: - (id)initWithContentHash:(NSString *)theHash length:(unsigned long long)theLength \endlink	*/
+
++ (NSFNanoBlob *)blobWithContentHash:(NSString *)theHash length:(unsigned long long)theLength;
+
+/** * Initializes a newly allocated reference to a blob.
+ * @param theHash the SHA-256 hash of the bytes of the blob. Must not be nil.
+ * @param theLength the length of the blob, in bytes.
+ * @return A reference to the blob.
+ * @throws NSFUnexpectedParameterException is thrown if the hash is nil or empty.
+ * @see \link blobWithContentHash:length: + (NSFNanoBlob *)blobWithContentHash:(NSString *)theHash length:(unsigned long long)theLength \endlink	*/
+
+- (id)initWithContentHash:(NSString *)theHash length:(unsigned long long)theLength;
+
+//@}
+
+/** @name Miscellaneous	*/
+
+//@{
+
+/** * Compares the receiver to another blob.
+ * @param otherBlob is a blob.
+ * @return YES if both blobs reference the same bytes, NO otherwise.	*/
+
+- (BOOL)isEqualToBlob:(NSFNanoBlob *)otherBlob;
+
+/** * Returns a string representation of the blob.	*/
+
+- (NSString *)description;
+
+//@}
+
+@end
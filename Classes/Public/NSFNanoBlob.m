@@ -0,0 +1,160 @@
+/*
+     NSFNanoBlob.m
+     NanoStore
+     
+     Copyright (c) 2010 Webbo, L.L.C. All rights reserved.
+     
+     Redistribution and use in source and binary forms, with or without modification, are permitted
+     provided that the following conditions are met:
+     
+     * Redistributions of source code must retain the above copyright notice, this list of conditions
+     and the following disclaimer.
+     * Redistributions in binary form must reproduce the above copyright notice, this list of conditions
+     and the following disclaimer in the documentation and/or other materials provided with the distribution.
+     * Neither the name of Webbo nor the names of its contributors may be used to endorse or promote
+     products derived from this software without specific prior written permission.
+     
+     THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED
+     WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+     PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR ANY
+     DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+     PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+     CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+     OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+     SUCH DAMAGE.	*/
+
+#import "NSFNanoBlob.h"
+#import "NSFNanoGlobals_Private.h"
+
+@implementation NSFNanoBlob
+{
+    /** \cond */
+    NSString            *contentHash;
+    unsigned long long  length;
+    /** \endcond */
+}
+
+@synthesize contentHash, length;
+
++ (NSFNanoBlob *)blobWithContentHash:(NSString *)theHash length:(unsigned long long)theLength
+{
+    return [[self alloc]initWithContentHash:theHash length:theLength];
+}
+
+- (id)initWithContentHash:(NSString *)theHash length:(unsigned long long)theLength
+{
+    if (theHash.length == 0)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theHash is invalid.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if ((self = [super init])) {
+        contentHash = [theHash copy];
+        length = theLength;
+    }
+    
+    return self;
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    // Immutable
+    return self;
+}
+
+- (BOOL)isEqualToBlob:(NSFNanoBlob *)otherBlob
+{
+    if (self == otherBlob) {
+        return YES;
+    }
+    
+    return ([otherBlob isKindOfClass:[NSFNanoBlob class]] && [contentHash isEqualToString:otherBlob.contentHash]);
+}
+
+- (BOOL)isEqual:(id)anObject
+{
+    return [self isEqualToBlob:anObject];
+}
+
+- (NSUInteger)hash
+{
+    return [contentHash hash];
+}
+
+/** \cond */
+
++ (NSFNanoBlob *)_blobWithReference:(NSDictionary *)aReference
+{
+    NSString *theHash = [aReference objectForKey:NSF_Private_NSFNanoBlob_Hash];
+    NSNumber *theLength = [aReference objectForKey:NSF_Private_NSFNanoBlob_Length];
+    
+    if ((2 != [aReference count]) || (NO == [theHash isKindOfClass:[NSString class]]) || (NO == [theLength isKindOfClass:[NSNumber class]])) {
+        return nil;
+    }
+    
+    return [[self alloc]initWithContentHash:theHash length:[theLength unsignedLongLongValue]];
+}
+
+- (NSDictionary *)_reference
+{
+    // How the blob is written in the plist and in NSFValues
+    return [NSDictionary dictionaryWithObjectsAndKeys:contentHash, NSF_Private_NSFNanoBlob_Hash, [NSNumber numberWithUnsignedLongLong:length], NSF_Private_NSFNanoBlob_Length, nil];
+}
+
++ (id)_collectionByResolvingReferences:(id)aCollection
+{
+    // Only the containers holding references are rebuilt, the rest is returned as is
+    if ([aCollection isKindOfClass:[NSDictionary class]]) {
+        NSFNanoBlob *blob = [self _blobWithReference:aCollection];
+        if (nil != blob) {
+            return blob;
+        }
+        
+        NSMutableDictionary *resolvedCollection = nil;
+        for (id key in aCollection) {
+            id value = [aCollection objectForKey:key];
+            id resolvedValue = [self _collectionByResolvingReferences:value];
+            if (resolvedValue != value) {
+                if (nil == resolvedCollection) {
+                    resolvedCollection = [aCollection mutableCopy];
+                }
+                [resolvedCollection setObject:resolvedValue forKey:key];
+            }
+        }
+        
+        return (nil != resolvedCollection) ? resolvedCollection : aCollection;
+    } else if ([aCollection isKindOfClass:[NSArray class]]) {
+        NSMutableArray *resolvedCollection = nil;
+        NSUInteger i, count = [aCollection count];
+        for (i = 0; i < count; i++) {
+            id value = [aCollection objectAtIndex:i];
+            id resolvedValue = [self _collectionByResolvingReferences:value];
+            if (resolvedValue != value) {
+                if (nil == resolvedCollection) {
+                    resolvedCollection = [aCollection mutableCopy];
+                }
+                [resolvedCollection replaceObjectAtIndex:i withObject:resolvedValue];
+            }
+        }
+        
+        return (nil != resolvedCollection) ? resolvedCollection : aCollection;
+    }
+    
+    return aCollection;
+}
+
+/** \endcond */
+
+- (NSString*)description
+{
+    NSMutableString *description = [NSMutableString string];
+    
+    [description appendString:@"\n"];
+    [description appendString:[NSString stringWithFormat:@"Blob address             : 0x%x\n", self]];
+    [description appendString:[NSString stringWithFormat:@"Content hash             : %@\n", contentHash]];
+    [description appendString:[NSString stringWithFormat:@"Length                   : %llu\n", length]];
+    
+    return description;
+}
+
+@end
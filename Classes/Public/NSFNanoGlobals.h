@@ -106,7 +106,13 @@ typedef enum {
     /** * It invokes the min() function. */
     NSFMin,
     /** * It invokes the total() function. See note above for additional information. */
-    NSFTotal
+    NSFTotal,
+    /** * An estimate of the 50th percentile (median), computed with a t-digest of bounded size. */
+    NSFApproximatePercentile50,
+    /** * An estimate of the 95th percentile, computed with a t-digest of bounded size. */
+    NSFApproximatePercentile95,
+    /** * An estimate of the 99th percentile, computed with a t-digest of bounded size. */
+    NSFApproximatePercentile99
 } NSFAggregateFunctionType;
 
 /** * Comparison options.
@@ -179,11 +185,25 @@ typedef enum {
     NSFReturnObjects = 1,
     /** * Returns the keys */
     NSFReturnKeys,
+    /** * Returns faults: NanoObjects which only hold their key and load their info from the document store the first time it's accessed. Objects which aren't NanoObjects, such as bags, are returned fully loaded. */
+    NSFReturnFaults,
 } NSFReturnType;
 
+/** * Set operation options.
+ * These values represent the operations available when combining the objects of a bag with those of another bag or a search.
+ @see NSFNanoBag	*/
+typedef enum {
+    /** * The objects found in both. */
+    NSFSetIntersection = 1,
+    /** * The objects found in either. */
+    NSFSetUnion,
+    /** * The objects found in the bag but not in the other. */
+    NSFSetDifference
+} NSFSetOperation;
+
 /** * Caching mechanism options.
- * These values represent the options used by the search mechanism to cache results.
- @see NSFNanoEngine	*/
+ * These values represent the options used by the document store to cache the objects retrieved by key.
+ @see NSFNanoStore, NSFNanoEngine	*/
 typedef enum {
     /** * Load data at as soon as it's available. Uses more memory, but data is available quicker. */
     CacheAllData = 1,
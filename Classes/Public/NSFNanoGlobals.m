@@ -108,6 +108,8 @@ NSString * const NSFNanoObjectBehaviorException                 = @"NSFNanoObjec
 NSString * const NSFNanoStoreUnableToManipulateStoreException   = @"NSFNanoStoreUnableToManipulateStoreException";
 NSString * const NSFKeys                                        = @"NSFKeys";
 NSString * const NSFValues                                      = @"NSFValues";
+NSString * const NSFBagMembers                                  = @"NSFBagMembers";
+NSString * const NSFBlobs                                       = @"NSFBlobs";
 NSString * const NSFKey                                         = @"NSFKey";
 NSString * const NSFAttribute                                   = @"NSFAttribute";
 NSString * const NSFValue                                       = @"NSFValue";
@@ -115,6 +117,12 @@ NSString * const NSFDatatype                                    = @"NSFDatatype"
 NSString * const NSFCalendarDate                                = @"NSFCalendarDate";
 NSString * const NSFObjectClass                                 = @"NSFObjectClass";
 NSString * const NSFPlist                                       = @"NSFPlist";
+NSString * const NSFHash                                        = @"NSFHash";
+NSString * const NSFTimestamp                                   = @"NSFTimestamp";
+NSString * const NSFArrayElement                                = @"NSFArrayElement";
+NSString * const NSFObjectKey                                   = @"NSFObjectKey";
+NSString * const NSFLength                                      = @"NSFLength";
+NSString * const NSFData                                        = @"NSFData";
 
 
 NSString * const NSF_Private_NSFKeys_NSFKey             = @"NSFKeys.NSFKey";
@@ -125,7 +133,9 @@ NSString * const NSF_Private_NSFValues_NSFValue         = @"NSFValues.NSFValue";
 NSString * const NSF_Private_NSFNanoBag_Name            = @"NSF_Private_NSFNanoBag_Name";
 NSString * const NSF_Private_NSFNanoBag_NSFKey          = @"NSF_Private_NSFNanoBag_NSFKey";
 NSString * const NSF_Private_NSFNanoBag_NSFObjectKeys   = @"NSF_Private_NSFNanoBag_NSFObjectKeys";
-NSString * const NSF_Private_ToDeleteTableKey           = @"NSF_Private_ToDeleteTableKey";
+NSString * const NSF_Private_NSFNanoBlob_Hash           = @"NSF_Private_NSFNanoBlob_Hash";
+NSString * const NSF_Private_NSFNanoBlob_Length         = @"NSF_Private_NSFNanoBlob_Length";
+NSString * const NSF_Private_MatchingKeysTableKey        = @"NSF_Private_MatchingKeysTableKey";
 
 NSString * const NSFRowIDColumnName                     = @"ROWID";
 
@@ -136,6 +146,9 @@ NSInteger const NSFNanoStoreErrorKey                               = -10002;
 #pragma mark Private section
 
 NSString * const NSFP_SchemaTable                    = @"NSFP_SchemaTable";
+NSString * const NSFP_AggregatesTable                = @"NSFP_Aggregates";
+NSString * const NSFP_AggregateDefinitionsTable      = @"NSFP_AggregateDefinitions";
+NSString * const NSFP_CompressionDictionariesTable   = @"NSFP_CompressionDictionaries";
 NSString * const NSFP_TableIdentifier                = @"NSFP_TableIdentifier";
 NSString * const NSFP_ColumnIdentifier               = @"NSFP_ColumnIdentifier";
 NSString * const NSFP_DatatypeIdentifier             = @"NSFP_DatatypeIdentifier";
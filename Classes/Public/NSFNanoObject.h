@@ -64,7 +64,8 @@
  - NSDate
  - NSNumber
  
- (*) The data type NSData is allowed, but it will be excluded from the indexing process.
+ (*) The data type NSData is allowed, but it will be excluded from the indexing process. When the document store has a blobSizeThreshold, the
+ larger NSData values are stored out-of-line and read back as NSFNanoBlob references.
  
  To save and retrieve objects from the document store, NanoStore moves the data around by encapsulating it in NanoObjects. In order to store the objects in
  NanoStore the developer has three options:
@@ -184,6 +185,23 @@
 @property (nonatomic, copy, readonly) NSDictionary *info;
 /** * The class name used to store the NanoObject.  */
 @property (nonatomic, copy, readonly) NSString *originalClassString;
+/** * Whether the NanoObject is a fault, that is, its info hasn't been loaded from the document store yet.
+ * @note Faults are returned by searches performed with \link Globals::NSFReturnFaults NSFReturnFaults \endlink. Accessing or modifying the
+ * contents of a fault loads the info of all the faults fetched in the same batch with one single query. If the info can't be loaded because
+ * the document store is closed or the object has been removed, NSFNanoStoreUnableToManipulateStoreException is raised and the NanoObject remains a fault.
+ * @see \link NSFNanoSearch::searchObjectsWithReturnType:error: - (id)searchObjectsWithReturnType:(NSFReturnType)theReturnType error:(out NSError **)outError \endlink */
+@property (nonatomic, assign, readonly, getter=isFault) BOOL fault;
+/** * The top-level attributes whose value has been modified since the NanoObject was loaded or last saved.  */
+@property (nonatomic, readonly) NSSet *changedAttributes;
+/** * The top-level attributes added since the NanoObject was loaded or last saved.  */
+@property (nonatomic, readonly) NSSet *addedAttributes;
+/** * The top-level attributes removed since the NanoObject was loaded or last saved.  */
+@property (nonatomic, readonly) NSSet *removedAttributes;
+/** * Whether the NanoObject has been modified since it was loaded or last saved. Objects which have never been saved always have unsaved changes.
+ * @note When saving an object loaded from the document store, only the attributes which have been changed, added or removed are rewritten.
+ * Changes made in place (i.e. through the info or a mutable value it holds) can't be tracked: once such values have been handed out,
+ * the object is compared with the stored document instead.  */
+@property (nonatomic, assign, readonly) BOOL hasUnsavedChanges;
 
 /** @name Creating and Initializing a NanoObject	*/
 
@@ -26,10 +26,61 @@
 #import "NSFNanoObject.h"
 #import "NSFNanoObject_Private.h"
 #import "NSFNanoGlobals_Private.h"
+#import "NSFNanoStore_Private.h"
+
+@implementation NSFNanoFaultBatch
+{
+    /** \cond */
+    __weak NSFNanoStore *store;
+    NSArray *keys;
+    NSMutableDictionary *loadedInfo;
+    /** \endcond */
+}
+
+- (id)initWithStore:(NSFNanoStore *)aStore keys:(NSArray *)someKeys
+{
+    if ((self = [super init])) {
+        store = aStore;
+        keys = [someKeys copy];
+        loadedInfo = nil;
+    }
+    
+    return self;
+}
+
+- (NSDictionary *)infoForKey:(NSString *)aKey
+{
+    // If the documents can't be read (the store is gone or closed), the batch stays unloaded so it can be tried again
+    if (nil != keys) {
+        NSDictionary *dictionaries = [store _dictionariesForKeys:keys];
+        if (nil == dictionaries) {
+            return nil;
+        }
+        loadedInfo = [dictionaries mutableCopy];
+        keys = nil;
+    }
+    
+    NSDictionary *theInfo = [loadedInfo objectForKey:aKey];
+    if (nil != theInfo) {
+        [loadedInfo removeObjectForKey:aKey];
+    }
+    
+    return theInfo;
+}
+
+@end
 
 @implementation NSFNanoObject
 {
     NSMutableDictionary *info;
+    /** \cond */
+    NSFNanoFaultBatch *_faultBatch;
+    NSMutableSet *_changedAttributes;
+    NSMutableSet *_addedAttributes;
+    NSMutableSet *_removedAttributes;
+    BOOL _isPersisted;
+    BOOL _mayHaveBeenModifiedInPlace;
+    /** \endcond */
 }
 
 @synthesize info, key, originalClassString;
@@ -74,6 +125,9 @@
             info = [NSMutableDictionary new];
             [info addEntriesFromDictionary:aDictionary];
         }
+        
+        // Objects handed to us by a store reflect what's stored: changes are tracked from here on
+        _isPersisted = (nil != aStore);
     }
     
     return self;
@@ -87,48 +141,120 @@
     [description appendString:[NSString stringWithFormat:@"NanoObject address : 0x%x\n", (unsigned int)self]];
     [description appendString:[NSString stringWithFormat:@"Original class     : %@\n", (nil != originalClassString) ? originalClassString : NSStringFromClass ([self class])]];
     [description appendString:[NSString stringWithFormat:@"Key                : %@\n", key]];
-    [description appendString:[NSString stringWithFormat:@"Info               : %ld key/value pairs\n", [info count]]];
+    if (nil != _faultBatch) {
+        [description appendString:@"Info               : <fault>\n"];
+    } else {
+        [description appendString:[NSString stringWithFormat:@"Info               : %ld key/value pairs\n", [info count]]];
+    }
     
     return description;
 }
 
+- (NSDictionary *)info
+{
+    [self _fireFaultIfNeeded];
+    
+    // The dictionary handed out is the mutable one we keep, so changes can no longer be told from the tracked attributes
+    _mayHaveBeenModifiedInPlace = YES;
+    
+    return info;
+}
+
+- (BOOL)isFault
+{
+    return (nil != _faultBatch);
+}
+
+- (NSSet *)changedAttributes
+{
+    return (nil != _changedAttributes) ? [_changedAttributes copy] : [NSSet set];
+}
+
+- (NSSet *)addedAttributes
+{
+    return (nil != _addedAttributes) ? [_addedAttributes copy] : [NSSet set];
+}
+
+- (NSSet *)removedAttributes
+{
+    return (nil != _removedAttributes) ? [_removedAttributes copy] : [NSSet set];
+}
+
+- (BOOL)hasUnsavedChanges
+{
+    return (NO == _isPersisted) || ([_changedAttributes count] > 0) || ([_addedAttributes count] > 0) || ([_removedAttributes count] > 0);
+}
+
 - (void)addEntriesFromDictionary:(NSDictionary *)otherDictionary
 {
+    [self _fireFaultIfNeeded];
+    
     // Allocate the dictionary if needed
     if (nil == info) {
         info = [NSMutableDictionary new];
     }
     
+    for (NSString *attribute in otherDictionary) {
+        [self _recordSetOfAttribute:attribute];
+        [self _recordAccessToValue:[otherDictionary objectForKey:attribute]];
+    }
+    
     [info addEntriesFromDictionary:otherDictionary];
 }
 
 - (void)setObject:(id)anObject forKey:(NSString *)aKey
 {
+    [self _fireFaultIfNeeded];
+    
     // Allocate the dictionary if needed
     if (nil == info) {
         info = [NSMutableDictionary new];
     }
     
+    [self _recordSetOfAttribute:aKey];
+    [self _recordAccessToValue:anObject];
+    
     [info setObject:anObject forKey:aKey];
 }
 
 - (id)objectForKey:(NSString *)aKey
 {
-    return [info objectForKey:aKey];
+    [self _fireFaultIfNeeded];
+    
+    id anObject = [info objectForKey:aKey];
+    [self _recordAccessToValue:anObject];
+    
+    return anObject;
 }
 
 - (void)removeObjectForKey:(NSString *)aKey
 {
+    [self _fireFaultIfNeeded];
+    
+    [self _recordRemovalOfAttribute:aKey];
+    
     [info removeObjectForKey:aKey];
 }
 
 - (void)removeAllObjects
 {
+    [self _fireFaultIfNeeded];
+    
+    for (NSString *attribute in [info allKeys]) {
+        [self _recordRemovalOfAttribute:attribute];
+    }
+    
     [info removeAllObjects];
 }
 
 - (void)removeObjectsForKeys:(NSArray *)keyArray
 {
+    [self _fireFaultIfNeeded];
+    
+    for (NSString *attribute in keyArray) {
+        [self _recordRemovalOfAttribute:attribute];
+    }
+    
     [info removeObjectsForKeys:keyArray];
 }
 
@@ -147,7 +273,7 @@
     }
     
     if (YES == success) {
-        success = [info isEqualToDictionary:otherNanoObject.info];
+        success = [self.info isEqualToDictionary:otherNanoObject.info];
     }
     
     return success;
@@ -166,6 +292,12 @@
         key = [[NSFNanoEngine stringWithUUID]copy];
         info = nil;
         originalClassString = nil;
+        _faultBatch = nil;
+        _changedAttributes = nil;
+        _addedAttributes = nil;
+        _removedAttributes = nil;
+        _isPersisted = NO;
+        _mayHaveBeenModifiedInPlace = NO;
     }
     
     return self;
@@ -192,7 +324,7 @@
 
 - (id)rootObject
 {
-    return info;
+    return self.info;
 }
 
 #pragma mark - Private Methods
@@ -205,6 +337,117 @@
     }
 }
 
+- (void)_setFaultBatch:(NSFNanoFaultBatch *)aBatch
+{
+    _faultBatch = aBatch;
+}
+
+- (void)_fireFaultIfNeeded
+{
+    if (nil == _faultBatch) {
+        return;
+    }
+    
+    // An object whose info can't be loaded stays a fault: as an empty object it would be saved over the stored one
+    NSDictionary *storedInfo = [_faultBatch infoForKey:key];
+    if (nil == storedInfo) {
+        [[NSException exceptionWithName:NSFNanoStoreUnableToManipulateStoreException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: the info of the object with key %@ could not be loaded. The document store is closed or the object has been removed.", [self class], _cmd, key]
+                               userInfo:nil]raise];
+    }
+    
+    _faultBatch = nil;
+    info = [storedInfo mutableCopy];
+}
+
+- (BOOL)_isPersisted
+{
+    return _isPersisted;
+}
+
+- (void)_markSaved
+{
+    _isPersisted = YES;
+    _changedAttributes = nil;
+    _addedAttributes = nil;
+    _removedAttributes = nil;
+    
+    // Mutable values handed to us (i.e. when the object was created) may still be referenced by the caller
+    _mayHaveBeenModifiedInPlace = NO;
+    for (NSString *attribute in info) {
+        [self _recordAccessToValue:[info objectForKey:attribute]];
+    }
+}
+
+- (BOOL)_tracksAllChanges
+{
+    return (NO == _mayHaveBeenModifiedInPlace);
+}
+
+- (void)_recordAccessToValue:(id)aValue
+{
+    // A mutable value held by someone else can change behind our back, and so can the mutable values nested in it
+    if (YES == _mayHaveBeenModifiedInPlace) {
+        return;
+    }
+    
+    if ([aValue isKindOfClass:[NSMutableArray class]] || [aValue isKindOfClass:[NSMutableDictionary class]] || [aValue isKindOfClass:[NSMutableSet class]] ||
+        [aValue isKindOfClass:[NSMutableString class]] || [aValue isKindOfClass:[NSMutableData class]]) {
+        _mayHaveBeenModifiedInPlace = YES;
+    } else if ([aValue isKindOfClass:[NSDictionary class]]) {
+        for (id nestedKey in aValue) {
+            [self _recordAccessToValue:[aValue objectForKey:nestedKey]];
+        }
+    } else if ([aValue isKindOfClass:[NSArray class]] || [aValue isKindOfClass:[NSSet class]]) {
+        for (id nestedValue in aValue) {
+            [self _recordAccessToValue:nestedValue];
+        }
+    }
+}
+
+- (void)_recordSetOfAttribute:(NSString *)anAttribute
+{
+    // Must be called before info is modified, so we can tell apart new attributes from existing ones
+    if (nil != [info objectForKey:anAttribute]) {
+        if (NO == [_addedAttributes containsObject:anAttribute]) {
+            if (nil == _changedAttributes) {
+                _changedAttributes = [NSMutableSet new];
+            }
+            [_changedAttributes addObject:anAttribute];
+        }
+    } else if (YES == [_removedAttributes containsObject:anAttribute]) {
+        // Removed and set again: as far as the store is concerned, it's been changed
+        [_removedAttributes removeObject:anAttribute];
+        if (nil == _changedAttributes) {
+            _changedAttributes = [NSMutableSet new];
+        }
+        [_changedAttributes addObject:anAttribute];
+    } else {
+        if (nil == _addedAttributes) {
+            _addedAttributes = [NSMutableSet new];
+        }
+        [_addedAttributes addObject:anAttribute];
+    }
+}
+
+- (void)_recordRemovalOfAttribute:(NSString *)anAttribute
+{
+    if (nil == [info objectForKey:anAttribute]) {
+        return;
+    }
+    
+    if (YES == [_addedAttributes containsObject:anAttribute]) {
+        // Added and removed before being saved: nothing to do
+        [_addedAttributes removeObject:anAttribute];
+    } else {
+        [_changedAttributes removeObject:anAttribute];
+        if (nil == _removedAttributes) {
+            _removedAttributes = [NSMutableSet new];
+        }
+        [_removedAttributes addObject:anAttribute];
+    }
+}
+
 /** \endcond */
 
 @end
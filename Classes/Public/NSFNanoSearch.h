@@ -30,10 +30,13 @@
  * A unit that provides an API to retrieve data from the document store.
  *
  * The search can be conducted in two ways: programatically via setters or by providing a SQL statement. In both cases,
- * it's necessary to indicate which object type should be returned. The type \link Globals::NSFReturnType NSFReturnType \endlink provides two options: \link Globals::NSFReturnObjects NSFReturnObjects \endlink and \link Globals::NSFReturnKeys NSFReturnKeys \endlink.
+ * it's necessary to indicate which object type should be returned. The type \link Globals::NSFReturnType NSFReturnType \endlink provides three options: \link Globals::NSFReturnObjects NSFReturnObjects \endlink, \link Globals::NSFReturnKeys NSFReturnKeys \endlink and \link Globals::NSFReturnFaults NSFReturnFaults \endlink.
  *
  *           -  \link Globals::NSFReturnObjects NSFReturnObjects \endlink will return a dictionary with the key of the NanoObject (key) and the NanoObject itself (value).
  *           -  \link Globals::NSFReturnKeys NSFReturnKeys \endlink will return an array of NanoObjects.
+ *           -  \link Globals::NSFReturnFaults NSFReturnFaults \endlink will return the same dictionary as \link Globals::NSFReturnObjects NSFReturnObjects \endlink, but the NanoObjects are faults:
+ *              they only hold their key, and their info is loaded in batches the first time one of them is accessed. Use it for large result sets of which only a few objects are inspected.
+ *              Objects whose class doesn't inherit from NSFNanoObject are returned as NSFNanoObject faults which remember the original class. The attributes to be returned are ignored.
  *
  * @par <b>Some observations about retrieving data</b><br>
  * 
@@ -153,7 +156,9 @@
 
 /** * The document store used for searching. */
 @property (nonatomic, weak, readonly) NSFNanoStore *nanoStore;
-/** * The set of attributes to be returned on matching objects. */
+/** * The set of attributes to be returned on matching objects.
+ * @note The attributes are read from the indexed values rather than decoding the whole object. Objects whose requested attributes are missing
+ * or hold a collection, a date or a value the index can't reproduce exactly fall back to their stored document. */
 @property (nonatomic, strong, readwrite) NSArray *attributesToBeReturned;
 /** * The key used for searching. */
 @property (nonatomic, copy, readwrite) NSString *key;
@@ -199,7 +204,7 @@
 //@{
 
 /** * Performs a search using the values of the properties.
- * @param theReturnType the type of object to be returned. Can be \link Globals::NSFReturnObjects NSFReturnObjects \endlink or \link Globals::NSFReturnKeys NSFReturnKeys \endlink.
+ * @param theReturnType the type of object to be returned. Can be \link Globals::NSFReturnObjects NSFReturnObjects \endlink, \link Globals::NSFReturnKeys NSFReturnKeys \endlink or \link Globals::NSFReturnFaults NSFReturnFaults \endlink.
  * @param outError is used if an error occurs. May be NULL.
  * @return An array is returned if: 1) the sort has been specified or 2) the return type is \link Globals::NSFReturnKeys NSFReturnKeys \endlink. Otherwise, a dictionary is returned.
  * @note The sort descriptor will be ignored when returning requesting NSFReturnKeys.
@@ -218,10 +223,39 @@
 
 - (id)searchObjectsAdded:(NSFDateMatchType)theDateMatch date:(NSDate *)theDate returnType:(NSFReturnType)theReturnType error:(out NSError **)outError;
 
+/** * Performs a search using the values of the properties, returning one page of results at a time.
+ * @param theReturnType the type of object to be returned. Can be \link Globals::NSFReturnObjects NSFReturnObjects \endlink or \link Globals::NSFReturnKeys NSFReturnKeys \endlink.
+ * @param thePageSize the maximum number of results to be returned. Must be greater than zero.
+ * @param theToken the token returned with the previous page, or nil to obtain the first page.
+ * @param outNextToken is set to the token needed to obtain the next page, or to nil when there are no more results. May be NULL.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return An array containing the objects (or keys) of the page, in order. Returns nil if an error occurs.
+ * @note The results are ordered by the first sort descriptor (if any) and then by insertion order. The token remembers the position of the last
+ * result, so every page is a constant-cost index seek, and objects added or removed while paging don't shift the pages that follow.
+ * Saving an object may give it a new position (i.e. bags and objects replaced under the same key are written anew), in which case it can show up again on a later page.
+ * When sorting, objects lacking the sort attribute are left out, and the attribute should hold a single value per object.
+ * The token is only valid for the search that produced it.
+ * @throws NSFUnexpectedParameterException is thrown if the page size is zero or the return type is \link Globals::NSFReturnFaults NSFReturnFaults \endlink.
+ * @see \link searchObjectsWithReturnType:error: - (id)searchObjectsWithReturnType:(NSFReturnType)theReturnType error:(out NSError **)outError \endlink	*/
+
+- (NSArray *)searchObjectsWithReturnType:(NSFReturnType)theReturnType pageSize:(NSUInteger)thePageSize continuationToken:(NSString *)theToken nextContinuationToken:(out NSString **)outNextToken error:(out NSError **)outError;
+
+/** * Returns the best objects matching the search according to the first sort descriptor.
+ * @param theCount the maximum number of objects to be returned.
+ * @param theReturnType the type of object to be returned. Can be \link Globals::NSFReturnObjects NSFReturnObjects \endlink or \link Globals::NSFReturnKeys NSFReturnKeys \endlink.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return An array containing up to theCount objects (or keys), best first. Returns nil if an error occurs.
+ * @note The values of the sort attribute are streamed through a bounded heap, so memory stays proportional to theCount and only the winners are decoded.
+ * Objects lacking the sort attribute are left out. Ties are broken by key. Only the first sort descriptor is taken into account.
+ * @throws NSFUnexpectedParameterException is thrown if no sort descriptor has been set or the return type is \link Globals::NSFReturnFaults NSFReturnFaults \endlink.
+ * @see \link searchObjectsWithReturnType:error: - (id)searchObjectsWithReturnType:(NSFReturnType)theReturnType error:(out NSError **)outError \endlink	*/
+
+- (NSArray *)searchTopObjects:(NSUInteger)theCount returnType:(NSFReturnType)theReturnType error:(out NSError **)outError;
+
 /** * Returns the result of the aggregate function.
  * @param theFunctionType is the function type to be applied.
  * @param theAttribute is the attribute used in the function.
- * @returns An NSNumber containing the result of the aggregate function.
+ * @returns An NSNumber containing the result of the aggregate function: an integer for counts, a double otherwise.
  * @details <b>Example:</b>
  @code
  * NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
@@ -234,13 +268,103 @@
  * NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
  * NSNumber *result = [search aggregateOperation:NSFAverage onAttribute:@"SomeNumber"];
  @endcode
- @note The sort descriptor will be ignored when executing aggregate operations.	*/
+ @note The sort descriptor will be ignored when executing aggregate operations.
+ * @note The result is returned as a float and the custom SQL set via the sql property is ignored. Use
+ * \link aggregateOperations:onAttribute:groupedByAttribute:error: - (NSDictionary *)aggregateOperations:(NSArray *)theFunctionTypes onAttribute:(NSString *)theAttribute groupedByAttribute:(NSString *)theGroupingAttribute error:(out NSError **)outError \endlink
+ * to obtain exact results.	*/
 
 - (NSNumber *)aggregateOperation:(NSFAggregateFunctionType)theFunctionType onAttribute:(NSString *)theAttribute;
 
+/** * Computes several aggregate functions at once, optionally grouped by the values of another attribute.
+ * @param theFunctionTypes an array of NSNumbers wrapping the \link Globals::NSFAggregateFunctionType NSFAggregateFunctionType \endlink values to be computed.
+ * @param theAttribute is the attribute used in the functions.
+ * @param theGroupingAttribute is the attribute whose values define the groups. May be nil.
+ * @param outError is used if an error occurs. May be NULL.
+ * @returns A dictionary mapping each group value to a dictionary which maps the function types (as found in theFunctionTypes) to their results.
+ * Without a grouping attribute, a single group keyed by NSNull is returned. Returns nil if an error occurs.
+ * @details <b>Example:</b>
+ @code
+ * // Count and sum the salaries of each department, in a single pass
+ * NSArray *functionTypes = [NSArray arrayWithObjects:[NSNumber numberWithInt:NSFCount], [NSNumber numberWithInt:NSFTotal], nil];
+ * NSDictionary *groups = [search aggregateOperations:functionTypes onAttribute:@"Salary" groupedByAttribute:@"Department" error:nil];
+ * NSNumber *totalSalesSalary = [[groups objectForKey:@"Sales"]objectForKey:[NSNumber numberWithInt:NSFTotal]];
+ @endcode
+ * @note The results are exact: counts are returned as 64-bit integers and the rest as doubles. Functions over no values (i.e. max or min) return NSNull.
+ * The search criteria are honored. The sort descriptor is ignored.
+ * @throws NSFUnexpectedParameterException is thrown if theFunctionTypes is empty or theAttribute is nil.	*/
+
+- (NSDictionary *)aggregateOperations:(NSArray *)theFunctionTypes onAttribute:(NSString *)theAttribute groupedByAttribute:(NSString *)theGroupingAttribute error:(out NSError **)outError;
+
+/** * Returns the number of matching objects holding each value of the specified attributes.
+ * @param theAttributes the attributes to be faceted.
+ * @param outError is used if an error occurs. May be NULL.
+ * @returns A dictionary mapping each attribute to a dictionary of value -> count (NSNumber). Returns nil if an error occurs.
+ * @note All the facets are computed in a single pass. An object holding the same value more than once is counted once. The search criteria are honored.
+ * @throws NSFUnexpectedParameterException is thrown if theAttributes is empty.	*/
+
+- (NSDictionary *)facetsForAttributes:(NSArray *)theAttributes error:(out NSError **)outError;
+
+/** * Computes several aggregate functions per fixed time interval of a date attribute.
+ * @param theFunctionTypes an array of NSNumbers wrapping the \link Globals::NSFAggregateFunctionType NSFAggregateFunctionType \endlink values to be computed.
+ * @param theAttribute is the attribute used in the functions. If nil, the functions apply to the timestamps themselves (i.e. NSFCount counts the objects in each bucket).
+ * @param theInterval the width of the buckets, in seconds (i.e. 60 for minutes, 3600 for hours).
+ * @param theDateAttribute the date attribute whose values are bucketed. If nil, the date the objects were last saved is used.
+ * @param outError is used if an error occurs. May be NULL.
+ * @returns A dictionary mapping the start date of each non-empty bucket to a dictionary which maps the function types (as found in theFunctionTypes) to their results.
+ * Returns nil if an error occurs.
+ * @details <b>Example:</b>
+ @code
+ * // Number of events and average duration per hour
+ * NSArray *functionTypes = [NSArray arrayWithObjects:[NSNumber numberWithInt:NSFCount], [NSNumber numberWithInt:NSFAverage], nil];
+ * NSDictionary *hours = [search aggregateOperations:functionTypes onAttribute:@"Duration" groupedByTimeInterval:3600 ofDateAttribute:@"StartDate" error:nil];
+ @endcode
+ * @note Dates are stored as seconds since 1970 as well, so the buckets are computed by SQLite in a single pass. Buckets are aligned on 1970-01-01 00:00:00 UTC.
+ * The search criteria are honored.
+ * @throws NSFUnexpectedParameterException is thrown if theFunctionTypes is empty or theInterval isn't positive.	*/
+
+- (NSDictionary *)aggregateOperations:(NSArray *)theFunctionTypes onAttribute:(NSString *)theAttribute groupedByTimeInterval:(NSTimeInterval)theInterval ofDateAttribute:(NSString *)theDateAttribute error:(out NSError **)outError;
+
+/** * Returns a percentile of the numeric values of an attribute among the matching objects.
+ * @param theFraction the percentile expressed as a fraction between 0 and 1 (i.e. 0.95 for p95).
+ * @param theAttribute is the attribute whose values are ranked.
+ * @param isApproximate if YES, the percentile is estimated with a t-digest in a single pass. Otherwise the exact value is returned.
+ * @param outError is used if an error occurs. May be NULL.
+ * @returns The percentile, or nil if there are no numeric values or an error occurs.
+ * @note Both modes use bounded memory. The exact percentile walks the values in index order up to the requested rank and interpolates linearly
+ * between the two closest ranks. The estimate needs a single pass over the values regardless of their order.
+ * @throws NSFUnexpectedParameterException is thrown if theAttribute is nil or theFraction is out of range.
+ * @see \link aggregateOperations:onAttribute:groupedByAttribute:error: - (NSDictionary *)aggregateOperations:(NSArray *)theFunctionTypes onAttribute:(NSString *)theAttribute groupedByAttribute:(NSString *)theGroupingAttribute error:(out NSError **)outError \endlink	*/
+
+- (NSNumber *)percentile:(double)theFraction onAttribute:(NSString *)theAttribute approximate:(BOOL)isApproximate error:(out NSError **)outError;
+
+/** * Returns a histogram of the numeric values of an attribute among the matching objects.
+ * @param theAttribute is the attribute whose values are counted.
+ * @param theLowerBound the lower bound of the first bucket.
+ * @param theUpperBound the upper bound of the last bucket.
+ * @param theNumberOfBuckets the number of buckets, all of the same width.
+ * @param outError is used if an error occurs. May be NULL.
+ * @returns An array of theNumberOfBuckets NSNumbers holding the number of values falling in each bucket. Returns nil if an error occurs.
+ * @note Both bounds are inclusive: values outside of them are not counted. The histogram is computed by the engine in a single pass.
+ * @throws NSFUnexpectedParameterException is thrown if theAttribute is nil, the bounds are invalid or theNumberOfBuckets is zero.	*/
+
+- (NSArray *)histogramOnAttribute:(NSString *)theAttribute lowerBound:(double)theLowerBound upperBound:(double)theUpperBound numberOfBuckets:(NSUInteger)theNumberOfBuckets error:(out NSError **)outError;
+
+/** * Returns the number of objects matching the search.
+ * @returns The number of matching objects, or -1 if the document store is closed or the search is invalid.
+ * @note Runs a single count(*) over the search predicate: no rows are materialized. Unlike \link aggregateOperation:onAttribute: - (NSNumber *)aggregateOperation:(NSFAggregateFunctionType)theFunctionType onAttribute:(NSString *)theAttribute \endlink,
+ * no attribute is needed. The sort descriptor and the attributes to be returned are ignored.	*/
+
+- (long long)countOfObjectsMatchingSearch;
+
+/** * Checks whether at least one object matches the search.
+ * @returns YES if an object matches the search, NO otherwise.
+ * @note The search stops at the first matching object. The sort descriptor and the attributes to be returned are ignored.	*/
+
+- (BOOL)existsObjectMatchingSearch;
+
 /** * Performs a search with a given SQL statement.
  * @param theSQLStatement is the SQL statement to be executed. Must not be nil or an empty string.
- * @param theReturnType the type of object to be returned. Can be \link Globals::NSFReturnObjects NSFReturnObjects \endlink or \link Globals::NSFReturnKeys NSFReturnKeys \endlink.
+ * @param theReturnType the type of object to be returned. Can be \link Globals::NSFReturnObjects NSFReturnObjects \endlink, \link Globals::NSFReturnKeys NSFReturnKeys \endlink or \link Globals::NSFReturnFaults NSFReturnFaults \endlink.
  * @param outError is used if an error occurs. May be NULL.
  * @return If theReturnType is \link Globals::NSFReturnObjects NSFReturnObjects \endlink, a dictionary is returned. Otherwise, an array is returned.
  * @note
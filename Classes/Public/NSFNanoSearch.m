@@ -27,6 +27,169 @@
 #import "NanoStore_Private.h"
 #import "NSFNanoSearch_Private.h"
 
+static const NSUInteger __NSFPFaultBatchSize = 64;
+
+/** \cond */
+
+// Bounded heap used by the top-K searches. The root holds the worst of the retained candidates,
+// so a new candidate only has to beat the root to get in.
+typedef struct {
+    int             rank;       // SQLite's ordering of storage classes: NULL, numbers, text, blobs
+    double          number;
+    unsigned char   *bytes;
+    int             length;
+    char            *key;
+} __NSFPTopKEntry;
+
+typedef struct {
+    __NSFPTopKEntry         *entries;
+    NSUInteger              count;
+    NSUInteger              capacity;
+    BOOL                    ascending;
+    CFMutableDictionaryRef  slots;      // Key -> index of its entry, so a key is found without scanning the heap
+} __NSFPTopKHeap;
+
+static Boolean __NSFPTopKKeysAreEqual(const void *a, const void *b)
+{
+    return (0 == strcmp((const char *)a, (const char *)b));
+}
+
+static CFHashCode __NSFPTopKHashKey(const void *aKey)
+{
+    // FNV-1a
+    CFHashCode hash = 2166136261U;
+    for (const unsigned char *c = (const unsigned char *)aKey; '\0' != *c; c++) {
+        hash = (hash ^ *c) * 16777619U;
+    }
+    return hash;
+}
+
+static int __NSFPTopKCompareValues(const __NSFPTopKEntry *a, const __NSFPTopKEntry *b)
+{
+    if (a->rank != b->rank) {
+        return (a->rank < b->rank) ? -1 : 1;
+    }
+    
+    if (1 == a->rank) {
+        return (a->number < b->number) ? -1 : ((a->number > b->number) ? 1 : 0);
+    }
+    
+    // Text and blobs compare like SQLite's BINARY collation
+    int result = memcmp(a->bytes, b->bytes, (size_t)MIN(a->length, b->length));
+    if (0 == result) {
+        result = (a->length < b->length) ? -1 : ((a->length > b->length) ? 1 : 0);
+    }
+    return result;
+}
+
+static BOOL __NSFPTopKIsWorse(const __NSFPTopKHeap *heap, const __NSFPTopKEntry *a, const __NSFPTopKEntry *b)
+{
+    // Ties are broken by key so the results don't depend on the order the rows are read in
+    int result = __NSFPTopKCompareValues(a, b);
+    if (0 == result) {
+        result = strcmp(a->key, b->key);
+        return (result > 0);
+    }
+    return (YES == heap->ascending) ? (result > 0) : (result < 0);
+}
+
+static void __NSFPTopKFreeEntry(__NSFPTopKEntry *entry)
+{
+    free(entry->bytes);
+    free(entry->key);
+    entry->bytes = NULL;
+    entry->key = NULL;
+}
+
+static void __NSFPTopKPlace(__NSFPTopKHeap *heap, NSUInteger index, __NSFPTopKEntry *entry)
+{
+    heap->entries[index] = *entry;
+    CFDictionarySetValue(heap->slots, heap->entries[index].key, (const void *)(uintptr_t)index);
+}
+
+static void __NSFPTopKEvict(__NSFPTopKHeap *heap, NSUInteger index)
+{
+    // The slot goes first: its key is the entry's own buffer
+    CFDictionaryRemoveValue(heap->slots, heap->entries[index].key);
+    __NSFPTopKFreeEntry(&heap->entries[index]);
+}
+
+static void __NSFPTopKSwap(__NSFPTopKHeap *heap, NSUInteger a, NSUInteger b)
+{
+    __NSFPTopKEntry swap = heap->entries[a];
+    __NSFPTopKPlace(heap, a, &heap->entries[b]);
+    __NSFPTopKPlace(heap, b, &swap);
+}
+
+static void __NSFPTopKSiftUp(__NSFPTopKHeap *heap, NSUInteger index)
+{
+    while (index > 0) {
+        NSUInteger parent = (index - 1) / 2;
+        if (NO == __NSFPTopKIsWorse(heap, &heap->entries[index], &heap->entries[parent])) {
+            break;
+        }
+        __NSFPTopKSwap(heap, index, parent);
+        index = parent;
+    }
+}
+
+static void __NSFPTopKSiftDown(__NSFPTopKHeap *heap, NSUInteger index)
+{
+    for (;;) {
+        NSUInteger worst = index;
+        NSUInteger left = (2 * index) + 1;
+        NSUInteger right = left + 1;
+        
+        if ((left < heap->count) && (YES == __NSFPTopKIsWorse(heap, &heap->entries[left], &heap->entries[worst]))) {
+            worst = left;
+        }
+        if ((right < heap->count) && (YES == __NSFPTopKIsWorse(heap, &heap->entries[right], &heap->entries[worst]))) {
+            worst = right;
+        }
+        if (worst == index) {
+            break;
+        }
+        
+        __NSFPTopKSwap(heap, index, worst);
+        index = worst;
+    }
+}
+
+static void __NSFPTopKOffer(__NSFPTopKHeap *heap, __NSFPTopKEntry *candidate)
+{
+    // Takes ownership of the candidate's buffers
+    if ((heap->count == heap->capacity) && (NO == __NSFPTopKIsWorse(heap, &heap->entries[0], candidate))) {
+        __NSFPTopKFreeEntry(candidate);
+        return;
+    }
+    
+    // Multi-valued attributes yield several rows per key: only the best one is kept
+    const void *slot = NULL;
+    if (CFDictionaryGetValueIfPresent(heap->slots, candidate->key, &slot)) {
+        NSUInteger index = (NSUInteger)(uintptr_t)slot;
+        if (YES == __NSFPTopKIsWorse(heap, &heap->entries[index], candidate)) {
+            __NSFPTopKEvict(heap, index);
+            __NSFPTopKPlace(heap, index, candidate);
+            __NSFPTopKSiftDown(heap, index);
+        } else {
+            __NSFPTopKFreeEntry(candidate);
+        }
+        return;
+    }
+    
+    if (heap->count < heap->capacity) {
+        __NSFPTopKPlace(heap, heap->count, candidate);
+        heap->count++;
+        __NSFPTopKSiftUp(heap, heap->count - 1);
+    } else {
+        __NSFPTopKEvict(heap, 0);
+        __NSFPTopKPlace(heap, 0, candidate);
+        __NSFPTopKSiftDown(heap, 0);
+    }
+}
+
+/** \endcond */
+
 @implementation NSFNanoSearch
 {
     /** \cond */
@@ -187,71 +350,616 @@
 {
     returnedObjectType = theReturnType;
     
-    // Make sure we don't have a SQL statement around...
-    sql = nil;
+    // Make sure we don't have a SQL statement around...
+    sql = nil;
+    
+    id results = [self _retrieveDataWithError:outError];
+    
+    return [self _sortResultsIfApplicable:results returnType:theReturnType];
+}
+
+- (id)searchObjectsAdded:(NSFDateMatchType)theDateMatch date:(NSDate *)theDate returnType:(NSFReturnType)theReturnType error:(out NSError **)outError
+{
+    returnedObjectType = theReturnType;
+    
+    // Make sure we don't have a SQL statement around...
+    sql = nil;
+    
+    id results = [self _retrieveDataAdded:theDateMatch calendarDate:theDate error:outError];
+    
+    if (NSFReturnKeys == theReturnType) {
+        results = [results allKeys];
+    }
+    
+    return results;
+}
+
+- (NSArray *)searchObjectsWithReturnType:(NSFReturnType)theReturnType pageSize:(NSUInteger)thePageSize continuationToken:(NSString *)theToken nextContinuationToken:(out NSString **)outNextToken error:(out NSError **)outError
+{
+    if (0 == thePageSize)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: thePageSize must be greater than zero.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if (NSFReturnFaults == theReturnType)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: NSFReturnFaults is not supported when paging.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if (nil != outNextToken) {
+        *outNextToken = nil;
+    }
+    
+    if (YES == [nanoStore isClosed]) {
+        return nil;
+    }
+    
+    returnedObjectType = theReturnType;
+    
+    // Make sure we don't have a SQL statement around...
+    sql = nil;
+    
+    NSFNanoSortDescriptor *descriptor = ([sort count] > 0) ? [sort objectAtIndex:0] : nil;
+    NSString *columns = (NSFReturnKeys == theReturnType) ? @"k.ROWID, k.NSFKey" : @"k.ROWID, k.NSFKey, k.NSFPlist, k.NSFObjectClass";
+    NSString *direction = ((nil == descriptor) || (YES == descriptor.isAscending)) ? @"ASC" : @"DESC";
+    NSString *comparison = ((nil == descriptor) || (YES == descriptor.isAscending)) ? @">" : @"<";
+    NSString *theSQLStatement = nil;
+    NSString *cursorClause = nil;
+    NSString *orderClause = nil;
+    
+    NSString *matchClause = [self _matchingKeysClauseForColumn:@"k.NSFKey"];
+    
+    // Rows are picked up right after the last one returned, in (sort value, ROWID) order: ROWID breaks the ties.
+    // The comparison is spelled out rather than written as a row value, which requires SQLite 3.15. The leading
+    // inclusive bound is redundant, but it's what lets SQLite seek the (NSFAttribute, NSFValue) index to the cursor.
+    if (nil != descriptor) {
+        theSQLStatement = [NSString stringWithFormat:@"SELECT %@, v.NSFValue FROM NSFKeys k JOIN NSFValues v ON v.NSFKey = k.NSFKey AND v.NSFAttribute = ?1 WHERE %@", columns, matchClause];
+        cursorClause = [NSString stringWithFormat:@" AND v.NSFValue %@= ?3 AND (v.NSFValue %@ ?3 OR (v.NSFValue = ?3 AND k.ROWID %@ ?4))", comparison, comparison, comparison];
+        orderClause = [NSString stringWithFormat:@" ORDER BY v.NSFValue %@, k.ROWID %@ LIMIT ?2", direction, direction];
+    } else {
+        theSQLStatement = [NSString stringWithFormat:@"SELECT %@ FROM NSFKeys k WHERE %@", columns, matchClause];
+        cursorClause = @" AND k.ROWID > ?4";
+        orderClause = @" ORDER BY k.ROWID LIMIT ?2";
+    }
+    
+    // The token is tied to the search which produced it
+    const char *fingerprintUTF8 = [[NSString stringWithFormat:@"%@%@|%@", theSQLStatement, orderClause, descriptor.attribute]UTF8String];
+    NSString *fingerprint = [NSFNanoEngine NSFP_contentHashOfBytes:fingerprintUTF8 length:strlen(fingerprintUTF8)];
+    
+    NSDictionary *cursor = nil;
+    if (nil != theToken) {
+        NSData *tokenData = [NSFNanoEngine decodeDataFromBase64:theToken];
+        cursor = (nil != tokenData) ? [NSPropertyListSerialization propertyListWithData:tokenData options:NSPropertyListImmutable format:NULL error:nil] : nil;
+        
+        if ((NO == [cursor isKindOfClass:[NSDictionary class]]) || (NO == [fingerprint isEqualToString:[cursor objectForKey:@"query"]]) || (nil == [cursor objectForKey:@"rowid"]) ||
+            ((nil != descriptor) && (nil == [cursor objectForKey:@"value"]))) {
+            if (nil != outError) {
+                *outError = [NSError errorWithDomain:NSFDomainKey
+                                                code:NSFNanoStoreErrorKey
+                                            userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the continuation token doesn't belong to this search.", [self class], _cmd]
+                                                                                 forKey:NSLocalizedFailureReasonErrorKey]];
+            }
+            return nil;
+        }
+        
+        theSQLStatement = [theSQLStatement stringByAppendingString:cursorClause];
+    }
+    
+    theSQLStatement = [theSQLStatement stringByAppendingString:orderClause];
+    _NSFLog(@"Paged SQL query: %@", theSQLStatement);
+    
+    sqlite3_stmt *theSQLiteStatement = NULL;
+    int status = sqlite3_prepare_v2 ([[nanoStore nanoStoreEngine]sqlite], [theSQLStatement UTF8String], -1, &theSQLiteStatement, NULL);
+    
+    // Since we're operating with extended result code support, extract the bits
+    // and obtain the regular result code
+    // For more info check: http://www.sqlite.org/c3ref/c_ioerr_access.html
+    
+    status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+    
+    if (SQLITE_OK != status) {
+        if (nil != outError) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the page could not be prepared.", [self class], _cmd]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        }
+        return nil;
+    }
+    
+    if (nil != descriptor) {
+        sqlite3_bind_text (theSQLiteStatement, 1, [descriptor.attribute UTF8String], -1, SQLITE_TRANSIENT);
+    }
+    sqlite3_bind_int64 (theSQLiteStatement, 2, (sqlite3_int64)thePageSize);
+    
+    if (nil != cursor) {
+        id cursorValue = [cursor objectForKey:@"value"];
+        if ([cursorValue isKindOfClass:[NSString class]]) {
+            sqlite3_bind_text (theSQLiteStatement, 3, [cursorValue UTF8String], -1, SQLITE_TRANSIENT);
+        } else if ([cursorValue isKindOfClass:[NSData class]]) {
+            sqlite3_bind_blob (theSQLiteStatement, 3, [cursorValue bytes], (int)[cursorValue length], SQLITE_TRANSIENT);
+        } else if ([cursorValue isKindOfClass:[NSNumber class]]) {
+            // Bind integers as such: a double can't represent them all beyond 2^53
+            const char *valueType = [cursorValue objCType];
+            if ((0 == strcmp(valueType, @encode(float))) || (0 == strcmp(valueType, @encode(double)))) {
+                sqlite3_bind_double (theSQLiteStatement, 3, [cursorValue doubleValue]);
+            } else {
+                sqlite3_bind_int64 (theSQLiteStatement, 3, [cursorValue longLongValue]);
+            }
+        }
+        sqlite3_bind_int64 (theSQLiteStatement, 4, [[cursor objectForKey:@"rowid"]longLongValue]);
+    }
+    
+    NSMutableArray *page = [NSMutableArray arrayWithCapacity:thePageSize];
+    sqlite3_int64 lastRowID = 0;
+    id lastValue = nil;
+    int valueColumn = sqlite3_column_count (theSQLiteStatement) - 1;
+    
+    while (SQLITE_ROW == sqlite3_step (theSQLiteStatement)) {
+        const char *keyUTF8 = (const char *)sqlite3_column_text (theSQLiteStatement, 1);
+        if (NULL == keyUTF8) {
+            continue;
+        }
+        
+        NSString *keyValue = [[NSString alloc]initWithUTF8String:keyUTF8];
+        lastRowID = sqlite3_column_int64 (theSQLiteStatement, 0);
+        
+        if (nil != descriptor) {
+            lastValue = [NSFNanoSearch _valueForColumn:valueColumn ofSQLite3Statement:theSQLiteStatement];
+            if ([NSNull null] == lastValue) {
+                lastValue = nil;
+            }
+        }
+        
+        if (NSFReturnKeys == theReturnType) {
+            [page addObject:keyValue];
+        } else {
+            // Like every other read, the cached instance is returned when there is one
+            id object = ((DoNotCacheData != nanoStore.cacheMethod) && (nanoStore.cacheCapacity > 0)) ? [nanoStore _cachedObjectForKey:keyValue] : nil;
+            if (nil == object) {
+                const char *objectClassUTF8 = (const char *)sqlite3_column_text (theSQLiteStatement, 3);
+                NSDictionary *info = [NSFNanoEngine NSFP_dictionaryForColumn:2 statement:theSQLiteStatement];
+                if ((nil == info) || (NULL == objectClassUTF8)) {
+                    continue;
+                }
+                
+                object = [nanoStore _objectWithInfo:info forKey:keyValue className:[NSString stringWithUTF8String:objectClassUTF8]];
+                [nanoStore _cacheObject:object forKey:keyValue];
+            }
+            
+            [page addObject:object];
+        }
+    }
+    
+    sqlite3_finalize (theSQLiteStatement);
+    
+    // A short page is the last one
+    if ((nil != outNextToken) && ([page count] == thePageSize) && ((nil == descriptor) || (nil != lastValue))) {
+        NSMutableDictionary *nextCursor = [NSMutableDictionary dictionaryWithObjectsAndKeys:fingerprint, @"query", [NSNumber numberWithLongLong:lastRowID], @"rowid", nil];
+        if (nil != lastValue) {
+            [nextCursor setObject:lastValue forKey:@"value"];
+        }
+        
+        NSData *tokenData = [NSPropertyListSerialization dataWithPropertyList:nextCursor format:NSPropertyListBinaryFormat_v1_0 options:0 error:nil];
+        *outNextToken = [NSFNanoEngine encodeDataToBase64:tokenData];
+    }
+    
+    return page;
+}
+
+- (NSArray *)searchTopObjects:(NSUInteger)theCount returnType:(NSFReturnType)theReturnType error:(out NSError **)outError
+{
+    if (0 == [sort count])
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: a sort descriptor is required.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if (NSFReturnFaults == theReturnType)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: NSFReturnFaults is not supported by top-K searches.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if ((YES == [nanoStore isClosed]) || (0 == theCount)) {
+        return [NSArray array];
+    }
+    
+    returnedObjectType = theReturnType;
+    
+    // Make sure we don't have a SQL statement around...
+    sql = nil;
+    
+    NSFNanoSortDescriptor *descriptor = [sort objectAtIndex:0];
+    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT NSFKey, NSFValue FROM NSFValues WHERE NSFAttribute = ? AND %@", [self _matchingKeysClauseForColumn:@"NSFKey"]];
+    
+    _NSFLog(@"Top-K SQL query: %@", theSQLStatement);
+    
+    sqlite3_stmt *theSQLiteStatement = NULL;
+    int status = sqlite3_prepare_v2 ([[nanoStore nanoStoreEngine]sqlite], [theSQLStatement UTF8String], -1, &theSQLiteStatement, NULL);
+    
+    // Since we're operating with extended result code support, extract the bits
+    // and obtain the regular result code
+    // For more info check: http://www.sqlite.org/c3ref/c_ioerr_access.html
+    
+    status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+    
+    if (SQLITE_OK != status) {
+        if (nil != outError) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the search could not be prepared.", [self class], _cmd]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        }
+        return nil;
+    }
+    
+    sqlite3_bind_text (theSQLiteStatement, 1, [descriptor.attribute UTF8String], -1, SQLITE_TRANSIENT);
+    
+    // Stream the (key, value) pairs through the heap: only the K best ones are kept around
+    CFDictionaryKeyCallBacks keyCallBacks = { 0, NULL, NULL, NULL, __NSFPTopKKeysAreEqual, __NSFPTopKHashKey };
+    __NSFPTopKHeap heap = { calloc(theCount, sizeof(__NSFPTopKEntry)), 0, theCount, descriptor.isAscending, CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &keyCallBacks, NULL) };
+    
+    while (SQLITE_ROW == sqlite3_step (theSQLiteStatement)) {
+        const char *keyUTF8 = (const char *)sqlite3_column_text (theSQLiteStatement, 0);
+        if (NULL == keyUTF8) {
+            continue;
+        }
+        
+        __NSFPTopKEntry candidate = { 0, 0.0, NULL, 0, NULL };
+        
+        switch (sqlite3_column_type (theSQLiteStatement, 1)) {
+            case SQLITE_INTEGER:
+            case SQLITE_FLOAT:
+                candidate.rank = 1;
+                candidate.number = sqlite3_column_double (theSQLiteStatement, 1);
+                break;
+            case SQLITE_TEXT:
+            case SQLITE_BLOB: {
+                candidate.rank = (SQLITE_TEXT == sqlite3_column_type (theSQLiteStatement, 1)) ? 2 : 3;
+                const void *bytes = (2 == candidate.rank) ? (const void *)sqlite3_column_text (theSQLiteStatement, 1) : sqlite3_column_blob (theSQLiteStatement, 1);
+                candidate.length = sqlite3_column_bytes (theSQLiteStatement, 1);
+                candidate.bytes = malloc((size_t)candidate.length + 1);
+                if (candidate.length > 0) {
+                    memcpy(candidate.bytes, bytes, (size_t)candidate.length);
+                }
+            }
+                break;
+            default:
+                break;
+        }
+        
+        candidate.key = strdup(keyUTF8);
+        __NSFPTopKOffer(&heap, &candidate);
+    }
+    
+    sqlite3_finalize (theSQLiteStatement);
+    
+    // Pop the worst candidate repeatedly: the winners come out in reverse order
+    NSMutableArray *winningKeys = [NSMutableArray arrayWithCapacity:heap.count];
+    while (heap.count > 0) {
+        [winningKeys insertObject:[[NSString alloc]initWithUTF8String:heap.entries[0].key] atIndex:0];
+        __NSFPTopKEvict(&heap, 0);
+        heap.count--;
+        if (heap.count > 0) {
+            __NSFPTopKPlace(&heap, 0, &heap.entries[heap.count]);
+            __NSFPTopKSiftDown(&heap, 0);
+        }
+    }
+    CFRelease(heap.slots);
+    free(heap.entries);
+    
+    if (NSFReturnKeys == theReturnType) {
+        return winningKeys;
+    }
+    
+    // Only the winners get decoded
+    NSDictionary *objects = [nanoStore _objectsForKeys:winningKeys ofClassNamed:nil];
+    NSMutableArray *orderedObjects = [NSMutableArray arrayWithCapacity:[winningKeys count]];
+    for (NSString *winningKey in winningKeys) {
+        id object = [objects objectForKey:winningKey];
+        if (nil != object) {
+            [orderedObjects addObject:object];
+        }
+    }
+    
+    return orderedObjects;
+}
+
+- (NSNumber *)aggregateOperation:(NSFAggregateFunctionType)theFunctionType onAttribute:(NSString *)theAttribute
+{
+    // This method has always ignored the custom SQL and returned a float. The exact results are available via -aggregateOperations:...
+    NSString *savedSQL = sql;
+    sql = nil;
+    
+    NSNumber *functionType = [NSNumber numberWithInt:theFunctionType];
+    NSDictionary *groups = [self aggregateOperations:[NSArray arrayWithObject:functionType] onAttribute:theAttribute groupedByAttribute:nil error:nil];
+    id result = [[groups objectForKey:[NSNull null]]objectForKey:functionType];
+    
+    sql = savedSQL;
+    
+    // Functions over no values at all (i.e. max() or min()) yield NULL
+    return [NSNumber numberWithFloat:[result isKindOfClass:[NSNumber class]] ? [result floatValue] : 0];
+}
+
+- (NSDictionary *)aggregateOperations:(NSArray *)theFunctionTypes onAttribute:(NSString *)theAttribute groupedByAttribute:(NSString *)theGroupingAttribute error:(out NSError **)outError
+{
+    if ((0 == [theFunctionTypes count]) || (nil == theAttribute))
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: the function types and the attribute are required.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if (YES == [nanoStore isClosed]) {
+        return nil;
+    }
+    
+    NSMutableArray *columns = [NSMutableArray arrayWithCapacity:[theFunctionTypes count]];
+    for (NSNumber *functionType in theFunctionTypes) {
+        [columns addObject:[NSFNanoSearch _SQLExpressionForAggregateFunction:[functionType intValue] column:@"v.NSFValue"]];
+    }
+    
+    // Every aggregate is computed in the same pass. Without grouping there's always exactly one row, even if nothing matches.
+    NSString *theSQLStatement = nil;
+    if (nil != theGroupingAttribute) {
+        theSQLStatement = [NSString stringWithFormat:@"SELECT g.NSFValue, %@ FROM NSFValues v JOIN NSFValues g ON g.NSFKey = v.NSFKey AND g.NSFAttribute = ?2 WHERE v.NSFAttribute = ?1 AND %@ GROUP BY g.NSFValue",
+                           [columns componentsJoinedByString:@", "], [self _matchingKeysClauseForColumn:@"v.NSFKey"]];
+    } else {
+        theSQLStatement = [NSString stringWithFormat:@"SELECT NULL, %@ FROM NSFValues v WHERE v.NSFAttribute = ?1 AND %@",
+                           [columns componentsJoinedByString:@", "], [self _matchingKeysClauseForColumn:@"v.NSFKey"]];
+    }
+    
+    _NSFLog(@"Aggregate SQL query: %@", theSQLStatement);
+    
+    sqlite3_stmt *theSQLiteStatement = [self _preparedSQLite3StatementForSQL:theSQLStatement selector:_cmd error:outError];
+    if (NULL == theSQLiteStatement) {
+        return nil;
+    }
+    
+    sqlite3_bind_text (theSQLiteStatement, 1, [theAttribute UTF8String], -1, SQLITE_TRANSIENT);
+    if (nil != theGroupingAttribute) {
+        sqlite3_bind_text (theSQLiteStatement, 2, [theGroupingAttribute UTF8String], -1, SQLITE_TRANSIENT);
+    }
+    
+    NSMutableDictionary *groups = [NSMutableDictionary dictionary];
+    NSUInteger i, count = [theFunctionTypes count];
+    
+    while (SQLITE_ROW == sqlite3_step (theSQLiteStatement)) {
+        NSMutableDictionary *aggregates = [NSMutableDictionary dictionaryWithCapacity:count];
+        for (i = 0; i < count; i++) {
+            [aggregates setObject:[NSFNanoSearch _valueForColumn:(int)i + 1 ofSQLite3Statement:theSQLiteStatement] forKey:[theFunctionTypes objectAtIndex:i]];
+        }
+        [groups setObject:aggregates forKey:[NSFNanoSearch _valueForColumn:0 ofSQLite3Statement:theSQLiteStatement]];
+    }
+    
+    sqlite3_finalize (theSQLiteStatement);
+    
+    return groups;
+}
+
+- (NSNumber *)percentile:(double)theFraction onAttribute:(NSString *)theAttribute approximate:(BOOL)isApproximate error:(out NSError **)outError
+{
+    if ((nil == theAttribute) || (theFraction < 0.0) || (theFraction > 1.0))
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: the attribute is required and the fraction must be between 0 and 1.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if (YES == [nanoStore isClosed]) {
+        return nil;
+    }
+    
+    NSString *numericValuesClause = [NSString stringWithFormat:@"NSFAttribute = ?1 AND typeof(NSFValue) IN ('integer', 'real') AND %@", [self _matchingKeysClauseForColumn:@"NSFKey"]];
+    
+    if (YES == isApproximate) {
+        NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT NSFP_approximatePercentile(NSFValue, ?2) FROM NSFValues WHERE %@", numericValuesClause];
+        sqlite3_stmt *theSQLiteStatement = [self _preparedSQLite3StatementForSQL:theSQLStatement selector:_cmd error:outError];
+        if (NULL == theSQLiteStatement) {
+            return nil;
+        }
+        
+        sqlite3_bind_text (theSQLiteStatement, 1, [theAttribute UTF8String], -1, SQLITE_TRANSIENT);
+        sqlite3_bind_double (theSQLiteStatement, 2, theFraction);
+        
+        id result = (SQLITE_ROW == sqlite3_step (theSQLiteStatement)) ? [NSFNanoSearch _valueForColumn:0 ofSQLite3Statement:theSQLiteStatement] : nil;
+        sqlite3_finalize (theSQLiteStatement);
+        
+        return [result isKindOfClass:[NSNumber class]] ? result : nil;
+    }
+    
+    // Exact: count the values, then walk the (NSFAttribute, NSFValue) index up to the rank. Only two values are ever held.
+    sqlite3_stmt *theSQLiteStatement = [self _preparedSQLite3StatementForSQL:[NSString stringWithFormat:@"SELECT count(*) FROM NSFValues WHERE %@", numericValuesClause] selector:_cmd error:outError];
+    if (NULL == theSQLiteStatement) {
+        return nil;
+    }
+    
+    sqlite3_bind_text (theSQLiteStatement, 1, [theAttribute UTF8String], -1, SQLITE_TRANSIENT);
+    long long count = (SQLITE_ROW == sqlite3_step (theSQLiteStatement)) ? sqlite3_column_int64 (theSQLiteStatement, 0) : 0;
+    sqlite3_finalize (theSQLiteStatement);
+    
+    if (0 == count) {
+        return nil;
+    }
+    
+    double rank = theFraction * (double)(count - 1);
+    long long lowerRank = (long long)floor(rank);
+    
+    theSQLiteStatement = [self _preparedSQLite3StatementForSQL:[NSString stringWithFormat:@"SELECT NSFValue FROM NSFValues WHERE %@ ORDER BY NSFValue LIMIT 2 OFFSET ?2", numericValuesClause] selector:_cmd error:outError];
+    if (NULL == theSQLiteStatement) {
+        return nil;
+    }
+    
+    sqlite3_bind_text (theSQLiteStatement, 1, [theAttribute UTF8String], -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64 (theSQLiteStatement, 2, lowerRank);
+    
+    double lowerValue = (SQLITE_ROW == sqlite3_step (theSQLiteStatement)) ? sqlite3_column_double (theSQLiteStatement, 0) : 0.0;
+    double upperValue = (SQLITE_ROW == sqlite3_step (theSQLiteStatement)) ? sqlite3_column_double (theSQLiteStatement, 0) : lowerValue;
+    sqlite3_finalize (theSQLiteStatement);
+    
+    // Interpolate linearly between the two closest ranks
+    return [NSNumber numberWithDouble:lowerValue + (upperValue - lowerValue) * (rank - (double)lowerRank)];
+}
+
+- (NSArray *)histogramOnAttribute:(NSString *)theAttribute lowerBound:(double)theLowerBound upperBound:(double)theUpperBound numberOfBuckets:(NSUInteger)theNumberOfBuckets error:(out NSError **)outError
+{
+    if ((nil == theAttribute) || (theUpperBound <= theLowerBound) || (0 == theNumberOfBuckets))
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: the attribute, a valid range and at least one bucket are required.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if (YES == [nanoStore isClosed]) {
+        return nil;
+    }
+    
+    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT NSFP_histogram(NSFValue, ?2, ?3, ?4) FROM NSFValues WHERE NSFAttribute = ?1 AND %@", [self _matchingKeysClauseForColumn:@"NSFKey"]];
+    sqlite3_stmt *theSQLiteStatement = [self _preparedSQLite3StatementForSQL:theSQLStatement selector:_cmd error:outError];
+    if (NULL == theSQLiteStatement) {
+        return nil;
+    }
+    
+    sqlite3_bind_text (theSQLiteStatement, 1, [theAttribute UTF8String], -1, SQLITE_TRANSIENT);
+    sqlite3_bind_double (theSQLiteStatement, 2, theLowerBound);
+    sqlite3_bind_double (theSQLiteStatement, 3, theUpperBound);
+    sqlite3_bind_int64 (theSQLiteStatement, 4, (sqlite3_int64)theNumberOfBuckets);
+    
+    int status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_step (theSQLiteStatement)];
+    if (SQLITE_ROW != status) {
+        if (nil != outError) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: %s", [self class], _cmd, sqlite3_errmsg ([[nanoStore nanoStoreEngine]sqlite])]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        }
+        sqlite3_finalize (theSQLiteStatement);
+        return nil;
+    }
+    
+    // Without any value the histogram is NULL: every bucket is empty
+    const sqlite3_int64 *counts = sqlite3_column_blob (theSQLiteStatement, 0);
+    NSUInteger numberOfCounts = (NULL != counts) ? (NSUInteger)sqlite3_column_bytes (theSQLiteStatement, 0) / sizeof(sqlite3_int64) : 0;
+    
+    NSMutableArray *buckets = [NSMutableArray arrayWithCapacity:theNumberOfBuckets];
+    for (NSUInteger i = 0; i < theNumberOfBuckets; i++) {
+        [buckets addObject:[NSNumber numberWithLongLong:(i < numberOfCounts) ? counts[i] : 0]];
+    }
+    
+    sqlite3_finalize (theSQLiteStatement);
+    
+    return buckets;
+}
+
+- (NSDictionary *)aggregateOperations:(NSArray *)theFunctionTypes onAttribute:(NSString *)theAttribute groupedByTimeInterval:(NSTimeInterval)theInterval ofDateAttribute:(NSString *)theDateAttribute error:(out NSError **)outError
+{
+    if ((0 == [theFunctionTypes count]) || (theInterval <= 0))
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: the function types and a positive interval are required.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if (YES == [nanoStore isClosed]) {
+        return nil;
+    }
+    
+    // The timestamps come from the date attribute's values or, by default, from the date the objects were saved
+    NSString *timestampsTable = (nil != theDateAttribute) ? @"NSFValues t" : @"NSFKeys t";
+    NSString *timestampsClause = (nil != theDateAttribute) ? @"t.NSFAttribute = ?2 AND t.NSFTimestamp IS NOT NULL" : @"t.NSFTimestamp IS NOT NULL";
+    NSString *aggregatedColumn = (nil != theAttribute) ? @"v.NSFValue" : @"t.NSFTimestamp";
+    NSString *valuesJoin = (nil != theAttribute) ? @" JOIN NSFValues v ON v.NSFKey = t.NSFKey AND v.NSFAttribute = ?1" : @"";
     
-    id results = [self _retrieveDataWithError:outError];
+    NSMutableArray *columns = [NSMutableArray arrayWithCapacity:[theFunctionTypes count]];
+    for (NSNumber *functionType in theFunctionTypes) {
+        [columns addObject:[NSFNanoSearch _SQLExpressionForAggregateFunction:[functionType intValue] column:aggregatedColumn]];
+    }
     
-    return [self _sortResultsIfApplicable:results returnType:theReturnType];
-}
-
-- (id)searchObjectsAdded:(NSFDateMatchType)theDateMatch date:(NSDate *)theDate returnType:(NSFReturnType)theReturnType error:(out NSError **)outError
-{
-    returnedObjectType = theReturnType;
+    // Buckets are aligned on 1970-01-01 00:00:00 UTC. The bucket index is floored, which CAST alone doesn't do for negative timestamps.
+    NSString *bucketIndex = @"(CAST(t.NSFTimestamp / ?3 AS INTEGER) - (t.NSFTimestamp < CAST(t.NSFTimestamp / ?3 AS INTEGER) * ?3))";
+    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT %@ * ?3, %@ FROM %@%@ WHERE %@ AND %@ GROUP BY 1",
+                                 bucketIndex, [columns componentsJoinedByString:@", "], timestampsTable, valuesJoin, timestampsClause, [self _matchingKeysClauseForColumn:@"t.NSFKey"]];
     
-    // Make sure we don't have a SQL statement around...
-    sql = nil;
+    _NSFLog(@"Time buckets SQL query: %@", theSQLStatement);
     
-    id results = [self _retrieveDataAdded:theDateMatch calendarDate:theDate error:outError];
+    sqlite3_stmt *theSQLiteStatement = [self _preparedSQLite3StatementForSQL:theSQLStatement selector:_cmd error:outError];
+    if (NULL == theSQLiteStatement) {
+        return nil;
+    }
     
-    if (NSFReturnKeys == theReturnType) {
-        results = [results allKeys];
+    if (nil != theAttribute) {
+        sqlite3_bind_text (theSQLiteStatement, 1, [theAttribute UTF8String], -1, SQLITE_TRANSIENT);
+    }
+    if (nil != theDateAttribute) {
+        sqlite3_bind_text (theSQLiteStatement, 2, [theDateAttribute UTF8String], -1, SQLITE_TRANSIENT);
     }
+    sqlite3_bind_double (theSQLiteStatement, 3, theInterval);
     
-    return results;
+    NSMutableDictionary *buckets = [NSMutableDictionary dictionary];
+    NSUInteger i, count = [theFunctionTypes count];
+    
+    while (SQLITE_ROW == sqlite3_step (theSQLiteStatement)) {
+        NSMutableDictionary *aggregates = [NSMutableDictionary dictionaryWithCapacity:count];
+        for (i = 0; i < count; i++) {
+            [aggregates setObject:[NSFNanoSearch _valueForColumn:(int)i + 1 ofSQLite3Statement:theSQLiteStatement] forKey:[theFunctionTypes objectAtIndex:i]];
+        }
+        [buckets setObject:aggregates forKey:[NSDate dateWithTimeIntervalSince1970:sqlite3_column_double (theSQLiteStatement, 0)]];
+    }
+    
+    sqlite3_finalize (theSQLiteStatement);
+    
+    return buckets;
 }
 
-- (NSNumber *)aggregateOperation:(NSFAggregateFunctionType)theFunctionType onAttribute:(NSString *)theAttribute
-{    
-    NSFReturnType savedObjectTypeReturned = returnedObjectType;
-    returnedObjectType = NSFReturnKeys;
+- (NSDictionary *)facetsForAttributes:(NSArray *)theAttributes error:(out NSError **)outError
+{
+    if (0 == [theAttributes count])
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: at least one attribute is required.", [self class], _cmd]
+                               userInfo:nil]raise];
     
-    NSString *savedSQL = sql;
-    sql = nil;
+    if (YES == [nanoStore isClosed]) {
+        return nil;
+    }
     
-    NSString *theSearchSQLStatement = [self sql];
-    NSMutableString *theAggregatedSQLStatement = [NSMutableString new];
+    NSUInteger i, count = [theAttributes count];
+    NSMutableArray *parameters = [NSMutableArray arrayWithCapacity:count];
+    for (i = 1; i <= count; i++) {
+        [parameters addObject:[NSString stringWithFormat:@"?%lu", (unsigned long)i]];
+    }
     
-    switch (theFunctionType) {
-        case NSFAverage:
-            [theAggregatedSQLStatement appendString:[NSString stringWithFormat:@"SELECT avg(NSFValue) FROM NSFValues WHERE NSFAttribute = '%@' AND NSFKey IN (%@)", theAttribute, theSearchSQLStatement]];
-            break;
-        case NSFCount:
-            [theAggregatedSQLStatement appendString:[NSString stringWithFormat:@"SELECT count(*) FROM NSFValues WHERE NSFAttribute = '%@' AND NSFKey IN (%@)", theAttribute, theSearchSQLStatement]];
-            break;
-        case NSFMax:
-            [theAggregatedSQLStatement appendString:[NSString stringWithFormat:@"SELECT max(NSFValue) FROM NSFValues WHERE NSFAttribute = '%@' AND NSFKey IN (%@)", theAttribute, theSearchSQLStatement]];
-            break;
-        case NSFMin:
-            [theAggregatedSQLStatement appendString:[NSString stringWithFormat:@"SELECT min(NSFValue) FROM NSFValues WHERE NSFAttribute = '%@' AND NSFKey IN (%@)", theAttribute, theSearchSQLStatement]];
-            break;
-        case NSFTotal:
-            /* Note:
-             Sum() will throw an "integer overflow" exception if all inputs are integers or NULL and an integer overflow occurs at any point
-             during the computation. Total() never throws an integer overflow.
-             */
-            [theAggregatedSQLStatement appendString:[NSString stringWithFormat:@"SELECT total(NSFValue) FROM NSFValues WHERE NSFAttribute = '%@' AND NSFKey IN (%@)", theAttribute, theSearchSQLStatement]];
-            break;
-        default:
-            break;
+    // All the facets come out of a single pass: an object holding a value more than once is counted once
+    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT NSFAttribute, NSFValue, count(DISTINCT NSFKey) FROM NSFValues WHERE NSFAttribute IN (%@) AND %@ GROUP BY NSFAttribute, NSFValue",
+                                 [parameters componentsJoinedByString:@","], [self _matchingKeysClauseForColumn:@"NSFKey"]];
+    
+    _NSFLog(@"Facets SQL query: %@", theSQLStatement);
+    
+    sqlite3_stmt *theSQLiteStatement = [self _preparedSQLite3StatementForSQL:theSQLStatement selector:_cmd error:outError];
+    if (NULL == theSQLiteStatement) {
+        return nil;
+    }
+    
+    NSMutableDictionary *facets = [NSMutableDictionary dictionaryWithCapacity:count];
+    for (i = 0; i < count; i++) {
+        NSString *facetAttribute = [theAttributes objectAtIndex:i];
+        sqlite3_bind_text (theSQLiteStatement, (int)i + 1, [facetAttribute UTF8String], -1, SQLITE_TRANSIENT);
+        [facets setObject:[NSMutableDictionary dictionary] forKey:facetAttribute];
+    }
+    
+    while (SQLITE_ROW == sqlite3_step (theSQLiteStatement)) {
+        NSMutableDictionary *facet = [facets objectForKey:[NSFNanoSearch _valueForColumn:0 ofSQLite3Statement:theSQLiteStatement]];
+        [facet setObject:[NSNumber numberWithLongLong:sqlite3_column_int64 (theSQLiteStatement, 2)] forKey:[NSFNanoSearch _valueForColumn:1 ofSQLite3Statement:theSQLiteStatement]];
     }
     
-    NSFNanoResult *result = [nanoStore _executeSQL:theAggregatedSQLStatement];
+    sqlite3_finalize (theSQLiteStatement);
+    
+    return facets;
+}
 
-    returnedObjectType = savedObjectTypeReturned;
-    sql = savedSQL;
+- (long long)countOfObjectsMatchingSearch
+{
+    // A key may come back more than once (i.e. custom SQL joining the values), but it's still a single object
+    NSNumber *count = [self _scalarForSQL:[NSString stringWithFormat:@"SELECT count(DISTINCT NSFKey) FROM (%@)", [self _preparedKeysSQL]]];
+    
+    return (nil == count) ? -1 : [count longLongValue];
+}
+
+- (BOOL)existsObjectMatchingSearch
+{
+    NSNumber *exists = [self _scalarForSQL:[NSString stringWithFormat:@"SELECT EXISTS (%@)", [self _preparedKeysSQL]]];
     
-    return [NSNumber numberWithFloat:[[result firstValue]floatValue]];
+    return (0 != [exists longLongValue]);
 }
 
 #pragma mark Private Methods
@@ -283,13 +991,41 @@
             case NSFReturnObjects:
                 aSQLQuery = [NSString stringWithFormat:@"SELECT NSFKey, NSFPlist, NSFObjectClass %@", subStatement];
                 break;
+            case NSFReturnFaults:
+                aSQLQuery = [NSString stringWithFormat:@"SELECT NSFKey, NSFObjectClass %@", subStatement];
+                break;
         }
+    } else if (NSFReturnFaults == returnedObjectType) {
+        // Faults match exactly what the objects would, but we leave the plists behind: only the key and the class are needed.
+        aSQLQuery = [NSString stringWithFormat:@"SELECT NSFKey, NSFObjectClass FROM NSFKeys WHERE NSFKey IN (%@)", [self _preparedKeysSQL]];
     } else {
         aSQLQuery = [self _preparedSQL];
     }
     
     _NSFLog(@"_dataWithKey SQL query: %@", aSQLQuery);
     
+    NSString *cacheKey = nil;
+    if (YES == nanoStore.searchResultCacheEnabled) {
+        cacheKey = [NSString stringWithFormat:@"%d|%@|%@", returnedObjectType, [attributesToBeReturned componentsJoinedByString:@","], aSQLQuery];
+        NSDictionary *cachedResults = [nanoStore _cachedSearchResultsForKey:cacheKey];
+        if (nil != cachedResults) {
+            return cachedResults;
+        }
+    }
+    
+    // Projections are answered from NSFValues: the documents only get read when the values alone can't rebuild an attribute
+    if ((nil == sql) && (NSFReturnObjects == returnedObjectType) && ([attributesToBeReturned count] > 0)) {
+        searchResults = [self _projectedObjectsWithError:outError];
+        
+        if ((nil != cacheKey) && (nil != searchResults)) {
+            NSDictionary *cachedResults = [searchResults copy];
+            [nanoStore _cacheSearchResults:cachedResults forKey:cacheKey SQL:aSQLQuery];
+            return cachedResults;
+        }
+        
+        return searchResults;
+    }
+    
     sqlite3 *sqliteStore = [[nanoStore nanoStoreEngine]sqlite];    
     sqlite3_stmt *theSQLiteStatement = NULL;
     
@@ -313,24 +1049,86 @@
                     [searchResults setObject:[NSNull null] forKey:theValue];
                 }
                 break;
+            case NSFReturnFaults:
+            {
+                NSMutableArray *faultKeys = [NSMutableArray new];
+                NSMutableArray *faultClasses = [NSMutableArray new];
+                NSMutableArray *otherKeys = [NSMutableArray new];
+                
+                while (SQLITE_ROW == sqlite3_step (theSQLiteStatement)) {
+                    char *keyUTF8 = (char *)sqlite3_column_text (theSQLiteStatement, 0);
+                    char *objectClassUTF8 = (char *)sqlite3_column_text (theSQLiteStatement, 1);
+                    
+                    if ((NULL == keyUTF8) || (NULL == objectClassUTF8)) {
+                        NSLog(@"*** Warning! These values are NanoStore's resposibility and should *never* be NULL: keyUTF8 (%s) - objectClassUTF8 (%s)", keyUTF8, objectClassUTF8);
+                        continue;
+                    }
+                    
+                    NSString *keyValue = [[NSString alloc]initWithUTF8String:keyUTF8];
+                    NSString *objectClass = [[NSString alloc]initWithUTF8String:objectClassUTF8];
+                    
+                    // Only NSFNanoObject and its subclasses know how to fire a fault. Objects of other known classes (bags, for example)
+                    // are loaded right away. Unknown classes become NanoObjects which remember the original class, just like the objects do.
+                    Class storedObjectClass = NSClassFromString(objectClass);
+                    if ((nil != storedObjectClass) && (NO == [storedObjectClass isSubclassOfClass:[NSFNanoObject class]])) {
+                        [otherKeys addObject:keyValue];
+                    } else {
+                        [faultKeys addObject:keyValue];
+                        [faultClasses addObject:objectClass];
+                    }
+                }
+                
+                if ([otherKeys count] > 0) {
+                    [searchResults addEntriesFromDictionary:[nanoStore _objectsForKeys:otherKeys ofClassNamed:nil]];
+                }
+                
+                // Faults are grouped in batches. Touching any fault loads the info of its whole batch.
+                NSUInteger count = [faultKeys count];
+                for (NSUInteger start = 0; start < count; start += __NSFPFaultBatchSize) {
+                    NSRange range = NSMakeRange(start, MIN(__NSFPFaultBatchSize, count - start));
+                    NSFNanoFaultBatch *batch = [[NSFNanoFaultBatch alloc]initWithStore:nanoStore keys:[faultKeys subarrayWithRange:range]];
+                    
+                    for (NSUInteger i = range.location; i < NSMaxRange(range); i++) {
+                        NSString *keyValue = [faultKeys objectAtIndex:i];
+                        NSString *objectClass = [faultClasses objectAtIndex:i];
+                        
+                        Class storedObjectClass = NSClassFromString(objectClass);
+                        BOOL saveOriginalClassReference = NO;
+                        if (nil == storedObjectClass) {
+                            storedObjectClass = [NSFNanoObject class];
+                            saveOriginalClassReference = YES;
+                        }
+                        
+                        NSFNanoObject *nanoObject = [[storedObjectClass alloc]initNanoObjectFromDictionaryRepresentation:nil forKey:keyValue store:nanoStore];
+                        [nanoObject _setFaultBatch:batch];
+                        
+                        if (YES == saveOriginalClassReference) {
+                            [nanoObject _setOriginalClassString:objectClass];
+                        }
+                        
+                        [searchResults setObject:nanoObject forKey:keyValue];
+                    }
+                }
+            }
+                break;
             default:
                 while (SQLITE_ROW == sqlite3_step (theSQLiteStatement)) {
                     char *keyUTF8 = (char *)sqlite3_column_text (theSQLiteStatement, 0);
-                    char *dictXMLUTF8 = (char *)sqlite3_column_text (theSQLiteStatement, 1);
+                    const void *dictBytes = sqlite3_column_blob (theSQLiteStatement, 1);
                     char *objectClassUTF8 = (char *)sqlite3_column_text (theSQLiteStatement, 2);
                     
                     // Sanity check: some queries return NULL, which would a crash below.
                     // Since these are values that are NanoStore's resposibility, they should *never* be NULL. Log it for posterity.
-                    if ((NULL == keyUTF8) || (NULL == dictXMLUTF8) || (NULL == objectClassUTF8)) {
-                        NSLog(@"*** Warning! These values are NanoStore's resposibility and should *never* be NULL: keyUTF8 (%s) - dictXMLUTF8 (%s) - objectClassUTF8 (%s)", keyUTF8, dictXMLUTF8, objectClassUTF8);
+                    if ((NULL == keyUTF8) || (NULL == dictBytes) || (NULL == objectClassUTF8)) {
+                        NSLog(@"*** Warning! These values are NanoStore's resposibility and should *never* be NULL: keyUTF8 (%s) - dictBytes (%p) - objectClassUTF8 (%s)", keyUTF8, dictBytes, objectClassUTF8);
                         continue;
                     }
                     
                     NSString *keyValue = [[NSString alloc]initWithUTF8String:keyUTF8];
-                    NSString *dictXML = [[NSString alloc]initWithUTF8String:dictXMLUTF8];
                     NSString *objectClass = [[NSString alloc]initWithUTF8String:objectClassUTF8];
                     
-                    NSDictionary *info = [NSFNanoEngine _plistToDictionary:dictXML];
+                    // The plist may be stored compressed, so it's read as bytes rather than as text
+                    NSDictionary *info = [NSFNanoEngine NSFP_dictionaryForColumn:1 statement:theSQLiteStatement];
                     if (nil == info) {
                         continue;
                     }
@@ -346,19 +1144,7 @@
                         NSMutableDictionary *subset = [NSMutableDictionary new];
                         
                         for (NSString *attributeValue in attributesToBeReturned) {
-                            id theValue = [info valueForKeyPath:attributeValue];
-                            if (nil != theValue) {
-                                if (NSNotFound == [attributeValue rangeOfString:@"."].location) {
-                                    [subset setValue:theValue forKeyPath:attributeValue];
-                                } else {
-                                    NSDictionary *subInfo = [self _dictionaryForKeyPath:attributeValue value:theValue];
-                                    if ([subInfo count] > 0) {
-                                        NSString *subInfoKey = [[subInfo allKeys]objectAtIndex:0];
-                                        NSString *subInfoValue = [subInfo objectForKey:subInfoKey];
-                                        [subset setValue:subInfoValue forKey:subInfoKey];
-                                    }
-                                }
-                            }
+                            [self _setProjectedValue:[info valueForKeyPath:attributeValue] forAttribute:attributeValue inSubset:subset];
                         }
                         
                         // Will be released below...
@@ -398,10 +1184,185 @@
         }
         searchResults = nil;
     }
+    
+    if ((nil != cacheKey) && (nil != searchResults)) {
+        NSDictionary *cachedResults = [searchResults copy];
+        [nanoStore _cacheSearchResults:cachedResults forKey:cacheKey SQL:aSQLQuery];
+        return cachedResults;
+    }
+    
+    return searchResults;
+}
+
+- (NSMutableDictionary *)_projectedObjectsWithError:(out NSError **)outError
+{
+    NSArray *requestedAttributes = [[NSSet setWithArray:attributesToBeReturned]allObjects];
+    NSUInteger i, count = [requestedAttributes count];
+    
+    // Besides the requested attributes, pick up their descendants: these reveal the attributes holding a collection
+    NSMutableArray *attributeClauses = [NSMutableArray arrayWithCapacity:count];
+    for (i = 1; i <= count; i++) {
+        [attributeClauses addObject:[NSString stringWithFormat:@"v.NSFAttribute = ?%lu OR substr(v.NSFAttribute, 1, length(?%lu) + 1) = ?%lu || '.'", (unsigned long)i, (unsigned long)i, (unsigned long)i]];
+    }
+    
+    NSString *matchClause = [self _matchingKeysClauseForColumn:@"k.NSFKey"];
+    
+    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT k.NSFKey, k.NSFObjectClass, v.NSFAttribute, v.NSFValue, v.NSFDatatype, v.NSFTimestamp, v.NSFArrayElement FROM NSFKeys k LEFT JOIN NSFValues v ON v.NSFKey = k.NSFKey AND (%@) WHERE %@", [attributeClauses componentsJoinedByString:@" OR "], matchClause];
+    
+    _NSFLog(@"Projection SQL query: %@", theSQLStatement);
+    
+    sqlite3_stmt *theSQLiteStatement = NULL;
+    int status = sqlite3_prepare_v2 ([[nanoStore nanoStoreEngine]sqlite], [theSQLStatement UTF8String], -1, &theSQLiteStatement, NULL);
+    
+    // Since we're operating with extended result code support, extract the bits
+    // and obtain the regular result code
+    // For more info check: http://www.sqlite.org/c3ref/c_ioerr_access.html
+    
+    status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+    
+    if (SQLITE_OK != status) {
+        if (nil != outError) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the projection could not be prepared.", [self class], _cmd]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        }
+        return nil;
+    }
+    
+    for (i = 0; i < count; i++) {
+        sqlite3_bind_text (theSQLiteStatement, (int)i + 1, [[requestedAttributes objectAtIndex:i]UTF8String], -1, SQLITE_TRANSIENT);
+    }
+    
+    NSMutableDictionary *classesByKey = [NSMutableDictionary dictionary];
+    NSMutableDictionary *valuesByKey = [NSMutableDictionary dictionary];
+    NSMutableSet *keysNeedingDocuments = [NSMutableSet set];
+    
+    while (SQLITE_ROW == sqlite3_step (theSQLiteStatement)) {
+        char *keyUTF8 = (char *)sqlite3_column_text (theSQLiteStatement, 0);
+        char *objectClassUTF8 = (char *)sqlite3_column_text (theSQLiteStatement, 1);
+        
+        if ((NULL == keyUTF8) || (NULL == objectClassUTF8)) {
+            NSLog(@"*** Warning! These values are NanoStore's resposibility and should *never* be NULL: keyUTF8 (%s) - objectClassUTF8 (%s)", keyUTF8, objectClassUTF8);
+            continue;
+        }
+        
+        NSString *keyValue = [[NSString alloc]initWithUTF8String:keyUTF8];
+        NSMutableDictionary *values = [valuesByKey objectForKey:keyValue];
+        if (nil == values) {
+            values = [NSMutableDictionary dictionary];
+            [valuesByKey setObject:values forKey:keyValue];
+            [classesByKey setObject:[[NSString alloc]initWithUTF8String:objectClassUTF8] forKey:keyValue];
+        }
+        
+        // No requested attribute found for this object
+        char *attributeUTF8 = (char *)sqlite3_column_text (theSQLiteStatement, 2);
+        if ((NULL == attributeUTF8) || (YES == [keysNeedingDocuments containsObject:keyValue])) {
+            continue;
+        }
+        
+        // Values are rebuilt from their datatype. Whatever can't be rebuilt exactly is read from the document instead:
+        // collections (a descendant attribute, a repeated one or an array element), dates and integers a double may have rounded.
+        NSString *attributeValue = [[NSString alloc]initWithUTF8String:attributeUTF8];
+        const char *datatypeUTF8 = (const char *)sqlite3_column_text (theSQLiteStatement, 4);
+        NSFNanoDatatype datatype = (NULL != datatypeUTF8) ? NSFNanoDatatypeFromString([NSString stringWithUTF8String:datatypeUTF8]) : NSFNanoTypeUnknown;
+        int valueType = sqlite3_column_type (theSQLiteStatement, 3);
+        id theValue = nil;
+        
+        // Rows written before array elements were flagged are NULL: they could belong to a single-element array
+        BOOL isScalar = ((SQLITE_INTEGER == sqlite3_column_type (theSQLiteStatement, 6)) && (0 == sqlite3_column_int (theSQLiteStatement, 6)));
+        
+        if (YES == isScalar) {
+            switch (datatype) {
+                case NSFNanoTypeNumber:
+                    if (SQLITE_INTEGER == valueType) {
+                        long long number = sqlite3_column_int64 (theSQLiteStatement, 3);
+                        if (llabs(number) < (1LL << 53)) {
+                            theValue = [NSNumber numberWithLongLong:number];
+                        }
+                    } else if (SQLITE_FLOAT == valueType) {
+                        theValue = [NSNumber numberWithDouble:sqlite3_column_double (theSQLiteStatement, 3)];
+                    }
+                    break;
+                case NSFNanoTypeString:
+                    // Dates are stored as text as well, but they're the only ones with a timestamp. Text which looked
+                    // like a number has been converted by the column affinity.
+                    if ((SQLITE_TEXT == valueType) && (SQLITE_NULL == sqlite3_column_type (theSQLiteStatement, 5))) {
+                        theValue = [[NSString alloc]initWithUTF8String:(const char *)sqlite3_column_text (theSQLiteStatement, 3)];
+                    }
+                    break;
+                case NSFNanoTypeData:
+                    if (SQLITE_BLOB == valueType) {
+                        theValue = [NSData dataWithBytes:sqlite3_column_blob (theSQLiteStatement, 3) length:sqlite3_column_bytes (theSQLiteStatement, 3)];
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+        
+        if ((nil == theValue) || (NO == [attributesToBeReturned containsObject:attributeValue]) || (nil != [values objectForKey:attributeValue])) {
+            [keysNeedingDocuments addObject:keyValue];
+            continue;
+        }
+        
+        [values setObject:theValue forKey:attributeValue];
+    }
+    
+    sqlite3_finalize (theSQLiteStatement);
+    
+    // A requested attribute without rows is either missing or an empty collection: only the document can tell
+    for (NSString *keyValue in valuesByKey) {
+        if ([[valuesByKey objectForKey:keyValue]count] < count) {
+            [keysNeedingDocuments addObject:keyValue];
+        }
+    }
+    
+    NSDictionary *documents = ([keysNeedingDocuments count] > 0) ? [nanoStore _objectsForKeys:[keysNeedingDocuments allObjects] ofClassNamed:nil] : nil;
+    NSMutableDictionary *searchResults = [NSMutableDictionary dictionaryWithCapacity:[valuesByKey count]];
+    
+    for (NSString *keyValue in valuesByKey) {
+        NSDictionary *values = [valuesByKey objectForKey:keyValue];
+        NSDictionary *info = nil;
+        
+        if (YES == [keysNeedingDocuments containsObject:keyValue]) {
+            info = [[documents objectForKey:keyValue]nanoObjectDictionaryRepresentation];
+            if (nil == info) {
+                continue;
+            }
+        }
         
+        NSMutableDictionary *subset = [NSMutableDictionary new];
+        
+        for (NSString *attributeValue in attributesToBeReturned) {
+            id theValue = (nil != info) ? [info valueForKeyPath:attributeValue] : [values objectForKey:attributeValue];
+            [self _setProjectedValue:theValue forAttribute:attributeValue inSubset:subset];
+        }
+        
+        [searchResults setObject:[nanoStore _objectWithInfo:subset forKey:keyValue className:[classesByKey objectForKey:keyValue]] forKey:keyValue];
+    }
+    
     return searchResults;
 }
 
+- (void)_setProjectedValue:(id)theValue forAttribute:(NSString *)anAttribute inSubset:(NSMutableDictionary *)subset
+{
+    if (nil == theValue) {
+        return;
+    }
+    
+    if (NSNotFound == [anAttribute rangeOfString:@"."].location) {
+        [subset setValue:theValue forKeyPath:anAttribute];
+    } else {
+        NSDictionary *subInfo = [self _dictionaryForKeyPath:anAttribute value:theValue];
+        if ([subInfo count] > 0) {
+            NSString *subInfoKey = [[subInfo allKeys]objectAtIndex:0];
+            NSString *subInfoValue = [subInfo objectForKey:subInfoKey];
+            [subset setValue:subInfoValue forKey:subInfoKey];
+        }
+    }
+}
+
 - (NSDictionary *)_retrieveDataAdded:(NSFDateMatchType)aDateMatch calendarDate:(NSDate *)aDate error:(out NSError **)outError
 {
     if ([nanoStore isClosed] == YES) {
@@ -496,6 +1457,162 @@
     return aSQLQuery;
 }
 
+- (NSString *)_preparedKeysSQL
+{
+    // A query returning the keys of the matching objects, suitable for set-based statements (i.e. 'NSFKey IN (...)')
+    NSString *aSQLQuery = sql;
+    
+    if (nil != aSQLQuery) {
+        // It's going to be embedded, so the statement can't be terminated. The query is kept whole and only
+        // its NSFKey column is looked at: whatever it selects, joins or filters on stays as written.
+        aSQLQuery = [aSQLQuery stringByTrimmingCharactersInSet:[NSCharacterSet characterSetWithCharactersInString:@"; \t\r\n"]];
+        aSQLQuery = [NSString stringWithFormat:@"SELECT DISTINCT NSFKey FROM (%@)", aSQLQuery];
+    } else if ((nil == expressions) && (nil == key) && (nil == attribute) && (nil == value)) {
+        // Without criteria every object matches
+        aSQLQuery = @"SELECT NSFKey FROM NSFKeys";
+    } else {
+        // Grouping by value would leave out the keys sharing a value. The class filter is applied by the query itself.
+        NSFReturnType returnType = returnedObjectType;
+        BOOL shouldGroupValues = groupValues;
+        returnedObjectType = NSFReturnKeys;
+        groupValues = NO;
+        aSQLQuery = [self _preparedSQL];
+        returnedObjectType = returnType;
+        groupValues = shouldGroupValues;
+        
+        return aSQLQuery;
+    }
+    
+    if (self.filterClass.length > 0) {
+        aSQLQuery = [NSString stringWithFormat:@"SELECT NSFKey FROM NSFKeys WHERE NSFObjectClass = %@ AND NSFKey IN (%@)", [NSFNanoStore _SQLLiteralForString:self.filterClass], aSQLQuery];
+    }
+    
+    return aSQLQuery;
+}
+
+- (NSString *)_matchingKeysClauseForColumn:(NSString *)aColumn
+{
+    // Without criteria every object matches, so there's no need to evaluate the predicate at all
+    if ((nil == sql) && (nil == expressions) && (nil == key) && (nil == attribute) && (nil == value) && (0 == self.filterClass.length)) {
+        return @"1";
+    }
+    
+    return [NSString stringWithFormat:@"%@ IN (%@)", aColumn, [self _preparedKeysSQL]];
+}
+
+- (sqlite3_stmt *)_preparedSQLite3StatementForSQL:(NSString *)aSQLQuery selector:(SEL)aSelector error:(out NSError **)outError
+{
+    sqlite3_stmt *theSQLiteStatement = NULL;
+    int status = sqlite3_prepare_v2 ([[nanoStore nanoStoreEngine]sqlite], [aSQLQuery UTF8String], -1, &theSQLiteStatement, NULL);
+    
+    // Since we're operating with extended result code support, extract the bits
+    // and obtain the regular result code
+    // For more info check: http://www.sqlite.org/c3ref/c_ioerr_access.html
+    
+    status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+    
+    if (SQLITE_OK != status) {
+        sqlite3_finalize (theSQLiteStatement);
+        if (nil != outError) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %@]: SQLite error ID: %d", [self class], NSStringFromSelector(aSelector), status]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        }
+        return NULL;
+    }
+    
+    return theSQLiteStatement;
+}
+
++ (id)_valueForColumn:(int)aColumn ofSQLite3Statement:(sqlite3_stmt *)aStatement
+{
+    // Integers and reals are kept apart so that counts come back exact
+    switch (sqlite3_column_type (aStatement, aColumn)) {
+        case SQLITE_INTEGER:
+            return [NSNumber numberWithLongLong:sqlite3_column_int64 (aStatement, aColumn)];
+        case SQLITE_FLOAT:
+            return [NSNumber numberWithDouble:sqlite3_column_double (aStatement, aColumn)];
+        case SQLITE_TEXT:
+            return [[NSString alloc]initWithUTF8String:(const char *)sqlite3_column_text (aStatement, aColumn)];
+        case SQLITE_BLOB:
+            return [NSData dataWithBytes:sqlite3_column_blob (aStatement, aColumn) length:sqlite3_column_bytes (aStatement, aColumn)];
+        default:
+            return [NSNull null];
+    }
+}
+
++ (NSString *)_SQLExpressionForAggregateFunction:(NSFAggregateFunctionType)theFunctionType column:(NSString *)aColumn
+{
+    switch (theFunctionType) {
+        case NSFAverage:
+            return [NSString stringWithFormat:@"avg(%@)", aColumn];
+        case NSFCount:
+            return [NSString stringWithFormat:@"count(%@)", aColumn];
+        case NSFMax:
+            return [NSString stringWithFormat:@"max(%@)", aColumn];
+        case NSFMin:
+            return [NSString stringWithFormat:@"min(%@)", aColumn];
+        case NSFTotal:
+            return [NSString stringWithFormat:@"total(%@)", aColumn];
+        case NSFApproximatePercentile50:
+            return [NSString stringWithFormat:@"NSFP_approximatePercentile(%@, 0.5)", aColumn];
+        case NSFApproximatePercentile95:
+            return [NSString stringWithFormat:@"NSFP_approximatePercentile(%@, 0.95)", aColumn];
+        case NSFApproximatePercentile99:
+            return [NSString stringWithFormat:@"NSFP_approximatePercentile(%@, 0.99)", aColumn];
+        default:
+            [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                     reason:[NSString stringWithFormat:@"*** +[%@ %s]: unknown aggregate function type %d.", [self class], _cmd, theFunctionType]
+                                   userInfo:nil]raise];
+            return nil;
+    }
+}
+
+- (NSNumber *)_scalarForSQL:(NSString *)aSQLQuery
+{
+    if (YES == [nanoStore isClosed]) {
+        return nil;
+    }
+    
+    _NSFLog(@"_scalarForSQL SQL query: %@", aSQLQuery);
+    
+    NSString *cacheKey = nil;
+    if (YES == nanoStore.searchResultCacheEnabled) {
+        cacheKey = [NSString stringWithFormat:@"scalar|%@", aSQLQuery];
+        NSNumber *cachedScalar = [[nanoStore _cachedSearchResultsForKey:cacheKey]objectForKey:@"scalar"];
+        if (nil != cachedScalar) {
+            return cachedScalar;
+        }
+    }
+    
+    sqlite3 *sqliteStore = [[nanoStore nanoStoreEngine]sqlite];
+    sqlite3_stmt *theSQLiteStatement = NULL;
+    NSNumber *scalar = nil;
+    
+    int status = sqlite3_prepare_v2 (sqliteStore, [aSQLQuery UTF8String], -1, &theSQLiteStatement, NULL);
+    
+    // Since we're operating with extended result code support, extract the bits
+    // and obtain the regular result code
+    // For more info check: http://www.sqlite.org/c3ref/c_ioerr_access.html
+    
+    status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+    
+    if (SQLITE_OK == status) {
+        if (SQLITE_ROW == [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_step (theSQLiteStatement)]) {
+            scalar = [NSNumber numberWithLongLong:sqlite3_column_int64 (theSQLiteStatement, 0)];
+        }
+    }
+    
+    sqlite3_finalize (theSQLiteStatement);
+    
+    if ((nil != cacheKey) && (nil != scalar)) {
+        [nanoStore _cacheSearchResults:[NSDictionary dictionaryWithObject:scalar forKey:@"scalar"] forKey:cacheKey SQL:aSQLQuery];
+    }
+    
+    return scalar;
+}
+
 - (NSString *)_prepareSQLQueryStringWithKey:(NSString *)aKey attribute:(NSString *)anAttribute value:(id)aValue matching:(NSFMatchType)aMatch
 {    
     NSMutableString *theSQLStatement = nil;
@@ -871,7 +1988,7 @@
             [cocoaSortDescriptors addObject:cocoaSort];
         }
         
-        if (NSFReturnObjects == theReturnType) {
+        if (NSFReturnKeys != theReturnType) {
             theResults = [[results allValues]sortedArrayUsingDescriptors:cocoaSortDescriptors];
         } else {
             theResults = [results allKeys];
@@ -64,7 +64,7 @@
 
 #import <sqlite3.h>
 
-@class NSFNanoEngine, NSFNanoResult, NSFNanoBag, NSFNanoSortDescriptor;
+@class NSFNanoEngine, NSFNanoResult, NSFNanoBag, NSFNanoSortDescriptor, NSFNanoSearch, NSFNanoBlob;
 
 @interface NSFNanoStore : NSObject
 
@@ -95,6 +95,55 @@
 @property (nonatomic, assign, readwrite) NSUInteger saveInterval;
 /** * Whether there are objects that haven't been saved to the store. */
 @property (nonatomic, readonly) BOOL hasUnsavedChanges;
+/** * The caching mechanism used when objects are retrieved by key. Defaults to <i>CacheAllData</i>.
+ 
+ - <i>CacheAllData</i>: objects are cached as soon as they are saved or retrieved.
+ - <i>CacheDataOnDemand</i>: objects are cached the first time they are retrieved.
+ - <i>DoNotCacheData</i>: objects are decoded from the document store every time.
+ 
+ @note The cache is an identity map: retrieving the same key twice returns the same instance, so changes made to a retrieved
+ object are visible to other callers even before the object is saved. The cache stays off, and every retrieval returns a new instance,
+ until cacheCapacity is set.
+ @see \link objectsWithKeysInArray: - (NSArray *)objectsWithKeysInArray:(NSArray *)theKeys \endlink	*/
+@property (nonatomic, assign, readwrite) NSFCacheMethod cacheMethod;
+/** * Maximum number of objects kept in the object cache. Defaults to 0, which leaves the object cache off. Changing the capacity clears the cache. */
+@property (nonatomic, assign, readwrite) NSUInteger cacheCapacity;
+/** * Number of object lookups served from the object cache. */
+@property (nonatomic, assign, readonly) unsigned long long cacheHitCount;
+/** * Number of object lookups that had to be decoded from the document store. */
+@property (nonatomic, assign, readonly) unsigned long long cacheMissCount;
+/** * Ratio of object lookups served from the object cache, between 0.0 and 1.0. */
+@property (nonatomic, assign, readonly) double cacheHitRate;
+/** * Whether the results of NSFNanoSearch queries are kept in memory and reused. Defaults to NO.
+ 
+ Results are keyed by the SQL of the search, its return type and the attributes to be returned. An entry is discarded as soon as a
+ transaction touching one of the tables read by the query is committed.
+ 
+ A search answered from the cache returns the same object instances as the search which filled it, so changes made to those objects
+ without saving them are seen by every caller. Copy the objects before changing them if that matters.
+ 
+ @note Only changes made through this document store are observed. Don't enable it if other processes write to the same file.
+ @note Finding the changed tables costs a callback per row written, which is only paid while the cache is enabled.	*/
+@property (nonatomic, assign, readwrite) BOOL searchResultCacheEnabled;
+/** * Number of objects which weren't written because their content was identical to the stored one.
+ * @note Every object keeps a hash of its encoded form. Saving an object whose hash and class match the stored ones is a no-op.	*/
+@property (nonatomic, assign, readonly) unsigned long long numberOfSkippedWrites;
+/** * Whether the documents are compressed with zlib when they're written. Defaults to NO.
+ 
+ A document is only stored compressed when that makes it smaller, and the documents already stored keep the form they were written in.
+ Compression pays off once a dictionary has been trained from the stored documents.
+ 
+ @note The values in NSFValues are never compressed: they're what searches are evaluated against.
+ @see \link trainCompressionDictionaryWithSampleSize:error: - (BOOL)trainCompressionDictionaryWithSampleSize:(NSUInteger)theSampleSize error:(out NSError **)outError \endlink
+ @see \link recompressStoredDocumentsAndReturnError: - (BOOL)recompressStoredDocumentsAndReturnError:(out NSError **)outError \endlink	*/
+@property (nonatomic, assign, readwrite) BOOL documentCompressionEnabled;
+/** * Size in bytes from which the NSData values are moved out of the documents and stored once in a separate table. Defaults to 0, which keeps every NSData value inline.
+ 
+ A value stored out-of-line is replaced by a reference to its content (a SHA-256 hash), so identical bytes saved by many objects take the space of a single copy.
+ The objects read back contain an NSFNanoBlob in place of the NSData, whose bytes are then read with \link dataOfBlob:error: - (NSData *)dataOfBlob:(NSFNanoBlob *)theBlob error:(out NSError **)outError \endlink.
+ 
+ @note Removing an object doesn't remove its blobs. Use \link removeUnreferencedBlobsAndReturnError: - (BOOL)removeUnreferencedBlobsAndReturnError:(out NSError **)outError \endlink to reclaim their space.	*/
+@property (nonatomic, assign, readwrite) NSUInteger blobSizeThreshold;
 
 /** @name Creating and Initializing NanoStore	*/
 
@@ -203,6 +252,8 @@
  * @param theObjects is an array of objects to be added to the document store. The objects must be \link NSFNanoObjectProtocol::initNanoObjectFromDictionaryRepresentation:forKey:store: NSFNanoObjectProtocol\endlink-compliant.
  * @param outError is used if an error occurs. May be NULL.
  * @return YES upon success, NO otherwise.
+ * @note Bag names are unique: if a bag is named like a stored bag or like another bag of the array, nothing is added and NO is returned.
+ * The names of all the bags are checked with a single indexed lookup.
  * @warning The objects of the array must be \link NSFNanoObjectProtocol::initNanoObjectFromDictionaryRepresentation:forKey:store: NSFNanoObjectProtocol\endlink-compliant.
  * @throws NSFNonConformingNanoObjectProtocolException is thrown if the object is non-\link NSFNanoObjectProtocol::initNanoObjectFromDictionaryRepresentation:forKey:store: NSFNanoObjectProtocol\endlink compliant.
  * @see \link addObject:error: - (BOOL)addObject:(id <NSFNanoObjectProtocol>)theObject error:(out NSError **)outError \endlink	*/
@@ -242,6 +293,40 @@
 
 - (BOOL)removeObjectsInArray:(NSArray *)theObjects error:(out NSError **)outError;
 
+/** * Removes the objects matching a search from the document store.
+ * @param theSearch the search describing the objects to be removed. Must not be nil.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success, NO otherwise.
+ * @note The removal runs entirely within SQLite: the matching objects (or their keys) are never loaded.
+ * @throws NSFUnexpectedParameterException is thrown if the search is nil.
+ * @see \link removeObjectsWithKeysInArray:error: - (BOOL)removeObjectsWithKeysInArray:(NSArray *)theKeys error:(out NSError **)outError \endlink	*/
+
+- (BOOL)removeObjectsMatchingSearch:(NSFNanoSearch *)theSearch error:(out NSError **)outError;
+
+/** * Sets an attribute on every object matching a search.
+ * @param theSearch the search describing the objects to be updated. Must not be nil.
+ * @param theAttribute the name of the attribute to be set. Must not be nil or empty, and cannot contain a period ('.').
+ * @param theValue the value of the attribute. Must be a property list object. Must not be nil.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success, NO otherwise.
+ * @note The update runs entirely within SQLite: the matching objects are never loaded. Only objects stored as NSFNanoObject are updated:
+ * bags, subclasses and other classes matching the search are left untouched.
+ * @throws NSFUnexpectedParameterException is thrown if the search, the attribute or the value is nil, or if the attribute contains a period ('.').	*/
+
+- (BOOL)updateObjectsMatchingSearch:(NSFNanoSearch *)theSearch setAttribute:(NSString *)theAttribute value:(id)theValue error:(out NSError **)outError;
+
+/** * Atomically adds an amount to a numeric attribute of a stored object.
+ * @param theAttribute the name of the attribute. Must not be nil or empty, and cannot contain a period ('.'). A missing attribute is treated as zero.
+ * @param theAmount the amount to be added. May be negative. Must not be nil.
+ * @param theKey the key of the object. Must not be nil.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return The new value of the attribute upon success, nil otherwise (i.e. the object doesn't exist or the attribute isn't a single number).
+ * @note The indexed value and the stored plist are patched in place within an immediate transaction, so concurrent writers can't interleave.
+ * The object isn't loaded and its other attributes aren't rewritten.
+ * @throws NSFUnexpectedParameterException is thrown if the attribute, the amount or the key is nil, or if the attribute contains a period ('.').	*/
+
+- (NSNumber *)incrementAttribute:(NSString *)theAttribute byAmount:(NSNumber *)theAmount forKey:(NSString *)theKey error:(out NSError **)outError;
+
 /** * Removes all objects from the document store.
  * @param outError is used if an error occurs. May be NULL.
  * @return YES upon success, NO otherwise.
@@ -269,13 +354,14 @@
 /** * Retrieves the bag associated with the specified name.
  * @param theName the name of the bag.
  * @returns The bag that matches the specified name, nil otherwise.
- * @note Check properties savedObjects, unsavedObjects and removedObjects to find out the current state of the bag.	*/
+ * @note Bag names are unique and indexed, so the bag is found with a single index seek.
+ * Check properties savedObjects, unsavedObjects and removedObjects to find out the current state of the bag.	*/
 
 - (NSFNanoBag *)bagWithName:(NSString *)theName;
 
 /** * Returns a new array containing the bags found in the document store matching the specified list of keys.
  * @param theKeys the list of bag keys.
- * @returns An array with the bags that match the specified list of keys.
+ * @returns An array with the bags that match the specified list of keys, in the order of the keys.
  * @see \link bags - (NSArray *)bags \endlink
  * @see \link bagsContainingObjectWithKey: - (NSArray *)bagsContainingObjectWithKey:(NSString *)theKey \endlink	*/
 
@@ -291,11 +377,22 @@
 
 /** * Returns a new array containing the objects found in the document store matching the specified list of keys.
  * @param theKeys the list of \link NSFNanoObjectProtocol::initNanoObjectFromDictionaryRepresentation:forKey:store: NSFNanoObjectProtocol\endlink-compliant object keys.
- * @returns An array with the objects matching the specified list of keys.
- * @note The keys can belong to any object class: NSFNanoObject, NSFNanoBag or any \link NSFNanoObjectProtocol::initNanoObjectFromDictionaryRepresentation:forKey:store: NSFNanoObjectProtocol\endlink-compliant object.	*/
+ * @returns An array with the objects matching the specified list of keys, in the order of the keys. Keys not found in the document store are skipped.
+ * @note The keys can belong to any object class: NSFNanoObject, NSFNanoBag or any \link NSFNanoObjectProtocol::initNanoObjectFromDictionaryRepresentation:forKey:store: NSFNanoObjectProtocol\endlink-compliant object.
+ * Objects found in the object cache are returned without being decoded again. See the cacheMethod property for details.
+ * @see \link orderedObjectsWithKeysInArray: - (NSArray *)orderedObjectsWithKeysInArray:(NSArray *)theKeys \endlink	*/
 
 - (NSArray *)objectsWithKeysInArray:(NSArray *)theKeys;
 
+/** * Returns a new array containing, for each key of the list, the object found in the document store or NSNull.
+ * @param theKeys the list of object keys. Must not be nil.
+ * @returns An array with as many elements as keys: the object matching the key at the same index, or NSNull if there's no such object.
+ * @note The keys are bound to cached statements in batches and large results are decoded concurrently. Objects found in the object cache are returned without being decoded again.
+ * @throws NSFUnexpectedParameterException is thrown if the list of keys is nil.
+ * @see \link objectsWithKeysInArray: - (NSArray *)objectsWithKeysInArray:(NSArray *)theKeys \endlink	*/
+
+- (NSArray *)orderedObjectsWithKeysInArray:(NSArray *)theKeys;
+
 /** * Returns a new array containing the objects classes in the document store.
  * @returns An array of the class names found in the document store.
  * @note The classes can be NSFNanoObject, NSFNanoBag or any \link NSFNanoObjectProtocol::initNanoObjectFromDictionaryRepresentation:forKey:store: NSFNanoObjectProtocol\endlink-compliant object.	*/
@@ -323,10 +420,72 @@
  * @param theClassName the name of the class that will be used for searching. Cannot be NULL.
  * @returns The count of objects of the specified class name.
  * @note The classes can be NSFNanoObject, NSFNanoBag or any \link NSFNanoObjectProtocol::initNanoObjectFromDictionaryRepresentation:forKey:store: NSFNanoObjectProtocol\endlink-compliant object.
+ * If the objects are counted by a \link materializeAggregateNamed:function:onAttribute:groupedByAttribute:error: materialized aggregate\endlink grouped by class name, the count is read from it.
  * @throws NSFUnexpectedParameterException is thrown if the class name is nil or empty.	*/
 
 - (long long)countOfObjectsOfClassNamed:(NSString *)theClassName;
 
+/** * Returns the keys of the objects which differ between the receiver and another document store.
+ * @param theStore the document store to compare against. Must not be nil.
+ * @return The keys of the objects stored in only one of the two document stores, or stored in both with different contents. Returns nil if either document store is closed.
+ * @note The comparison is based on the content hashes kept for every object: no object is decoded.
+ * @throws NSFUnexpectedParameterException is thrown if the store is nil.	*/
+
+- (NSArray *)keysOfObjectsDifferingFromStore:(NSFNanoStore *)theStore;
+
+//@}
+
+/** @name Materialized Aggregates	*/
+
+//@{
+
+/** * Registers an aggregate which the document store keeps up to date as objects are added, updated and removed.
+ * @param theName the name the aggregate is read back with. Must not be nil or empty. Registering an existing name replaces it.
+ * @param theFunctionType the function to apply: NSFCount, NSFTotal or NSFAverage.
+ * @param theAttribute the attribute being aggregated. May be nil with NSFCount, in which case the objects themselves are counted.
+ * @param theGroupingAttribute the attribute whose values split the aggregate into groups. If nil, the objects are grouped by class name.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success, NO otherwise.
+ * @note The aggregate is computed once when registered and then maintained by SQLite triggers on every change, so reading it
+ * never scans the document store. Aggregates based on the class name are also used by \link countOfObjectsOfClassNamed: - (long long)countOfObjectsOfClassNamed:(NSString *)theClassName \endlink.
+ * @throws NSFUnexpectedParameterException is thrown if the name is nil or empty, if the function is not NSFCount, NSFTotal or NSFAverage,
+ * if the attribute is missing for a function other than NSFCount or if the attribute is also the grouping attribute.
+ * @see \link valueOfMaterializedAggregateNamed:forGroup: - (NSNumber *)valueOfMaterializedAggregateNamed:(NSString *)theName forGroup:(id)theGroupValue \endlink
+ * @see \link rebuildMaterializedAggregatesAndReturnError: - (BOOL)rebuildMaterializedAggregatesAndReturnError:(out NSError **)outError \endlink	*/
+
+- (BOOL)materializeAggregateNamed:(NSString *)theName function:(NSFAggregateFunctionType)theFunctionType onAttribute:(NSString *)theAttribute groupedByAttribute:(NSString *)theGroupingAttribute error:(out NSError **)outError;
+
+/** * Unregisters a materialized aggregate and stops maintaining it.
+ * @param theName the name of the aggregate. Must not be nil.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success or if no aggregate has that name, NO otherwise.
+ * @throws NSFUnexpectedParameterException is thrown if the name is nil.	*/
+
+- (BOOL)removeMaterializedAggregateNamed:(NSString *)theName error:(out NSError **)outError;
+
+/** * Returns the value of a materialized aggregate for one group.
+ * @param theName the name of the aggregate. Must not be nil.
+ * @param theGroupValue the class name or the value of the grouping attribute. Must not be nil.
+ * @return The value of the aggregate, 0 if the group is empty, or nil if no aggregate has that name.
+ * @note The value is read from a single row.
+ * @throws NSFUnexpectedParameterException is thrown if the name or the group is nil.	*/
+
+- (NSNumber *)valueOfMaterializedAggregateNamed:(NSString *)theName forGroup:(id)theGroupValue;
+
+/** * Returns the values of a materialized aggregate for all of its groups.
+ * @param theName the name of the aggregate. Must not be nil.
+ * @return A dictionary mapping each non-empty group to the value of the aggregate.
+ * @throws NSFUnexpectedParameterException is thrown if the name is nil.	*/
+
+- (NSDictionary *)valuesOfMaterializedAggregateNamed:(NSString *)theName;
+
+/** * Recomputes every materialized aggregate from the objects in the document store.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success, NO otherwise.
+ * @note The aggregates are always kept current, so this is only needed to check their consistency or to drop accumulated rounding errors.	*/
+
+- (BOOL)rebuildMaterializedAggregatesAndReturnError:(out NSError **)outError;
+
 //@}
 
 /** @name Saving and Maintenance	*/
@@ -369,6 +528,23 @@
 
 - (BOOL)rebuildIndexesAndReturnError:(out NSError **)outError;
 
+/** * Trains the dictionary used to compress the documents from a random sample of the stored ones, and saves it in the document store.
+ * @param theSampleSize the maximum number of documents to sample. Must be at least 2.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success, NO otherwise.
+ * @note The documents written from then on use the new dictionary. The previous dictionaries are kept, so the documents compressed with them remain readable.
+ * @see \link recompressStoredDocumentsAndReturnError: - (BOOL)recompressStoredDocumentsAndReturnError:(out NSError **)outError \endlink	*/
+
+- (BOOL)trainCompressionDictionaryWithSampleSize:(NSUInteger)theSampleSize error:(out NSError **)outError;
+
+/** * Rewrites every stored document with the current compression settings.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success, NO otherwise.
+ * @note Use it after training a dictionary to compress the existing documents with it, or after disabling compression to decompress them.
+ * @see documentCompressionEnabled	*/
+
+- (BOOL)recompressStoredDocumentsAndReturnError:(out NSError **)outError;
+
 /** * Makes a copy of the document store to a different location and optionally compacts it to its minimum size.
  * @param thePath is the location where the document store should be copied to.
  * @param shouldCompact is used to flag whether the document store should be compacted.
@@ -381,6 +557,64 @@
 
 //@}
 
+/** @name Blobs	*/
+
+//@{
+
+/** * Stores the bytes in the blob table, unless identical bytes are already stored.
+ * @param theData the bytes to be stored. Must not be nil.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return The reference to the blob upon success, nil otherwise.
+ * @note The reference can be saved in any object, just like an NSData value stored out-of-line.
+ * @see \link addBlobFromInputStream:length:error: - (NSFNanoBlob *)addBlobFromInputStream:(NSInputStream *)theStream length:(unsigned long long)theLength error:(out NSError **)outError \endlink	*/
+
+- (NSFNanoBlob *)addBlobWithData:(NSData *)theData error:(out NSError **)outError;
+
+/** * Stores the bytes read from a stream in the blob table, unless identical bytes are already stored.
+ * @param theStream the stream to read from. It's opened if needed, and left open. Must not be nil.
+ * @param theLength the number of bytes to read from the stream.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return The reference to the blob upon success, nil otherwise.
+ * @note The bytes are copied in chunks, so the blob is never held in memory in full.	*/
+
+- (NSFNanoBlob *)addBlobFromInputStream:(NSInputStream *)theStream length:(unsigned long long)theLength error:(out NSError **)outError;
+
+/** * Returns the bytes of a blob.
+ * @param theBlob the reference to the blob. Must not be nil.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return The bytes upon success, nil otherwise.
+ * @see \link dataOfBlob:inRange:error: - (NSData *)dataOfBlob:(NSFNanoBlob *)theBlob inRange:(NSRange)theRange error:(out NSError **)outError \endlink	*/
+
+- (NSData *)dataOfBlob:(NSFNanoBlob *)theBlob error:(out NSError **)outError;
+
+/** * Returns a range of the bytes of a blob.
+ * @param theBlob the reference to the blob. Must not be nil.
+ * @param theRange the range of bytes to read. Must lie within the blob.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return The bytes upon success, nil otherwise.
+ * @note Only the bytes in the range are read from the document store.	*/
+
+- (NSData *)dataOfBlob:(NSFNanoBlob *)theBlob inRange:(NSRange)theRange error:(out NSError **)outError;
+
+/** * Writes the bytes of a blob to a stream.
+ * @param theBlob the reference to the blob. Must not be nil.
+ * @param theStream the stream to write to. It's opened if needed, and left open. Must not be nil.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success, NO otherwise.
+ * @note The bytes are copied in chunks, so the blob is never held in memory in full.	*/
+
+- (BOOL)writeBlob:(NSFNanoBlob *)theBlob toOutputStream:(NSOutputStream *)theStream error:(out NSError **)outError;
+
+/** * Removes the blobs which aren't referenced by any stored object.
+ * @param outError is used if an error occurs. May be NULL.
+ * @return YES upon success, NO otherwise.
+ * @note A blob added since the document store was opened is kept until an object referencing it is saved, so it's safe to add the blob first and save
+ * the object afterwards. Blobs which were never referenced are removed once the document store has been reopened.	*/
+
+- (BOOL)removeUnreferencedBlobsAndReturnError:(out NSError **)outError;
+
+//@}
+
 /** @name Transactions	*/
 
 //@{
@@ -417,6 +651,23 @@
 
 //@}
 
+/** @name Object Cache	*/
+
+//@{
+
+/** * Removes all objects from the object cache, as well as the cached search results.
+ * @note The objects remain in the document store. Use this method to release memory when it's scarce.
+ * @see \link resetCacheStatistics - (void)resetCacheStatistics \endlink	*/
+
+- (void)clearCache;
+
+/** * Resets the hit and miss counters of the object cache.
+ * @see \link clearCache - (void)clearCache \endlink	*/
+
+- (void)resetCacheStatistics;
+
+//@}
+
 /** @name Miscellaneous	*/
 
 //@{
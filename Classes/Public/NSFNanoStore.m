@@ -29,6 +29,49 @@
 #import "NSFNanoStore_Private.h"
 
 #include <stdlib.h>
+#include <CommonCrypto/CommonDigest.h>
+
+static const NSUInteger __NSFPMaximumCachedSearchResults = 128;
+
+// Deletes and multi-gets bind their keys straight into an IN list. A handful of arities keeps the number of cached
+// statements small: the last batch is padded up to the next arity by repeating its last key.
+static const NSUInteger __NSFPKeyBatchSizes[] = {1, 8, 64};
+#define __NSFPNumberOfKeyBatchSizes (sizeof(__NSFPKeyBatchSizes) / sizeof(__NSFPKeyBatchSizes[0]))
+
+// Below this many objects, decoding them concurrently costs more than it saves
+static const NSUInteger __NSFPMinimumObjectsForConcurrentDecoding = 32;
+
+// Bag names are looked up in chunks, well below SQLite's default limit of 999 host parameters
+static const NSUInteger __NSFPBagNamesPerLookup = 500;
+
+// Out-of-line blobs are streamed through a buffer of this size
+static const NSUInteger __NSFPBlobChunkSize = 65536;
+
+// NSFCalendarDate is always "now" when written. Its numeric counterpart (seconds since 1970, UTC) is computed by SQLite.
+static NSString * const __NSFPCurrentTimestampSQL = @"((julianday('now') - 2440587.5) * 86400.0)";
+
+// Suffixes of the triggers keeping a materialized aggregate current: three for the rows providing the groups, three for the measured values
+static NSString * const __NSFPMaterializedAggregateTriggers[] = {@"GroupInsert", @"GroupDelete", @"GroupUpdate", @"MeasureInsert", @"MeasureDelete", @"MeasureUpdate"};
+
+static NSString *__NSFPStringFromSHA256Digest(const unsigned char *digest)
+{
+    char hexadecimal[CC_SHA256_DIGEST_LENGTH * 2 + 1];
+    for (NSUInteger i = 0; i < CC_SHA256_DIGEST_LENGTH; i++) {
+        snprintf (hexadecimal + i * 2, 3, "%02x", digest[i]);
+    }
+    
+    return [[NSString alloc]initWithUTF8String:hexadecimal];
+}
+
+static inline NSUInteger __NSFPKeyBatchSizeIndexForCount(NSUInteger count)
+{
+    // The smallest statement able to hold the keys (or the largest one available)
+    NSUInteger sizeIndex = 0;
+    while ((sizeIndex + 1 < __NSFPNumberOfKeyBatchSizes) && (__NSFPKeyBatchSizes[sizeIndex] < count)) {
+        sizeIndex++;
+    }
+    return sizeIndex;
+}
 
 @implementation NSFNanoStore
 {
@@ -36,18 +79,52 @@
     NSFNanoEngine               *nanoStoreEngine;
     NSFEngineProcessingMode     nanoEngineProcessingMode;
     NSUInteger                  saveInterval;
+    NSFCacheMethod              cacheMethod;
+    NSUInteger                  cacheCapacity;
+    unsigned long long          cacheHitCount;
+    unsigned long long          cacheMissCount;
+    BOOL                        searchResultCacheEnabled;
+    unsigned long long          numberOfSkippedWrites;
+    BOOL                        documentCompressionEnabled;
+    NSUInteger                  blobSizeThreshold;
     
     /** \cond */
     NSMutableArray              *addedObjects;
     BOOL                        _isOurTransaction;
     sqlite3_stmt                *_storeValuesStatement;
     sqlite3_stmt                *_storeKeysStatement;
+    sqlite3_stmt                *_updateKeysStatement;
+    sqlite3_stmt                *_removeAttributeStatement;
+    sqlite3_stmt                *_deleteKeysStatements[__NSFPNumberOfKeyBatchSizes * 3];
+    sqlite3_stmt                *_selectKeysStatements[__NSFPNumberOfKeyBatchSizes];
+    sqlite3_stmt                *_readValueStatement;
+    sqlite3_stmt                *_updateValueStatement;
+    sqlite3_stmt                *_mergeKeysStatement;
+    sqlite3_stmt                *_rehashKeysStatement;
+    NSMutableArray              *_objectCacheKeys;
+    NSMutableArray              *_objectCacheEntries;
+    NSMutableDictionary         *_objectCacheSlots;
+    unsigned char               *_objectCacheReferenceBits;
+    NSUInteger                  _objectCacheHand;
+    NSMutableDictionary         *_searchResultCache;
+    NSDictionary                *_searchResultCacheTables;
+    int                         _searchResultCacheSchemaVersion;
+    NSMapTable                  *_outOfLineBlobs;
+    NSMutableSet                *_pendingBlobHashes;
     /** \endcond */
 }
 
 @synthesize nanoStoreEngine;
 @synthesize nanoEngineProcessingMode;
 @synthesize saveInterval;
+@synthesize cacheMethod;
+@synthesize cacheCapacity;
+@synthesize cacheHitCount;
+@synthesize cacheMissCount;
+@synthesize searchResultCacheEnabled;
+@synthesize numberOfSkippedWrites;
+@synthesize documentCompressionEnabled;
+@synthesize blobSizeThreshold;
 
 // ----------------------------------------------
 // Initialization / Cleanup
@@ -102,6 +179,25 @@
         _storeKeysStatement = NULL;
         
         addedObjects = [[NSMutableArray alloc]initWithCapacity:saveInterval];
+        
+        cacheMethod = CacheAllData;
+        cacheCapacity = 0;
+        _objectCacheKeys = [NSMutableArray new];
+        _objectCacheEntries = [NSMutableArray new];
+        _objectCacheSlots = [NSMutableDictionary new];
+        _objectCacheReferenceBits = calloc(cacheCapacity, sizeof(unsigned char));
+        _objectCacheHand = 0;
+        
+        searchResultCacheEnabled = NO;
+        _searchResultCache = [NSMutableDictionary new];
+        _searchResultCacheTables = nil;
+        _searchResultCacheSchemaVersion = -1;
+        
+        documentCompressionEnabled = NO;
+        
+        blobSizeThreshold = 0;
+        _outOfLineBlobs = [NSMapTable mapTableWithKeyOptions:NSMapTableObjectPointerPersonality valueOptions:NSMapTableStrongMemory];
+        _pendingBlobHashes = [NSMutableSet new];
     }
     
     return self;
@@ -111,7 +207,7 @@
 {
     [self closeWithError:nil];
     
-    
+    free(_objectCacheReferenceBits);
 }
 
 - (NSString *)filePath
@@ -124,7 +220,7 @@
     if ([nanoStoreEngine isDatabaseOpen] == YES)
         return YES;
     
-    if ([nanoStoreEngine openWithCacheMethod:CacheAllData useFastMode:(NSFEngineProcessingFastMode == nanoEngineProcessingMode)] == NO) {
+    if ([nanoStoreEngine openWithCacheMethod:cacheMethod useFastMode:(NSFEngineProcessingFastMode == nanoEngineProcessingMode)] == NO) {
         NSString *message = [NSString stringWithFormat:@"*** -[%@ %s]: open database failed: %@", [self class], _cmd, [self filePath]];
         _NSFLog(message);
         if (nil != outError)
@@ -161,7 +257,11 @@
 - (BOOL)closeWithError:(out NSError **)outError
 {
     BOOL success = [self saveStoreAndReturnError:outError];
+    
+    [_pendingBlobHashes removeAllObjects];
+    
     [self _releasePreparedStatements];
+    [self clearCache];
     [nanoStoreEngine close];
     
     return success;
@@ -182,6 +282,69 @@
     return ([addedObjects count] > 0);
 }
 
+- (void)setCacheMethod:(NSFCacheMethod)theCacheMethod
+{
+    cacheMethod = theCacheMethod;
+    [nanoStoreEngine setCacheMethod:theCacheMethod];
+    
+    if (DoNotCacheData == cacheMethod) {
+        [self clearCache];
+    }
+}
+
+- (void)setSearchResultCacheEnabled:(BOOL)flag
+{
+    searchResultCacheEnabled = flag;
+    
+    [nanoStoreEngine NSFP_setTracksChangedTables:flag];
+    
+    if (NO == searchResultCacheEnabled) {
+        [_searchResultCache removeAllObjects];
+    }
+}
+
+- (void)setDocumentCompressionEnabled:(BOOL)flag
+{
+    documentCompressionEnabled = flag;
+    
+    [nanoStoreEngine NSFP_setCompressesPlists:flag];
+}
+
+- (void)setCacheCapacity:(NSUInteger)theCapacity
+{
+    [self clearCache];
+    
+    cacheCapacity = theCapacity;
+    free(_objectCacheReferenceBits);
+    _objectCacheReferenceBits = calloc((cacheCapacity > 0 ? cacheCapacity : 1), sizeof(unsigned char));
+}
+
+- (double)cacheHitRate
+{
+    unsigned long long lookups = cacheHitCount + cacheMissCount;
+    
+    if (0 == lookups) {
+        return 0.0;
+    }
+    
+    return (double)cacheHitCount / (double)lookups;
+}
+
+- (void)clearCache
+{
+    [_objectCacheKeys removeAllObjects];
+    [_objectCacheEntries removeAllObjects];
+    [_objectCacheSlots removeAllObjects];
+    _objectCacheHand = 0;
+    [_searchResultCache removeAllObjects];
+}
+
+- (void)resetCacheStatistics
+{
+    cacheHitCount = 0;
+    cacheMissCount = 0;
+}
+
 
 - (BOOL)addObject:(id <NSFNanoObjectProtocol>)object error:(out NSError **)outError
 {
@@ -207,28 +370,49 @@
         return NO;
     }
     
-    // Add the regular objects. For bags, redirect it the saving method.
-    NSMutableArray *nonBagObjects = [[NSMutableArray alloc]initWithCapacity:[someObjects count]];
-    
+    // Make sure the names of the bags are unique, with a single lookup for all of them. A bag being saved again keeps its name.
+    NSMutableDictionary *keysOfNamedBags = [NSMutableDictionary dictionary];
+    NSString *duplicateBagName = nil;
     for (id object in someObjects) {
-        // If it's a bag, make sure the name is unique
         if (YES == [object isKindOfClass:[NSFNanoBag class]]) {
             NSFNanoBag *bag = (NSFNanoBag *)object;
             NSString *bagName = bag.name;
             if (bagName.length > 0) {
-                NSFNanoBag *bagWithSameName = [self bagWithName:bagName];
-                if (nil != bagWithSameName) {
-                    if (nil != outError) {
-                        *outError = [NSError errorWithDomain:NSFDomainKey
-                                                        code:NSFNanoStoreErrorKey
-                                                    userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: a bag named '%@' already exists.", [self class], _cmd, bagName]
-                                                                                         forKey:NSLocalizedFailureReasonErrorKey]];
-                        
-                        return NO;
-                    }
+                NSString *bagKey = [keysOfNamedBags objectForKey:bagName];
+                if ((nil != bagKey) && (NO == [bagKey isEqualToString:bag.key])) {
+                    duplicateBagName = bagName;
+                    break;
                 }
+                [keysOfNamedBags setObject:bag.key forKey:bagName];
             }
-            
+        }
+    }
+    
+    if ((nil == duplicateBagName) && ([keysOfNamedBags count] > 0)) {
+        NSDictionary *keysOfStoredBags = [self _keysOfBagsNamed:[keysOfNamedBags allKeys]];
+        for (NSString *bagName in keysOfStoredBags) {
+            if (NO == [[keysOfStoredBags objectForKey:bagName]isEqualToString:[keysOfNamedBags objectForKey:bagName]]) {
+                duplicateBagName = bagName;
+                break;
+            }
+        }
+    }
+    
+    if (nil != duplicateBagName) {
+        if (nil != outError) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: a bag named '%@' already exists.", [self class], _cmd, duplicateBagName]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        }
+        return NO;
+    }
+    
+    // Add the regular objects. For bags, redirect it the saving method.
+    NSMutableArray *nonBagObjects = [[NSMutableArray alloc]initWithCapacity:[someObjects count]];
+    
+    for (id object in someObjects) {
+        if (YES == [object isKindOfClass:[NSFNanoBag class]]) {
             
             // If it's a bag, process it first by gathering. If it's not dirty, there's no need to save...
             if (YES == [object hasUnsavedChanges]) {
@@ -276,6 +460,11 @@
 }
 
 - (BOOL)removeObjectsWithKeysInArray:(NSArray *)someKeys error:(out NSError **)outError
+{
+    return [self _removeObjectsWithKeysInArray:someKeys keepingBagMembers:NO error:outError];
+}
+
+- (BOOL)_removeObjectsWithKeysInArray:(NSArray *)someKeys keepingBagMembers:(BOOL)keepBagMembers error:(out NSError **)outError
 {
     if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
         return NO;
@@ -290,50 +479,26 @@
     if (0 == count)
         return NO;
     
-    BOOL transactionStartedHere = [self beginTransactionAndReturnError:nil];
+    [self _removeCachedObjectsWithKeys:someKeys];
     
-    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"CREATE TEMP TABLE %@(x);", NSF_Private_ToDeleteTableKey];
-    [nanoStoreEngine executeSQL:theSQLStatement];
+    BOOL transactionStartedHere = [self beginTransactionAndReturnError:nil];
     
-    sqlite3_stmt *statement;
-    theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@ VALUES (?);", NSF_Private_ToDeleteTableKey];
-    BOOL success = [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement];
+    _NSFLog(@"          Before removing the keys from NSFKeys and NSFValues...");
+    BOOL success = [self _deleteRowsForKeys:someKeys keepingBagMembers:keepBagMembers];
     
-    if (success) {
-        for (NSString *key in someKeys) {
-            int status = sqlite3_reset (statement);
-            if (SQLITE_OK != status) {
-                break;
-            }
-            
-            // Bind and execute the statement...
-            status = sqlite3_bind_text ( statement, 1, [key UTF8String], -1, SQLITE_STATIC);
-            
-            // Since we're operating with extended result code support, extract the bits
-            // and obtain the regular result code
-            // For more info check: http://www.sqlite.org/c3ref/c_ioerr_access.html
-            
-            status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
-            
-            if (SQLITE_OK == status) {
-                [self _executeSQLite3StepUsingSQLite3Statement:statement];
-            }
+    if (NO == success) {
+        if (transactionStartedHere)
+            [self rollbackTransactionAndReturnError:nil];
+        
+        if (nil != outError) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the objects could not be removed.", [self class], _cmd]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
         }
-        sqlite3_finalize(statement);
+        return NO;
     }
     
-    _NSFLog(@"          Before removing the keys to be stored from NSFKeys...");
-    theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE %@ IN (SELECT * FROM %@);", NSFKeys, NSFKey, NSF_Private_ToDeleteTableKey];
-    [nanoStoreEngine executeSQL:theSQLStatement];
-    
-    _NSFLog(@"          Before removing the keys to be stored from NSFValues...");
-    theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE %@ IN (SELECT * FROM %@);", NSFValues, NSFKey, NSF_Private_ToDeleteTableKey];
-    [nanoStoreEngine executeSQL:theSQLStatement];
-    
-    _NSFLog(@"          Before DROP TABLE NSF_Private_ToDeleteTableKey...");
-    theSQLStatement = [[NSString alloc]initWithFormat:@"DROP TABLE %@;", NSF_Private_ToDeleteTableKey];
-    [nanoStoreEngine executeSQL:theSQLStatement];
-    
     if (transactionStartedHere)
         if ([self commitTransactionAndReturnError:nil] == NO)
             _NSFLog(@"          Could not commit the transaction.");
@@ -365,6 +530,268 @@
     return [self removeObjectsWithKeysInArray:someKeys error:outError];
 }
 
+- (NSNumber *)incrementAttribute:(NSString *)theAttribute byAmount:(NSNumber *)theAmount forKey:(NSString *)theKey error:(out NSError **)outError
+{
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
+        return nil;
+    
+    if (0 == [theAttribute length])
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theAttribute is nil or empty.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if (NSNotFound != [theAttribute rangeOfString:@"."].location)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theAttribute cannot contain a period ('.')", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if (nil == theAmount)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theAmount is nil.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if (nil == theKey)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theKey is nil.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    // Take the write lock before reading, so nobody can sneak in between the read and the write
+    NSFNanoEngine *engine = [self nanoStoreEngine];
+    BOOL transactionStartedHere = NO;
+    if (NO == [engine isTransactionActive]) {
+        transactionStartedHere = [engine beginImmediateTransaction];
+        if (NO == transactionStartedHere) {
+            if (nil != outError) {
+                *outError = [NSError errorWithDomain:NSFDomainKey
+                                                code:NSFNanoStoreErrorKey
+                                            userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: could not start an immediate transaction.", [self class], _cmd]
+                                                                                 forKey:NSLocalizedFailureReasonErrorKey]];
+            }
+            return nil;
+        }
+    }
+    
+    NSString *failureReason = nil;
+    NSNumber *newValue = nil;
+    
+    // Read the current value: a single numeric row, or none at all
+    double currentValue = 0.0;
+    long long currentIntegerValue = 0;
+    BOOL isInteger = YES;
+    NSUInteger numberOfRows = 0;
+    BOOL isNumber = YES;
+    NSString *numberDatatype = NSFStringFromNanoDataType(NSFNanoTypeNumber);
+    
+    sqlite3_reset (_readValueStatement);
+    sqlite3_bind_text (_readValueStatement, 1, [theKey UTF8String], -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text (_readValueStatement, 2, [theAttribute UTF8String], -1, SQLITE_TRANSIENT);
+    while (SQLITE_ROW == sqlite3_step (_readValueStatement)) {
+        const char *datatypeUTF8 = (const char *)sqlite3_column_text (_readValueStatement, 1);
+        isNumber = isNumber && (NULL != datatypeUTF8) && (0 == strcmp(datatypeUTF8, [numberDatatype UTF8String]));
+        
+        // Integers are read as such: going through a double would round the counters beyond 2^53
+        isInteger = (SQLITE_INTEGER == sqlite3_column_type (_readValueStatement, 0));
+        currentIntegerValue = sqlite3_column_int64 (_readValueStatement, 0);
+        currentValue = sqlite3_column_double (_readValueStatement, 0);
+        numberOfRows++;
+    }
+    sqlite3_reset (_readValueStatement);
+    
+    if ((numberOfRows > 1) || (NO == isNumber)) {
+        failureReason = @"the attribute isn't a single number";
+    } else {
+        // Stick to integers unless either side has a fractional part
+        const char *amountType = [theAmount objCType];
+        BOOL isFloatingPoint = ((0 == strcmp(amountType, @encode(float))) || (0 == strcmp(amountType, @encode(double))) || ((NO == isInteger) && (currentValue != floor(currentValue))));
+        if (YES == isFloatingPoint) {
+            newValue = [NSNumber numberWithDouble:currentValue + [theAmount doubleValue]];
+        } else if (YES == isInteger) {
+            newValue = [NSNumber numberWithLongLong:currentIntegerValue + [theAmount longLongValue]];
+        } else {
+            newValue = [NSNumber numberWithLongLong:(long long)currentValue + [theAmount longLongValue]];
+        }
+        
+        // Patch the plist first: no change means there's no such object
+        NSString *patchXML = [self _plistStringFromDictionary:[NSDictionary dictionaryWithObject:newValue forKey:theAttribute] error:nil];
+        NSString *calendarDate = [NSFNanoStore _calendarDateToString:[NSDate date]];
+        
+        if ((nil == patchXML) || (NO == [self _stepSQLite3Statement:_mergeKeysStatement bindingTexts:[NSArray arrayWithObjects:patchXML, calendarDate, theKey, nil]])) {
+            failureReason = @"the stored object could not be patched";
+        } else if (0 == sqlite3_changes ([engine sqlite])) {
+            failureReason = @"there's no object with such key";
+        } else if (NO == [self _stepSQLite3Statement:_rehashKeysStatement bindingTexts:[NSArray arrayWithObject:theKey]]) {
+            failureReason = @"the stored object could not be rehashed";
+        } else if (0 == numberOfRows) {
+            if (NO == [self _storeValuesOfDictionary:[NSDictionary dictionaryWithObject:newValue forKey:theAttribute] forKey:theKey usingSQLite3Statement:_storeValuesStatement]) {
+                failureReason = @"the attribute could not be indexed";
+            }
+        } else {
+            sqlite3_reset (_updateValueStatement);
+            int bindStatus = (YES == isFloatingPoint) ? sqlite3_bind_double (_updateValueStatement, 1, [newValue doubleValue]) : sqlite3_bind_int64 (_updateValueStatement, 1, [newValue longLongValue]);
+            BOOL success = ((bindStatus == SQLITE_OK) &&
+                            (sqlite3_bind_text (_updateValueStatement, 2, [theKey UTF8String], -1, SQLITE_TRANSIENT) == SQLITE_OK) &&
+                            (sqlite3_bind_text (_updateValueStatement, 3, [theAttribute UTF8String], -1, SQLITE_TRANSIENT) == SQLITE_OK) &&
+                            (SQLITE_DONE == [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_step (_updateValueStatement)]));
+            if (NO == success) {
+                failureReason = @"the attribute could not be updated";
+            }
+        }
+    }
+    
+    [self _removeCachedObjectsWithKeys:[NSArray arrayWithObject:theKey]];
+    
+    if (nil == failureReason) {
+        if (transactionStartedHere)
+            if ([engine commitTransaction] == NO)
+                _NSFLog(@"          Could not commit the transaction.");
+        return newValue;
+    }
+    
+    if (transactionStartedHere)
+        [engine rollbackTransaction];
+    
+    if (nil != outError) {
+        *outError = [NSError errorWithDomain:NSFDomainKey
+                                        code:NSFNanoStoreErrorKey
+                                    userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: %@.", [self class], _cmd, failureReason]
+                                                                         forKey:NSLocalizedFailureReasonErrorKey]];
+    }
+    
+    return nil;
+}
+
+- (BOOL)removeObjectsMatchingSearch:(NSFNanoSearch *)theSearch error:(out NSError **)outError
+{
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
+        return NO;
+    
+    if (nil == theSearch)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theSearch is nil.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    BOOL transactionStartedHere = [self beginTransactionAndReturnError:nil];
+    
+    BOOL success = [self _collectKeysMatchingSearch:theSearch];
+    
+    if (YES == success) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE %@ IN (SELECT %@ FROM %@);", NSFValues, NSFKey, NSFKey, NSF_Private_MatchingKeysTableKey];
+        success = (nil == [[self _executeSQL:theSQLStatement]error]);
+    }
+    
+    if (YES == success) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE %@ IN (SELECT %@ FROM %@);", NSFKeys, NSFKey, NSFKey, NSF_Private_MatchingKeysTableKey];
+        success = (nil == [[self _executeSQL:theSQLStatement]error]);
+    }
+    
+    if (YES == success) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE %@ IN (SELECT %@ FROM %@);", NSFBagMembers, NSFKey, NSFKey, NSF_Private_MatchingKeysTableKey];
+        success = (nil == [[self _executeSQL:theSQLStatement]error]);
+    }
+    
+    return [self _finishMatchingKeysOperationWithSuccess:success transactionStartedHere:transactionStartedHere selector:_cmd error:outError];
+}
+
+- (BOOL)updateObjectsMatchingSearch:(NSFNanoSearch *)theSearch setAttribute:(NSString *)theAttribute value:(id)theValue error:(out NSError **)outError
+{
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
+        return NO;
+    
+    if (nil == theSearch)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theSearch is nil.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if (0 == [theAttribute length])
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theAttribute is nil or empty.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if (NSNotFound != [theAttribute rangeOfString:@"."].location)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theAttribute cannot contain a period ('.')", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if (nil == theValue)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theValue is nil.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    // The patch is merged into every matching plist by NSFP_mergePlist()
+    NSDictionary *patch = [NSDictionary dictionaryWithObject:theValue forKey:theAttribute];
+    NSString *patchXML = [self _plistStringFromDictionary:patch error:outError];
+    if (nil == patchXML) {
+        return NO;
+    }
+    
+    BOOL transactionStartedHere = [self beginTransactionAndReturnError:nil];
+    
+    BOOL success = [self _collectKeysMatchingSearch:theSearch];
+    sqlite3_stmt *statement = NULL;
+    
+    // Only plain NanoObjects are patched: bags and the other classes give their documents a structure of their own
+    if (YES == success) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE %@ NOT IN (SELECT %@ FROM %@ WHERE %@ = '%@');", NSF_Private_MatchingKeysTableKey, NSFKey, NSFKey, NSFKeys, NSFObjectClass, NSStringFromClass([NSFNanoObject class])];
+        success = (nil == [[self _executeSQL:theSQLStatement]error]);
+    }
+    
+    // Merge the attribute into the plists...
+    if (YES == success) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"UPDATE %@ SET %@ = NSFP_mergePlist(%@, ?1), %@ = ?2, %@ = %@ WHERE %@ IN (SELECT %@ FROM %@);", NSFKeys, NSFPlist, NSFPlist, NSFCalendarDate, NSFTimestamp, __NSFPCurrentTimestampSQL, NSFKey, NSFKey, NSF_Private_MatchingKeysTableKey];
+        success = [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement];
+        if (YES == success) {
+            success = ((sqlite3_bind_text (statement, 1, [patchXML UTF8String], -1, SQLITE_TRANSIENT) == SQLITE_OK) &&
+                       (sqlite3_bind_text (statement, 2, [[NSFNanoStore _calendarDateToString:[NSDate date]]UTF8String], -1, SQLITE_TRANSIENT) == SQLITE_OK) &&
+                       (SQLITE_DONE == [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_step (statement)]));
+            sqlite3_finalize (statement);
+        }
+    }
+    
+    // ... refresh their hashes...
+    if (YES == success) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"UPDATE %@ SET %@ = NSFP_contentHash(%@) WHERE %@ IN (SELECT %@ FROM %@);", NSFKeys, NSFHash, NSFPlist, NSFKey, NSFKey, NSF_Private_MatchingKeysTableKey];
+        success = (nil == [[self _executeSQL:theSQLStatement]error]);
+    }
+    
+    // ... remove the rows of the previous value (including the nested ones)...
+    if (YES == success) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE %@ IN (SELECT %@ FROM %@) AND (%@ = ?1 OR substr(%@, 1, length(?2)) = ?2);", NSFValues, NSFKey, NSFKey, NSF_Private_MatchingKeysTableKey, NSFAttribute, NSFAttribute];
+        success = [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement];
+        if (YES == success) {
+            success = ((sqlite3_bind_text (statement, 1, [theAttribute UTF8String], -1, SQLITE_TRANSIENT) == SQLITE_OK) &&
+                       (sqlite3_bind_text (statement, 2, [[theAttribute stringByAppendingString:@"."]UTF8String], -1, SQLITE_TRANSIENT) == SQLITE_OK) &&
+                       (SQLITE_DONE == [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_step (statement)]));
+            sqlite3_finalize (statement);
+        }
+    }
+    
+    // ... and index the new value for every matching key
+    if (YES == success) {
+        NSMutableArray *flattenedKeys = [NSMutableArray new];
+        NSMutableArray *flattenedValues = [NSMutableArray new];
+        NSMutableIndexSet *arrayElementIndexes = [NSMutableIndexSet new];
+        [self _flattenCollection:patch keys:&flattenedKeys values:&flattenedValues arrayElementIndexes:arrayElementIndexes];
+        
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(%@, %@, %@, %@, %@, %@) SELECT %@, ?1, ?2, ?3, ?4, ?5 FROM %@;", NSFValues, NSFKey, NSFAttribute, NSFValue, NSFDatatype, NSFTimestamp, NSFArrayElement, NSFKey, NSF_Private_MatchingKeysTableKey];
+        success = [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement];
+        
+        NSUInteger i, count = [flattenedKeys count];
+        for (i = 0; (YES == success) && (i < count); i++) {
+            @autoreleasepool {
+                sqlite3_reset (statement);
+                success = [self _bindValue:[flattenedValues objectAtIndex:i] forAttribute:[flattenedKeys objectAtIndex:i] isArrayElement:[arrayElementIndexes containsIndex:i] firstParameterNumber:1 usingSQLite3Statement:statement];
+                success = success && (SQLITE_DONE == [self _executeSQLite3StepUsingSQLite3Statement:statement]);
+            }
+        }
+        
+        sqlite3_finalize (statement);
+    }
+    
+    [_outOfLineBlobs removeAllObjects];
+    
+    return [self _finishMatchingKeysOperationWithSuccess:success transactionStartedHere:transactionStartedHere selector:_cmd error:outError];
+}
+
 #pragma mark Searching
 
 - (NSArray *)bags
@@ -378,14 +805,17 @@
 
 - (NSFNanoBag *)bagWithName:(NSString *)theName
 {
-    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:self];
+    if (nil == theName) {
+        return nil;
+    }
     
-    search.attribute = NSF_Private_NSFNanoBag_Name;
-    search.match = NSFEqualTo;
-    search.value = theName;
+    // Bag names are unique and indexed, so the key is a single index seek away
+    NSString *bagKey = [[self _keysOfBagsNamed:[NSArray arrayWithObject:theName]]objectForKey:theName];
+    if (nil == bagKey) {
+        return nil;
+    }
     
-    // Returns a dictionary with the UUID of the object (key) and the NanoObject (value).
-    return [[[search searchObjectsWithReturnType:NSFReturnObjects error:nil]allObjects]lastObject];
+    return [[self bagsWithKeysInArray:[NSArray arrayWithObject:bagKey]]lastObject];
 }
 
 - (NSArray *)bagsWithKeysInArray:(NSArray *)someKeys
@@ -394,11 +824,18 @@
         return [NSArray array];
     }
     
-    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:self];
-    NSString *quotedString = [NSFNanoSearch _quoteStrings:someKeys joiningWithDelimiter:@","];
-    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT NSFKey, NSFPlist, NSFObjectClass FROM NSFKeys WHERE NSFKey IN (%@) AND NSFObjectClass = \"%@\"", quotedString, NSStringFromClass([NSFNanoBag class])];
+    NSArray *uniqueKeys = [[NSOrderedSet orderedSetWithArray:someKeys]array];
+    NSDictionary *bags = [self _objectsForKeys:uniqueKeys ofClassNamed:NSStringFromClass([NSFNanoBag class])];
+    NSMutableArray *orderedBags = [NSMutableArray arrayWithCapacity:[bags count]];
     
-    return [[search executeSQL:theSQLStatement returnType:NSFReturnObjects error:nil]allValues];
+    for (NSString *key in uniqueKeys) {
+        NSFNanoBag *bag = [bags objectForKey:key];
+        if (nil != bag) {
+            [orderedBags addObject:bag];
+        }
+    }
+    
+    return orderedBags;
 }
 
 - (NSArray *)bagsContainingObjectWithKey:(NSString *)aKey
@@ -408,7 +845,7 @@
     }
     
     NSFNanoSearch *search = [NSFNanoSearch searchWithStore:self];
-    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT NSFKey, NSFPlist, NSFObjectClass FROM NSFKeys WHERE NSFKey IN (SELECT DISTINCT (NSFKEY) FROM NSFValues WHERE NSFValue = \"%@\") AND NSFObjectClass = \"%@\"", aKey, NSStringFromClass([NSFNanoBag class])];
+    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT NSFKey, NSFPlist, NSFObjectClass FROM NSFKeys WHERE NSFKey IN (SELECT NSFKey FROM NSFBagMembers WHERE NSFObjectKey = \"%@\") AND NSFObjectClass = \"%@\"", aKey, NSStringFromClass([NSFNanoBag class])];
     
     return [[search executeSQL:theSQLStatement returnType:NSFReturnObjects error:nil]allValues];
 }
@@ -419,26 +856,81 @@
         return [NSArray array];
     }
     
-    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:self];
-    NSString *quotedString = [NSFNanoSearch _quoteStrings:someKeys joiningWithDelimiter:@","];
-    NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT NSFKey, NSFPlist, NSFObjectClass FROM NSFKeys WHERE NSFKey IN (%@)", quotedString];
+    NSArray *uniqueKeys = [[NSOrderedSet orderedSetWithArray:someKeys]array];
+    NSDictionary *objects = [self _objectsByKeyForKeys:uniqueKeys];
+    NSMutableArray *orderedObjects = [NSMutableArray arrayWithCapacity:[objects count]];
     
-    return [[search executeSQL:theSQLStatement returnType:NSFReturnObjects error:nil]allValues];
-}
-
-- (NSArray *)allObjectClasses
-{
-    NSFNanoResult *results = [self _executeSQL:@"SELECT DISTINCT(NSFObjectClass) FROM NSFKeys"];
+    for (NSString *key in uniqueKeys) {
+        id object = [objects objectForKey:key];
+        if (nil != object) {
+            [orderedObjects addObject:object];
+        }
+    }
     
-    return [results valuesForColumn:@"NSFKeys.NSFObjectClass"];
+    return orderedObjects;
 }
 
-- (NSArray *)objectsOfClassNamed:(NSString *)theClassName
+- (NSArray *)orderedObjectsWithKeysInArray:(NSArray *)someKeys
 {
-    return [self objectsOfClassNamed:theClassName usingSortDescriptors:nil];
+    if (nil == someKeys)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: someKeys is nil.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    NSDictionary *objects = [self _objectsByKeyForKeys:[[NSOrderedSet orderedSetWithArray:someKeys]array]];
+    
+    return [objects objectsForKeys:someKeys notFoundMarker:[NSNull null]];
 }
 
-- (NSArray *)objectsOfClassNamed:(NSString *)theClassName usingSortDescriptors:(NSArray *)theSortDescriptors
+- (NSArray *)keysOfObjectsDifferingFromStore:(NSFNanoStore *)theStore
+{
+    if (nil == theStore)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theStore is nil.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if ((YES == [self isClosed]) || (YES == [theStore isClosed])) {
+        return nil;
+    }
+    
+    // Only the keys, hashes and classes are compared: no object is decoded
+    NSDictionary *ourHashes = [self _storedHashesForKeys:nil];
+    NSDictionary *theirHashes = [theStore _storedHashesForKeys:nil];
+    if ((nil == ourHashes) || (nil == theirHashes)) {
+        return nil;
+    }
+    
+    NSMutableArray *differingKeys = [NSMutableArray new];
+    
+    for (NSString *key in ourHashes) {
+        NSArray *theirHash = [theirHashes objectForKey:key];
+        if ((nil == theirHash) || (NO == [theirHash isEqualToArray:[ourHashes objectForKey:key]])) {
+            [differingKeys addObject:key];
+        }
+    }
+    
+    for (NSString *key in theirHashes) {
+        if (nil == [ourHashes objectForKey:key]) {
+            [differingKeys addObject:key];
+        }
+    }
+    
+    return differingKeys;
+}
+
+- (NSArray *)allObjectClasses
+{
+    NSFNanoResult *results = [self _executeSQL:@"SELECT DISTINCT(NSFObjectClass) FROM NSFKeys"];
+    
+    return [results valuesForColumn:@"NSFKeys.NSFObjectClass"];
+}
+
+- (NSArray *)objectsOfClassNamed:(NSString *)theClassName
+{
+    return [self objectsOfClassNamed:theClassName usingSortDescriptors:nil];
+}
+
+- (NSArray *)objectsOfClassNamed:(NSString *)theClassName usingSortDescriptors:(NSArray *)theSortDescriptors
 {
     if (nil == theClassName) {
         [[NSException exceptionWithName:NSFUnexpectedParameterException
@@ -465,6 +957,12 @@
                                userInfo:nil]raise];
     }
     
+    // A materialized count per class answers with a single row
+    NSNumber *materializedCount = [self _materializedCountOfObjectsOfClassNamed:theClassName];
+    if (nil != materializedCount) {
+        return [materializedCount longLongValue];
+    }
+    
     NSFNanoSearch *search = [NSFNanoSearch searchWithStore:self];
     
     NSString *theSQLStatement = [NSString stringWithFormat:@"SELECT count(*) FROM NSFKeys WHERE NSFObjectClass = \"%@\"", theClassName];
@@ -473,6 +971,227 @@
     return [[results firstValue]longLongValue];
 }
 
+#pragma mark Materialized Aggregates
+
+- (BOOL)materializeAggregateNamed:(NSString *)theName function:(NSFAggregateFunctionType)theFunctionType onAttribute:(NSString *)theAttribute groupedByAttribute:(NSString *)theGroupingAttribute error:(out NSError **)outError
+{
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
+        return NO;
+    
+    if (0 == [theName length])
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theName is nil or empty.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    // Minimums and maximums can't be kept current once their value is removed, so only the sums are materialized
+    if ((NSFCount != theFunctionType) && (NSFTotal != theFunctionType) && (NSFAverage != theFunctionType))
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: only NSFCount, NSFTotal and NSFAverage can be materialized.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if ((nil == theAttribute) && (NSFCount != theFunctionType))
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: the attribute can only be omitted when counting objects.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if ((nil != theAttribute) && (YES == [theAttribute isEqualToString:theGroupingAttribute]))
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: an attribute cannot be grouped by itself.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    BOOL transactionStartedHere = [self beginTransactionAndReturnError:nil];
+    
+    BOOL success = [self _setupMaterializedAggregatesSchema];
+    
+    if (YES == success) {
+        // Redefining an aggregate replaces it, triggers included
+        [self removeMaterializedAggregateNamed:theName error:nil];
+        
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(NSFP_Name, NSFP_Function, NSFP_Attribute, NSFP_GroupingAttribute) VALUES (?, ?, ?, ?);", NSFP_AggregateDefinitionsTable];
+        sqlite3_stmt *statement;
+        success = [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement];
+        if (YES == success) {
+            sqlite3_bind_text (statement, 1, [theName UTF8String], -1, SQLITE_TRANSIENT);
+            sqlite3_bind_int (statement, 2, theFunctionType);
+            if (nil != theAttribute) {
+                sqlite3_bind_text (statement, 3, [theAttribute UTF8String], -1, SQLITE_TRANSIENT);
+            }
+            if (nil != theGroupingAttribute) {
+                sqlite3_bind_text (statement, 4, [theGroupingAttribute UTF8String], -1, SQLITE_TRANSIENT);
+            }
+            success = (SQLITE_DONE == [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_step (statement)]);
+            sqlite3_finalize (statement);
+        }
+    }
+    
+    if (YES == success) {
+        long long identifier = sqlite3_last_insert_rowid ([[self nanoStoreEngine]sqlite]);
+        success = [self _recomputeMaterializedAggregateNamed:theName attribute:theAttribute groupingAttribute:theGroupingAttribute];
+        for (NSString *triggerStatement in [self _materializedAggregateTriggersForIdentifier:identifier name:theName attribute:theAttribute groupingAttribute:theGroupingAttribute]) {
+            if (NO == success) {
+                break;
+            }
+            success = (nil == [[self _executeSQL:triggerStatement]error]);
+        }
+    }
+    
+    if (YES == success) {
+        if (transactionStartedHere)
+            if ([self commitTransactionAndReturnError:nil] == NO)
+                _NSFLog(@"          Could not commit the transaction.");
+        return YES;
+    }
+    
+    if (transactionStartedHere)
+        [self rollbackTransactionAndReturnError:nil];
+    
+    if (nil != outError) {
+        *outError = [NSError errorWithDomain:NSFDomainKey
+                                        code:NSFNanoStoreErrorKey
+                                    userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the aggregate %@ could not be materialized.", [self class], _cmd, theName]
+                                                                         forKey:NSLocalizedFailureReasonErrorKey]];
+    }
+    
+    return NO;
+}
+
+- (BOOL)removeMaterializedAggregateNamed:(NSString *)theName error:(out NSError **)outError
+{
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
+        return NO;
+    
+    if (nil == theName)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theName is nil.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    for (NSDictionary *definition in [self _materializedAggregateDefinitions]) {
+        if (NO == [theName isEqualToString:[definition objectForKey:@"NSFP_Name"]]) {
+            continue;
+        }
+        
+        [self _dropMaterializedAggregateTriggersForIdentifier:[[definition objectForKey:NSFRowIDColumnName]longLongValue]];
+        
+        NSString *literal = [NSFNanoStore _SQLLiteralForString:theName];
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE NSFP_Name = %@;", NSFP_AggregatesTable, literal];
+        NSError *resultValues = [[self _executeSQL:theSQLStatement]error];
+        theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE NSFP_Name = %@;", NSFP_AggregateDefinitionsTable, literal];
+        NSError *resultDefinition = [[self _executeSQL:theSQLStatement]error];
+        
+        if ((nil != resultValues) || (nil != resultDefinition)) {
+            if (nil != outError) {
+                *outError = [NSError errorWithDomain:NSFDomainKey
+                                                code:NSFNanoStoreErrorKey
+                                            userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the aggregate %@ could not be removed.", [self class], _cmd, theName]
+                                                                                 forKey:NSLocalizedFailureReasonErrorKey]];
+            }
+            return NO;
+        }
+    }
+    
+    return YES;
+}
+
+- (NSNumber *)valueOfMaterializedAggregateNamed:(NSString *)theName forGroup:(id)theGroupValue
+{
+    if ((nil == theName) || (nil == theGroupValue))
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: the name and the group are required.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if (YES == [self isClosed]) {
+        return nil;
+    }
+    
+    // Both tables are read through their primary keys: the aggregate is never recomputed
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT d.NSFP_Function, a.NSFP_Count, a.NSFP_Total FROM %@ d LEFT JOIN %@ a ON a.NSFP_Name = d.NSFP_Name AND a.NSFP_Group = ?2 WHERE d.NSFP_Name = ?1;", NSFP_AggregateDefinitionsTable, NSFP_AggregatesTable];
+    sqlite3_stmt *statement;
+    if (NO == [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement]) {
+        return nil;
+    }
+    
+    sqlite3_bind_text (statement, 1, [theName UTF8String], -1, SQLITE_TRANSIENT);
+    [self _bindMaterializedAggregateGroup:theGroupValue parameterNumber:2 usingSQLite3Statement:statement];
+    
+    NSNumber *value = nil;
+    if (SQLITE_ROW == sqlite3_step (statement)) {
+        value = [NSFNanoStore _valueOfMaterializedAggregateFunction:sqlite3_column_int (statement, 0) count:sqlite3_column_int64 (statement, 1) total:sqlite3_column_double (statement, 2)];
+    }
+    
+    sqlite3_finalize (statement);
+    
+    return value;
+}
+
+- (NSDictionary *)valuesOfMaterializedAggregateNamed:(NSString *)theName
+{
+    if (nil == theName)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theName is nil.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if (YES == [self isClosed]) {
+        return nil;
+    }
+    
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT d.NSFP_Function, a.NSFP_Count, a.NSFP_Total, a.NSFP_Group FROM %@ d JOIN %@ a ON a.NSFP_Name = d.NSFP_Name WHERE d.NSFP_Name = ?1;", NSFP_AggregateDefinitionsTable, NSFP_AggregatesTable];
+    sqlite3_stmt *statement;
+    if (NO == [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement]) {
+        return nil;
+    }
+    
+    sqlite3_bind_text (statement, 1, [theName UTF8String], -1, SQLITE_TRANSIENT);
+    
+    NSMutableDictionary *values = [NSMutableDictionary dictionary];
+    while (SQLITE_ROW == sqlite3_step (statement)) {
+        NSNumber *value = [NSFNanoStore _valueOfMaterializedAggregateFunction:sqlite3_column_int (statement, 0) count:sqlite3_column_int64 (statement, 1) total:sqlite3_column_double (statement, 2)];
+        [values setObject:value forKey:[NSFNanoSearch _valueForColumn:3 ofSQLite3Statement:statement]];
+    }
+    
+    sqlite3_finalize (statement);
+    
+    return values;
+}
+
+- (BOOL)rebuildMaterializedAggregatesAndReturnError:(out NSError **)outError
+{
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
+        return NO;
+    
+    BOOL transactionStartedHere = [self beginTransactionAndReturnError:nil];
+    BOOL success = YES;
+    
+    for (NSDictionary *definition in [self _materializedAggregateDefinitions]) {
+        id attribute = [definition objectForKey:@"NSFP_Attribute"];
+        id groupingAttribute = [definition objectForKey:@"NSFP_GroupingAttribute"];
+        success = [self _recomputeMaterializedAggregateNamed:[definition objectForKey:@"NSFP_Name"]
+                                                   attribute:([NSNull null] == attribute) ? nil : attribute
+                                           groupingAttribute:([NSNull null] == groupingAttribute) ? nil : groupingAttribute];
+        if (NO == success) {
+            break;
+        }
+    }
+    
+    if (YES == success) {
+        if (transactionStartedHere)
+            if ([self commitTransactionAndReturnError:nil] == NO)
+                _NSFLog(@"          Could not commit the transaction.");
+        return YES;
+    }
+    
+    if (transactionStartedHere)
+        [self rollbackTransactionAndReturnError:nil];
+    
+    if (nil != outError) {
+        *outError = [NSError errorWithDomain:NSFDomainKey
+                                        code:NSFNanoStoreErrorKey
+                                    userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the materialized aggregates could not be rebuilt.", [self class], _cmd]
+                                                                         forKey:NSLocalizedFailureReasonErrorKey]];
+    }
+    
+    return NO;
+}
+
 #pragma mark Database Optimizations and Maintenance
 
 - (BOOL)beginTransactionAndReturnError:(out NSError **)outError
@@ -546,14 +1265,23 @@
     if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
         return NO;
     
+    [self clearCache];
+    
     NSError *resultKeys = [[self _executeSQL:[NSString stringWithFormat:@"DROP TABLE %@", NSFKeys]]error];
     NSError *resultValues = [[self _executeSQL:[NSString stringWithFormat:@"DROP TABLE %@", NSFValues]]error];
+    NSError *resultMembers = [[self _executeSQL:[NSString stringWithFormat:@"DROP TABLE %@", NSFBagMembers]]error];
+    NSError *resultBlobs = [[self _executeSQL:[NSString stringWithFormat:@"DROP TABLE %@", NSFBlobs]]error];
+    
+    // The materialized aggregates stay defined, but there's nothing left to aggregate
+    if ([[[self nanoStoreEngine]NSFP_flattenAllTables]containsObject:NSFP_AggregatesTable]) {
+        [self _executeSQL:[NSString stringWithFormat:@"DELETE FROM %@", NSFP_AggregatesTable]];
+    }
     
     [self _setupCachingSchema];
     
     [self rebuildIndexesAndReturnError:nil];
     
-    if ((nil != resultKeys) || (nil != resultValues)) {
+    if ((nil != resultKeys) || (nil != resultValues) || (nil != resultMembers) || (nil != resultBlobs)) {
         if (nil != outError) {
             *outError = [NSError errorWithDomain:NSFDomainKey
                                             code:NSFNanoStoreErrorKey
@@ -611,10 +1339,17 @@
     _NSFLog(@"     [[self nanoStoreEngine]createIndexForColumn: NSFKey table: NSFValues isUnique:NO]: %@", [[self nanoStoreEngine]createIndexForColumn:NSFKey table:NSFValues isUnique:NO] ? @"YES" : @"NO");
     _NSFLog(@"     [[self nanoStoreEngine]createIndexForColumn: NSFAttribute table: NSFValues isUnique:NO]: %@", [[self nanoStoreEngine]createIndexForColumn:NSFAttribute table:NSFValues isUnique:NO] ? @"YES" : @"NO");
     _NSFLog(@"     [[self nanoStoreEngine]createIndexForColumn: NSFValue table: NSFValues isUnique:NO]: %@", [[self nanoStoreEngine]createIndexForColumn:NSFValue table:NSFValues isUnique:NO] ? @"YES" : @"NO");
+    _NSFLog(@"     [[self nanoStoreEngine]createIndexForColumns: (NSFAttribute, NSFValue) table: NSFValues isUnique:NO]: %@", [[self nanoStoreEngine]createIndexForColumns:[NSArray arrayWithObjects:NSFAttribute, NSFValue, nil] table:NSFValues isUnique:NO] ? @"YES" : @"NO");
+    _NSFLog(@"     [[self nanoStoreEngine]createIndexForColumns: (NSFAttribute, NSFTimestamp) table: NSFValues isUnique:NO]: %@", [[self nanoStoreEngine]createIndexForColumns:[NSArray arrayWithObjects:NSFAttribute, NSFTimestamp, nil] table:NSFValues isUnique:NO] ? @"YES" : @"NO");
     
     _NSFLog(@"     [[self nanoStoreEngine]createIndexForColumn: NSFKey table: NSFKeys isUnique:YES]: %@", [[self nanoStoreEngine]createIndexForColumn:NSFKey table:NSFKeys isUnique:YES] ? @"YES" : @"NO");
     _NSFLog(@"     [[self nanoStoreEngine]createIndexForColumn: NSFCalendarDate table: NSFKeys isUnique:NO]: %@", [[self nanoStoreEngine]createIndexForColumn:NSFCalendarDate table:NSFKeys isUnique:NO] ? @"YES" : @"NO");
     _NSFLog(@"     [[self nanoStoreEngine]createIndexForColumn: NSFObjectClass table: NSFKeys isUnique:NO]: %@", [[self nanoStoreEngine]createIndexForColumn:NSFObjectClass table:NSFKeys isUnique:NO] ? @"YES" : @"NO");
+    _NSFLog(@"     [[self nanoStoreEngine]createIndexForColumn: NSFTimestamp table: NSFKeys isUnique:NO]: %@", [[self nanoStoreEngine]createIndexForColumn:NSFTimestamp table:NSFKeys isUnique:NO] ? @"YES" : @"NO");
+    
+    _NSFLog(@"     [[self nanoStoreEngine]createIndexForColumns: (NSFKey, NSFObjectKey) table: NSFBagMembers isUnique:YES]: %@", [[self nanoStoreEngine]createIndexForColumns:[NSArray arrayWithObjects:NSFKey, NSFObjectKey, nil] table:NSFBagMembers isUnique:YES] ? @"YES" : @"NO");
+    _NSFLog(@"     [[self nanoStoreEngine]createIndexForColumn: NSFObjectKey table: NSFBagMembers isUnique:NO]: %@", [[self nanoStoreEngine]createIndexForColumn:NSFObjectKey table:NSFBagMembers isUnique:NO] ? @"YES" : @"NO");
+    _NSFLog(@"     [self _createBagNamesIndex]: %@", [self _createBagNamesIndex] ? @"YES" : @"NO");
 
     NSTimeInterval seconds = [[NSDate date]timeIntervalSinceDate:startDate];    
     _NSFLog(@"Done. Rebuilding the indexes took %.3f seconds", seconds);
@@ -622,192 +1357,1867 @@
     return YES;
 }
 
-- (BOOL)saveStoreToDirectoryAtPath:(NSString *)path compactDatabase:(BOOL)compact error:(out NSError **)outError
+- (BOOL)trainCompressionDictionaryWithSampleSize:(NSUInteger)theSampleSize error:(out NSError **)outError
 {
-    if (nil == path)
+    if (theSampleSize < 2)
         [[NSException exceptionWithName:NSFUnexpectedParameterException
-                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: path is nil.", [self class], _cmd]
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theSampleSize must be at least 2.", [self class], _cmd]
                                userInfo:nil]raise];
     
-    // Make sure we've expanded the tilde
-    path = [path stringByExpandingTildeInPath];
-    
     if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
         return NO;
     
-    if ([[self nanoStoreEngine]isTransactionActive]) {
+    // Sample the stored documents, whatever the form they were stored in
+    NSMutableArray *samples = [NSMutableArray arrayWithCapacity:theSampleSize];
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT %@ FROM %@ ORDER BY random() LIMIT %lu;", NSFPlist, NSFKeys, (unsigned long)theSampleSize];
+    sqlite3_stmt *statement;
+    if (YES == [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement]) {
+        while (SQLITE_ROW == sqlite3_step (statement)) {
+            NSData *plistData = [NSFNanoEngine NSFP_plistDataFromBytes:sqlite3_column_blob (statement, 0) length:sqlite3_column_bytes (statement, 0)];
+            if ([plistData length] > 0) {
+                [samples addObject:[plistData copy]];
+            }
+        }
+        sqlite3_finalize (statement);
+    }
+    
+    NSData *dictionary = ([samples count] > 1) ? [NSFNanoEngine NSFP_compressionDictionaryFromSamples:samples] : nil;
+    if (nil == dictionary) {
         if (nil != outError)
             *outError = [NSError errorWithDomain:NSFDomainKey
                                             code:NSFNanoStoreErrorKey
-                                        userInfo:[NSDictionary dictionaryWithObject:@"Cannot backup store. A transaction is still open."
-                                                                             forKey:NSLocalizedDescriptionKey]];
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the stored documents don't have enough in common to train a dictionary.", [self class], _cmd]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
         return NO;
     }
     
-    if ([[self filePath]isEqualToString:NSFMemoryDatabase] == YES) {
-        return [self _backupMemoryStoreToDirectoryAtPath:path extension:nil compact:compact error:outError];
-    } else {
-        return [self _backupFileStoreToDirectoryAtPath:path extension:nil compact:compact error:outError];
+    // Dictionaries are never removed: the rows compressed with the previous ones still need them
+    theSQLStatement = [[NSString alloc]initWithFormat:@"CREATE TABLE IF NOT EXISTS %@(ROWID INTEGER PRIMARY KEY, NSFP_Dictionary BLOB);", NSFP_CompressionDictionariesTable];
+    NSFNanoResult *result = [self _executeSQL:theSQLStatement];
+    if (nil != [result error]) {
+        if (nil != outError)
+            *outError = [result error];
+        return NO;
     }
     
-    return NO;
+    theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(NSFP_Dictionary) VALUES (?);", NSFP_CompressionDictionariesTable];
+    BOOL success = [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement];
+    if (YES == success) {
+        success = (sqlite3_bind_blob (statement, 1, [dictionary bytes], (int)[dictionary length], SQLITE_STATIC) == SQLITE_OK);
+        success = success && (SQLITE_DONE == [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_step (statement)]);
+        sqlite3_finalize (statement);
+    }
+    
+    if (NO == success) {
+        if (nil != outError)
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the dictionary could not be stored: %s", [self class], _cmd, sqlite3_errmsg([[self nanoStoreEngine]sqlite])]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        return NO;
+    }
+    
+    [[self nanoStoreEngine]NSFP_setCompressionDictionary:dictionary];
+    
+    return YES;
 }
 
-#pragma mark - Private Methods
-
-/** \cond */
-
-+ (NSFNanoStore *)_createAndOpenDebugDatabase
+- (BOOL)recompressStoredDocumentsAndReturnError:(out NSError **)outError
 {
-    NSFNanoStore *db =  [NSFNanoStore createStoreWithType:NSFPersistentStoreType path:[@"~/Desktop/NanoStoreDebug.db" stringByExpandingTildeInPath]];
-    NSError *outError = nil;
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
+        return NO;
     
-    if (NO == [db openWithError:&outError]) {
-        [[NSException exceptionWithName:NSFNanoStoreUnableToManipulateStoreException
-                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: could not open the database. Reason: %@", [self class], _cmd, [outError localizedDescription]]
-                               userInfo:nil]raise];
+    // NSFP_compressPlist writes each document the way it would be written now, so this also decompresses them when compression is off
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"UPDATE %@ SET %@ = NSFP_compressPlist(%@);", NSFKeys, NSFPlist, NSFPlist];
+    NSFNanoResult *result = [self _executeSQL:theSQLStatement];
+    if (nil != [result error]) {
+        if (nil != outError)
+            *outError = [result error];
+        return NO;
     }
     
-    return db;
+    return YES;
 }
 
-- (NSFNanoResult *)_executeSQL:(NSString *)theSQLStatement
+// ----------------------------------------------
+// Blobs
+// ----------------------------------------------
+
+- (NSFNanoBlob *)addBlobWithData:(NSData *)theData error:(out NSError **)outError
 {
-    if (nil == theSQLStatement)
+    if (nil == theData)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theData is nil.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
         return nil;
     
-    return [[self nanoStoreEngine]executeSQL:theSQLStatement];
-}
-
-- (BOOL)_initializePreparedStatementsWithError:(out NSError **)outError
-{
-    BOOL hasInitializationSucceeded = YES;
+    NSString *failureReason = nil;
+    NSFNanoBlob *blob = nil;
     
-    if (NULL == _storeValuesStatement) {
-        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(%@, %@, %@, %@) VALUES (?,?,?,?);", NSFValues, NSFKey, NSFAttribute, NSFValue, NSFDatatype];
-        hasInitializationSucceeded = [self _prepareSQLite3Statement:&_storeValuesStatement theSQLStatement:theSQLStatement];
+    if ([theData length] > INT_MAX) {
+        failureReason = @"the blob is too large";
+    } else {
+        unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+        CC_SHA256 ([theData bytes], (CC_LONG)[theData length], digest);
+        blob = [NSFNanoBlob blobWithContentHash:__NSFPStringFromSHA256Digest(digest) length:[theData length]];
         
-        if ((nil != outError) && (NO == hasInitializationSucceeded)) {
-            *outError = [NSError errorWithDomain:NSFDomainKey
-                                            code:NSFNanoStoreErrorKey
-                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: failed to prepare _storeValuesStatement.", [self class], _cmd]
-                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        // The same bytes are only stored once
+        if (0 == [self _rowIDOfBlobWithHash:blob.contentHash]) {
+            NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(%@, %@, %@) VALUES (?, ?, ?);", NSFBlobs, NSFHash, NSFLength, NSFData];
+            sqlite3_stmt *statement;
+            BOOL success = [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement];
+            if (YES == success) {
+                success = ((sqlite3_bind_text (statement, 1, [blob.contentHash UTF8String], -1, SQLITE_TRANSIENT) == SQLITE_OK) &&
+                           (sqlite3_bind_int64 (statement, 2, (sqlite3_int64)[theData length]) == SQLITE_OK) &&
+                           (sqlite3_bind_blob (statement, 3, [theData bytes], (int)[theData length], SQLITE_STATIC) == SQLITE_OK) &&
+                           (SQLITE_DONE == [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_step (statement)]));
+                sqlite3_finalize (statement);
+            }
+            
+            if (NO == success) {
+                failureReason = [NSString stringWithUTF8String:sqlite3_errmsg ([[self nanoStoreEngine]sqlite])];
+            }
+        }
+        
+        if (nil == failureReason) {
+            [_pendingBlobHashes addObject:blob.contentHash];
         }
     }
     
-    if ((NULL == _storeKeysStatement) && (YES == hasInitializationSucceeded)) {
-        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(%@, %@, %@, %@) VALUES (?,?,?,?);", NSFKeys, NSFKey, NSFPlist, NSFCalendarDate, NSFObjectClass];
-        hasInitializationSucceeded = [self _prepareSQLite3Statement:&_storeKeysStatement theSQLStatement:theSQLStatement];
-        
-        if ((nil != outError) && (NO == hasInitializationSucceeded)) {
+    if (nil != failureReason) {
+        if (nil != outError)
             *outError = [NSError errorWithDomain:NSFDomainKey
                                             code:NSFNanoStoreErrorKey
-                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: failed to prepare _storeKeysStatement.", [self class], _cmd]
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: %@.", [self class], _cmd, failureReason]
                                                                              forKey:NSLocalizedFailureReasonErrorKey]];
-        }
+        return nil;
     }
     
-    return hasInitializationSucceeded;
-}
-
-- (void)_releasePreparedStatements
-{
-    if (_storeValuesStatement != NULL) { sqlite3_finalize(_storeValuesStatement);_storeValuesStatement = NULL; }
-    if (_storeKeysStatement != NULL) { sqlite3_finalize(_storeKeysStatement);_storeKeysStatement = NULL; }
+    return blob;
 }
 
-- (void)_setIsOurTransaction:(BOOL)value
+- (NSFNanoBlob *)addBlobFromInputStream:(NSInputStream *)theStream length:(unsigned long long)theLength error:(out NSError **)outError
 {
-    if (_isOurTransaction != value) {
-        _isOurTransaction = value;
+    if (nil == theStream)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theStream is nil.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
+        return nil;
+    
+    if (theLength > INT_MAX) {
+        if (nil != outError)
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the blob is too large.", [self class], _cmd]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        return nil;
+    }
+    
+    sqlite3 *sqliteDatabase = [[self nanoStoreEngine]sqlite];
+    NSString *failureReason = nil;
+    NSFNanoBlob *blob = nil;
+    
+    BOOL transactionStartedHere = [self beginTransactionAndReturnError:nil];
+    
+    // Reserve the space first, so the bytes can be written in place one chunk at a time. The hash is only known at the end.
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(%@, %@, %@) VALUES (NULL, ?1, zeroblob(?1));", NSFBlobs, NSFHash, NSFLength, NSFData];
+    sqlite3_stmt *statement;
+    BOOL success = [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement];
+    if (YES == success) {
+        success = ((sqlite3_bind_int64 (statement, 1, (sqlite3_int64)theLength) == SQLITE_OK) &&
+                   (SQLITE_DONE == [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_step (statement)]));
+        sqlite3_finalize (statement);
+    }
+    
+    sqlite3_int64 rowID = sqlite3_last_insert_rowid (sqliteDatabase);
+    sqlite3_blob *sqliteBlob = NULL;
+    if ((NO == success) || (SQLITE_OK != sqlite3_blob_open (sqliteDatabase, "main", [NSFBlobs UTF8String], [NSFData UTF8String], rowID, 1, &sqliteBlob))) {
+        failureReason = [NSString stringWithUTF8String:sqlite3_errmsg (sqliteDatabase)];
+    } else {
+        if (NSStreamStatusNotOpen == [theStream streamStatus]) {
+            [theStream open];
+        }
+        
+        CC_SHA256_CTX context;
+        CC_SHA256_Init (&context);
+        uint8_t *buffer = malloc (__NSFPBlobChunkSize);
+        unsigned long long offset = 0;
+        
+        while ((nil == failureReason) && (offset < theLength)) {
+            NSInteger bytesRead = [theStream read:buffer maxLength:(NSUInteger)MIN(__NSFPBlobChunkSize, theLength - offset)];
+            if (bytesRead <= 0) {
+                failureReason = @"the stream ended before the expected length";
+            } else if (SQLITE_OK != sqlite3_blob_write (sqliteBlob, buffer, (int)bytesRead, (int)offset)) {
+                failureReason = [NSString stringWithUTF8String:sqlite3_errmsg (sqliteDatabase)];
+            } else {
+                CC_SHA256_Update (&context, buffer, (CC_LONG)bytesRead);
+                offset += bytesRead;
+            }
+        }
+        
+        free (buffer);
+        sqlite3_blob_close (sqliteBlob);
+        
+        unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+        CC_SHA256_Final (digest, &context);
+        blob = [NSFNanoBlob blobWithContentHash:__NSFPStringFromSHA256Digest(digest) length:theLength];
+    }
+    
+    // Now that the hash is known, keep the copy which was already stored (if any) and drop this one
+    if (nil == failureReason) {
+        NSString *rowIDString = [NSString stringWithFormat:@"%lld", (long long)rowID];
+        if (0 != [self _rowIDOfBlobWithHash:blob.contentHash]) {
+            theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE ROWID = ?;", NSFBlobs];
+            success = [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement] && [self _stepSQLite3Statement:statement bindingTexts:[NSArray arrayWithObject:rowIDString]];
+        } else {
+            theSQLStatement = [[NSString alloc]initWithFormat:@"UPDATE %@ SET %@ = ? WHERE ROWID = ?;", NSFBlobs, NSFHash];
+            success = [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement] && [self _stepSQLite3Statement:statement bindingTexts:[NSArray arrayWithObjects:blob.contentHash, rowIDString, nil]];
+        }
+        sqlite3_finalize (statement);
+        
+        if (NO == success) {
+            failureReason = [NSString stringWithUTF8String:sqlite3_errmsg (sqliteDatabase)];
+        }
     }
+    
+    if (nil == failureReason) {
+        if (transactionStartedHere)
+            if ([self commitTransactionAndReturnError:nil] == NO)
+                _NSFLog(@"          Could not commit the transaction.");
+        [_pendingBlobHashes addObject:blob.contentHash];
+        return blob;
+    }
+    
+    if (transactionStartedHere)
+        [self rollbackTransactionAndReturnError:nil];
+    
+    if (nil != outError)
+        *outError = [NSError errorWithDomain:NSFDomainKey
+                                        code:NSFNanoStoreErrorKey
+                                    userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: %@.", [self class], _cmd, failureReason]
+                                                                         forKey:NSLocalizedFailureReasonErrorKey]];
+    
+    return nil;
 }
 
-- (BOOL)_isOurTransaction
+- (NSData *)dataOfBlob:(NSFNanoBlob *)theBlob error:(out NSError **)outError
 {
-    return _isOurTransaction;
+    if (nil == theBlob)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theBlob is nil.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    return [self dataOfBlob:theBlob inRange:NSMakeRange(0, (NSUInteger)theBlob.length) error:outError];
 }
 
-- (NSString*)_nestedDescriptionWithPrefixedSpace:(NSString *)prefixedSpace
+- (NSData *)dataOfBlob:(NSFNanoBlob *)theBlob inRange:(NSRange)theRange error:(out NSError **)outError
 {
-    if (nil == prefixedSpace) {
-        prefixedSpace = @"";
+    if (nil == theBlob)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theBlob is nil.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
+        return nil;
+    
+    sqlite3_blob *sqliteBlob = [self _openBlob:theBlob error:outError];
+    if (NULL == sqliteBlob) {
+        return nil;
     }
     
-    NSMutableString *description = [NSMutableString string];
-    [description appendString:@"\n"];
-    [description appendString:[NSString stringWithFormat:@"%@NanoStore address      : 0x%x\n", prefixedSpace, self]];
-    [description appendString:[NSString stringWithFormat:@"%@Is our transaction?    : %@\n", prefixedSpace, (_isOurTransaction ? @"Yes" : @"No")]];
-    [description appendString:[NSString stringWithFormat:@"%@Save interval           : %ld\n", prefixedSpace, (saveInterval == 0 ? 1 : saveInterval)]];
-    [description appendString:[NSString stringWithFormat:@"%@Engine                 : %@\n", prefixedSpace, [nanoStoreEngine NSFP_nestedDescriptionWithPrefixedSpace:@"          "]]];
+    if (NSMaxRange(theRange) > (NSUInteger)sqlite3_blob_bytes (sqliteBlob)) {
+        sqlite3_blob_close (sqliteBlob);
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theRange is beyond the end of the blob.", [self class], _cmd]
+                               userInfo:nil]raise];
+    }
     
-    return description;
+    NSMutableData *data = [NSMutableData dataWithLength:theRange.length];
+    int status = sqlite3_blob_read (sqliteBlob, [data mutableBytes], (int)theRange.length, (int)theRange.location);
+    sqlite3_blob_close (sqliteBlob);
+    
+    if (SQLITE_OK != [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status]) {
+        if (nil != outError)
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: %s.", [self class], _cmd, sqlite3_errmsg ([[self nanoStoreEngine]sqlite])]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        return nil;
+    }
+    
+    return data;
 }
 
-- (BOOL)_checkNanoStoreIsReadyAndReturnError:(out NSError **)outError
+- (BOOL)writeBlob:(NSFNanoBlob *)theBlob toOutputStream:(NSOutputStream *)theStream error:(out NSError **)outError
 {
-    if (nil == [self nanoStoreEngine]) {
+    if (nil == theBlob)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theBlob is nil.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if (nil == theStream)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: theStream is nil.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
+        return NO;
+    
+    sqlite3_blob *sqliteBlob = [self _openBlob:theBlob error:outError];
+    if (NULL == sqliteBlob) {
+        return NO;
+    }
+    
+    if (NSStreamStatusNotOpen == [theStream streamStatus]) {
+        [theStream open];
+    }
+    
+    // Only one chunk is ever in memory
+    NSString *failureReason = nil;
+    uint8_t *buffer = malloc (__NSFPBlobChunkSize);
+    int length = sqlite3_blob_bytes (sqliteBlob);
+    int offset = 0;
+    
+    while ((nil == failureReason) && (offset < length)) {
+        int chunkLength = (int)MIN(__NSFPBlobChunkSize, (NSUInteger)(length - offset));
+        if (SQLITE_OK != sqlite3_blob_read (sqliteBlob, buffer, chunkLength, offset)) {
+            failureReason = [NSString stringWithUTF8String:sqlite3_errmsg ([[self nanoStoreEngine]sqlite])];
+            break;
+        }
+        
+        NSInteger bytesWritten = 0;
+        while (bytesWritten < chunkLength) {
+            NSInteger result = [theStream write:buffer + bytesWritten maxLength:chunkLength - bytesWritten];
+            if (result <= 0) {
+                failureReason = @"the stream didn't accept the bytes";
+                break;
+            }
+            bytesWritten += result;
+        }
+        
+        offset += chunkLength;
+    }
+    
+    free (buffer);
+    sqlite3_blob_close (sqliteBlob);
+    
+    if (nil != failureReason) {
         if (nil != outError)
             *outError = [NSError errorWithDomain:NSFDomainKey
                                             code:NSFNanoStoreErrorKey
-                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the NSF store has not been set.", [self class], _cmd]
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: %@.", [self class], _cmd, failureReason]
                                                                              forKey:NSLocalizedFailureReasonErrorKey]];
         return NO;
     }
     
-    if ([[self nanoStoreEngine]isDatabaseOpen] == NO) {
+    return YES;
+}
+
+- (BOOL)removeUnreferencedBlobsAndReturnError:(out NSError **)outError
+{
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
+        return NO;
+    
+    // The blobs added since the store was opened are kept until an object referencing them is saved
+    NSMutableString *pendingClause = [NSMutableString string];
+    if ([_pendingBlobHashes count] > 0) {
+        NSMutableArray *pendingHashes = [NSMutableArray arrayWithCapacity:[_pendingBlobHashes count]];
+        for (NSString *hash in _pendingBlobHashes) {
+            [pendingHashes addObject:[NSFNanoStore _SQLLiteralForString:hash]];
+        }
+        [pendingClause appendFormat:@" AND %@ NOT IN (%@)", NSFHash, [pendingHashes componentsJoinedByString:@", "]];
+    }
+    
+    // References are indexed like any other value, so a blob is still in use if its hash is found in NSFValues. A NULL hash
+    // belongs to a streamed blob which never completed.
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE %@ IS NULL OR (NOT EXISTS (SELECT 1 FROM %@ v WHERE v.%@ = %@.%@ AND (v.%@ = '%@' OR v.%@ LIKE '%%.%@'))%@);",
+                                 NSFBlobs, NSFHash, NSFValues, NSFValue, NSFBlobs, NSFHash, NSFAttribute, NSF_Private_NSFNanoBlob_Hash, NSFAttribute, NSF_Private_NSFNanoBlob_Hash, pendingClause];
+    NSFNanoResult *result = [self _executeSQL:theSQLStatement];
+    if (nil != [result error]) {
+        if (nil != outError)
+            *outError = [result error];
+        return NO;
+    }
+    
+    return YES;
+}
+
+- (BOOL)saveStoreToDirectoryAtPath:(NSString *)path compactDatabase:(BOOL)compact error:(out NSError **)outError
+{
+    if (nil == path)
+        [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: path is nil.", [self class], _cmd]
+                               userInfo:nil]raise];
+    
+    // Make sure we've expanded the tilde
+    path = [path stringByExpandingTildeInPath];
+    
+    if ([self _checkNanoStoreIsReadyAndReturnError:outError] == NO)
+        return NO;
+    
+    if ([[self nanoStoreEngine]isTransactionActive]) {
         if (nil != outError)
             *outError = [NSError errorWithDomain:NSFDomainKey
                                             code:NSFNanoStoreErrorKey
-                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the store is not open.", [self class], _cmd]
-                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+                                        userInfo:[NSDictionary dictionaryWithObject:@"Cannot backup store. A transaction is still open."
+                                                                             forKey:NSLocalizedDescriptionKey]];
         return NO;
     }
     
-    return YES;
+    if ([[self filePath]isEqualToString:NSFMemoryDatabase] == YES) {
+        return [self _backupMemoryStoreToDirectoryAtPath:path extension:nil compact:compact error:outError];
+    } else {
+        return [self _backupFileStoreToDirectoryAtPath:path extension:nil compact:compact error:outError];
+    }
+    
+    return NO;
 }
 
-- (BOOL)_setupCachingSchema
+#pragma mark - Private Methods
+
+/** \cond */
+
++ (NSFNanoStore *)_createAndOpenDebugDatabase
 {
-    NSString *theSQLStatement;
-    BOOL success;
-    NSArray *tables = [[self nanoStoreEngine]tables];
-    NSString *rowUIDDatatype = NSFStringFromNanoDataType(NSFNanoTypeRowUID);
-    NSString *stringDatatype = NSFStringFromNanoDataType(NSFNanoTypeString);
-    NSString *dateDatatype = NSFStringFromNanoDataType(NSFNanoTypeDate);
+    NSFNanoStore *db =  [NSFNanoStore createStoreWithType:NSFPersistentStoreType path:[@"~/Desktop/NanoStoreDebug.db" stringByExpandingTildeInPath]];
+    NSError *outError = nil;
+    
+    if (NO == [db openWithError:&outError]) {
+        [[NSException exceptionWithName:NSFNanoStoreUnableToManipulateStoreException
+                                 reason:[NSString stringWithFormat:@"*** -[%@ %s]: could not open the database. Reason: %@", [self class], _cmd, [outError localizedDescription]]
+                               userInfo:nil]raise];
+    }
+    
+    return db;
+}
 
-    // Setup the Values table
-    if ([tables containsObject:NSFValues] == NO) {
-        theSQLStatement = [NSString stringWithFormat:@"CREATE TABLE %@(ROWID INTEGER PRIMARY KEY, %@ TEXT, %@ TEXT, %@ NONE, %@ TEXT);", NSFValues, NSFKey, NSFAttribute, NSFValue, NSFDatatype];
-        success = (nil == [[[self nanoStoreEngine]executeSQL:theSQLStatement]error]);
-        if (NO == success)
-            return NO;
-        
-        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFValues, NSFRowIDColumnName, rowUIDDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
-        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFValues, NSFKey, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
-        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFValues, NSFAttribute, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
-        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFValues, NSFValue, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
-        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFValues, NSFDatatype, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+- (NSFNanoResult *)_executeSQL:(NSString *)theSQLStatement
+{
+    if (nil == theSQLStatement)
+        return nil;
+    
+    return [[self nanoStoreEngine]executeSQL:theSQLStatement];
+}
+
+
+// ----------------------------------------------
+// Object cache (CLOCK replacement)
+// ----------------------------------------------
+
+- (NSDictionary *)_objectsByKeyForKeys:(NSArray *)someKeys
+{
+    if ((0 == [someKeys count]) || (YES == [self isClosed])) {
+        return [NSDictionary dictionary];
     }
     
-    // Setup the Plist table
-    if ([tables containsObject:NSFKeys] == NO) {
-        theSQLStatement = [NSString stringWithFormat:@"CREATE TABLE %@(ROWID INTEGER PRIMARY KEY, %@ TEXT, %@ TEXT, %@ TEXT, %@ TEXT);", NSFKeys, NSFKey, NSFPlist, NSFCalendarDate, NSFObjectClass];
-        success = (nil == [[[self nanoStoreEngine]executeSQL:theSQLStatement]error]);
-        if (NO == success)
-            return NO;
+    if ((DoNotCacheData == cacheMethod) || (0 == cacheCapacity)) {
+        return [self _objectsForKeys:someKeys ofClassNamed:nil];
+    }
+    
+    // Serve what we can from the object cache and only decode the keys we haven't seen yet
+    NSMutableDictionary *objects = [NSMutableDictionary dictionaryWithCapacity:[someKeys count]];
+    NSMutableArray *missingKeys = [NSMutableArray array];
+    
+    for (NSString *key in someKeys) {
+        id object = [self _cachedObjectForKey:key];
+        if (nil != object) {
+            [objects setObject:object forKey:key];
+        } else {
+            [missingKeys addObject:key];
+        }
+    }
+    
+    if ([missingKeys count] > 0) {
+        NSDictionary *retrievedObjects = [self _objectsForKeys:missingKeys ofClassNamed:nil];
+        [retrievedObjects enumerateKeysAndObjectsUsingBlock:^(id key, id object, BOOL *stop) {
+            [self _cacheObject:object forKey:key];
+        }];
+        [objects addEntriesFromDictionary:retrievedObjects];
+    }
+    
+    return objects;
+}
+
+- (id)_cachedObjectForKey:(NSString *)aKey
+{
+    NSNumber *slot = [_objectCacheSlots objectForKey:aKey];
+    
+    if (nil == slot) {
+        cacheMissCount++;
+        return nil;
+    }
+    
+    NSUInteger index = [slot unsignedIntegerValue];
+    
+    // Give the entry a second chance the next time the hand sweeps by
+    _objectCacheReferenceBits[index] = 1;
+    cacheHitCount++;
+    
+    return [_objectCacheEntries objectAtIndex:index];
+}
+
+- (void)_cacheObject:(id)anObject forKey:(NSString *)aKey
+{
+    if ((nil == anObject) || (nil == aKey) || (DoNotCacheData == cacheMethod) || (0 == cacheCapacity)) {
+        return;
+    }
+    
+    NSNumber *slot = [_objectCacheSlots objectForKey:aKey];
+    NSUInteger index;
+    
+    if (nil != slot) {
+        index = [slot unsignedIntegerValue];
+        [_objectCacheEntries replaceObjectAtIndex:index withObject:anObject];
+        _objectCacheReferenceBits[index] = 1;
+        return;
+    }
+    
+    NSUInteger count = [_objectCacheEntries count];
+    
+    if (count < cacheCapacity) {
+        index = count;
+        [_objectCacheKeys addObject:aKey];
+        [_objectCacheEntries addObject:anObject];
+    } else {
+        // Sweep the hand until we find an entry that hasn't been referenced since the last pass.
+        // Referenced entries get their bit cleared, so this loop ends after at most two revolutions.
+        while (YES) {
+            if (_objectCacheHand >= count) {
+                _objectCacheHand = 0;
+            }
+            if (0 == _objectCacheReferenceBits[_objectCacheHand]) {
+                break;
+            }
+            _objectCacheReferenceBits[_objectCacheHand] = 0;
+            _objectCacheHand++;
+        }
         
-        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFKeys, NSFRowIDColumnName, rowUIDDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
-        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFKeys, NSFKey, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
-        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFKeys, NSFPlist, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
-        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFKeys, dateDatatype, dateDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];        
-        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFKeys, NSFObjectClass, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        index = _objectCacheHand++;
+        
+        id victimKey = [_objectCacheKeys objectAtIndex:index];
+        if ([NSNull null] != victimKey) {
+            [_objectCacheSlots removeObjectForKey:victimKey];
+        }
+        
+        [_objectCacheKeys replaceObjectAtIndex:index withObject:aKey];
+        [_objectCacheEntries replaceObjectAtIndex:index withObject:anObject];
+    }
+    
+    _objectCacheReferenceBits[index] = 1;
+    [_objectCacheSlots setObject:[NSNumber numberWithUnsignedInteger:index] forKey:aKey];
+}
+
+- (void)_refreshCachedObject:(id)anObject forKey:(NSString *)aKey
+{
+    // Patched objects never go through removal, so whichever instance was cached for the key has to be dealt with here.
+    // Only write through when we're caching everything: otherwise drop any other instance, which no longer matches the store.
+    if (CacheAllData == cacheMethod) {
+        [self _cacheObject:anObject forKey:aKey];
+        return;
+    }
+    
+    NSNumber *slot = [_objectCacheSlots objectForKey:aKey];
+    if ((nil != slot) && (anObject != [_objectCacheEntries objectAtIndex:[slot unsignedIntegerValue]])) {
+        [self _removeCachedObjectsWithKeys:[NSArray arrayWithObject:aKey]];
+    }
+}
+
+- (void)_removeCachedObjectsWithKeys:(NSArray *)someKeys
+{
+    if (0 == [_objectCacheSlots count]) {
+        return;
+    }
+    
+    for (NSString *key in someKeys) {
+        NSNumber *slot = [_objectCacheSlots objectForKey:key];
+        if (nil != slot) {
+            NSUInteger index = [slot unsignedIntegerValue];
+            [_objectCacheKeys replaceObjectAtIndex:index withObject:[NSNull null]];
+            [_objectCacheEntries replaceObjectAtIndex:index withObject:[NSNull null]];
+            _objectCacheReferenceBits[index] = 0;
+            [_objectCacheSlots removeObjectForKey:key];
+        }
+    }
+}
+
+- (NSDictionary *)_dictionariesForKeys:(NSArray *)someKeys
+{
+    // Returns nil when the documents couldn't be read at all, as opposed to an empty dictionary when none of the keys is stored
+    if (YES == [self isClosed]) {
+        return nil;
+    }
+    
+    NSUInteger count = [someKeys count];
+    NSMutableDictionary *dictionaries = [NSMutableDictionary dictionaryWithCapacity:count];
+    NSUInteger chunkSize = 500;
+    NSUInteger location = 0;
+    
+    while (location < count) {
+        NSArray *chunk = [someKeys subarrayWithRange:NSMakeRange(location, MIN(chunkSize, count - location))];
+        NSMutableArray *placeholders = [NSMutableArray arrayWithCapacity:[chunk count]];
+        for (NSUInteger i = 0; i < [chunk count]; i++) {
+            [placeholders addObject:@"?"];
+        }
+        
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT %@, %@ FROM %@ WHERE %@ IN (%@);", NSFKey, NSFPlist, NSFKeys, NSFKey, [placeholders componentsJoinedByString:@","]];
+        sqlite3_stmt *statement;
+        
+        if (NO == [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement]) {
+            return nil;
+        }
+        
+        int column = 1;
+        for (NSString *key in chunk) {
+            sqlite3_bind_text (statement, column++, [key UTF8String], -1, SQLITE_TRANSIENT);
+        }
+        
+        while (SQLITE_ROW == sqlite3_step (statement)) {
+            const char *keyUTF8 = (const char *)sqlite3_column_text (statement, 0);
+            if (NULL == keyUTF8) {
+                continue;
+            }
+            
+            NSDictionary *info = [NSFNanoEngine NSFP_dictionaryForColumn:1 statement:statement];
+            if (nil != info) {
+                [dictionaries setObject:info forKey:[NSString stringWithUTF8String:keyUTF8]];
+            }
+        }
+        
+        sqlite3_finalize (statement);
+        
+        location += [chunk count];
+    }
+    
+    return dictionaries;
+}
+
+// ----------------------------------------------
+// Search result cache
+// ----------------------------------------------
+
+- (NSDictionary *)_cachedSearchResultsForKey:(NSString *)aKey
+{
+    NSArray *entry = [_searchResultCache objectForKey:aKey];
+    if (nil == entry) {
+        return nil;
+    }
+    
+    // Our own uncommitted changes are visible to our reads, so the cached results can't be trusted until they're committed
+    NSFNanoEngine *engine = [self nanoStoreEngine];
+    if (YES == [engine NSFP_hasUncommittedChanges]) {
+        return nil;
+    }
+    
+    NSDictionary *generations = [entry objectAtIndex:1];
+    for (NSString *table in generations) {
+        if ([engine NSFP_generationForTable:table] != [[generations objectForKey:table]unsignedLongLongValue]) {
+            [_searchResultCache removeObjectForKey:aKey];
+            return nil;
+        }
+    }
+    
+    return [entry objectAtIndex:0];
+}
+
+- (void)_cacheSearchResults:(NSDictionary *)someResults forKey:(NSString *)aKey SQL:(NSString *)aSQLQuery
+{
+    NSFNanoEngine *engine = [self nanoStoreEngine];
+    if ((nil == someResults) || (YES == [engine NSFP_hasUncommittedChanges])) {
+        return;
+    }
+    
+    if ([_searchResultCache count] >= __NSFPMaximumCachedSearchResults) {
+        [_searchResultCache removeAllObjects];
+    }
+    
+    // Remember the generation of every table the query reads from. Any commit touching one of them invalidates the entry.
+    NSDictionary *tables = [self _searchResultCacheTables];
+    NSMutableDictionary *generations = [NSMutableDictionary dictionary];
+    NSCharacterSet *separators = [[NSCharacterSet characterSetWithCharactersInString:@"_abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"]invertedSet];
+    for (NSString *word in [aSQLQuery componentsSeparatedByCharactersInSet:separators]) {
+        NSString *table = [tables objectForKey:[word lowercaseString]];
+        if (nil != table) {
+            [generations setObject:[NSNumber numberWithUnsignedLongLong:[engine NSFP_generationForTable:table]] forKey:table];
+        }
+    }
+    
+    [_searchResultCache setObject:[NSArray arrayWithObjects:someResults, generations, nil] forKey:aKey];
+}
+
+- (NSDictionary *)_searchResultCacheTables
+{
+    // The tables (by lowercased name, since SQL identifiers are case-insensitive) are only read again when the schema changes
+    int schemaVersion = -1;
+    sqlite3_stmt *statement;
+    if (YES == [self _prepareSQLite3Statement:&statement theSQLStatement:@"PRAGMA schema_version;"]) {
+        if (SQLITE_ROW == sqlite3_step (statement)) {
+            schemaVersion = sqlite3_column_int (statement, 0);
+        }
+        sqlite3_finalize (statement);
+    }
+    
+    if ((nil == _searchResultCacheTables) || (schemaVersion != _searchResultCacheSchemaVersion)) {
+        NSMutableDictionary *tables = [NSMutableDictionary dictionary];
+        for (NSString *table in [[self nanoStoreEngine]tables]) {
+            [tables setObject:table forKey:[table lowercaseString]];
+        }
+        _searchResultCacheTables = tables;
+        _searchResultCacheSchemaVersion = schemaVersion;
+    }
+    
+    return _searchResultCacheTables;
+}
+
+- (BOOL)_initializePreparedStatementsWithError:(out NSError **)outError
+{
+    BOOL hasInitializationSucceeded = YES;
+    
+    if (NULL == _storeValuesStatement) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(%@, %@, %@, %@, %@, %@) VALUES (?,?,?,?,?,?);", NSFValues, NSFKey, NSFAttribute, NSFValue, NSFDatatype, NSFTimestamp, NSFArrayElement];
+        hasInitializationSucceeded = [self _prepareSQLite3Statement:&_storeValuesStatement theSQLStatement:theSQLStatement];
+        
+        if ((nil != outError) && (NO == hasInitializationSucceeded)) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: failed to prepare _storeValuesStatement.", [self class], _cmd]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        }
+    }
+    
+    if ((NULL == _storeKeysStatement) && (YES == hasInitializationSucceeded)) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(%@, %@, %@, %@, %@, %@) VALUES (?,?,?,?,?,%@);", NSFKeys, NSFKey, NSFPlist, NSFCalendarDate, NSFObjectClass, NSFHash, NSFTimestamp, __NSFPCurrentTimestampSQL];
+        hasInitializationSucceeded = [self _prepareSQLite3Statement:&_storeKeysStatement theSQLStatement:theSQLStatement];
+        
+        if ((nil != outError) && (NO == hasInitializationSucceeded)) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: failed to prepare _storeKeysStatement.", [self class], _cmd]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        }
+    }
+    
+    if ((NULL == _updateKeysStatement) && (YES == hasInitializationSucceeded)) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"UPDATE %@ SET %@ = ?, %@ = ?, %@ = ?, %@ = ?, %@ = %@ WHERE %@ = ?;", NSFKeys, NSFPlist, NSFCalendarDate, NSFObjectClass, NSFHash, NSFTimestamp, __NSFPCurrentTimestampSQL, NSFKey];
+        hasInitializationSucceeded = [self _prepareSQLite3Statement:&_updateKeysStatement theSQLStatement:theSQLStatement];
+        
+        if ((nil != outError) && (NO == hasInitializationSucceeded)) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: failed to prepare _updateKeysStatement.", [self class], _cmd]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        }
+    }
+    
+    if ((NULL == _removeAttributeStatement) && (YES == hasInitializationSucceeded)) {
+        // Matches the attribute itself as well as everything nested under it (i.e. 'attribute.*')
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE %@ = ?1 AND (%@ = ?2 OR substr(%@, 1, length(?3)) = ?3);", NSFValues, NSFKey, NSFAttribute, NSFAttribute];
+        hasInitializationSucceeded = [self _prepareSQLite3Statement:&_removeAttributeStatement theSQLStatement:theSQLStatement];
+        
+        if ((nil != outError) && (NO == hasInitializationSucceeded)) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: failed to prepare _removeAttributeStatement.", [self class], _cmd]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        }
+    }
+    
+    if ((NULL == _readValueStatement) && (YES == hasInitializationSucceeded)) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT %@, %@ FROM %@ WHERE %@ = ? AND %@ = ?;", NSFValue, NSFDatatype, NSFValues, NSFKey, NSFAttribute];
+        hasInitializationSucceeded = [self _prepareSQLite3Statement:&_readValueStatement theSQLStatement:theSQLStatement];
+        
+        if ((nil != outError) && (NO == hasInitializationSucceeded)) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: failed to prepare _readValueStatement.", [self class], _cmd]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        }
+    }
+    
+    if ((NULL == _updateValueStatement) && (YES == hasInitializationSucceeded)) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"UPDATE %@ SET %@ = ? WHERE %@ = ? AND %@ = ?;", NSFValues, NSFValue, NSFKey, NSFAttribute];
+        hasInitializationSucceeded = [self _prepareSQLite3Statement:&_updateValueStatement theSQLStatement:theSQLStatement];
+        
+        if ((nil != outError) && (NO == hasInitializationSucceeded)) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: failed to prepare _updateValueStatement.", [self class], _cmd]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        }
+    }
+    
+    if ((NULL == _mergeKeysStatement) && (YES == hasInitializationSucceeded)) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"UPDATE %@ SET %@ = NSFP_mergePlist(%@, ?), %@ = ?, %@ = %@ WHERE %@ = ?;", NSFKeys, NSFPlist, NSFPlist, NSFCalendarDate, NSFTimestamp, __NSFPCurrentTimestampSQL, NSFKey];
+        hasInitializationSucceeded = [self _prepareSQLite3Statement:&_mergeKeysStatement theSQLStatement:theSQLStatement];
+        
+        if ((nil != outError) && (NO == hasInitializationSucceeded)) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: failed to prepare _mergeKeysStatement.", [self class], _cmd]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        }
+    }
+    
+    if ((NULL == _rehashKeysStatement) && (YES == hasInitializationSucceeded)) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"UPDATE %@ SET %@ = NSFP_contentHash(%@) WHERE %@ = ?;", NSFKeys, NSFHash, NSFPlist, NSFKey];
+        hasInitializationSucceeded = [self _prepareSQLite3Statement:&_rehashKeysStatement theSQLStatement:theSQLStatement];
+        
+        if ((nil != outError) && (NO == hasInitializationSucceeded)) {
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: failed to prepare _rehashKeysStatement.", [self class], _cmd]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        }
+    }
+    
+    return hasInitializationSucceeded;
+}
+
+- (void)_releasePreparedStatements
+{
+    if (_storeValuesStatement != NULL) { sqlite3_finalize(_storeValuesStatement);_storeValuesStatement = NULL; }
+    if (_storeKeysStatement != NULL) { sqlite3_finalize(_storeKeysStatement);_storeKeysStatement = NULL; }
+    if (_updateKeysStatement != NULL) { sqlite3_finalize(_updateKeysStatement);_updateKeysStatement = NULL; }
+    if (_removeAttributeStatement != NULL) { sqlite3_finalize(_removeAttributeStatement);_removeAttributeStatement = NULL; }
+    if (_readValueStatement != NULL) { sqlite3_finalize(_readValueStatement);_readValueStatement = NULL; }
+    if (_updateValueStatement != NULL) { sqlite3_finalize(_updateValueStatement);_updateValueStatement = NULL; }
+    if (_mergeKeysStatement != NULL) { sqlite3_finalize(_mergeKeysStatement);_mergeKeysStatement = NULL; }
+    if (_rehashKeysStatement != NULL) { sqlite3_finalize(_rehashKeysStatement);_rehashKeysStatement = NULL; }
+    for (NSUInteger i = 0; i < __NSFPNumberOfKeyBatchSizes * 3; i++) {
+        if (_deleteKeysStatements[i] != NULL) { sqlite3_finalize(_deleteKeysStatements[i]);_deleteKeysStatements[i] = NULL; }
+    }
+    for (NSUInteger i = 0; i < __NSFPNumberOfKeyBatchSizes; i++) {
+        if (_selectKeysStatements[i] != NULL) { sqlite3_finalize(_selectKeysStatements[i]);_selectKeysStatements[i] = NULL; }
+    }
+}
+
+- (sqlite3_stmt *)_deleteKeysStatementForTable:(NSString *)aTable batchSizeIndex:(NSUInteger)sizeIndex
+{
+    NSUInteger slot = (sizeIndex * 3) + ((YES == [aTable isEqualToString:NSFKeys]) ? 0 : ((YES == [aTable isEqualToString:NSFValues]) ? 1 : 2));
+    
+    if (NULL == _deleteKeysStatements[slot]) {
+        NSUInteger batchSize = __NSFPKeyBatchSizes[sizeIndex];
+        NSMutableArray *placeholders = [NSMutableArray arrayWithCapacity:batchSize];
+        for (NSUInteger i = 0; i < batchSize; i++) {
+            [placeholders addObject:@"?"];
+        }
+        
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE %@ IN (%@);", aTable, NSFKey, [placeholders componentsJoinedByString:@","]];
+        if (NO == [self _prepareSQLite3Statement:&_deleteKeysStatements[slot] theSQLStatement:theSQLStatement]) {
+            _deleteKeysStatements[slot] = NULL;
+        }
+    }
+    
+    return _deleteKeysStatements[slot];
+}
+
+- (BOOL)_deleteRowsForKeys:(NSArray *)someKeys keepingBagMembers:(BOOL)keepBagMembers
+{
+    // Removing a bag also removes its membership, unless the bag is only being rewritten
+    NSArray *tables = (YES == keepBagMembers) ? [NSArray arrayWithObjects:NSFKeys, NSFValues, nil] : [NSArray arrayWithObjects:NSFKeys, NSFValues, NSFBagMembers, nil];
+    NSUInteger count = [someKeys count];
+    NSUInteger location = 0;
+    
+    while (location < count) {
+        NSUInteger sizeIndex = __NSFPKeyBatchSizeIndexForCount(count - location);
+        NSRange range = NSMakeRange(location, MIN(__NSFPKeyBatchSizes[sizeIndex], count - location));
+        
+        for (NSString *table in tables) {
+            sqlite3_stmt *statement = [self _deleteKeysStatementForTable:table batchSizeIndex:sizeIndex];
+            if ((NULL == statement) || (NO == [self _bindKeys:someKeys inRange:range paddedTo:__NSFPKeyBatchSizes[sizeIndex] toSQLite3Statement:statement])) {
+                return NO;
+            }
+            
+            if (SQLITE_DONE != [self _executeSQLite3StepUsingSQLite3Statement:statement]) {
+                return NO;
+            }
+        }
+        
+        location = NSMaxRange(range);
+    }
+    
+    return YES;
+}
+
+- (BOOL)_bindKeys:(NSArray *)someKeys inRange:(NSRange)aRange paddedTo:(NSUInteger)batchSize toSQLite3Statement:(sqlite3_stmt *)aStatement
+{
+    // Since we're operating with extended result code support, extract the bits
+    // and obtain the regular result code
+    // For more info check: http://www.sqlite.org/c3ref/c_ioerr_access.html
+    
+    int status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_reset (aStatement)];
+    if (SQLITE_OK != status) {
+        return NO;
+    }
+    
+    for (NSUInteger i = 0; i < batchSize; i++) {
+        NSString *key = [someKeys objectAtIndex:aRange.location + MIN(i, aRange.length - 1)];
+        status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_bind_text (aStatement, (int)i + 1, [key UTF8String], -1, SQLITE_STATIC)];
+        if (SQLITE_OK != status) {
+            return NO;
+        }
+    }
+    
+    return YES;
+}
+
+- (sqlite3_stmt *)_selectKeysStatementForBatchSizeIndex:(NSUInteger)sizeIndex
+{
+    if (NULL == _selectKeysStatements[sizeIndex]) {
+        NSUInteger batchSize = __NSFPKeyBatchSizes[sizeIndex];
+        NSMutableArray *placeholders = [NSMutableArray arrayWithCapacity:batchSize];
+        for (NSUInteger i = 0; i < batchSize; i++) {
+            [placeholders addObject:@"?"];
+        }
+        
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT %@, %@, %@ FROM %@ WHERE %@ IN (%@);", NSFKey, NSFPlist, NSFObjectClass, NSFKeys, NSFKey, [placeholders componentsJoinedByString:@","]];
+        if (NO == [self _prepareSQLite3Statement:&_selectKeysStatements[sizeIndex] theSQLStatement:theSQLStatement]) {
+            _selectKeysStatements[sizeIndex] = NULL;
+        }
+    }
+    
+    return _selectKeysStatements[sizeIndex];
+}
+
+- (NSDictionary *)_objectsForKeys:(NSArray *)someKeys ofClassNamed:(NSString *)aClassName
+{
+    // Maps each key found to its object. A nil class name accepts objects of any class.
+    NSUInteger count = [someKeys count];
+    NSMutableArray *foundKeys = [NSMutableArray arrayWithCapacity:count];
+    NSMutableArray *foundPlists = [NSMutableArray arrayWithCapacity:count];
+    NSMutableArray *foundClasses = [NSMutableArray arrayWithCapacity:count];
+    NSUInteger location = 0;
+    
+    // The rows are read serially through the (single) connection...
+    while (location < count) {
+        NSUInteger sizeIndex = __NSFPKeyBatchSizeIndexForCount(count - location);
+        NSRange range = NSMakeRange(location, MIN(__NSFPKeyBatchSizes[sizeIndex], count - location));
+        
+        sqlite3_stmt *statement = [self _selectKeysStatementForBatchSizeIndex:sizeIndex];
+        if ((NULL == statement) || (NO == [self _bindKeys:someKeys inRange:range paddedTo:__NSFPKeyBatchSizes[sizeIndex] toSQLite3Statement:statement])) {
+            break;
+        }
+        
+        while (SQLITE_ROW == sqlite3_step (statement)) {
+            const char *keyUTF8 = (const char *)sqlite3_column_text (statement, 0);
+            const void *plistBytes = sqlite3_column_blob (statement, 1);
+            int plistLength = sqlite3_column_bytes (statement, 1);
+            const char *objectClassUTF8 = (const char *)sqlite3_column_text (statement, 2);
+            
+            if ((NULL == keyUTF8) || (NULL == plistBytes) || (NULL == objectClassUTF8)) {
+                continue;
+            }
+            
+            NSString *objectClass = [[NSString alloc]initWithUTF8String:objectClassUTF8];
+            if ((nil != aClassName) && (NO == [aClassName isEqualToString:objectClass])) {
+                continue;
+            }
+            
+            [foundKeys addObject:[[NSString alloc]initWithUTF8String:keyUTF8]];
+            [foundPlists addObject:[[NSData alloc]initWithBytes:plistBytes length:plistLength]];
+            [foundClasses addObject:objectClass];
+        }
+        
+        sqlite3_reset (statement);
+        location = NSMaxRange(range);
+    }
+    
+    // ... while the plists, which is where the time goes, are decoded concurrently
+    NSUInteger foundCount = [foundKeys count];
+    NSMutableDictionary *objects = [NSMutableDictionary dictionaryWithCapacity:foundCount];
+    if (0 == foundCount) {
+        return objects;
+    }
+    
+    NSDictionary * __strong *infos = (NSDictionary * __strong *)calloc(foundCount, sizeof(NSDictionary *));
+    if (foundCount >= __NSFPMinimumObjectsForConcurrentDecoding) {
+        dispatch_apply(foundCount, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t i) {
+            @autoreleasepool {
+                infos[i] = [NSFNanoEngine NSFP_dictionaryFromPlistData:[foundPlists objectAtIndex:i]];
+            }
+        });
+    } else {
+        for (NSUInteger i = 0; i < foundCount; i++) {
+            infos[i] = [NSFNanoEngine NSFP_dictionaryFromPlistData:[foundPlists objectAtIndex:i]];
+        }
+    }
+    
+    // The objects themselves are created on the calling thread: their initializers may not be thread-safe
+    for (NSUInteger i = 0; i < foundCount; i++) {
+        NSDictionary *info = infos[i];
+        infos[i] = nil;
+        if (nil == info) {
+            continue;
+        }
+        
+        NSString *keyValue = [foundKeys objectAtIndex:i];
+        [objects setObject:[self _objectWithInfo:info forKey:keyValue className:[foundClasses objectAtIndex:i]] forKey:keyValue];
+    }
+    free(infos);
+    
+    return objects;
+}
+
+- (id)_objectWithInfo:(NSDictionary *)info forKey:(NSString *)aKey className:(NSString *)aClassName
+{
+    Class storedObjectClass = NSClassFromString(aClassName);
+    BOOL saveOriginalClassReference = NO;
+    if (nil == storedObjectClass) {
+        storedObjectClass = [NSFNanoObject class];
+        saveOriginalClassReference = YES;
+    }
+    
+    id nanoObject = [[storedObjectClass alloc]initNanoObjectFromDictionaryRepresentation:info forKey:aKey store:self];
+    
+    // Keep a reference to the original class so the object can be restored properly later on
+    if (YES == saveOriginalClassReference) {
+        [nanoObject _setOriginalClassString:aClassName];
+    }
+    
+    return nanoObject;
+}
+
+- (BOOL)_stepSQLite3Statement:(sqlite3_stmt *)aStatement bindingTexts:(NSArray *)someTexts
+{
+    // Since we're operating with extended result code support, extract the bits
+    // and obtain the regular result code
+    // For more info check: http://www.sqlite.org/c3ref/c_ioerr_access.html
+    
+    if (SQLITE_OK != [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_reset (aStatement)]) {
+        return NO;
+    }
+    
+    int column = 1;
+    for (NSString *text in someTexts) {
+        if (SQLITE_OK != sqlite3_bind_text (aStatement, column++, [text UTF8String], -1, SQLITE_TRANSIENT)) {
+            return NO;
+        }
+    }
+    
+    return (SQLITE_DONE == [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_step (aStatement)]);
+}
+
+- (BOOL)_collectKeysMatchingSearch:(NSFNanoSearch *)theSearch
+{
+    // The keys are gathered in a temporary table so the statements that follow see the same set of objects,
+    // no matter which tables they modify.
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"CREATE TEMP TABLE IF NOT EXISTS %@(%@ TEXT PRIMARY KEY);", NSF_Private_MatchingKeysTableKey, NSFKey];
+    if (nil != [[self _executeSQL:theSQLStatement]error]) {
+        return NO;
+    }
+    
+    theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@;", NSF_Private_MatchingKeysTableKey];
+    [self _executeSQL:theSQLStatement];
+    
+    theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT OR IGNORE INTO %@(%@) %@", NSF_Private_MatchingKeysTableKey, NSFKey, [theSearch _preparedKeysSQL]];
+    _NSFLog(@"_collectKeysMatchingSearch SQL query: %@", theSQLStatement);
+    
+    return (nil == [[self _executeSQL:theSQLStatement]error]);
+}
+
+- (BOOL)_finishMatchingKeysOperationWithSuccess:(BOOL)success transactionStartedHere:(BOOL)transactionStartedHere selector:(SEL)aSelector error:(out NSError **)outError
+{
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@;", NSF_Private_MatchingKeysTableKey];
+    [self _executeSQL:theSQLStatement];
+    
+    // The matching keys never left SQLite, so there's no telling which cached objects are affected
+    [self clearCache];
+    
+    if (YES == success) {
+        if (transactionStartedHere)
+            if ([self commitTransactionAndReturnError:nil] == NO)
+                _NSFLog(@"          Could not commit the transaction.");
+        return YES;
+    }
+    
+    if (transactionStartedHere)
+        [self rollbackTransactionAndReturnError:nil];
+    
+    if (nil != outError) {
+        *outError = [NSError errorWithDomain:NSFDomainKey
+                                        code:NSFNanoStoreErrorKey
+                                    userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %@]: the objects matching the search could not be modified.", [self class], NSStringFromSelector(aSelector)]
+                                                                         forKey:NSLocalizedFailureReasonErrorKey]];
+    }
+    
+    return NO;
+}
+
+- (void)_setIsOurTransaction:(BOOL)value
+{
+    if (_isOurTransaction != value) {
+        _isOurTransaction = value;
+    }
+}
+
+- (BOOL)_isOurTransaction
+{
+    return _isOurTransaction;
+}
+
+- (NSString*)_nestedDescriptionWithPrefixedSpace:(NSString *)prefixedSpace
+{
+    if (nil == prefixedSpace) {
+        prefixedSpace = @"";
+    }
+    
+    NSMutableString *description = [NSMutableString string];
+    [description appendString:@"\n"];
+    [description appendString:[NSString stringWithFormat:@"%@NanoStore address      : 0x%x\n", prefixedSpace, self]];
+    [description appendString:[NSString stringWithFormat:@"%@Is our transaction?    : %@\n", prefixedSpace, (_isOurTransaction ? @"Yes" : @"No")]];
+    [description appendString:[NSString stringWithFormat:@"%@Save interval           : %ld\n", prefixedSpace, (saveInterval == 0 ? 1 : saveInterval)]];
+    [description appendString:[NSString stringWithFormat:@"%@Cached objects         : %ld of %ld\n", prefixedSpace, [_objectCacheSlots count], cacheCapacity]];
+    [description appendString:[NSString stringWithFormat:@"%@Cache hit rate         : %.2f\n", prefixedSpace, [self cacheHitRate]]];
+    [description appendString:[NSString stringWithFormat:@"%@Engine                 : %@\n", prefixedSpace, [nanoStoreEngine NSFP_nestedDescriptionWithPrefixedSpace:@"          "]]];
+    
+    return description;
+}
+
+- (BOOL)_checkNanoStoreIsReadyAndReturnError:(out NSError **)outError
+{
+    if (nil == [self nanoStoreEngine]) {
+        if (nil != outError)
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the NSF store has not been set.", [self class], _cmd]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        return NO;
+    }
+    
+    if ([[self nanoStoreEngine]isDatabaseOpen] == NO) {
+        if (nil != outError)
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the store is not open.", [self class], _cmd]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        return NO;
+    }
+    
+    return YES;
+}
+
+- (BOOL)_setupCachingSchema
+{
+    NSString *theSQLStatement;
+    BOOL success;
+    NSArray *tables = [[self nanoStoreEngine]tables];
+    NSString *rowUIDDatatype = NSFStringFromNanoDataType(NSFNanoTypeRowUID);
+    NSString *stringDatatype = NSFStringFromNanoDataType(NSFNanoTypeString);
+    NSString *dateDatatype = NSFStringFromNanoDataType(NSFNanoTypeDate);
+    NSString *numberDatatype = NSFStringFromNanoDataType(NSFNanoTypeNumber);
+
+    // Setup the Values table
+    if ([tables containsObject:NSFValues] == NO) {
+        theSQLStatement = [NSString stringWithFormat:@"CREATE TABLE %@(ROWID INTEGER PRIMARY KEY, %@ TEXT, %@ TEXT, %@ NONE, %@ TEXT, %@ REAL, %@ INTEGER);", NSFValues, NSFKey, NSFAttribute, NSFValue, NSFDatatype, NSFTimestamp, NSFArrayElement];
+        success = (nil == [[[self nanoStoreEngine]executeSQL:theSQLStatement]error]);
+        if (NO == success)
+            return NO;
+        
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFValues, NSFRowIDColumnName, rowUIDDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFValues, NSFKey, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFValues, NSFAttribute, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFValues, NSFValue, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFValues, NSFDatatype, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFValues, NSFTimestamp, numberDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFValues, NSFArrayElement, numberDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+    } else if (NO == [[[self nanoStoreEngine]columnsForTable:NSFValues]containsObject:NSFTimestamp]) {
+        // Stores created before timestamps existed: dates were only kept as text, so recover them from the values shaped like one
+        theSQLStatement = [NSString stringWithFormat:@"ALTER TABLE %@ ADD COLUMN %@ REAL;", NSFValues, NSFTimestamp];
+        success = (nil == [[[self nanoStoreEngine]executeSQL:theSQLStatement]error]);
+        if (NO == success)
+            return NO;
+        
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFValues, NSFTimestamp, numberDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        
+        theSQLStatement = [NSString stringWithFormat:@"UPDATE %@ SET %@ = NSFP_timestampFromCalendarDate(%@) WHERE %@ = '%@';", NSFValues, NSFTimestamp, NSFValue, NSFDatatype, dateDatatype];
+        [[self nanoStoreEngine]executeSQL:theSQLStatement];
+    }
+    
+    // Stores created before array elements were told apart: their rows are left NULL, which projections read as unknown
+    if (NO == [[[self nanoStoreEngine]columnsForTable:NSFValues]containsObject:NSFArrayElement]) {
+        theSQLStatement = [NSString stringWithFormat:@"ALTER TABLE %@ ADD COLUMN %@ INTEGER;", NSFValues, NSFArrayElement];
+        success = (nil == [[[self nanoStoreEngine]executeSQL:theSQLStatement]error]);
+        if (NO == success)
+            return NO;
+        
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFValues, NSFArrayElement, numberDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+    }
+    
+    // Setup the Plist table
+    if ([tables containsObject:NSFKeys] == NO) {
+        theSQLStatement = [NSString stringWithFormat:@"CREATE TABLE %@(ROWID INTEGER PRIMARY KEY, %@ TEXT, %@ TEXT, %@ TEXT, %@ TEXT, %@ TEXT, %@ REAL);", NSFKeys, NSFKey, NSFPlist, NSFCalendarDate, NSFObjectClass, NSFHash, NSFTimestamp];
+        success = (nil == [[[self nanoStoreEngine]executeSQL:theSQLStatement]error]);
+        if (NO == success)
+            return NO;
+        
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFKeys, NSFRowIDColumnName, rowUIDDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFKeys, NSFKey, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFKeys, NSFPlist, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFKeys, dateDatatype, dateDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];        
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFKeys, NSFObjectClass, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFKeys, NSFHash, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFKeys, NSFTimestamp, numberDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+    } else if (NO == [[[self nanoStoreEngine]columnsForTable:NSFKeys]containsObject:NSFHash]) {
+        // Stores created before content hashes existed: add the column and compute the hash of what's already stored
+        theSQLStatement = [NSString stringWithFormat:@"ALTER TABLE %@ ADD COLUMN %@ TEXT;", NSFKeys, NSFHash];
+        success = (nil == [[[self nanoStoreEngine]executeSQL:theSQLStatement]error]);
+        if (NO == success)
+            return NO;
+        
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFKeys, NSFHash, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        
+        theSQLStatement = [NSString stringWithFormat:@"UPDATE %@ SET %@ = NSFP_contentHash(%@);", NSFKeys, NSFHash, NSFPlist];
+        [[self nanoStoreEngine]executeSQL:theSQLStatement];
+    }
+    
+    if (NO == [[[self nanoStoreEngine]columnsForTable:NSFKeys]containsObject:NSFTimestamp]) {
+        // Stores created before timestamps existed: derive them from the calendar dates
+        theSQLStatement = [NSString stringWithFormat:@"ALTER TABLE %@ ADD COLUMN %@ REAL;", NSFKeys, NSFTimestamp];
+        success = (nil == [[[self nanoStoreEngine]executeSQL:theSQLStatement]error]);
+        if (NO == success)
+            return NO;
+        
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFKeys, NSFTimestamp, numberDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        
+        theSQLStatement = [NSString stringWithFormat:@"UPDATE %@ SET %@ = NSFP_timestampFromCalendarDate(%@);", NSFKeys, NSFTimestamp, NSFCalendarDate];
+        [[self nanoStoreEngine]executeSQL:theSQLStatement];
+    }
+    
+    // Setup the bag membership table
+    if ([tables containsObject:NSFBagMembers] == NO) {
+        theSQLStatement = [NSString stringWithFormat:@"CREATE TABLE %@(ROWID INTEGER PRIMARY KEY, %@ TEXT, %@ TEXT);", NSFBagMembers, NSFKey, NSFObjectKey];
+        success = (nil == [[[self nanoStoreEngine]executeSQL:theSQLStatement]error]);
+        if (NO == success)
+            return NO;
+        
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFBagMembers, NSFRowIDColumnName, rowUIDDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFBagMembers, NSFKey, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFBagMembers, NSFObjectKey, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        
+        // Stores created before the membership table kept the keys of the members among the values of each bag
+        theSQLStatement = [NSString stringWithFormat:@"INSERT INTO %@(%@, %@) SELECT DISTINCT v.%@, v.%@ FROM %@ v JOIN %@ k ON k.%@ = v.%@ AND k.%@ = '%@' WHERE v.%@ = '%@';",
+                           NSFBagMembers, NSFKey, NSFObjectKey, NSFKey, NSFValue, NSFValues, NSFKeys, NSFKey, NSFKey, NSFObjectClass, NSStringFromClass([NSFNanoBag class]), NSFAttribute, NSF_Private_NSFNanoBag_NSFObjectKeys];
+        [[self nanoStoreEngine]executeSQL:theSQLStatement];
+    }
+    
+    // Setup the blob table. Blobs are content-addressed: the unique hash is what deduplicates them, so it isn't an index rebuildIndexes manages.
+    if ([tables containsObject:NSFBlobs] == NO) {
+        theSQLStatement = [NSString stringWithFormat:@"CREATE TABLE %@(ROWID INTEGER PRIMARY KEY, %@ TEXT UNIQUE, %@ INTEGER, %@ BLOB);", NSFBlobs, NSFHash, NSFLength, NSFData];
+        success = (nil == [[[self nanoStoreEngine]executeSQL:theSQLStatement]error]);
+        if (NO == success)
+            return NO;
+        
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFBlobs, NSFRowIDColumnName, rowUIDDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFBlobs, NSFHash, stringDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFBlobs, NSFLength, numberDatatype, nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+        [[self nanoStoreEngine]NSFP_insertStringValues:[NSArray arrayWithObjects:NSFBlobs, NSFData, NSFStringFromNanoDataType(NSFNanoTypeData), nil] forColumns:[NSArray arrayWithObjects:NSFP_TableIdentifier, NSFP_ColumnIdentifier, NSFP_DatatypeIdentifier, nil]table:NSFP_SchemaTable];
+    }
+    
+    // The names of the bags are checked every time bags are added, so their index can't wait for rebuildIndexes
+    [self _createBagNamesIndex];
+    
+    [self _loadCompressionDictionaries];
+    
+    return [self _installMaterializedAggregateTriggers];
+}
+
+// ----------------------------------------------
+// Document compression
+// ----------------------------------------------
+
+- (void)_loadCompressionDictionaries
+{
+    // Created on demand: stores which were never trained don't have the table
+    if (NO == [[[self nanoStoreEngine]NSFP_flattenAllTables]containsObject:NSFP_CompressionDictionariesTable]) {
+        return;
+    }
+    
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT NSFP_Dictionary FROM %@ ORDER BY ROWID;", NSFP_CompressionDictionariesTable];
+    sqlite3_stmt *statement;
+    if (NO == [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement]) {
+        return;
+    }
+    
+    // Every dictionary is needed to read the rows compressed with it, but only the latest one is used to write
+    NSData *latestDictionary = nil;
+    while (SQLITE_ROW == sqlite3_step (statement)) {
+        const void *bytes = sqlite3_column_blob (statement, 0);
+        int length = sqlite3_column_bytes (statement, 0);
+        if ((NULL != bytes) && (length > 0)) {
+            latestDictionary = [[NSData alloc]initWithBytes:bytes length:length];
+            [NSFNanoEngine NSFP_registerCompressionDictionary:latestDictionary];
+        }
+    }
+    sqlite3_finalize (statement);
+    
+    [[self nanoStoreEngine]NSFP_setCompressionDictionary:latestDictionary];
+}
+
+- (BOOL)_bindPlist:(const char *)dictXMLUTF8 parameterNumber:(int)aParamNumber usingSQLite3Statement:(sqlite3_stmt *)aStatement
+{
+    // Written compressed only when it's enabled and makes the row smaller. NSFHash is always the hash of the XML.
+    NSData *compressedPlist = [[self nanoStoreEngine]NSFP_compressedPlistFromBytes:dictXMLUTF8 length:strlen(dictXMLUTF8)];
+    if (nil != compressedPlist) {
+        return (sqlite3_bind_blob (aStatement, aParamNumber, [compressedPlist bytes], (int)[compressedPlist length], SQLITE_TRANSIENT) == SQLITE_OK);
+    }
+    
+    return (sqlite3_bind_text (aStatement, aParamNumber, dictXMLUTF8, -1, SQLITE_STATIC) == SQLITE_OK);
+}
+
+// ----------------------------------------------
+// Out-of-line blobs
+// ----------------------------------------------
+
+- (id)_storedFormOfCollection:(id)aCollection
+{
+    // Blobs are written as references. Large NSData values are moved out-of-line first, once per save: the same
+    // value is typically seen twice, by the plist and by the flattened values.
+    if ([aCollection isKindOfClass:[NSFNanoBlob class]]) {
+        [_pendingBlobHashes removeObject:[aCollection contentHash]];
+        return [aCollection _reference];
+    } else if ([aCollection isKindOfClass:[NSData class]]) {
+        if ((0 == blobSizeThreshold) || ([aCollection length] < blobSizeThreshold)) {
+            return aCollection;
+        }
+        
+        NSFNanoBlob *blob = [_outOfLineBlobs objectForKey:aCollection];
+        if (nil == blob) {
+            blob = [self addBlobWithData:aCollection error:nil];
+            if (nil == blob) {
+                // It can still be stored inline
+                return aCollection;
+            }
+            [_outOfLineBlobs setObject:blob forKey:aCollection];
+        }
+        
+        [_pendingBlobHashes removeObject:blob.contentHash];
+        return [blob _reference];
+    } else if ([aCollection isKindOfClass:[NSDictionary class]]) {
+        NSMutableDictionary *storedCollection = nil;
+        for (id key in aCollection) {
+            id value = [aCollection objectForKey:key];
+            id storedValue = [self _storedFormOfCollection:value];
+            if (storedValue != value) {
+                if (nil == storedCollection) {
+                    storedCollection = [aCollection mutableCopy];
+                }
+                [storedCollection setObject:storedValue forKey:key];
+            }
+        }
+        
+        return (nil != storedCollection) ? storedCollection : aCollection;
+    } else if ([aCollection isKindOfClass:[NSArray class]]) {
+        NSMutableArray *storedCollection = nil;
+        NSUInteger i, count = [aCollection count];
+        for (i = 0; i < count; i++) {
+            id value = [aCollection objectAtIndex:i];
+            id storedValue = [self _storedFormOfCollection:value];
+            if (storedValue != value) {
+                if (nil == storedCollection) {
+                    storedCollection = [aCollection mutableCopy];
+                }
+                [storedCollection replaceObjectAtIndex:i withObject:storedValue];
+            }
+        }
+        
+        return (nil != storedCollection) ? storedCollection : aCollection;
+    }
+    
+    return aCollection;
+}
+
+- (long long)_rowIDOfBlobWithHash:(NSString *)aHash
+{
+    long long rowID = 0;
+    
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT ROWID FROM %@ WHERE %@ = ?;", NSFBlobs, NSFHash];
+    sqlite3_stmt *statement;
+    if (YES == [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement]) {
+        sqlite3_bind_text (statement, 1, [aHash UTF8String], -1, SQLITE_TRANSIENT);
+        if (SQLITE_ROW == sqlite3_step (statement)) {
+            rowID = sqlite3_column_int64 (statement, 0);
+        }
+        sqlite3_finalize (statement);
+    }
+    
+    return rowID;
+}
+
+- (sqlite3_blob *)_openBlob:(NSFNanoBlob *)theBlob error:(out NSError **)outError
+{
+    sqlite3_blob *blob = NULL;
+    long long rowID = [self _rowIDOfBlobWithHash:theBlob.contentHash];
+    
+    if ((0 == rowID) || (SQLITE_OK != sqlite3_blob_open ([[self nanoStoreEngine]sqlite], "main", [NSFBlobs UTF8String], [NSFData UTF8String], rowID, 0, &blob))) {
+        if (NULL != blob) {
+            sqlite3_blob_close (blob);
+        }
+        if (nil != outError)
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSFNanoStoreErrorKey
+                                        userInfo:[NSDictionary dictionaryWithObject:[NSString stringWithFormat:@"*** -[%@ %s]: the blob %@ could not be found.", [self class], _cmd, theBlob.contentHash]
+                                                                             forKey:NSLocalizedFailureReasonErrorKey]];
+        return NULL;
+    }
+    
+    return blob;
+}
+
+// ----------------------------------------------
+// Bag membership
+// ----------------------------------------------
+
+- (NSArray *)_keysOfMembersOfBagWithKey:(NSString *)aBagKey
+{
+    NSMutableArray *memberKeys = [NSMutableArray array];
+    
+    // Members which no longer exist in the document store are left out, as they were when bags were read whole
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT m.%@ FROM %@ m WHERE m.%@ = ? AND EXISTS (SELECT 1 FROM %@ k WHERE k.%@ = m.%@);", NSFObjectKey, NSFBagMembers, NSFKey, NSFKeys, NSFKey, NSFObjectKey];
+    sqlite3_stmt *statement;
+    if (NO == [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement]) {
+        return memberKeys;
+    }
+    
+    sqlite3_bind_text (statement, 1, [aBagKey UTF8String], -1, SQLITE_TRANSIENT);
+    
+    while (SQLITE_ROW == sqlite3_step (statement)) {
+        const char *objectKeyUTF8 = (const char *)sqlite3_column_text (statement, 0);
+        if (NULL != objectKeyUTF8) {
+            [memberKeys addObject:[[NSString alloc]initWithUTF8String:objectKeyUTF8]];
+        }
+    }
+    
+    sqlite3_finalize (statement);
+    
+    return memberKeys;
+}
+
+- (NSArray *)_keysOfMembersOfBagWithKey:(NSString *)aBagKey afterRowID:(long long)aRowID limit:(NSUInteger)aLimit
+{
+    // Each row is an array holding the ROWID of the membership and the key of the member
+    NSMutableArray *rows = [NSMutableArray arrayWithCapacity:aLimit];
+    
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT m.ROWID, m.%@ FROM %@ m WHERE m.%@ = ?1 AND m.ROWID > ?2 AND EXISTS (SELECT 1 FROM %@ k WHERE k.%@ = m.%@) ORDER BY m.ROWID LIMIT ?3;", NSFObjectKey, NSFBagMembers, NSFKey, NSFKeys, NSFKey, NSFObjectKey];
+    sqlite3_stmt *statement;
+    if (NO == [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement]) {
+        return rows;
+    }
+    
+    sqlite3_bind_text (statement, 1, [aBagKey UTF8String], -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int64 (statement, 2, aRowID);
+    sqlite3_bind_int64 (statement, 3, (sqlite3_int64)aLimit);
+    
+    while (SQLITE_ROW == sqlite3_step (statement)) {
+        const char *objectKeyUTF8 = (const char *)sqlite3_column_text (statement, 1);
+        if (NULL != objectKeyUTF8) {
+            [rows addObject:[NSArray arrayWithObjects:[NSNumber numberWithLongLong:sqlite3_column_int64 (statement, 0)], [[NSString alloc]initWithUTF8String:objectKeyUTF8], nil]];
+        }
+    }
+    
+    sqlite3_finalize (statement);
+    
+    return rows;
+}
+
+- (long long)_countOfMembersOfBagWithKey:(NSString *)aBagKey
+{
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT count(*) FROM %@ m WHERE m.%@ = ? AND EXISTS (SELECT 1 FROM %@ k WHERE k.%@ = m.%@);", NSFBagMembers, NSFKey, NSFKeys, NSFKey, NSFObjectKey];
+    sqlite3_stmt *statement;
+    if (NO == [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement]) {
+        return 0;
+    }
+    
+    sqlite3_bind_text (statement, 1, [aBagKey UTF8String], -1, SQLITE_TRANSIENT);
+    
+    long long count = 0;
+    if (SQLITE_ROW == sqlite3_step (statement)) {
+        count = sqlite3_column_int64 (statement, 0);
+    }
+    
+    sqlite3_finalize (statement);
+    
+    return count;
+}
+
+- (BOOL)_createBagNamesIndex
+{
+    // A partial index: only the rows holding the names of bags are indexed. Stores which already hold two bags
+    // with the same name get a regular index, so the lookups are fast all the same.
+    NSString *indexName = [NSString stringWithFormat:@"%@_%@_IDX", NSFValues, NSF_Private_NSFNanoBag_Name];
+    NSString *indexSQL = [NSString stringWithFormat:@"INDEX IF NOT EXISTS %@ ON %@ (%@) WHERE %@ = '%@';", indexName, NSFValues, NSFValue, NSFAttribute, NSF_Private_NSFNanoBag_Name];
+    
+    if (nil == [[self _executeSQL:[NSString stringWithFormat:@"CREATE UNIQUE %@", indexSQL]]error]) {
+        return YES;
+    }
+    
+    return (nil == [[self _executeSQL:[NSString stringWithFormat:@"CREATE %@", indexSQL]]error]);
+}
+
+- (NSDictionary *)_keysOfBagsNamed:(NSArray *)someNames
+{
+    // Returns the keys of the stored bags (values) by name (keys). The attribute is spelled out so the partial index applies.
+    NSMutableDictionary *keysByName = [NSMutableDictionary dictionaryWithCapacity:[someNames count]];
+    NSUInteger count = [someNames count];
+    NSUInteger location = 0;
+    
+    while (location < count) {
+        NSRange range = NSMakeRange(location, MIN(__NSFPBagNamesPerLookup, count - location));
+        NSArray *names = [someNames subarrayWithRange:range];
+        
+        NSMutableArray *placeholders = [NSMutableArray arrayWithCapacity:[names count]];
+        for (NSUInteger i = 0; i < [names count]; i++) {
+            [placeholders addObject:@"?"];
+        }
+        
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT %@, %@ FROM %@ WHERE %@ = '%@' AND %@ IN (%@);",
+                                     NSFKey, NSFValue, NSFValues, NSFAttribute, NSF_Private_NSFNanoBag_Name, NSFValue, [placeholders componentsJoinedByString:@","]];
+        sqlite3_stmt *statement;
+        if (NO == [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement]) {
+            return keysByName;
+        }
+        
+        int parameter = 1;
+        for (NSString *name in names) {
+            sqlite3_bind_text (statement, parameter++, [name UTF8String], -1, SQLITE_TRANSIENT);
+        }
+        
+        while (SQLITE_ROW == sqlite3_step (statement)) {
+            const char *keyUTF8 = (const char *)sqlite3_column_text (statement, 0);
+            const char *nameUTF8 = (const char *)sqlite3_column_text (statement, 1);
+            if ((NULL != keyUTF8) && (NULL != nameUTF8)) {
+                [keysByName setObject:[NSString stringWithUTF8String:keyUTF8] forKey:[NSString stringWithUTF8String:nameUTF8]];
+            }
+        }
+        
+        sqlite3_finalize (statement);
+        
+        location = NSMaxRange(range);
+    }
+    
+    return keysByName;
+}
+
+- (NSArray *)_keysForSQL:(NSString *)aSQLQuery bindingTexts:(NSArray *)someTexts
+{
+    sqlite3_stmt *statement;
+    if (NO == [self _prepareSQLite3Statement:&statement theSQLStatement:aSQLQuery]) {
+        return nil;
+    }
+    
+    int parameter = 1;
+    for (NSString *text in someTexts) {
+        sqlite3_bind_text (statement, parameter++, [text UTF8String], -1, SQLITE_TRANSIENT);
+    }
+    
+    NSMutableArray *keys = [NSMutableArray array];
+    int status;
+    while (SQLITE_ROW == (status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_step (statement)])) {
+        const char *keyUTF8 = (const char *)sqlite3_column_text (statement, 0);
+        if (NULL != keyUTF8) {
+            [keys addObject:[[NSString alloc]initWithUTF8String:keyUTF8]];
+        }
+    }
+    
+    sqlite3_finalize (statement);
+    
+    return (SQLITE_DONE == status) ? keys : nil;
+}
+
+- (long long)_countForSQL:(NSString *)aSQLQuery bindingTexts:(NSArray *)someTexts
+{
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT count(*) FROM (%@);", aSQLQuery];
+    sqlite3_stmt *statement;
+    if (NO == [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement]) {
+        return -1;
+    }
+    
+    int parameter = 1;
+    for (NSString *text in someTexts) {
+        sqlite3_bind_text (statement, parameter++, [text UTF8String], -1, SQLITE_TRANSIENT);
+    }
+    
+    long long count = -1;
+    if (SQLITE_ROW == [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_step (statement)]) {
+        count = sqlite3_column_int64 (statement, 0);
+    }
+    
+    sqlite3_finalize (statement);
+    
+    return count;
+}
+
+- (BOOL)_addMembersToBagWithKey:(NSString *)aBagKey fromSQL:(NSString *)aSQLQuery bindingTexts:(NSArray *)someTexts
+{
+    // The members are copied row by row inside SQLite: the keys never make it to Objective-C
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(%@, %@) SELECT ?%lu, %@ FROM (%@);",
+                                 NSFBagMembers, NSFKey, NSFObjectKey, (unsigned long)[someTexts count] + 1, NSFObjectKey, aSQLQuery];
+    sqlite3_stmt *statement;
+    if (NO == [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement]) {
+        return NO;
+    }
+    
+    BOOL success = [self _stepSQLite3Statement:statement bindingTexts:[someTexts arrayByAddingObject:aBagKey]];
+    
+    sqlite3_finalize (statement);
+    
+    return success;
+}
+
+- (BOOL)_storeMembersOfBagWithKey:(NSString *)aBagKey addingKeys:(NSArray *)addedKeys removingKeys:(NSArray *)removedKeys
+{
+    // Only the changes are written: the members already stored are left alone. Objects re-added to a bag show up
+    // among the added keys, hence the check for an existing row.
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(%@, %@) SELECT ?1, ?2 WHERE NOT EXISTS (SELECT 1 FROM %@ WHERE %@ = ?1 AND %@ = ?2);", NSFBagMembers, NSFKey, NSFObjectKey, NSFBagMembers, NSFKey, NSFObjectKey];
+    BOOL success = YES;
+    
+    if ([addedKeys count] > 0) {
+        sqlite3_stmt *statement = NULL;
+        success = [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement];
+        for (NSString *objectKey in addedKeys) {
+            if (NO == success) {
+                break;
+            }
+            success = [self _stepSQLite3Statement:statement bindingTexts:[NSArray arrayWithObjects:aBagKey, objectKey, nil]];
+        }
+        sqlite3_finalize (statement);
+    }
+    
+    if ((YES == success) && ([removedKeys count] > 0)) {
+        theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE %@ = ?1 AND %@ = ?2;", NSFBagMembers, NSFKey, NSFObjectKey];
+        sqlite3_stmt *statement = NULL;
+        success = [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement];
+        for (NSString *objectKey in removedKeys) {
+            if (NO == success) {
+                break;
+            }
+            success = [self _stepSQLite3Statement:statement bindingTexts:[NSArray arrayWithObjects:aBagKey, objectKey, nil]];
+        }
+        sqlite3_finalize (statement);
+    }
+    
+    return success;
+}
+
+// ----------------------------------------------
+// Materialized aggregates
+// ----------------------------------------------
+
+- (BOOL)_setupMaterializedAggregatesSchema
+{
+    // Created on demand: stores without materialized aggregates don't pay for them
+    NSArray *tables = [[self nanoStoreEngine]NSFP_flattenAllTables];
+    
+    if ([tables containsObject:NSFP_AggregateDefinitionsTable] == NO) {
+        NSString *theSQLStatement = [NSString stringWithFormat:@"CREATE TABLE %@(ROWID INTEGER PRIMARY KEY, NSFP_Name TEXT UNIQUE, NSFP_Function INTEGER, NSFP_Attribute TEXT, NSFP_GroupingAttribute TEXT);", NSFP_AggregateDefinitionsTable];
+        if (nil != [[self _executeSQL:theSQLStatement]error])
+            return NO;
+    }
+    
+    if ([tables containsObject:NSFP_AggregatesTable] == NO) {
+        NSString *theSQLStatement = [NSString stringWithFormat:@"CREATE TABLE %@(NSFP_Name TEXT, NSFP_Group NONE, NSFP_Count INTEGER, NSFP_Total REAL, PRIMARY KEY (NSFP_Name, NSFP_Group));", NSFP_AggregatesTable];
+        if (nil != [[self _executeSQL:theSQLStatement]error])
+            return NO;
+    }
+    
+    return YES;
+}
+
+- (NSArray *)_materializedAggregateDefinitions
+{
+    NSMutableArray *definitions = [NSMutableArray array];
+    
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT ROWID, NSFP_Name, NSFP_Function, NSFP_Attribute, NSFP_GroupingAttribute FROM %@;", NSFP_AggregateDefinitionsTable];
+    sqlite3_stmt *statement;
+    if (NO == [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement]) {
+        return definitions;
+    }
+    
+    while (SQLITE_ROW == sqlite3_step (statement)) {
+        NSMutableDictionary *definition = [NSMutableDictionary dictionaryWithCapacity:5];
+        for (int i = 0; i < sqlite3_column_count (statement); i++) {
+            [definition setObject:[NSFNanoSearch _valueForColumn:i ofSQLite3Statement:statement] forKey:[NSString stringWithUTF8String:sqlite3_column_name (statement, i)]];
+        }
+        [definitions addObject:definition];
+    }
+    
+    sqlite3_finalize (statement);
+    
+    return definitions;
+}
+
+- (BOOL)_installMaterializedAggregateTriggers
+{
+    // Dropping NSFKeys or NSFValues drops their triggers along with them
+    for (NSDictionary *definition in [self _materializedAggregateDefinitions]) {
+        id attribute = [definition objectForKey:@"NSFP_Attribute"];
+        id groupingAttribute = [definition objectForKey:@"NSFP_GroupingAttribute"];
+        NSArray *triggerStatements = [self _materializedAggregateTriggersForIdentifier:[[definition objectForKey:NSFRowIDColumnName]longLongValue]
+                                                                                  name:[definition objectForKey:@"NSFP_Name"]
+                                                                             attribute:([NSNull null] == attribute) ? nil : attribute
+                                                                     groupingAttribute:([NSNull null] == groupingAttribute) ? nil : groupingAttribute];
+        for (NSString *triggerStatement in triggerStatements) {
+            if (nil != [[self _executeSQL:triggerStatement]error])
+                return NO;
+        }
+    }
+    
+    return YES;
+}
+
+- (void)_dropMaterializedAggregateTriggersForIdentifier:(long long)anIdentifier
+{
+    for (NSUInteger i = 0; i < sizeof(__NSFPMaterializedAggregateTriggers) / sizeof(__NSFPMaterializedAggregateTriggers[0]); i++) {
+        NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"DROP TRIGGER IF EXISTS %@_%lld_%@;", NSFP_AggregatesTable, anIdentifier, __NSFPMaterializedAggregateTriggers[i]];
+        [self _executeSQL:theSQLStatement];
+    }
+}
+
+- (NSArray *)_materializedAggregateTriggersForIdentifier:(long long)anIdentifier name:(NSString *)aName attribute:(NSString *)anAttribute groupingAttribute:(NSString *)aGroupingAttribute
+{
+    // The groups are either the classes of the objects or the values of the grouping attribute. Each pair made of a group row
+    // and a measured value of the same object is added when the later of the two rows is inserted, and subtracted when the
+    // earlier of the two is deleted, so the order in which the rows of an object are written doesn't matter.
+    NSString *name = [NSFNanoStore _SQLLiteralForString:aName];
+    NSString *groupTable = NSFKeys;
+    NSString *groupColumn = NSFObjectClass;
+    NSString *groupFilter = @"1";
+    if (nil != aGroupingAttribute) {
+        groupTable = NSFValues;
+        groupColumn = NSFValue;
+        groupFilter = [NSString stringWithFormat:@"g.NSFAttribute = %@", [NSFNanoStore _SQLLiteralForString:aGroupingAttribute]];
+    }
+    
+    NSString *(^groupRowSQL)(NSString *, NSString *) = ^NSString *(NSString *row, NSString *sign) {
+        NSString *matchingGroup = [NSString stringWithFormat:@"NSFP_Name = %@ AND NSFP_Group = %@.%@", name, row, groupColumn];
+        NSString *update = nil;
+        if (nil == anAttribute) {
+            update = [NSString stringWithFormat:@"NSFP_Count = NSFP_Count %@ 1", sign];
+        } else {
+            NSString *measures = [NSString stringWithFormat:@"FROM NSFValues WHERE NSFKey = %@.NSFKey AND NSFAttribute = %@", row, [NSFNanoStore _SQLLiteralForString:anAttribute]];
+            update = [NSString stringWithFormat:@"NSFP_Count = NSFP_Count %@ (SELECT count(NSFValue) %@), NSFP_Total = NSFP_Total %@ (SELECT total(NSFValue) %@)", sign, measures, sign, measures];
+        }
+        return [NSString stringWithFormat:@"INSERT OR IGNORE INTO %@ VALUES (%@, %@.%@, 0, 0); UPDATE %@ SET %@ WHERE %@; DELETE FROM %@ WHERE %@ AND NSFP_Count = 0; ",
+                NSFP_AggregatesTable, name, row, groupColumn, NSFP_AggregatesTable, update, matchingGroup, NSFP_AggregatesTable, matchingGroup];
+    };
+    
+    NSString *(^measureRowSQL)(NSString *, NSString *) = ^NSString *(NSString *row, NSString *sign) {
+        NSString *groups = [NSString stringWithFormat:@"FROM %@ g WHERE g.NSFKey = %@.NSFKey AND g.%@ IS NOT NULL AND %@", groupTable, row, groupColumn, groupFilter];
+        NSString *pairs = [NSString stringWithFormat:@"(SELECT count(*) %@ AND g.%@ = %@.NSFP_Group)", groups, groupColumn, NSFP_AggregatesTable];
+        NSString *matchingGroups = [NSString stringWithFormat:@"NSFP_Name = %@ AND NSFP_Group IN (SELECT g.%@ %@)", name, groupColumn, groups];
+        return [NSString stringWithFormat:@"INSERT OR IGNORE INTO %@ SELECT %@, g.%@, 0, 0 %@; UPDATE %@ SET NSFP_Count = NSFP_Count %@ %@ * (%@.NSFValue IS NOT NULL), NSFP_Total = NSFP_Total %@ %@ * (SELECT total(%@.NSFValue)) WHERE %@; DELETE FROM %@ WHERE %@ AND NSFP_Count = 0; ",
+                NSFP_AggregatesTable, name, groupColumn, groups, NSFP_AggregatesTable, sign, pairs, row, sign, pairs, row, matchingGroups, NSFP_AggregatesTable, matchingGroups];
+    };
+    
+    NSString *prefix = [NSString stringWithFormat:@"CREATE TRIGGER IF NOT EXISTS %@_%lld", NSFP_AggregatesTable, anIdentifier];
+    NSMutableArray *triggerStatements = [NSMutableArray arrayWithCapacity:6];
+    
+    if (nil == aGroupingAttribute) {
+        [triggerStatements addObject:[NSString stringWithFormat:@"%@_%@ AFTER INSERT ON NSFKeys BEGIN %@END;", prefix, __NSFPMaterializedAggregateTriggers[0], groupRowSQL (@"new", @"+")]];
+        [triggerStatements addObject:[NSString stringWithFormat:@"%@_%@ AFTER DELETE ON NSFKeys BEGIN %@END;", prefix, __NSFPMaterializedAggregateTriggers[1], groupRowSQL (@"old", @"-")]];
+        [triggerStatements addObject:[NSString stringWithFormat:@"%@_%@ AFTER UPDATE OF NSFObjectClass ON NSFKeys WHEN old.NSFObjectClass IS NOT new.NSFObjectClass BEGIN %@%@END;", prefix, __NSFPMaterializedAggregateTriggers[2], groupRowSQL (@"old", @"-"), groupRowSQL (@"new", @"+")]];
+    } else {
+        NSString *grouping = [NSFNanoStore _SQLLiteralForString:aGroupingAttribute];
+        [triggerStatements addObject:[NSString stringWithFormat:@"%@_%@ AFTER INSERT ON NSFValues WHEN new.NSFAttribute = %@ AND new.NSFValue IS NOT NULL BEGIN %@END;", prefix, __NSFPMaterializedAggregateTriggers[0], grouping, groupRowSQL (@"new", @"+")]];
+        [triggerStatements addObject:[NSString stringWithFormat:@"%@_%@ AFTER DELETE ON NSFValues WHEN old.NSFAttribute = %@ AND old.NSFValue IS NOT NULL BEGIN %@END;", prefix, __NSFPMaterializedAggregateTriggers[1], grouping, groupRowSQL (@"old", @"-")]];
+        [triggerStatements addObject:[NSString stringWithFormat:@"%@_%@ AFTER UPDATE OF NSFValue ON NSFValues WHEN new.NSFAttribute = %@ AND old.NSFValue IS NOT new.NSFValue AND old.NSFValue IS NOT NULL AND new.NSFValue IS NOT NULL BEGIN %@%@END;", prefix, __NSFPMaterializedAggregateTriggers[2], grouping, groupRowSQL (@"old", @"-"), groupRowSQL (@"new", @"+")]];
+    }
+    
+    if (nil != anAttribute) {
+        NSString *measured = [NSFNanoStore _SQLLiteralForString:anAttribute];
+        [triggerStatements addObject:[NSString stringWithFormat:@"%@_%@ AFTER INSERT ON NSFValues WHEN new.NSFAttribute = %@ BEGIN %@END;", prefix, __NSFPMaterializedAggregateTriggers[3], measured, measureRowSQL (@"new", @"+")]];
+        [triggerStatements addObject:[NSString stringWithFormat:@"%@_%@ AFTER DELETE ON NSFValues WHEN old.NSFAttribute = %@ BEGIN %@END;", prefix, __NSFPMaterializedAggregateTriggers[4], measured, measureRowSQL (@"old", @"-")]];
+        [triggerStatements addObject:[NSString stringWithFormat:@"%@_%@ AFTER UPDATE OF NSFValue ON NSFValues WHEN new.NSFAttribute = %@ AND old.NSFValue IS NOT new.NSFValue BEGIN %@%@END;", prefix, __NSFPMaterializedAggregateTriggers[5], measured, measureRowSQL (@"old", @"-"), measureRowSQL (@"new", @"+")]];
+    }
+    
+    return triggerStatements;
+}
+
+- (BOOL)_recomputeMaterializedAggregateNamed:(NSString *)aName attribute:(NSString *)anAttribute groupingAttribute:(NSString *)aGroupingAttribute
+{
+    // Same pairing as the triggers, computed from scratch
+    NSString *name = [NSFNanoStore _SQLLiteralForString:aName];
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"DELETE FROM %@ WHERE NSFP_Name = %@;", NSFP_AggregatesTable, name];
+    if (nil != [[self _executeSQL:theSQLStatement]error])
+        return NO;
+    
+    NSString *groupTable = NSFKeys;
+    NSString *groupColumn = NSFObjectClass;
+    NSString *groupFilter = @"1";
+    if (nil != aGroupingAttribute) {
+        groupTable = NSFValues;
+        groupColumn = NSFValue;
+        groupFilter = [NSString stringWithFormat:@"g.NSFAttribute = %@", [NSFNanoStore _SQLLiteralForString:aGroupingAttribute]];
+    }
+    
+    if (nil == anAttribute) {
+        theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@ SELECT %@, g.%@, count(*), 0 FROM %@ g WHERE g.%@ IS NOT NULL AND %@ GROUP BY g.%@;",
+                           NSFP_AggregatesTable, name, groupColumn, groupTable, groupColumn, groupFilter, groupColumn];
+    } else {
+        theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@ SELECT %@, g.%@, count(v.NSFValue), total(v.NSFValue) FROM %@ g JOIN NSFValues v ON v.NSFKey = g.NSFKey AND v.NSFAttribute = %@ WHERE g.%@ IS NOT NULL AND %@ GROUP BY g.%@ HAVING count(v.NSFValue) > 0;",
+                           NSFP_AggregatesTable, name, groupColumn, groupTable, [NSFNanoStore _SQLLiteralForString:anAttribute], groupColumn, groupFilter, groupColumn];
+    }
+    
+    return (nil == [[self _executeSQL:theSQLStatement]error]);
+}
+
+- (NSNumber *)_materializedCountOfObjectsOfClassNamed:(NSString *)aClassName
+{
+    // nil unless a count of objects per class has been materialized
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT ifnull((SELECT a.NSFP_Count FROM %@ a WHERE a.NSFP_Name = d.NSFP_Name AND a.NSFP_Group = ?1), 0) FROM %@ d WHERE d.NSFP_Function = %d AND d.NSFP_Attribute IS NULL AND d.NSFP_GroupingAttribute IS NULL LIMIT 1;", NSFP_AggregatesTable, NSFP_AggregateDefinitionsTable, NSFCount];
+    sqlite3_stmt *statement;
+    if (NO == [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement]) {
+        return nil;
     }
     
-    return YES;
+    sqlite3_bind_text (statement, 1, [aClassName UTF8String], -1, SQLITE_TRANSIENT);
+    
+    NSNumber *count = nil;
+    if (SQLITE_ROW == sqlite3_step (statement)) {
+        count = [NSNumber numberWithLongLong:sqlite3_column_int64 (statement, 0)];
+    }
+    
+    sqlite3_finalize (statement);
+    
+    return count;
+}
+
+- (void)_bindMaterializedAggregateGroup:(id)aGroupValue parameterNumber:(int)aParamNumber usingSQLite3Statement:(sqlite3_stmt *)aStatement
+{
+    // Groups are stored the way the values they come from are: numbers as doubles, dates as text
+    switch ([self _NSFDatatypeOfObject:aGroupValue]) {
+        case NSFNanoTypeData:
+            sqlite3_bind_blob (aStatement, aParamNumber, [aGroupValue bytes], (int)[aGroupValue length], SQLITE_TRANSIENT);
+            break;
+        case NSFNanoTypeNumber:
+            sqlite3_bind_double (aStatement, aParamNumber, [aGroupValue doubleValue]);
+            break;
+        default:
+            sqlite3_bind_text (aStatement, aParamNumber, [[self _stringFromValue:aGroupValue]UTF8String], -1, SQLITE_TRANSIENT);
+            break;
+    }
+}
+
++ (NSNumber *)_valueOfMaterializedAggregateFunction:(NSFAggregateFunctionType)theFunctionType count:(long long)aCount total:(double)aTotal
+{
+    switch (theFunctionType) {
+        case NSFCount:
+            return [NSNumber numberWithLongLong:aCount];
+        case NSFTotal:
+            return [NSNumber numberWithDouble:aTotal];
+        default:
+            return [NSNumber numberWithDouble:(0 == aCount) ? 0.0 : aTotal / aCount];
+    }
 }
 
-- (BOOL)_storeDictionary:(NSDictionary *)someInfo forKey:(NSString *)aKey forClassNamed:(NSString *)className usingSQLite3Statement:(sqlite3_stmt *)storeValuesStatement error:(out NSError **)outError
++ (NSString *)_SQLLiteralForString:(NSString *)aString
+{
+    return [NSString stringWithFormat:@"'%@'", [aString stringByReplacingOccurrencesOfString:@"'" withString:@"''"]];
+}
+
+- (BOOL)_storeDictionary:(NSDictionary *)someInfo plist:(NSString *)dictXML hash:(NSString *)aHash forKey:(NSString *)aKey forClassNamed:(NSString *)className usingSQLite3Statement:(sqlite3_stmt *)storeValuesStatement error:(out NSError **)outError
 {
     if (nil == someInfo)
         [[NSException exceptionWithName:NSFUnexpectedParameterException
@@ -839,6 +3249,56 @@
                                    userInfo:nil]raise];
     }
     
+    BOOL success = [self _storeValuesOfDictionary:someInfo forKey:aKey usingSQLite3Statement:storeValuesStatement];
+    
+    if (YES == success) {
+        // Save the Key and its Plist (if it applies). Reuse the encoded form if the caller has already computed it.
+        if (nil == dictXML) {
+            dictXML = [self _plistStringFromDictionary:someInfo error:outError];
+            aHash = nil;
+        }
+        
+        if (nil == dictXML) {
+            success = NO;
+        } else {
+            const char *aKeyUTF8 = [aKey UTF8String];
+            const char *dictXMLUTF8 = [dictXML UTF8String];
+            
+            if (nil == aHash) {
+                aHash = [NSFNanoEngine NSFP_contentHashOfBytes:dictXMLUTF8 length:strlen(dictXMLUTF8)];
+            }
+            
+            // Reset, as required by SQLite...
+            int status = sqlite3_reset (_storeKeysStatement);
+            
+            // Since we're operating with extended result code support, extract the bits
+            // and obtain the regular result code
+            // For more info check: http://www.sqlite.org/c3ref/c_ioerr_access.html
+            
+            status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+            
+            // Bind and execute the statement...
+            if (SQLITE_OK == status) {
+                
+                BOOL resultBindKey = (sqlite3_bind_text (_storeKeysStatement, 1, aKeyUTF8, -1, SQLITE_STATIC) == SQLITE_OK);
+                BOOL resultBindPlist = [self _bindPlist:dictXMLUTF8 parameterNumber:2 usingSQLite3Statement:_storeKeysStatement];
+                BOOL resultBindCalendarDate = (sqlite3_bind_text (_storeKeysStatement, 3, [[NSFNanoStore _calendarDateToString:[NSDate date]]UTF8String], -1, SQLITE_STATIC) == SQLITE_OK);
+                BOOL resultBindClass = (sqlite3_bind_text (_storeKeysStatement, 4, [className UTF8String], -1, SQLITE_STATIC) == SQLITE_OK);
+                BOOL resultBindHash = (sqlite3_bind_text (_storeKeysStatement, 5, [aHash UTF8String], -1, SQLITE_STATIC) == SQLITE_OK);
+                
+                success = (resultBindKey && resultBindPlist && resultBindCalendarDate && resultBindClass && resultBindHash);
+                if (success) {
+                    success = (SQLITE_DONE == [self _executeSQLite3StepUsingSQLite3Statement:_storeKeysStatement]);
+                }
+            }
+        }
+    }
+    
+    return success;
+}
+
+- (BOOL)_storeValuesOfDictionary:(NSDictionary *)someInfo forKey:(NSString *)aKey usingSQLite3Statement:(sqlite3_stmt *)storeValuesStatement
+{
     const char *aKeyUTF8 = [aKey UTF8String];
     BOOL success = YES;
     
@@ -846,9 +3306,10 @@
     {
         NSMutableArray *flattenedKeys = [NSMutableArray new];
         NSMutableArray *flattenedValues = [NSMutableArray new];
+        NSMutableIndexSet *arrayElementIndexes = [NSMutableIndexSet new];
         
         @autoreleasepool {
-            [self _flattenCollection:someInfo keys:&flattenedKeys values:&flattenedValues];
+            [self _flattenCollection:someInfo keys:&flattenedKeys values:&flattenedValues arrayElementIndexes:arrayElementIndexes];
             
             NSUInteger i, count = [flattenedKeys count];
             
@@ -871,98 +3332,297 @@
                     
                     // Bind and execute the statement...
                     BOOL resultBindKey = (sqlite3_bind_text (storeValuesStatement, 1, aKeyUTF8, -1, SQLITE_STATIC) == SQLITE_OK);
-                    BOOL resultBindAttribute = (sqlite3_bind_text (storeValuesStatement, 2, [attribute UTF8String], -1, SQLITE_STATIC) == SQLITE_OK);
+                    BOOL resultBindValues = [self _bindValue:value forAttribute:attribute isArrayElement:[arrayElementIndexes containsIndex:i] firstParameterNumber:2 usingSQLite3Statement:storeValuesStatement];
                     
-                    // Take advantage of manifest typing
-                    // Branch the type of bind based on the type to be stored: NSString, NSData, NSDate or NSNumber
-                    NSFNanoDatatype valueDataType = [self _NSFDatatypeOfObject:value];
-                    BOOL resultBindValue = NO;
-                    
-                    switch (valueDataType) {
-                        case NSFNanoTypeData:
-                            resultBindValue = (sqlite3_bind_blob(storeValuesStatement, 3, [value bytes], [value length], NULL) == SQLITE_OK);
-                            break;
-                        case NSFNanoTypeString:
-                        case NSFNanoTypeDate:
-                            resultBindValue = (sqlite3_bind_text (storeValuesStatement, 3, [[self _stringFromValue:value]UTF8String], -1, SQLITE_STATIC) == SQLITE_OK);
-                            break;
-                            break;
-                        case NSFNanoTypeNumber:
-                            resultBindValue = (sqlite3_bind_double (storeValuesStatement, 3, [value doubleValue]) == SQLITE_OK);
-                            break;
-                        default:
-                            [[NSException exceptionWithName:NSFUnexpectedParameterException
-                                                     reason:[NSString stringWithFormat:@"*** -[%@ %s]: datatype %@ cannot be stored because its class type is unknown.", [self class], _cmd, [value class]]
-                                                   userInfo:nil]raise];
-                            break;
-                    }
-                    
-                    // Store the element's datatype so we can recreate it later on when we read it back from the store...
-                    NSString *valueDatatypeString = NSFStringFromNanoDataType(valueDataType);
-                    BOOL resultBindDatatype = (sqlite3_bind_text (storeValuesStatement, 4, [valueDatatypeString UTF8String], -1, SQLITE_STATIC) == SQLITE_OK);
-                    
-                    success = (resultBindKey && resultBindAttribute && resultBindValue && resultBindDatatype);
+                    success = (resultBindKey && resultBindValues);
                     if (success) {
-                        [self _executeSQLite3StepUsingSQLite3Statement:storeValuesStatement];
+                        success = (SQLITE_DONE == [self _executeSQLite3StepUsingSQLite3Statement:storeValuesStatement]);
                     }
                 }
+                
+                if (NO == success) {
+                    break;
+                }
             }
             
         }
     }
     
-    if (YES == success) {
-        // Save the Key and its Plist (if it applies)
-        NSString *dictXML = nil;
-        NSString *errorString = nil;
-        
-        NSData *dictData = [NSPropertyListSerialization dataFromPropertyList:someInfo format:NSPropertyListXMLFormat_v1_0 errorDescription:&errorString];
-        if (nil != errorString) {
-            NSLog(@"     Dictionary: %@", someInfo);
-            NSLog(@"*** -[%@ %@]: [NSPropertyListSerialization dataFromPropertyList] failure. %@", [self class], NSStringFromSelector(_cmd), errorString);
-            NSLog(@"     Dictionary info: %@", someInfo);
-            success = NO;
+    return success;
+}
+
+- (BOOL)_bindValue:(id)aValue forAttribute:(NSString *)anAttribute isArrayElement:(BOOL)isArrayElement firstParameterNumber:(int)aParamNumber usingSQLite3Statement:(sqlite3_stmt *)aStatement
+{
+    // Binds, in order: the attribute, the value, its datatype, its timestamp and the array element flag
+    BOOL resultBindAttribute = (sqlite3_bind_text (aStatement, aParamNumber, [anAttribute UTF8String], -1, SQLITE_STATIC) == SQLITE_OK);
+    
+    // Take advantage of manifest typing
+    // Branch the type of bind based on the type to be stored: NSString, NSData, NSDate or NSNumber
+    NSFNanoDatatype valueDataType = [self _NSFDatatypeOfObject:aValue];
+    BOOL resultBindValue = NO;
+    
+    switch (valueDataType) {
+        case NSFNanoTypeData:
+            resultBindValue = (sqlite3_bind_blob(aStatement, aParamNumber + 1, [aValue bytes], [aValue length], NULL) == SQLITE_OK);
+            break;
+        case NSFNanoTypeString:
+        case NSFNanoTypeDate:
+            resultBindValue = (sqlite3_bind_text (aStatement, aParamNumber + 1, [[self _stringFromValue:aValue]UTF8String], -1, SQLITE_STATIC) == SQLITE_OK);
+            break;
+        case NSFNanoTypeNumber:
+            resultBindValue = (sqlite3_bind_double (aStatement, aParamNumber + 1, [aValue doubleValue]) == SQLITE_OK);
+            break;
+        default:
+            [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                     reason:[NSString stringWithFormat:@"*** -[%@ %s]: datatype %@ cannot be stored because its class type is unknown.", [self class], _cmd, [aValue class]]
+                                   userInfo:nil]raise];
+            break;
+    }
+    
+    // Store the element's datatype so we can recreate it later on when we read it back from the store...
+    NSString *valueDatatypeString = NSFStringFromNanoDataType(valueDataType);
+    BOOL resultBindDatatype = (sqlite3_bind_text (aStatement, aParamNumber + 2, [valueDatatypeString UTF8String], -1, SQLITE_STATIC) == SQLITE_OK);
+    
+    // Dates are also stored as seconds since 1970 so they can be compared and bucketed numerically. Bindings survive
+    // a reset, so the other datatypes clear it explicitly.
+    BOOL resultBindTimestamp = NO;
+    if (NSFNanoTypeDate == valueDataType) {
+        resultBindTimestamp = (sqlite3_bind_double (aStatement, aParamNumber + 3, [aValue timeIntervalSince1970]) == SQLITE_OK);
+    } else {
+        resultBindTimestamp = (sqlite3_bind_null (aStatement, aParamNumber + 3) == SQLITE_OK);
+    }
+    
+    // Flag the values found inside an array: a single element reads back exactly like a scalar
+    BOOL resultBindArrayElement = (sqlite3_bind_int (aStatement, aParamNumber + 4, isArrayElement ? 1 : 0) == SQLITE_OK);
+    
+    return (resultBindAttribute && resultBindValue && resultBindDatatype && resultBindTimestamp && resultBindArrayElement);
+}
+
+- (NSString *)_plistStringFromDictionary:(NSDictionary *)someInfo error:(out NSError **)outError
+{
+    someInfo = [self _storedFormOfCollection:someInfo];
+    
+    NSString *dictXML = nil;
+    NSString *errorString = nil;
+    
+    NSData *dictData = [NSPropertyListSerialization dataFromPropertyList:someInfo format:NSPropertyListXMLFormat_v1_0 errorDescription:&errorString];
+    if (nil != errorString) {
+        NSLog(@"     Dictionary: %@", someInfo);
+        NSLog(@"*** -[%@ %@]: [NSPropertyListSerialization dataFromPropertyList] failure. %@", [self class], NSStringFromSelector(_cmd), errorString);
+        NSLog(@"     Dictionary info: %@", someInfo);
+        return nil;
+    }
+    
+    if ([dictData length] > 0)
+        dictXML = [[NSString alloc]initWithBytes:[dictData bytes]length:[dictData length]encoding:NSUTF8StringEncoding];
+    else
+        dictXML = @"";
+    
+    if (nil == dictXML) {
+        if (nil != outError)
+            *outError = [NSError errorWithDomain:NSFDomainKey
+                                            code:NSF_Private_InvalidParameterDataCodeKey
+                                        userInfo:[NSDictionary dictionaryWithObject:@"Couldn't serialize the object: %@"
+                                                                             forKey:NSLocalizedDescriptionKey]];
+    }
+    
+    return dictXML;
+}
+
+- (BOOL)_updateStoredObject:(NSFNanoObject *)anObject plist:(NSString *)dictXML hash:(NSString *)aHash forClassNamed:(NSString *)className storedInfo:(NSDictionary *)storedInfo usingTrackedAttributes:(BOOL)useTrackedAttributes error:(out NSError **)outError
+{
+    NSString *aKey = anObject.key;
+    NSDictionary *someInfo = [anObject nanoObjectDictionaryRepresentation];
+    if ((nil == someInfo) || ((NO == useTrackedAttributes) && (nil == storedInfo))) {
+        return NO;
+    }
+    
+    NSMutableSet *staleAttributes = [NSMutableSet set];
+    NSMutableSet *freshAttributes = [NSMutableSet set];
+    
+    if (YES == useTrackedAttributes) {
+        // The object knows what it's been through since it was loaded or saved
+        [staleAttributes unionSet:anObject.changedAttributes];
+        [staleAttributes unionSet:anObject.removedAttributes];
+        [freshAttributes unionSet:anObject.changedAttributes];
+        [freshAttributes unionSet:anObject.addedAttributes];
+    } else {
+        // Otherwise the attributes to reindex are found by comparing the representation with the stored document: subclasses
+        // build their own representation, and the info (or the containers in it) may have been modified in place.
+        for (NSString *attribute in someInfo) {
+            id storedValue = [storedInfo objectForKey:attribute];
+            if (nil == storedValue) {
+                [freshAttributes addObject:attribute];
+            } else if (NO == [storedValue isEqual:[someInfo objectForKey:attribute]]) {
+                [staleAttributes addObject:attribute];
+                [freshAttributes addObject:attribute];
+            }
+        }
+        
+        for (NSString *attribute in storedInfo) {
+            if (nil == [someInfo objectForKey:attribute]) {
+                [staleAttributes addObject:attribute];
+            }
+        }
+    }
+    
+    for (NSString *attribute in freshAttributes) {
+        if (NSNotFound != [attribute rangeOfString:@"."].location)
+            [[NSException exceptionWithName:NSFUnexpectedParameterException
+                                     reason:[NSString stringWithFormat:@"*** -[%@ %s]: the keys of the dictionary cannot contain a period ('.')", [self class], _cmd]
+                                   userInfo:nil]raise];
+    }
+    
+    if (nil == dictXML) {
+        dictXML = [self _plistStringFromDictionary:someInfo error:outError];
+        if (nil == dictXML) {
+            return NO;
+        }
+        aHash = nil;
+    }
+    
+    const char *dictXMLUTF8 = [dictXML UTF8String];
+    if (nil == aHash) {
+        aHash = [NSFNanoEngine NSFP_contentHashOfBytes:dictXMLUTF8 length:strlen(dictXMLUTF8)];
+    }
+    
+    const char *aKeyUTF8 = [aKey UTF8String];
+    sqlite3 *sqliteDatabase = [[self nanoStoreEngine]sqlite];
+    
+    // Patch the Key row first: if it's not there, the object has to be written from scratch
+    int status = sqlite3_reset (_updateKeysStatement);
+    
+    // Since we're operating with extended result code support, extract the bits
+    // and obtain the regular result code
+    // For more info check: http://www.sqlite.org/c3ref/c_ioerr_access.html
+    
+    status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
+    if (SQLITE_OK != status) {
+        return NO;
+    }
+    
+    BOOL resultBindPlist = [self _bindPlist:dictXMLUTF8 parameterNumber:1 usingSQLite3Statement:_updateKeysStatement];
+    BOOL resultBindCalendarDate = (sqlite3_bind_text (_updateKeysStatement, 2, [[NSFNanoStore _calendarDateToString:[NSDate date]]UTF8String], -1, SQLITE_TRANSIENT) == SQLITE_OK);
+    BOOL resultBindClass = (sqlite3_bind_text (_updateKeysStatement, 3, [className UTF8String], -1, SQLITE_STATIC) == SQLITE_OK);
+    BOOL resultBindHash = (sqlite3_bind_text (_updateKeysStatement, 4, [aHash UTF8String], -1, SQLITE_STATIC) == SQLITE_OK);
+    BOOL resultBindKey = (sqlite3_bind_text (_updateKeysStatement, 5, aKeyUTF8, -1, SQLITE_STATIC) == SQLITE_OK);
+    
+    if ((NO == resultBindPlist) || (NO == resultBindCalendarDate) || (NO == resultBindClass) || (NO == resultBindHash) || (NO == resultBindKey)) {
+        return NO;
+    }
+    
+    if ((SQLITE_DONE != [self _executeSQLite3StepUsingSQLite3Statement:_updateKeysStatement]) || (0 == sqlite3_changes (sqliteDatabase))) {
+        return NO;
+    }
+    
+    // Remove the rows of the attributes which are gone or have been modified...
+    for (NSString *attribute in staleAttributes) {
+        status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:sqlite3_reset (_removeAttributeStatement)];
+        if (SQLITE_OK != status) {
+            return NO;
+        }
+        
+        NSString *nestedPrefix = [attribute stringByAppendingString:@"."];
+        BOOL success = ((sqlite3_bind_text (_removeAttributeStatement, 1, aKeyUTF8, -1, SQLITE_STATIC) == SQLITE_OK) &&
+                        (sqlite3_bind_text (_removeAttributeStatement, 2, [attribute UTF8String], -1, SQLITE_STATIC) == SQLITE_OK) &&
+                        (sqlite3_bind_text (_removeAttributeStatement, 3, [nestedPrefix UTF8String], -1, SQLITE_STATIC) == SQLITE_OK));
+        if (NO == success) {
+            return NO;
+        }
+        
+        if (SQLITE_DONE != [self _executeSQLite3StepUsingSQLite3Statement:_removeAttributeStatement]) {
+            return NO;
+        }
+    }
+    
+    // ... and index the ones which have been modified or added
+    NSMutableDictionary *freshInfo = [NSMutableDictionary dictionaryWithCapacity:[freshAttributes count]];
+    for (NSString *attribute in freshAttributes) {
+        id theValue = [someInfo objectForKey:attribute];
+        if (nil != theValue) {
+            [freshInfo setObject:theValue forKey:attribute];
+        }
+    }
+    
+    if ([freshInfo count] > 0) {
+        return [self _storeValuesOfDictionary:freshInfo forKey:aKey usingSQLite3Statement:_storeValuesStatement];
+    }
+    
+    return YES;
+}
+
+- (NSString *)_storedClassNameOfObject:(id)anObject
+{
+    // If the object was originally created by storing a class not recognized by this process, honor it and store it with the right class string.
+    NSString *className = nil;
+    if (YES == [anObject respondsToSelector:@selector(originalClassString)]) {
+        className = [anObject originalClassString];
+    }
+    
+    // Otherwise, just save the class name of the object being stored
+    if (nil == className) {
+        className = NSStringFromClass([anObject class]);
+    }
+    
+    return className;
+}
+
+- (NSDictionary *)_storedHashesForKeys:(NSArray *)someKeys
+{
+    // Maps each key to an array containing its content hash and its class name. A nil array of keys fetches every object.
+    NSUInteger count = [someKeys count];
+    NSMutableDictionary *storedHashes = [NSMutableDictionary dictionaryWithCapacity:count];
+    if ((nil != someKeys) && (0 == count)) {
+        return storedHashes;
+    }
+    
+    NSUInteger chunkSize = 500;
+    NSUInteger location = 0;
+    
+    do {
+        NSArray *chunk = nil;
+        NSString *theSQLStatement = nil;
+        
+        if (nil == someKeys) {
+            theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT %@, %@, %@ FROM %@;", NSFKey, NSFHash, NSFObjectClass, NSFKeys];
         } else {
-            if ([dictData length] > 0)
-                dictXML = [[NSString alloc]initWithBytes:[dictData bytes]length:[dictData length]encoding:NSUTF8StringEncoding];
-            else
-                dictXML = @"";
+            chunk = [someKeys subarrayWithRange:NSMakeRange(location, MIN(chunkSize, count - location))];
+            NSMutableArray *placeholders = [NSMutableArray arrayWithCapacity:[chunk count]];
+            for (NSUInteger j = 0; j < [chunk count]; j++) {
+                [placeholders addObject:@"?"];
+            }
+            theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT %@, %@, %@ FROM %@ WHERE %@ IN (%@);", NSFKey, NSFHash, NSFObjectClass, NSFKeys, NSFKey, [placeholders componentsJoinedByString:@","]];
+        }
+        
+        sqlite3_stmt *statement;
+        if (NO == [self _prepareSQLite3Statement:&statement theSQLStatement:theSQLStatement]) {
+            return nil;
+        }
+        
+        int column = 1;
+        for (NSString *key in chunk) {
+            sqlite3_bind_text (statement, column++, [key UTF8String], -1, SQLITE_TRANSIENT);
+        }
+        
+        while (SQLITE_ROW == sqlite3_step (statement)) {
+            const char *keyUTF8 = (const char *)sqlite3_column_text (statement, 0);
+            const char *hashUTF8 = (const char *)sqlite3_column_text (statement, 1);
+            const char *classUTF8 = (const char *)sqlite3_column_text (statement, 2);
             
-            if (nil == dictXML) {
-                if (nil != outError)
-                    *outError = [NSError errorWithDomain:NSFDomainKey
-                                                    code:NSF_Private_InvalidParameterDataCodeKey
-                                                userInfo:[NSDictionary dictionaryWithObject:@"Couldn't serialize the object: %@"
-                                                                                     forKey:NSLocalizedDescriptionKey]];
-                success = NO;
-            } else {
-                // Reset, as required by SQLite...
-                int status = sqlite3_reset (_storeKeysStatement);
-                
-                // Since we're operating with extended result code support, extract the bits
-                // and obtain the regular result code
-                // For more info check: http://www.sqlite.org/c3ref/c_ioerr_access.html
-                
-                status = [NSFNanoEngine NSFP_stripBitsFromExtendedResultCode:status];
-                
-                // Bind and execute the statement...
-                if (SQLITE_OK == status) {
-                    
-                    BOOL resultBindKey = (sqlite3_bind_text (_storeKeysStatement, 1, aKeyUTF8, -1, SQLITE_STATIC) == SQLITE_OK);
-                    BOOL resultBindPlist = (sqlite3_bind_text (_storeKeysStatement, 2, [dictXML UTF8String], -1, SQLITE_STATIC) == SQLITE_OK);
-                    BOOL resultBindCalendarDate = (sqlite3_bind_text (_storeKeysStatement, 3, [[NSFNanoStore _calendarDateToString:[NSDate date]]UTF8String], -1, SQLITE_STATIC) == SQLITE_OK);
-                    BOOL resultBindClass = (sqlite3_bind_text (_storeKeysStatement, 4, [className UTF8String], -1, SQLITE_STATIC) == SQLITE_OK);
-                    
-                    success = (resultBindKey && resultBindPlist && resultBindCalendarDate && resultBindClass);
-                    if (success) {
-                        [self _executeSQLite3StepUsingSQLite3Statement:_storeKeysStatement];
-                    }
-                }
+            if ((NULL == keyUTF8) || (NULL == hashUTF8) || (NULL == classUTF8)) {
+                continue;
             }
+            
+            [storedHashes setObject:[NSArray arrayWithObjects:[NSString stringWithUTF8String:hashUTF8], [NSString stringWithUTF8String:classUTF8], nil]
+                             forKey:[NSString stringWithUTF8String:keyUTF8]];
         }
-    }
+        
+        sqlite3_finalize (statement);
+        
+        location += [chunk count];
+    } while (location < count);
     
-    return success;
+    return storedHashes;
 }
 
 - (NSFNanoDatatype)_NSFDatatypeOfObject:(id)value
@@ -1002,7 +3662,7 @@
     return [[NSNull null]description];
 }
 
-+ (NSString *)_calendarDateToString:(NSDate *)aDate
++ (NSDateFormatter *)_calendarDateFormatter
 {
     static NSDateFormatter *__sNSFNanoStoreDateFormatter = nil;
     if (nil == __sNSFNanoStoreDateFormatter) {
@@ -1012,21 +3672,43 @@
         [__sNSFNanoStoreDateFormatter setDateFormat:@"yyyy-MM-dd HH:mm:ss:SSS"]; 
     }
     
+    return __sNSFNanoStoreDateFormatter;
+}
+
++ (NSString *)_calendarDateToString:(NSDate *)aDate
+{
     if (nil == aDate)
         [[NSException exceptionWithName:NSFUnexpectedParameterException
                                  reason:[NSString stringWithFormat:@"*** -[%@ %s]: aDate is nil.", [self class], _cmd]
                                userInfo:nil]raise];
     
-    return [__sNSFNanoStoreDateFormatter stringFromDate:aDate];
+    return [[self _calendarDateFormatter]stringFromDate:aDate];
+}
+
++ (NSDate *)_calendarDateFromString:(NSString *)aString
+{
+    // Only strings written by _calendarDateToString: are accepted
+    if (23 != [aString length]) {
+        return nil;
+    }
+    
+    return [[self _calendarDateFormatter]dateFromString:aString];
 }
 
 - (void)_flattenCollection:(NSDictionary *)info keys:(NSMutableArray **)flattenedKeys values:(NSMutableArray **)flattenedValues
 {
+    [self _flattenCollection:info keys:flattenedKeys values:flattenedValues arrayElementIndexes:nil];
+}
+
+- (void)_flattenCollection:(NSDictionary *)info keys:(NSMutableArray **)flattenedKeys values:(NSMutableArray **)flattenedValues arrayElementIndexes:(NSMutableIndexSet *)arrayElementIndexes
+{
+    info = [self _storedFormOfCollection:info];
+    
     NSMutableArray *keyPath = [NSMutableArray new];
-    [self _flattenCollection:info keyPath:&keyPath keys:flattenedKeys values:flattenedValues];
+    [self _flattenCollection:info keyPath:&keyPath keys:flattenedKeys values:flattenedValues arrayElementIndexes:arrayElementIndexes];
 }
 
-- (void)_flattenCollection:(id)someObject keyPath:(NSMutableArray **)aKeyPath keys:(NSMutableArray **)flattenedKeys values:(NSMutableArray **)flattenedValues
+- (void)_flattenCollection:(id)someObject keyPath:(NSMutableArray **)aKeyPath keys:(NSMutableArray **)flattenedKeys values:(NSMutableArray **)flattenedValues arrayElementIndexes:(NSMutableIndexSet *)arrayElementIndexes
 {
     BOOL isOfTypeCollection = ([someObject isKindOfClass:[NSDictionary class]] || [someObject isKindOfClass:[NSArray class]]);
 
@@ -1040,12 +3722,16 @@
         if ([someObject isKindOfClass:[NSDictionary class]]) {
             for (NSString *key in someObject) {
                 [*aKeyPath addObject:key];
-                [self _flattenCollection:[someObject objectForKey:key] keyPath:aKeyPath keys:flattenedKeys values:flattenedValues];
+                [self _flattenCollection:[someObject objectForKey:key] keyPath:aKeyPath keys:flattenedKeys values:flattenedValues arrayElementIndexes:arrayElementIndexes];
                 [*aKeyPath removeLastObject];
             }
         } else if ([someObject isKindOfClass:[NSArray class]]) {
+            NSUInteger firstIndex = (nil != flattenedKeys) ? [*flattenedKeys count] : 0;
             for (id anObject in someObject) {
-                [self _flattenCollection:anObject keyPath:aKeyPath keys:flattenedKeys values:flattenedValues];
+                [self _flattenCollection:anObject keyPath:aKeyPath keys:flattenedKeys values:flattenedValues arrayElementIndexes:arrayElementIndexes];
+            }
+            if (nil != flattenedKeys) {
+                [arrayElementIndexes addIndexesInRange:NSMakeRange(firstIndex, [*flattenedKeys count] - firstIndex)];
             }
         }
     }
@@ -1074,12 +3760,13 @@
     return (SQLITE_OK == status);
 }
 
-- (void)_executeSQLite3StepUsingSQLite3Statement:(sqlite3_stmt *)aStatement
+- (int)_executeSQLite3StepUsingSQLite3Statement:(sqlite3_stmt *)aStatement
 {
     BOOL waitingForRow = YES;
+    int status = SQLITE_OK;
     
     do {
-        int status = sqlite3_step(aStatement);
+        status = sqlite3_step(aStatement);
         
         // Since we're operating with extended result code support, extract the bits
         // and obtain the regular result code
@@ -1102,6 +3789,8 @@
                 break;
         }
     } while (waitingForRow);
+    
+    return status;
 }
 
 - (BOOL)_addObjectsFromArray:(NSArray *)someObjects forceSave:(BOOL)forceSave error:(out NSError **)outError
@@ -1121,6 +3810,9 @@
         NSDate *startRemovingDate = [NSDate date];
         _NSFLog(@"     Removing the objects to be stored...");
         NSMutableSet *keys = [NSMutableSet new];
+        NSMutableSet *updatableObjects = [NSMutableSet new];
+        NSHashTable *trackedObjects = [NSHashTable hashTableWithOptions:NSPointerFunctionsObjectPointerPersonality];
+        NSCountedSet *keyOccurrences = [NSCountedSet new];
         NSInteger i = unsavedObjectsCount;
         
         // Remove all objects non conforming with the NSFNanoObjectProtocol
@@ -1138,15 +3830,81 @@
                                          reason:[NSString stringWithFormat:@"*** -[%@ %s]: unexpected NSFNanoObject behavior. Reason: the object's key is nil.", [self class], _cmd]
                                        userInfo:nil]raise]; 
             }
-            [keys addObject:objectKey];
+            [keyOccurrences addObject:objectKey];
+        }
+        
+        // Encode the objects once: objects whose encoded form matches what's already stored don't need to be written at all,
+        // and the encoded form of the others is reused when they're written.
+        NSMapTable *encodedObjects = [NSMapTable mapTableWithKeyOptions:NSMapTableObjectPointerPersonality valueOptions:NSMapTableStrongMemory];
+        NSDictionary *storedHashes = [self _storedHashesForKeys:[keyOccurrences allObjects]];
+        unsigned long long skippedWrites = 0;
+        i = [addedObjects count];
+        
+        while ( i-- ) {
+            id object = [addedObjects objectAtIndex:i];
+            NSString *objectKey = [(id)object nanoObjectKey];
+            
+            // Asked before the representation, which hands out the info: plain NanoObjects whose info hasn't been handed out
+            // can be patched from the attributes they've tracked
+            BOOL tracksAllChanges = ([object class] == [NSFNanoObject class]) && (YES == [object _tracksAllChanges]);
+            NSDictionary *objectInfo = [object nanoObjectDictionaryRepresentation];
+            NSString *dictXML = (nil != objectInfo) ? [self _plistStringFromDictionary:objectInfo error:nil] : nil;
+            
+            if (nil != dictXML) {
+                const char *dictXMLUTF8 = [dictXML UTF8String];
+                NSString *hash = [NSFNanoEngine NSFP_contentHashOfBytes:dictXMLUTF8 length:strlen(dictXMLUTF8)];
+                NSArray *storedHash = [storedHashes objectForKey:objectKey];
+                
+                // Keys showing up more than once in the batch are always written, so the last object wins as it always has
+                if ((1 == [keyOccurrences countForObject:objectKey]) && (YES == [storedHash isEqualToArray:[NSArray arrayWithObjects:hash, [self _storedClassNameOfObject:object], nil]])) {
+                    if (YES == [object isKindOfClass:[NSFNanoObject class]]) {
+                        [object _markSaved];
+                    }
+                    [self _refreshCachedObject:object forKey:objectKey];
+                    [addedObjects removeObjectAtIndex:i];
+                    skippedWrites++;
+                    continue;
+                }
+                
+                [encodedObjects setObject:[NSArray arrayWithObjects:dictXML, hash, nil] forKey:object];
+            }
+            
+            // Objects loaded from the store only need their modified attributes to be rewritten
+            if ((YES == [object isKindOfClass:[NSFNanoObject class]]) && (YES == [object _isPersisted])) {
+                [updatableObjects addObject:object];
+                if (YES == tracksAllChanges) {
+                    [trackedObjects addObject:object];
+                }
+            } else {
+                [keys addObject:objectKey];
+            }
+        }
+        
+        numberOfSkippedWrites += skippedWrites;
+        _NSFLog(@"     Skipping %llu unchanged objects...", skippedWrites);
+        
+        // If the same key is also being written whole, it wins: there's no point in patching it
+        for (NSFNanoObject *object in [updatableObjects allObjects]) {
+            if (YES == [keys containsObject:object.key]) {
+                [updatableObjects removeObject:object];
+            }
         }
         
+        // For the others, the stored documents tell which attributes have to be reindexed
+        NSMutableArray *updatableKeys = [NSMutableArray arrayWithCapacity:[updatableObjects count]];
+        for (NSFNanoObject *object in updatableObjects) {
+            if (NO == [trackedObjects containsObject:object]) {
+                [updatableKeys addObject:object.key];
+            }
+        }
+        NSDictionary *storedInfos = [self _dictionariesForKeys:updatableKeys];
+        
         // Recalculate how many elements we have left
         unsavedObjectsCount = [addedObjects count];
         
-        if (unsavedObjectsCount > 0) {
+        if ([keys count] > 0) {
             NSError *localOutError = nil;
-            if (NO == [self removeObjectsWithKeysInArray:[keys allObjects] error:&localOutError]) {
+            if (NO == [self _removeObjectsWithKeysInArray:[keys allObjects] keepingBagMembers:YES error:&localOutError]) {
                 [[NSException exceptionWithName:NSFNanoStoreUnableToManipulateStoreException
                                          reason:[NSString stringWithFormat:@"*** -[%@ %s]: %@", [self class], _cmd, [localOutError localizedDescription]]
                                        userInfo:nil]raise];
@@ -1168,23 +3926,33 @@
         
         for (id object in addedObjects) {
             @autoreleasepool {
-                // If the object was originally created by storing a class not recognized by this process, honor it and store it with the right class string.
-                NSString *className = nil;
-                if (YES == [object respondsToSelector:@selector(originalClassString)]) {
-                    className = [object originalClassString];
-                }
+                NSString *className = [self _storedClassNameOfObject:object];
+                NSArray *encodedObject = [encodedObjects objectForKey:object];
+                NSString *dictXML = [encodedObject objectAtIndex:0];
+                NSString *hash = [encodedObject lastObject];
                 
-                // Otherwise, just save the class name of the object being stored
-                if (nil == className) {
-                    className = NSStringFromClass([object class]);
+                BOOL wasUpdated = NO;
+                if (YES == [updatableObjects containsObject:object]) {
+                    wasUpdated = [self _updateStoredObject:object plist:dictXML hash:hash forClassNamed:className storedInfo:[storedInfos objectForKey:[(id)object nanoObjectKey]] usingTrackedAttributes:[trackedObjects containsObject:object] error:outError];
+                    
+                    // The object isn't in the store (or couldn't be patched): clean up whatever is left and write it whole
+                    if (NO == wasUpdated) {
+                        [self _removeObjectsWithKeysInArray:[NSArray arrayWithObject:[(id)object nanoObjectKey]] keepingBagMembers:YES error:nil];
+                    }
                 }
                 
-                if (NO == [self _storeDictionary:[object nanoObjectDictionaryRepresentation] forKey:[(id)object nanoObjectKey] forClassNamed:className usingSQLite3Statement:_storeValuesStatement error:outError]) {
+                if ((NO == wasUpdated) && (NO == [self _storeDictionary:[object nanoObjectDictionaryRepresentation] plist:dictXML hash:hash forKey:[(id)object nanoObjectKey] forClassNamed:className usingSQLite3Statement:_storeValuesStatement error:outError])) {
                     [[NSException exceptionWithName:NSFNanoStoreUnableToManipulateStoreException
                                              reason:[NSString stringWithFormat:@"*** -[%@ %s]: %@", [self class], _cmd, [*outError localizedDescription]]
                                            userInfo:nil]raise];
                 }
                 
+                if (YES == [object isKindOfClass:[NSFNanoObject class]]) {
+                    [object _markSaved];
+                }
+                
+                [self _refreshCachedObject:object forKey:[(id)object nanoObjectKey]];
+                
                 i++;
                 
                 // Commit every 'saveInterval' interations...
@@ -1221,6 +3989,7 @@
         _NSFLog(@"     Done. Storing the objects took %.3f seconds (%.0f keys/sec.)", secondsStoring, ratio);
         
         [addedObjects removeAllObjects];
+        [_outOfLineBlobs removeAllObjects];
     }
     
     return YES;
@@ -1362,6 +4131,25 @@
     theSQLStatement = [NSString stringWithFormat:@"INSERT INTO fileDB.%@ (%@) SELECT * FROM main.%@", NSFValues, columns, NSFValues];
     [self _executeSQL:theSQLStatement];
     
+    // Transfer the NSFBagMembers table
+    columns = [[[self nanoStoreEngine]columnsForTable:NSFBagMembers]componentsJoinedByString:@", "];
+    theSQLStatement = [NSString stringWithFormat:@"INSERT INTO fileDB.%@ (%@) SELECT * FROM main.%@", NSFBagMembers, columns, NSFBagMembers];
+    [self _executeSQL:theSQLStatement];
+    
+    // Transfer the NSFBlobs table, which holds the bytes the values larger than the threshold refer to
+    theSQLStatement = [NSString stringWithFormat:@"CREATE TABLE IF NOT EXISTS fileDB.%@(ROWID INTEGER PRIMARY KEY, %@ TEXT UNIQUE, %@ INTEGER, %@ BLOB)", NSFBlobs, NSFHash, NSFLength, NSFData];
+    [self _executeSQL:theSQLStatement];
+    theSQLStatement = [NSString stringWithFormat:@"INSERT INTO fileDB.%@ (ROWID, %@, %@, %@) SELECT ROWID, %@, %@, %@ FROM main.%@", NSFBlobs, NSFHash, NSFLength, NSFData, NSFHash, NSFLength, NSFData, NSFBlobs];
+    [self _executeSQL:theSQLStatement];
+    
+    // Transfer the compression dictionaries, if any were trained: the compressed documents can't be read without them
+    if (YES == [[[self nanoStoreEngine]NSFP_flattenAllTables]containsObject:NSFP_CompressionDictionariesTable]) {
+        theSQLStatement = [NSString stringWithFormat:@"CREATE TABLE IF NOT EXISTS fileDB.%@(ROWID INTEGER PRIMARY KEY, NSFP_Dictionary BLOB)", NSFP_CompressionDictionariesTable];
+        [self _executeSQL:theSQLStatement];
+        theSQLStatement = [NSString stringWithFormat:@"INSERT INTO fileDB.%@ (ROWID, NSFP_Dictionary) SELECT ROWID, NSFP_Dictionary FROM main.%@", NSFP_CompressionDictionariesTable, NSFP_CompressionDictionariesTable];
+        [self _executeSQL:theSQLStatement];
+    }
+    
     // Safely detach the file-based database
     [self _executeSQL:@"DETACH DATABASE fileDB"];
     
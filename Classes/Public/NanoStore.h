@@ -34,6 +34,7 @@
 #import "NSFNanoSortDescriptor.h"
 #import "NSFNanoResult.h"
 #import "NSFNanoBag.h"
+#import "NSFNanoBlob.h"
 #import "NSFNanoEngine.h"
 #import "NSFNanoGlobals.h"
 
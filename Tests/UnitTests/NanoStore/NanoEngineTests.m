@@ -47,4 +47,25 @@
     STAssertTrue (maxRowUID == 2, @"Expected to find the max RowUID for the given table.");
 }
 
+- (void)testBase64RoundTrip
+{
+    NSString *encoded = [NSFNanoEngine encodeDataToBase64:[@"foobar" dataUsingEncoding:NSUTF8StringEncoding]];
+    NSString *encodedWithPadding = [NSFNanoEngine encodeDataToBase64:[@"fooba" dataUsingEncoding:NSUTF8StringEncoding]];
+    NSData *decoded = [NSFNanoEngine decodeDataFromBase64:@"Zm9vYg=="];
+    
+    // Every padding length, and more than one quantum
+    BOOL roundTrips = YES;
+    NSMutableData *data = [NSMutableData data];
+    for (NSUInteger i = 0; i < 64; i++) {
+        NSData *decodedData = [NSFNanoEngine decodeDataFromBase64:[NSFNanoEngine encodeDataToBase64:data]];
+        roundTrips = roundTrips && [decodedData isEqualToData:data];
+        uint8_t byte = (uint8_t)(i * 37);
+        [data appendBytes:&byte length:1];
+    }
+    
+    STAssertTrue ([encoded isEqualToString:@"Zm9vYmFy"] && [encodedWithPadding isEqualToString:@"Zm9vYmE="], @"Expected the data to be encoded in base 64.");
+    STAssertTrue ([decoded isEqualToData:[@"foob" dataUsingEncoding:NSUTF8StringEncoding]], @"Expected the string to be decoded from base 64.");
+    STAssertTrue (roundTrips, @"Expected the data to read back unchanged.");
+}
+
 @end
\ No newline at end of file
@@ -510,6 +510,9 @@
     
     NSArray *bags = [nanoStore bags];
     
+    // The bag needs the store to load its objects
+    [[bags lastObject]inflateBag];
+    
     [nanoStore closeWithError:nil];
     
     STAssertTrue ([[[bags lastObject]savedObjects]count] == 3, @"Saving a bag should have succeded.");
@@ -530,6 +533,9 @@
     
     NSArray *bags = [nanoStore bags];
     
+    // The bag needs the store to load its objects
+    [[bags lastObject]inflateBag];
+    
     [nanoStore closeWithError:nil];
     
     STAssertTrue ([[[bags lastObject]savedObjects]count] == 3, @"Saving a bag should have succeded.");
@@ -559,6 +565,7 @@
     STAssertTrue (nil == outError, @"Saving the bag failed. Reason: %@.", [outError localizedDescription]);
 
     savedBag = [[nanoStore bags]lastObject];
+    [savedBag inflateBag];
 
     [nanoStore closeWithError:nil];
     
@@ -593,6 +600,7 @@
     STAssertTrue (nil == outError, @"Saving the bag failed. Reason: %@.", [outError localizedDescription]);
     
     savedBag = [[nanoStore bags]lastObject];
+    [savedBag inflateBag];
     [nanoStore closeWithError:nil];
     
     STAssertTrue (([[savedBag savedObjects]count] == 3), @"Expected savedObjects to have 3 elements.");
@@ -722,6 +730,7 @@
     STAssertTrue (([[savedBag savedObjects]count] == 2) && ([[savedBag unsavedObjects]count] == 1) && ([[savedBag removedObjects]count] == 0), @"Editing objects from a bag should have succeded.");
     
     [savedBag undoChangesWithError:&outError];
+    [savedBag inflateBag];
     
     [nanoStore closeWithError:nil];
     
@@ -887,4 +896,311 @@
     STAssertTrue (YES == inflated, @"Expected the bag to be inflated.");
 }
 
+
+- (void)testBagMembershipStoredIncrementally
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoBag *bag = [NSFNanoBag bag];
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj3 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [bag addObjectsFromArray:[NSArray arrayWithObjects:obj1, obj2, nil] error:nil];
+    [nanoStore addObject:bag error:nil];
+    
+    [bag removeObject:obj1];
+    [bag addObject:obj3 error:nil];
+    [bag saveAndReturnError:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    long long memberRows = [[[search executeSQL:[NSString stringWithFormat:@"SELECT count(*) FROM NSFBagMembers WHERE NSFKey = '%@'", bag.key]]firstValue]longLongValue];
+    long long keyValueRows = [[[search executeSQL:@"SELECT count(*) FROM NSFValues WHERE NSFAttribute = 'NSF_Private_NSFNanoBag_NSFObjectKeys'"]firstValue]longLongValue];
+    NSFNanoBag *storedBag = [[nanoStore bagsWithKeysInArray:[NSArray arrayWithObject:bag.key]]lastObject];
+    NSUInteger storedBagCount = storedBag.count;
+    BOOL storedBagHasAddedObject = (nil != [storedBag.savedObjects objectForKey:obj3.key]);
+    BOOL storedBagHasRemovedObject = (nil != [storedBag.savedObjects objectForKey:obj1.key]);
+    NSUInteger bagsWithRemovedObject = [[nanoStore bagsContainingObjectWithKey:obj1.key]count];
+    NSUInteger bagsWithAddedObject = [[nanoStore bagsContainingObjectWithKey:obj3.key]count];
+    
+    [nanoStore removeObject:bag error:nil];
+    long long memberRowsAfterRemoval = [[[search executeSQL:@"SELECT count(*) FROM NSFBagMembers"]firstValue]longLongValue];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ((2 == memberRows) && (0 == keyValueRows), @"Expected the members to be kept in NSFBagMembers only.");
+    STAssertTrue ((2 == storedBagCount) && (YES == storedBagHasAddedObject) && (NO == storedBagHasRemovedObject), @"Expected the stored bag to reflect the changes.");
+    STAssertTrue ((0 == bagsWithRemovedObject) && (1 == bagsWithAddedObject), @"Expected the reverse lookups to follow the membership.");
+    STAssertTrue (0 == memberRowsAfterRemoval, @"Expected the membership to be removed along with the bag.");
+}
+
+- (void)testBagRenamedKeepsItsMembers
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoBag *bag = [NSFNanoBag bagWithName:@"Before"];
+    [bag addObject:object error:nil];
+    [nanoStore addObject:bag error:nil];
+    
+    // Renaming changes the bag's document, so the bag is rewritten
+    bag.name = @"After";
+    BOOL savedNewName = [bag saveAndReturnError:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    long long memberRows = [[[search executeSQL:[NSString stringWithFormat:@"SELECT count(*) FROM NSFBagMembers WHERE NSFKey = '%@'", bag.key]]firstValue]longLongValue];
+    NSFNanoBag *retrievedBag = [[nanoStore bagsWithKeysInArray:[NSArray arrayWithObject:bag.key]]lastObject];
+    BOOL hasObject = (nil != [retrievedBag.savedObjects objectForKey:object.key]);
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue (YES == savedNewName, @"Expected the renamed bag to be saved.");
+    STAssertTrue ((1 == memberRows) && (YES == hasObject), @"Expected the renamed bag to keep its members.");
+}
+
+- (void)testBagLazyInflationAndPaging
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoBag *bag = [NSFNanoBag bag];
+    NSMutableArray *objects = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 5; i++) {
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo]];
+    }
+    [bag addObjectsFromArray:objects error:nil];
+    [nanoStore addObject:bag error:nil];
+    
+    NSFNanoBag *storedBag = [[nanoStore bagsWithKeysInArray:[NSArray arrayWithObject:bag.key]]lastObject];
+    NSUInteger count = storedBag.count;
+    
+    NSMutableSet *pagedKeys = [NSMutableSet set];
+    NSUInteger numberOfPages = 0;
+    NSUInteger numberOfPagedObjects = 0;
+    NSString *token = nil;
+    do {
+        NSArray *page = [storedBag objectsWithPageSize:2 continuationToken:token nextContinuationToken:&token];
+        for (NSFNanoObject *object in page) {
+            [pagedKeys addObject:object.key];
+        }
+        numberOfPagedObjects += [page count];
+        numberOfPages++;
+    } while ((nil != token) && (numberOfPages < 10));
+    
+    BOOL inflated = (5 == [storedBag.savedObjects count]);
+    for (NSFNanoObject *object in objects) {
+        if ([NSNull null] == [storedBag.savedObjects objectForKey:object.key]) {
+            inflated = NO;
+        }
+    }
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue (5 == count, @"Expected the stored bag to be counted without inflating it.");
+    STAssertTrue ((5 == numberOfPagedObjects) && (5 == [pagedKeys count]) && (3 == numberOfPages), @"Expected every object to be paged exactly once.");
+    STAssertTrue (YES == inflated, @"Expected the bag to be inflated when its objects are accessed.");
+}
+
+- (void)testBagLeavesOutMembersRemovedFromStore
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj3 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoBag *bag = [NSFNanoBag bagWithObjects:[NSArray arrayWithObjects:obj1, obj2, obj3, nil]];
+    [nanoStore addObject:bag error:nil];
+    
+    [nanoStore removeObject:obj2 error:nil];
+    
+    NSFNanoBag *storedBag = [[nanoStore bagsWithKeysInArray:[NSArray arrayWithObject:bag.key]]lastObject];
+    NSUInteger count = storedBag.count;
+    NSFNanoBag *otherStoredBag = [[nanoStore bagsWithKeysInArray:[NSArray arrayWithObject:bag.key]]lastObject];
+    NSDictionary *otherSavedObjects = [otherStoredBag savedObjects];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue (2 == count, @"Expected the removed member not to be counted.");
+    STAssertTrue ((2 == [otherSavedObjects count]) && (nil == [otherSavedObjects objectForKey:obj2.key]), @"Expected the removed member to be left out.");
+}
+
+- (void)testBagSaveKeepsObjectsInMemory
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoBag *bag = [NSFNanoBag bag];
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj3 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [bag addObjectsFromArray:[NSArray arrayWithObjects:obj1, obj2, nil] error:nil];
+    [nanoStore addObject:bag error:nil];
+    
+    [bag removeObject:obj1];
+    [bag addObject:obj3 error:nil];
+    NSError *outError = nil;
+    BOOL success = [bag saveAndReturnError:&outError];
+    
+    BOOL keptInMemory = ((obj2 == [bag.savedObjects objectForKey:obj2.key]) && (obj3 == [bag.savedObjects objectForKey:obj3.key]));
+    NSUInteger storedCount = [[[nanoStore bagsWithKeysInArray:[NSArray arrayWithObject:bag.key]]lastObject]count];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ((YES == success) && (nil == outError), @"Saving the bag should have succeded.");
+    STAssertTrue ((2 == [bag.savedObjects count]) && (0 == [bag.unsavedObjects count]) && (0 == [bag.removedObjects count]) && (NO == bag.hasUnsavedChanges), @"Expected the bag to reflect the save.");
+    STAssertTrue (YES == keptInMemory, @"Expected the saved objects to be the ones added to the bag.");
+    STAssertTrue (2 == storedCount, @"Expected the stored bag to have two elements.");
+}
+
+- (void)testBagSetOperations
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObject:@"A" forKey:@"segment"]];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObject:@"A" forKey:@"segment"]];
+    NSFNanoObject *obj3 = [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObject:@"B" forKey:@"segment"]];
+    NSFNanoObject *obj4 = [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObject:@"B" forKey:@"segment"]];
+    NSFNanoBag *bagA = [NSFNanoBag bagWithObjects:[NSArray arrayWithObjects:obj1, obj2, obj3, nil]];
+    NSFNanoBag *bagB = [NSFNanoBag bagWithObjects:[NSArray arrayWithObjects:obj2, obj3, obj4, nil]];
+    [nanoStore addObjectsFromArray:[NSArray arrayWithObjects:bagA, bagB, nil] error:nil];
+    
+    NSError *outError = nil;
+    NSSet *intersection = [NSSet setWithArray:[bagA keysBySetOperation:NSFSetIntersection withBagOrSearch:bagB error:&outError]];
+    NSSet *difference = [NSSet setWithArray:[bagA keysBySetOperation:NSFSetDifference withBagOrSearch:bagB error:nil]];
+    long long unionCount = [bagA countOfObjectsBySetOperation:NSFSetUnion withBagOrSearch:bagB];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"segment";
+    search.match = NSFEqualTo;
+    search.value = @"B";
+    long long intersectionCountWithSearch = [bagA countOfObjectsBySetOperation:NSFSetIntersection withBagOrSearch:search];
+    
+    NSFNanoBag *unionBag = [bagA bagBySetOperation:NSFSetUnion withBagOrSearch:bagB name:@"union" error:nil];
+    long long unionBagCount = unionBag.count;
+    BOOL unionBagHasAllObjects = (4 == [unionBag.savedObjects count]) && (nil != [unionBag.savedObjects objectForKey:obj4.key]);
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ((nil == outError) && ([intersection isEqualToSet:[NSSet setWithObjects:obj2.key, obj3.key, nil]]), @"Expected the intersection to hold the shared objects.");
+    STAssertTrue ([difference isEqualToSet:[NSSet setWithObject:obj1.key]], @"Expected the difference to hold the objects of the first bag only.");
+    STAssertTrue (4 == unionCount, @"Expected the union to hold four objects.");
+    STAssertTrue (1 == intersectionCountWithSearch, @"Expected one object of the bag to match the search.");
+    STAssertTrue ((nil != unionBag) && (4 == unionBagCount) && (YES == unionBagHasAllObjects) && ([unionBag.name isEqualToString:@"union"]), @"Expected the new bag to hold the union.");
+}
+
+- (void)testBagSetOperationsLeaveOutMembersRemovedFromStore
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj3 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj4 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoBag *bagA = [NSFNanoBag bagWithObjects:[NSArray arrayWithObjects:obj1, obj2, obj3, nil]];
+    NSFNanoBag *bagB = [NSFNanoBag bagWithObjects:[NSArray arrayWithObjects:obj2, obj3, obj4, nil]];
+    [nanoStore addObjectsFromArray:[NSArray arrayWithObjects:bagA, bagB, nil] error:nil];
+    
+    [nanoStore removeObjectsInArray:[NSArray arrayWithObjects:obj1, obj3, nil] error:nil];
+    
+    NSSet *intersection = [NSSet setWithArray:[bagA keysBySetOperation:NSFSetIntersection withBagOrSearch:bagB error:nil]];
+    NSSet *difference = [NSSet setWithArray:[bagB keysBySetOperation:NSFSetDifference withBagOrSearch:bagA error:nil]];
+    long long unionCount = [bagA countOfObjectsBySetOperation:NSFSetUnion withBagOrSearch:bagB];
+    long long unionBagCount = [[bagA bagBySetOperation:NSFSetUnion withBagOrSearch:bagB name:nil error:nil]count];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ([intersection isEqualToSet:[NSSet setWithObject:obj2.key]], @"Expected the intersection to leave out the removed objects.");
+    STAssertTrue ([difference isEqualToSet:[NSSet setWithObject:obj4.key]], @"Expected the difference to leave out the removed objects.");
+    STAssertTrue ((2 == unionCount) && (2 == unionBagCount), @"Expected the union to leave out the removed objects.");
+}
+
+- (void)testBagUniqueNamesCheckedInBatch
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSMutableArray *bags = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 600; i++) {
+        [bags addObject:[NSFNanoBag bagWithName:[NSString stringWithFormat:@"Bag %lu", (unsigned long)i]]];
+    }
+    
+    NSError *outError = nil;
+    BOOL addedBags = [nanoStore addObjectsFromArray:bags error:&outError];
+    BOOL addedBagsAgain = [nanoStore addObjectsFromArray:bags error:nil];
+    
+    NSFNanoBag *duplicateBag = [NSFNanoBag bagWithName:@"Bag 599"];
+    BOOL addedDuplicateBag = [nanoStore addObjectsFromArray:[NSArray arrayWithObjects:[NSFNanoBag bagWithName:@"Bag 600"], duplicateBag, nil] error:nil];
+    BOOL addedDuplicatesInArray = [nanoStore addObjectsFromArray:[NSArray arrayWithObjects:[NSFNanoBag bagWithName:@"Twin"], [NSFNanoBag bagWithName:@"Twin"], nil] error:nil];
+    
+    NSFNanoBag *renamedBag = [bags objectAtIndex:1];
+    renamedBag.name = @"Bag 0";
+    BOOL savedRenamedBag = [renamedBag saveAndReturnError:nil];
+    
+    NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoBag *bag = [bags objectAtIndex:2];
+    [bag addObject:object error:nil];
+    [bag saveAndReturnError:nil];
+    bag.name = @"Renamed";
+    BOOL savedNewName = [bag saveAndReturnError:nil];
+    NSUInteger retrievedBagCount = [[nanoStore bagWithName:@"Renamed"]count];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ((YES == addedBags) && (nil == outError) && (YES == addedBagsAgain), @"Expected the bags to be saved, and saved again.");
+    STAssertTrue ((NO == addedDuplicateBag) && (NO == addedDuplicatesInArray), @"Expected bags with existing names to be rejected.");
+    STAssertTrue (NO == savedRenamedBag, @"Expected a bag renamed after another one to be rejected.");
+    STAssertTrue ((YES == savedNewName) && (1 == retrievedBagCount), @"Expected a renamed bag to keep its members.");
+}
+
+- (void)testBagNeedsItsStoreToLoadItsMembers
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoBag *bag = [NSFNanoBag bagWithObjects:[NSArray arrayWithObjects:[NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo], [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo], nil]];
+    [nanoStore addObject:bag error:nil];
+    NSFNanoBag *storedBag = [[nanoStore bagsWithKeysInArray:[NSArray arrayWithObject:bag.key]]lastObject];
+    
+    // Closing the store doesn't load the bags read from it
+    [nanoStore closeWithError:nil];
+    
+    NSUInteger savedObjectsWhileClosed = [storedBag.savedObjects count];
+    NSError *outError = nil;
+    BOOL addedWhileClosed = [storedBag addObject:[NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo] error:&outError];
+    
+    STAssertTrue (0 == savedObjectsWhileClosed, @"Expected nothing to be loaded while the store is closed.");
+    STAssertTrue ((NO == addedWhileClosed) && (nil != outError), @"Expected an error when the members can't be loaded.");
+}
+
+- (void)testBagSaveIsRolledBackWhenTheMembersCantBeSaved
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoBag *bag = [NSFNanoBag bagWithName:@"Before"];
+    [nanoStore addObject:bag error:nil];
+    
+    // Without the membership table, only the bag and its new object could be written
+    [nanoStore _executeSQL:@"DROP TABLE NSFBagMembers"];
+    
+    NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    bag.name = @"After";
+    [bag addObject:object error:nil];
+    NSError *outError = nil;
+    BOOL saved = [bag saveAndReturnError:&outError];
+    
+    long long bagsNamedAfter = [[[nanoStore _executeSQL:@"SELECT count(*) FROM NSFValues WHERE NSFAttribute = 'NSF_Private_NSFNanoBag_Name' AND NSFValue = 'After'"]firstValue]longLongValue];
+    long long storedObjects = [[[nanoStore _executeSQL:[NSString stringWithFormat:@"SELECT count(*) FROM NSFKeys WHERE NSFKey = '%@'", object.key]]firstValue]longLongValue];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ((NO == saved) && (nil != outError), @"Expected the save to fail.");
+    STAssertTrue ((0 == bagsNamedAfter) && (0 == storedObjects), @"Expected the bag and its object to be rolled back along with the membership.");
+    STAssertTrue ((YES == bag.hasUnsavedChanges) && (1 == [bag.unsavedObjects count]), @"Expected the bag to keep its unsaved changes.");
+}
+
 @end
\ No newline at end of file
@@ -9,6 +9,7 @@
 #import "NanoStore.h"
 #import "NanoStoreObjectTests.h"
 #import "NSFNanoStore_Private.h"
+#import "NSFNanoObject_Private.h"
 
 @implementation NanoStoreObjectTests
 
@@ -161,6 +162,25 @@
     STAssertTrue ((nil != info) && ([info count] == 0) && (nil == [info objectForKey:@"foo"]), @"Expected removeObjectForKey: to work.");
 }
 
+- (void)testObjectTracksChangedAttributes
+{
+    NSFNanoObject *object = [[NSFNanoObject alloc]initNanoObjectFromDictionaryRepresentation:_defaultTestInfo forKey:nil store:nil];
+    [object _markSaved];
+    
+    [object setObject:@"Tito" forKey:@"FirstName"];
+    [object setObject:@"bar" forKey:@"foo"];
+    [object removeObjectForKey:@"LastName"];
+    [object setObject:@"baz" forKey:@"temp"];
+    [object removeObjectForKey:@"temp"];
+    
+    BOOL success = ([object.changedAttributes isEqualToSet:[NSSet setWithObject:@"FirstName"]] &&
+                    [object.addedAttributes isEqualToSet:[NSSet setWithObject:@"foo"]] &&
+                    [object.removedAttributes isEqualToSet:[NSSet setWithObject:@"LastName"]] &&
+                    (YES == object.hasUnsavedChanges));
+    
+    STAssertTrue (success, @"Expected the changed, added and removed attributes to be tracked.");
+}
+
 #pragma mark -
 
 - (void)testBagCopyNanoObject
@@ -11,6 +11,7 @@
 #import "NanoStoreSearchTests.h"
 #import "NSFNanoStore_Private.h"
 #import "NSFNanoObject_Private.h"
+#import "NSFNanoEngine_Private.h"
 #import "NSFNanoSortDescriptor.h"
 #import "NanoCarTestClass.h"
 #import "NanoPersonTestClass.h"
@@ -279,6 +280,31 @@
     STAssertTrue ([searchResults count] == 2, @"Expected to find two objects.");
 }
 
+- (void)testSearchResultCacheInvalidatedOnCommit
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    BOOL trackedWhileDisabled = [[nanoStore nanoStoreEngine]NSFP_tracksChangedTables];
+    nanoStore.searchResultCacheEnabled = YES;
+    BOOL trackedWhileEnabled = [[nanoStore nanoStoreEngine]NSFP_tracksChangedTables];
+    [nanoStore addObjectsFromArray:[NSArray arrayWithObject:[NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo]] error:nil];
+
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+
+    NSDictionary *firstResults = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    NSDictionary *secondResults = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+
+    [nanoStore addObjectsFromArray:[NSArray arrayWithObject:[NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo]] error:nil];
+
+    NSDictionary *thirdResults = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+
+    [nanoStore closeWithError:nil];
+
+    STAssertTrue ((NO == trackedWhileDisabled) && (YES == trackedWhileEnabled), @"Expected the changed tables to be tracked only while the cache is enabled.");
+    STAssertTrue (firstResults == secondResults, @"Expected the repeated search to be served from the result cache.");
+    STAssertTrue ([thirdResults count] == 2, @"Expected the cached results to be discarded after the commit.");
+}
+
 - (void)testSearchObjectsReturningObjects
 {
     NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
@@ -296,6 +322,339 @@
     STAssertTrue ([searchResults count] == 2, @"Expected to find two objects.");
 }
 
+- (void)testSearchObjectsReturningFaults
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [nanoStore addObjectsFromArray:[NSArray arrayWithObjects:obj1, obj2, nil] error:nil];
+
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+
+    NSDictionary *searchResults = [search searchObjectsWithReturnType:NSFReturnFaults error:nil];
+    NSFNanoObject *fault1 = [searchResults objectForKey:obj1.key];
+    NSFNanoObject *fault2 = [searchResults objectForKey:obj2.key];
+
+    BOOL faultedBeforeAccess = (YES == fault1.isFault) && (YES == fault2.isFault);
+    BOOL loadedOnAccess = [fault1.info isEqualToDictionary:_defaultTestInfo];
+    BOOL siblingStillFault = fault2.isFault;
+    BOOL siblingLoaded = [fault2.info isEqualToDictionary:_defaultTestInfo];
+
+    [nanoStore closeWithError:nil];
+
+    STAssertTrue ([searchResults count] == 2, @"Expected to find two objects.");
+    STAssertTrue (faultedBeforeAccess, @"Expected the objects to be faults before being accessed.");
+    STAssertTrue (loadedOnAccess && (NO == fault1.isFault), @"Expected the fault to load its info when accessed.");
+    STAssertTrue (siblingStillFault && siblingLoaded, @"Expected the sibling fault to fire on its own access, using the batch already loaded.");
+}
+
+- (void)testSearchObjectsReturningFaultsOfOtherClasses
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+
+    NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoBag *bag = [NSFNanoBag bagWithName:@"Faults"];
+    [nanoStore addObjectsFromArray:[NSArray arrayWithObjects:object, bag, nil] error:nil];
+
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    NSDictionary *searchResults = [search searchObjectsWithReturnType:NSFReturnFaults error:nil];
+    id retrievedBag = [searchResults objectForKey:bag.key];
+    NSFNanoObject *fault = [searchResults objectForKey:object.key];
+
+    [nanoStore closeWithError:nil];
+
+    // The store is closed, so the fault can't be fulfilled. It must not turn into an empty object.
+    BOOL raised = NO;
+    @try {
+        [fault objectForKey:@"FirstName"];
+    } @catch (NSException *e) {
+        raised = YES;
+    }
+
+    STAssertTrue ([retrievedBag isKindOfClass:[NSFNanoBag class]] && [[retrievedBag name]isEqualToString:@"Faults"], @"Expected the bag to be returned as a bag.");
+    STAssertTrue (raised && (YES == fault.isFault), @"Expected the fault to raise and stay a fault when its info can't be loaded.");
+}
+
+- (void)testSearchCountAndExistsObjectsMatchingSearch
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    [nanoStore addObjectsFromArray:[NSArray arrayWithObjects:[NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo], [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo], nil] error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    long long allCount = [search countOfObjectsMatchingSearch];
+    
+    search.attribute = @"FirstName";
+    search.match = NSFEqualTo;
+    search.value = @"Tito";
+    long long matchingCount = [search countOfObjectsMatchingSearch];
+    BOOL matchingExists = [search existsObjectMatchingSearch];
+    
+    search.value = @"Nobody";
+    long long missingCount = [search countOfObjectsMatchingSearch];
+    BOOL missingExists = [search existsObjectMatchingSearch];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ((2 == allCount) && (2 == matchingCount) && (0 == missingCount), @"Expected the counts to match the objects, not their values.");
+    STAssertTrue (matchingExists && (NO == missingExists), @"Expected existence to follow the matches.");
+}
+
+- (void)testSearchCountObjectsMatchingCustomSQL
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    [nanoStore addObjectsFromArray:[NSArray arrayWithObjects:[NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo], [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo], nil] error:nil];
+    
+    // Two values per object: each object shows up twice among the rows
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    [search executeSQL:@"SELECT NSFKey, NSFValue FROM NSFValues WHERE NSFAttribute IN ('FirstName', 'LastName')" returnType:NSFReturnKeys error:nil];
+    long long count = [search countOfObjectsMatchingSearch];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue (2 == count, @"Expected each object to be counted once.");
+}
+
+- (void)testSearchObjectsInPagesWithContinuationToken
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSMutableArray *objects = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 25; i++) {
+        NSMutableDictionary *info = [_defaultTestInfo mutableCopy];
+        [info setObject:[NSNumber numberWithUnsignedInteger:i % 5] forKey:@"Rank"];
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:info]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"FirstName";
+    search.match = NSFEqualTo;
+    search.value = @"Tito";
+    search.sort = [NSArray arrayWithObject:[NSFNanoSortDescriptor sortDescriptorWithAttribute:@"Rank" ascending:NO]];
+    
+    NSMutableArray *pagedObjects = [NSMutableArray array];
+    NSString *token = nil;
+    NSUInteger numberOfPages = 0;
+    
+    do {
+        NSString *nextToken = nil;
+        NSArray *page = [search searchObjectsWithReturnType:NSFReturnObjects pageSize:10 continuationToken:token nextContinuationToken:&nextToken error:nil];
+        [pagedObjects addObjectsFromArray:page];
+        token = nextToken;
+        numberOfPages++;
+        
+        // Objects sorting before the current position must not show up later on
+        if (1 == numberOfPages) {
+            NSMutableDictionary *info = [_defaultTestInfo mutableCopy];
+            [info setObject:[NSNumber numberWithInt:10] forKey:@"Rank"];
+            [nanoStore addObject:[NSFNanoObject nanoObjectWithDictionary:info] error:nil];
+        }
+    } while (nil != token);
+    
+    NSError *outError = nil;
+    NSString *otherToken = nil;
+    [search searchObjectsWithReturnType:NSFReturnKeys pageSize:10 continuationToken:nil nextContinuationToken:&otherToken error:nil];
+    search.value = @"Other";
+    NSArray *rejectedPage = [search searchObjectsWithReturnType:NSFReturnKeys pageSize:10 continuationToken:otherToken nextContinuationToken:nil error:&outError];
+    
+    [nanoStore closeWithError:nil];
+    
+    BOOL isSorted = YES;
+    for (NSUInteger i = 1; i < [pagedObjects count]; i++) {
+        isSorted = isSorted && ([[[pagedObjects objectAtIndex:i - 1]objectForKey:@"Rank"]integerValue] >= [[[pagedObjects objectAtIndex:i]objectForKey:@"Rank"]integerValue]);
+    }
+    
+    STAssertTrue ((25 == [pagedObjects count]) && (25 == [[NSSet setWithArray:[pagedObjects valueForKey:@"key"]]count]), @"Expected every object exactly once.");
+    STAssertTrue (isSorted && (3 == numberOfPages), @"Expected three pages sorted by descending rank.");
+    STAssertTrue ((nil == rejectedPage) && (nil != outError), @"Expected the token of another search to be rejected.");
+}
+
+- (void)testSearchObjectsInPagesReturnsCachedObjects
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    nanoStore.cacheCapacity = 1000;
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [nanoStore addObject:object error:nil];
+    [nanoStore clearCache];
+    
+    NSFNanoObject *retrievedObject = [[nanoStore objectsWithKeysInArray:[NSArray arrayWithObject:object.key]]lastObject];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    NSArray *page = [search searchObjectsWithReturnType:NSFReturnObjects pageSize:10 continuationToken:nil nextContinuationToken:nil error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ((nil != retrievedObject) && ([page lastObject] == retrievedObject), @"Expected the page to return the cached instance.");
+}
+
+- (void)testSearchObjectsInPagesSortedByLargeIntegers
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSMutableArray *objects = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 3; i++) {
+        NSMutableDictionary *info = [_defaultTestInfo mutableCopy];
+        [info setObject:[NSNumber numberWithUnsignedInteger:i] forKey:@"Rank"];
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:info]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    // Consecutive integers beyond 2^53 collapse into the same double
+    [nanoStore _executeSQL:@"UPDATE NSFValues SET NSFValue = 9007199254740993 + NSFValue WHERE NSFAttribute = 'Rank';"];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.sort = [NSArray arrayWithObject:[NSFNanoSortDescriptor sortDescriptorWithAttribute:@"Rank" ascending:YES]];
+    
+    NSMutableArray *pagedKeys = [NSMutableArray array];
+    NSString *token = nil;
+    NSUInteger numberOfPages = 0;
+    
+    do {
+        NSString *nextToken = nil;
+        [pagedKeys addObjectsFromArray:[search searchObjectsWithReturnType:NSFReturnKeys pageSize:1 continuationToken:token nextContinuationToken:&nextToken error:nil]];
+        token = nextToken;
+        numberOfPages++;
+    } while ((nil != token) && (numberOfPages < 10));
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ([pagedKeys isEqualToArray:[objects valueForKey:@"key"]], @"Expected every object exactly once, in order.");
+}
+
+- (void)testSearchTopObjectsWithBoundedHeap
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSMutableArray *objects = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 25; i++) {
+        NSMutableDictionary *info = [_defaultTestInfo mutableCopy];
+        [info setObject:[NSNumber numberWithUnsignedInteger:(i * 7) % 25] forKey:@"Rank"];
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:info]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"FirstName";
+    search.match = NSFEqualTo;
+    search.value = @"Tito";
+    search.sort = [NSArray arrayWithObject:[NSFNanoSortDescriptor sortDescriptorWithAttribute:@"Rank" ascending:NO]];
+    
+    NSArray *topObjects = [search searchTopObjects:3 returnType:NSFReturnObjects error:nil];
+    
+    search.sort = [NSArray arrayWithObject:[NSFNanoSortDescriptor sortDescriptorWithAttribute:@"Rank" ascending:YES]];
+    NSArray *bottomKeys = [search searchTopObjects:2 returnType:NSFReturnKeys error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    NSMutableArray *topRanks = [NSMutableArray arrayWithCapacity:[topObjects count]];
+    for (NSFNanoObject *topObject in topObjects) {
+        [topRanks addObject:[topObject objectForKey:@"Rank"]];
+    }
+    STAssertTrue ([topRanks isEqualToArray:[NSArray arrayWithObjects:[NSNumber numberWithInt:24], [NSNumber numberWithInt:23], [NSNumber numberWithInt:22], nil]], @"Expected the three highest ranks, best first.");
+    STAssertTrue ((2 == [bottomKeys count]) && [[bottomKeys objectAtIndex:0]isKindOfClass:[NSString class]], @"Expected the two lowest ranked keys.");
+}
+
+- (void)testSearchTopObjectsKeepsOneEntryPerKey
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSMutableArray *objects = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 10; i++) {
+        NSMutableDictionary *info = [_defaultTestInfo mutableCopy];
+        [info setObject:[NSNumber numberWithUnsignedInteger:i] forKey:@"Rank"];
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:info]];
+    }
+    
+    // Each value of a multi-valued attribute is a row of its own
+    NSMutableDictionary *info = [_defaultTestInfo mutableCopy];
+    [info setObject:[NSArray arrayWithObjects:[NSNumber numberWithInt:50], [NSNumber numberWithInt:8], [NSNumber numberWithInt:60], nil] forKey:@"Rank"];
+    NSFNanoObject *multiValued = [NSFNanoObject nanoObjectWithDictionary:info];
+    [objects addObject:multiValued];
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.sort = [NSArray arrayWithObject:[NSFNanoSortDescriptor sortDescriptorWithAttribute:@"Rank" ascending:NO]];
+    NSArray *topKeys = [search searchTopObjects:3 returnType:NSFReturnKeys error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    NSArray *expectedKeys = [NSArray arrayWithObjects:multiValued.key, [[objects objectAtIndex:9]key], [[objects objectAtIndex:8]key], nil];
+    STAssertTrue ([topKeys isEqualToArray:expectedKeys], @"Expected the multi-valued object once, ranked by its best value.");
+}
+
+- (void)testSearchObjectsReturningProjectedAttributes
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *otherObject = [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObject:@"Other" forKey:@"FirstName"]];
+    [nanoStore addObjectsFromArray:[NSArray arrayWithObjects:object, otherObject, nil] error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attributesToBeReturned = [NSArray arrayWithObjects:@"FirstName", @"SomeNumber", @"Countries.Spain", nil];
+    NSDictionary *thinResults = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    
+    search.attributesToBeReturned = [NSArray arrayWithObjects:@"FirstName", @"Countries", nil];
+    search.attribute = @"FirstName";
+    search.match = NSFEqualTo;
+    search.value = @"Tito";
+    NSDictionary *collectionResults = [search searchObjectsWithReturnType:NSFReturnObjects error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    NSDictionary *thinInfo = [[thinResults objectForKey:object.key]info];
+    STAssertTrue ((2 == [thinResults count]) && (3 == [thinInfo count]), @"Expected both objects, the first one with three attributes.");
+    STAssertTrue ([[thinInfo objectForKey:@"SomeNumber"]isEqual:[_defaultTestInfo objectForKey:@"SomeNumber"]], @"Expected the number to be projected.");
+    STAssertTrue ([[[thinInfo objectForKey:@"Countries"]objectForKey:@"Spain"]isEqualToString:@"Barcelona"], @"Expected the nested attribute to be projected.");
+    STAssertTrue ([[[thinResults objectForKey:otherObject.key]info]isEqualToDictionary:[NSDictionary dictionaryWithObject:@"Other" forKey:@"FirstName"]], @"Expected only the attributes found.");
+    
+    NSDictionary *collectionInfo = [[collectionResults objectForKey:object.key]info];
+    STAssertTrue ((1 == [collectionResults count]) && [[collectionInfo objectForKey:@"Countries"]isEqualToDictionary:[_defaultTestInfo objectForKey:@"Countries"]], @"Expected the collection to be read from the document.");
+}
+
+- (void)testSearchObjectsReturningProjectedAttributesExactly
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSDictionary *info = [NSDictionary dictionaryWithObjectsAndKeys:[NSArray arrayWithObject:@"Barcelona"], @"Cities",
+                          @"0123", @"Code",
+                          [NSNumber numberWithLongLong:9007199254740993LL], @"Big",
+                          [NSNumber numberWithInt:42], @"Small",
+                          nil];
+    NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:info];
+    [nanoStore addObject:object error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attributesToBeReturned = [NSArray arrayWithObject:@"Cities"];
+    NSDictionary *arrayInfo = [[[search searchObjectsWithReturnType:NSFReturnObjects error:nil]objectForKey:object.key]info];
+    
+    search.attributesToBeReturned = [NSArray arrayWithObjects:@"Code", @"Big", nil];
+    NSDictionary *inexactInfo = [[[search searchObjectsWithReturnType:NSFReturnObjects error:nil]objectForKey:object.key]info];
+    
+    search.attributesToBeReturned = [NSArray arrayWithObject:@"Small"];
+    NSDictionary *numberInfo = [[[search searchObjectsWithReturnType:NSFReturnObjects error:nil]objectForKey:object.key]info];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ([[arrayInfo objectForKey:@"Cities"]isEqual:[NSArray arrayWithObject:@"Barcelona"]], @"Expected a single-element array to stay an array.");
+    STAssertTrue ([[inexactInfo objectForKey:@"Code"]isEqual:@"0123"], @"Expected a numeric-looking string to stay a string.");
+    STAssertTrue ([[inexactInfo objectForKey:@"Big"]longLongValue] == 9007199254740993LL, @"Expected a large integer to keep its precision.");
+    STAssertTrue ([[numberInfo objectForKey:@"Small"]isEqual:[NSNumber numberWithInt:42]], @"Expected the number to be projected.");
+}
+
 - (void)testSearchObjectsReturningObjectsWithGivenKey
 {
     NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
@@ -1026,6 +1385,126 @@
 }
 
 
+- (void)testAggregateFunctionIgnoresCustomSQL
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    long long large = 16777217;
+    [nanoStore addObjectsFromArray:[NSArray arrayWithObjects:[NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObject:[NSNumber numberWithLongLong:large] forKey:@"SomeNumber"]],
+                                    [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObject:[NSNumber numberWithInt:1] forKey:@"OtherNumber"]], nil] error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.sql = @"SELECT NSFKey FROM NSFValues WHERE NSFAttribute = 'OtherNumber'";
+    NSNumber *max = [search aggregateOperation:NSFMax onAttribute:@"SomeNumber"];
+    NSString *sqlAfterwards = search.sql;
+    search.sql = nil;
+    NSNumber *maxKey = [NSNumber numberWithInt:NSFMax];
+    NSNumber *exactMax = [[[search aggregateOperations:[NSArray arrayWithObject:maxKey] onAttribute:@"SomeNumber" groupedByAttribute:nil error:nil]objectForKey:[NSNull null]]objectForKey:maxKey];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ((float)large == [max floatValue], @"Expected the custom SQL to be ignored.");
+    STAssertTrue (0 == strcmp([max objCType], @encode(float)), @"Expected a float result.");
+    STAssertTrue (nil != sqlAfterwards, @"Expected the custom SQL to be restored.");
+    STAssertTrue (large == [exactMax longLongValue], @"Expected the exact result.");
+}
+
+- (void)testAggregateFunctionsGroupedByAttributeAndFacets
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSMutableArray *objects = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 10; i++) {
+        NSMutableDictionary *info = [_defaultTestInfo mutableCopy];
+        [info setObject:[NSNumber numberWithUnsignedInteger:i] forKey:@"SomeNumber"];
+        [info setObject:((0 == i % 2) ? @"Even" : @"Odd") forKey:@"Parity"];
+        [info setObject:((i < 3) ? @"Low" : @"High") forKey:@"Range"];
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:info]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    NSNumber *count = [NSNumber numberWithInt:NSFCount];
+    NSNumber *total = [NSNumber numberWithInt:NSFTotal];
+    NSNumber *max = [NSNumber numberWithInt:NSFMax];
+    NSDictionary *groups = [search aggregateOperations:[NSArray arrayWithObjects:count, total, max, nil] onAttribute:@"SomeNumber" groupedByAttribute:@"Parity" error:nil];
+    
+    search.attribute = @"Range";
+    search.match = NSFEqualTo;
+    search.value = @"Low";
+    NSDictionary *facets = [search facetsForAttributes:[NSArray arrayWithObjects:@"Parity", @"Missing", nil] error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    NSDictionary *odd = [groups objectForKey:@"Odd"];
+    STAssertTrue ((2 == [groups count]) && (5 == [[odd objectForKey:count]longLongValue]) && (25 == [[odd objectForKey:total]doubleValue]) && (9 == [[odd objectForKey:max]doubleValue]), @"Expected the odd numbers to be aggregated together.");
+    STAssertTrue ((2 == [[[facets objectForKey:@"Parity"]objectForKey:@"Even"]longLongValue]) && (1 == [[[facets objectForKey:@"Parity"]objectForKey:@"Odd"]longLongValue]), @"Expected the facets to honor the search.");
+    STAssertTrue ((nil != [facets objectForKey:@"Missing"]) && (0 == [[facets objectForKey:@"Missing"]count]), @"Expected an empty facet for a missing attribute.");
+}
+
+- (void)testPercentilesAndHistogram
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSMutableArray *objects = [NSMutableArray array];
+    for (NSUInteger i = 1; i <= 100; i++) {
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObject:[NSNumber numberWithUnsignedInteger:i] forKey:@"Latency"]]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    NSNumber *median = [search percentile:0.5 onAttribute:@"Latency" approximate:NO error:nil];
+    NSNumber *p95 = [search percentile:0.95 onAttribute:@"Latency" approximate:NO error:nil];
+    NSNumber *approximateP95 = [search percentile:0.95 onAttribute:@"Latency" approximate:YES error:nil];
+    NSNumber *p99 = [search aggregateOperation:NSFApproximatePercentile99 onAttribute:@"Latency"];
+    NSNumber *missing = [search percentile:0.5 onAttribute:@"Missing" approximate:NO error:nil];
+    NSArray *buckets = [search histogramOnAttribute:@"Latency" lowerBound:1 upperBound:100 numberOfBuckets:4 error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ((50.5 == [median doubleValue]) && (fabs([p95 doubleValue] - 95.05) < 0.000001), @"Expected the exact percentiles.");
+    STAssertTrue ((fabs([approximateP95 doubleValue] - 95.05) < 1.0) && (fabs([p99 doubleValue] - 99.01) < 1.0), @"Expected close estimates.");
+    STAssertTrue (nil == missing, @"Expected no percentile without values.");
+    STAssertTrue ((4 == [buckets count]) && (100 == [[buckets valueForKeyPath:@"@sum.longLongValue"]longLongValue]), @"Expected every value to fall in a bucket.");
+}
+
+- (void)testAggregateFunctionsGroupedByTimeInterval
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    // Six events, ten minutes apart, starting on the hour
+    NSTimeInterval start = 1300000000 - fmod(1300000000, 3600);
+    NSMutableArray *objects = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 6; i++) {
+        NSMutableDictionary *info = [NSMutableDictionary dictionary];
+        [info setObject:[NSDate dateWithTimeIntervalSince1970:start + i * 600] forKey:@"StartDate"];
+        [info setObject:[NSNumber numberWithUnsignedInteger:i] forKey:@"Duration"];
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:info]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    NSNumber *count = [NSNumber numberWithInt:NSFCount];
+    NSNumber *total = [NSNumber numberWithInt:NSFTotal];
+    NSDictionary *halfHours = [search aggregateOperations:[NSArray arrayWithObjects:count, total, nil] onAttribute:@"Duration" groupedByTimeInterval:1800 ofDateAttribute:@"StartDate" error:nil];
+    NSDictionary *savedDays = [search aggregateOperations:[NSArray arrayWithObject:count] onAttribute:nil groupedByTimeInterval:86400 ofDateAttribute:nil error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    NSDictionary *secondHalfHour = [halfHours objectForKey:[NSDate dateWithTimeIntervalSince1970:start + 1800]];
+    STAssertTrue ((2 == [halfHours count]) && (3 == [[secondHalfHour objectForKey:count]longLongValue]) && (12 == [[secondHalfHour objectForKey:total]doubleValue]), @"Expected two half-hour buckets of three events.");
+    
+    long long savedCount = 0;
+    for (NSDictionary *aggregates in [savedDays allValues]) {
+        savedCount += [[aggregates objectForKey:count]longLongValue];
+    }
+    STAssertTrue (6 == savedCount, @"Expected every saved object to be counted by the date it was saved.");
+}
+
 - (void)testExplainSQLNil
 {
     NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
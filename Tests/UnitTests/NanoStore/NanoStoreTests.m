@@ -474,6 +474,563 @@
 }
 
 
+- (void)testObjectCacheReturnsSameInstance
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    nanoStore.cacheMethod = CacheDataOnDemand;
+    nanoStore.cacheCapacity = 1000;
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [nanoStore addObject:obj1 error:nil];
+    
+    NSArray *keys = [NSArray arrayWithObject:obj1.key];
+    id firstObject = [[nanoStore objectsWithKeysInArray:keys]lastObject];
+    id secondObject = [[nanoStore objectsWithKeysInArray:keys]lastObject];
+    
+    unsigned long long hits = nanoStore.cacheHitCount;
+    unsigned long long misses = nanoStore.cacheMissCount;
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ((nil != firstObject) && (firstObject == secondObject) && (1 == hits) && (1 == misses), @"Expected the second lookup to be served from the object cache.");
+}
+
+- (void)testObjectCacheIsOffByDefault
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [nanoStore addObject:obj1 error:nil];
+    
+    NSArray *keys = [NSArray arrayWithObject:obj1.key];
+    id firstObject = [[nanoStore objectsWithKeysInArray:keys]lastObject];
+    id secondObject = [[nanoStore objectsWithKeysInArray:keys]lastObject];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ((nil != firstObject) && (firstObject != secondObject) && (firstObject != obj1), @"Expected every lookup to return a new instance.");
+}
+
+- (void)testObjectCacheDropsOtherInstancesOnSave
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    nanoStore.cacheMethod = CacheDataOnDemand;
+    nanoStore.cacheCapacity = 1000;
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [nanoStore addObject:obj1 error:nil];
+    
+    // The retrieved instance is cached, then the original one is changed and saved
+    NSArray *keys = [NSArray arrayWithObject:obj1.key];
+    NSFNanoObject *cachedObject = [[nanoStore objectsWithKeysInArray:keys]lastObject];
+    [obj1 setObject:@"Updated" forKey:@"FirstName"];
+    [nanoStore addObject:obj1 error:nil];
+    NSFNanoObject *reloadedObject = [[nanoStore objectsWithKeysInArray:keys]lastObject];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ((cachedObject != obj1) && [[reloadedObject objectForKey:@"FirstName"]isEqualToString:@"Updated"], @"Expected the stale instance to be dropped from the object cache.");
+}
+
+- (void)testObjectCacheInvalidatedOnRemove
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    nanoStore.cacheCapacity = 1000;
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [nanoStore addObject:obj1 error:nil];
+    
+    NSArray *keys = [NSArray arrayWithObject:obj1.key];
+    NSUInteger countBeforeRemoving = [[nanoStore objectsWithKeysInArray:keys]count];
+    [nanoStore removeObject:obj1 error:nil];
+    NSUInteger countAfterRemoving = [[nanoStore objectsWithKeysInArray:keys]count];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ((1 == countBeforeRemoving) && (0 == countAfterRemoving), @"Expected the removed object to be evicted from the object cache.");
+}
+
+- (void)testObjectCacheEvictsWhenFull
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    nanoStore.cacheCapacity = 2;
+    
+    NSFNanoObject *obj1 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj2 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *obj3 = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [nanoStore addObjectsFromArray:[NSArray arrayWithObjects:obj1, obj2, obj3, nil] error:nil];
+    
+    [nanoStore resetCacheStatistics];
+    NSArray *objects = [nanoStore objectsWithKeysInArray:[NSArray arrayWithObjects:obj1.key, obj2.key, obj3.key, nil]];
+    unsigned long long hits = nanoStore.cacheHitCount;
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue (([objects count] == 3) && (hits == 2), @"Expected the cache to hold two of the three objects.");
+}
+
+- (void)testStoreSavesOnlyModifiedAttributes
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [nanoStore addObject:object error:nil];
+    
+    [object setObject:@"Updated" forKey:@"FirstName"];
+    [object removeObjectForKey:@"LastName"];
+    [object setObject:[NSDictionary dictionaryWithObject:@"Nested" forKey:@"Level"] forKey:@"Extra"];
+    BOOL hadUnsavedChanges = object.hasUnsavedChanges;
+    [nanoStore addObject:object error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"FirstName";
+    search.match = NSFEqualTo;
+    search.value = @"Updated";
+    NSUInteger updatedCount = [[search searchObjectsWithReturnType:NSFReturnKeys error:nil]count];
+    
+    search.value = @"Tito";
+    NSUInteger staleCount = [[search searchObjectsWithReturnType:NSFReturnKeys error:nil]count];
+    
+    [search reset];
+    search.attribute = @"LastName";
+    NSUInteger removedCount = [[search searchObjectsWithReturnType:NSFReturnKeys error:nil]count];
+    
+    [search reset];
+    search.attribute = @"Extra.Level";
+    search.match = NSFEqualTo;
+    search.value = @"Nested";
+    NSUInteger nestedCount = [[search searchObjectsWithReturnType:NSFReturnKeys error:nil]count];
+    
+    [nanoStore clearCache];
+    NSFNanoObject *reloadedObject = [[nanoStore objectsWithKeysInArray:[NSArray arrayWithObject:object.key]]lastObject];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue (hadUnsavedChanges && (NO == object.hasUnsavedChanges), @"Expected the object to be clean after being saved.");
+    STAssertTrue ((1 == updatedCount) && (0 == staleCount), @"Expected the changed attribute to be reindexed.");
+    STAssertTrue (0 == removedCount, @"Expected the removed attribute to be gone.");
+    STAssertTrue (1 == nestedCount, @"Expected the added nested attribute to be indexed.");
+    STAssertTrue ([reloadedObject.info isEqualToDictionary:object.info], @"Expected the stored plist to match the object.");
+}
+
+- (void)testStoreReindexesUntrackedChanges
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSMutableDictionary *address = [NSMutableDictionary dictionaryWithObject:@"Paris" forKey:@"City"];
+    NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObjectsAndKeys:@"Tito", @"FirstName", address, @"Address", nil]];
+    [nanoStore addObject:object error:nil];
+    
+    // Neither change goes through setObject:forKey:, so neither is tracked
+    [address setObject:@"Barcelona" forKey:@"City"];
+    [(NSMutableDictionary *)object.info setObject:@"Updated" forKey:@"FirstName"];
+    [nanoStore addObject:object error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Address.City";
+    search.match = NSFEqualTo;
+    search.value = @"Barcelona";
+    NSUInteger nestedCount = [[search searchObjectsWithReturnType:NSFReturnKeys error:nil]count];
+    
+    search.value = @"Paris";
+    NSUInteger staleNestedCount = [[search searchObjectsWithReturnType:NSFReturnKeys error:nil]count];
+    
+    search.attribute = @"FirstName";
+    search.value = @"Updated";
+    NSUInteger updatedCount = [[search searchObjectsWithReturnType:NSFReturnKeys error:nil]count];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ((1 == nestedCount) && (0 == staleNestedCount), @"Expected the nested change to be reindexed.");
+    STAssertTrue (1 == updatedCount, @"Expected the change made to the info in place to be reindexed.");
+}
+
+- (void)testStoreSkipsWritingUnchangedObjects
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [nanoStore addObject:object error:nil];
+    unsigned long long skippedAfterInsert = nanoStore.numberOfSkippedWrites;
+    
+    NSFNanoObject *sameObject = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo key:object.key];
+    [nanoStore addObject:sameObject error:nil];
+    unsigned long long skippedAfterResave = nanoStore.numberOfSkippedWrites;
+    
+    [sameObject setObject:@"Updated" forKey:@"FirstName"];
+    [nanoStore addObject:sameObject error:nil];
+    unsigned long long skippedAfterChange = nanoStore.numberOfSkippedWrites;
+    
+    NSUInteger count = [[nanoStore allObjects]count];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ((0 == skippedAfterInsert) && (1 == skippedAfterResave) && (1 == skippedAfterChange), @"Expected only the unchanged object to be skipped.");
+    STAssertTrue (1 == count, @"Expected one object to be stored.");
+}
+
+- (void)testStoreReturnsKeysOfObjectsDifferingFromAnotherStore
+{
+    NSFNanoStore *storeA = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    NSFNanoStore *storeB = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    
+    NSFNanoObject *shared = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *changed = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *onlyInA = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [storeA addObjectsFromArray:[NSArray arrayWithObjects:shared, changed, onlyInA, nil] error:nil];
+    
+    NSMutableDictionary *changedInfo = [_defaultTestInfo mutableCopy];
+    [changedInfo setObject:@"Changed" forKey:@"FirstName"];
+    [storeB addObjectsFromArray:[NSArray arrayWithObjects:[NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo key:shared.key],
+                                 [NSFNanoObject nanoObjectWithDictionary:changedInfo key:changed.key], nil] error:nil];
+    
+    NSSet *differingKeys = [NSSet setWithArray:[storeA keysOfObjectsDifferingFromStore:storeB]];
+    
+    [storeA closeWithError:nil];
+    [storeB closeWithError:nil];
+    
+    STAssertTrue ([differingKeys isEqualToSet:[NSSet setWithObjects:changed.key, onlyInA.key, nil]], @"Expected the changed and missing objects to be reported.");
+}
+
+- (void)testStoreRemoveObjectsWithKeysInBatches
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSMutableArray *objects = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 100; i++) {
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    // 1 + 9 + 75 keys exercise a single key, a padded batch and a full batch followed by a padded one
+    NSArray *keys = [objects valueForKey:@"key"];
+    BOOL success = [nanoStore removeObjectsWithKeysInArray:[keys subarrayWithRange:NSMakeRange(0, 1)] error:nil];
+    success = success && [nanoStore removeObjectsWithKeysInArray:[keys subarrayWithRange:NSMakeRange(1, 9)] error:nil];
+    success = success && [nanoStore removeObjectsWithKeysInArray:[keys subarrayWithRange:NSMakeRange(10, 75)] error:nil];
+    
+    NSUInteger count = [[nanoStore allObjects]count];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"FirstName";
+    search.match = NSFEqualTo;
+    search.value = @"Tito";
+    NSUInteger indexedCount = [[search searchObjectsWithReturnType:NSFReturnKeys error:nil]count];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue (success && (15 == count) && (15 == indexedCount), @"Expected 15 objects to remain after removing 85.");
+}
+
+- (void)testStoreRemoveObjectsReportsFailedDelete
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [nanoStore addObject:object error:nil];
+    
+    [nanoStore _executeSQL:@"CREATE TRIGGER NSFTestRejectDelete BEFORE DELETE ON NSFValues BEGIN SELECT RAISE(ABORT, 'rejected'); END;"];
+    
+    NSError *outError = nil;
+    BOOL success = [nanoStore removeObjectsWithKeysInArray:[NSArray arrayWithObject:object.key] error:&outError];
+    NSUInteger count = [[nanoStore allObjects]count];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ((NO == success) && (nil != outError), @"Expected the failed delete to be reported.");
+    STAssertTrue (1 == count, @"Expected the object to remain in the store.");
+}
+
+- (void)testStoreRemoveObjectsMatchingSearch
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSMutableDictionary *otherInfo = [_defaultTestInfo mutableCopy];
+    [otherInfo setObject:@"Other" forKey:@"FirstName"];
+    NSFNanoObject *kept = [NSFNanoObject nanoObjectWithDictionary:otherInfo];
+    [nanoStore addObjectsFromArray:[NSArray arrayWithObjects:[NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo], [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo], kept, nil] error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"FirstName";
+    search.match = NSFEqualTo;
+    search.value = @"Tito";
+    BOOL success = [nanoStore removeObjectsMatchingSearch:search error:nil];
+    
+    NSArray *remainingKeys = [[nanoStore allObjects]valueForKey:@"key"];
+    
+    [search reset];
+    search.attribute = @"LastName";
+    NSUInteger indexedCount = [[search searchObjectsWithReturnType:NSFReturnKeys error:nil]count];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue (success && [remainingKeys isEqualToArray:[NSArray arrayWithObject:kept.key]], @"Expected only the non-matching object to remain.");
+    STAssertTrue (1 == indexedCount, @"Expected the values of the removed objects to be gone.");
+}
+
+- (void)testStoreRemoveObjectsMatchingClassOnly
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *kept = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoBag *bag = [NSFNanoBag bag];
+    [nanoStore addObjectsFromArray:[NSArray arrayWithObjects:kept, bag, nil] error:nil];
+    
+    // Nothing but the class narrows the search down
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.filterClass = NSStringFromClass([NSFNanoBag class]);
+    long long count = [search countOfObjectsMatchingSearch];
+    BOOL success = [nanoStore removeObjectsMatchingSearch:search error:nil];
+    
+    NSArray *remainingKeys = [[nanoStore allObjects]valueForKey:@"key"];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue (1 == count, @"Expected only the bag to match the search.");
+    STAssertTrue (success && [remainingKeys isEqualToArray:[NSArray arrayWithObject:kept.key]], @"Expected the objects of other classes to remain.");
+}
+
+- (void)testStoreUpdateObjectsMatchingSearch
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSMutableDictionary *otherInfo = [_defaultTestInfo mutableCopy];
+    [otherInfo setObject:@"Other" forKey:@"FirstName"];
+    NSFNanoObject *matching = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoObject *untouched = [NSFNanoObject nanoObjectWithDictionary:otherInfo];
+    [nanoStore addObjectsFromArray:[NSArray arrayWithObjects:matching, untouched, nil] error:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"FirstName";
+    search.match = NSFEqualTo;
+    search.value = @"Tito";
+    BOOL success = [nanoStore updateObjectsMatchingSearch:search setAttribute:@"Countries" value:[NSDictionary dictionaryWithObject:@"Spain" forKey:@"Home"] error:nil];
+    
+    [search reset];
+    search.attribute = @"Countries.Home";
+    search.match = NSFEqualTo;
+    search.value = @"Spain";
+    NSArray *updatedKeys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    
+    NSFNanoObject *reloadedObject = [[nanoStore objectsWithKeysInArray:[NSArray arrayWithObject:matching.key]]lastObject];
+    NSFNanoObject *reloadedUntouched = [[nanoStore objectsWithKeysInArray:[NSArray arrayWithObject:untouched.key]]lastObject];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue (success && [updatedKeys isEqualToArray:[NSArray arrayWithObject:matching.key]], @"Expected the new value to be indexed for the matching object only.");
+    STAssertTrue ([[reloadedObject objectForKey:@"Countries"]isEqualToDictionary:[NSDictionary dictionaryWithObject:@"Spain" forKey:@"Home"]], @"Expected the stored plist to contain the new value.");
+    STAssertTrue ([reloadedUntouched.info isEqualToDictionary:otherInfo], @"Expected the non-matching object to be untouched.");
+}
+
+- (void)testStoreUpdateObjectsMatchingSearchLeavesBagsAlone
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    NSFNanoBag *bag = [NSFNanoBag bagWithObjects:[NSArray arrayWithObject:object]];
+    [nanoStore addObjectsFromArray:[NSArray arrayWithObjects:object, bag, nil] error:nil];
+    
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT %@ FROM %@ WHERE %@ = '%@';", NSFPlist, NSFKeys, NSFKey, bag.key];
+    NSString *bagPlistBefore = [[nanoStore _executeSQL:theSQLStatement]firstValue];
+    
+    // The search matches everything, the bag included
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    BOOL success = [nanoStore updateObjectsMatchingSearch:search setAttribute:@"Country" value:@"Spain" error:nil];
+    
+    NSString *bagPlistAfter = [[nanoStore _executeSQL:theSQLStatement]firstValue];
+    
+    [search reset];
+    search.attribute = @"Country";
+    search.match = NSFEqualTo;
+    search.value = @"Spain";
+    NSArray *updatedKeys = [search searchObjectsWithReturnType:NSFReturnKeys error:nil];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue (success && [updatedKeys isEqualToArray:[NSArray arrayWithObject:object.key]], @"Expected only the NanoObject to be updated.");
+    STAssertTrue ([bagPlistAfter isEqualToString:bagPlistBefore], @"Expected the document of the bag to be left untouched.");
+}
+
+- (void)testStoreUpdateObjectsMatchingSearchWithPeriodInAttribute
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"FirstName";
+    search.match = NSFEqualTo;
+    search.value = @"Tito";
+    
+    BOOL hasRaised = NO;
+    @try {
+        [nanoStore updateObjectsMatchingSearch:search setAttribute:@"Countries.Home" value:@"Spain" error:nil];
+    } @catch (NSException *e) {
+        hasRaised = [[e name]isEqualToString:NSFUnexpectedParameterException];
+    }
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue (hasRaised, @"Expected an attribute containing a period to be rejected.");
+}
+
+- (void)testStoreIncrementAttribute
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [nanoStore addObject:object error:nil];
+    
+    NSNumber *firstHit = [nanoStore incrementAttribute:@"Hits" byAmount:[NSNumber numberWithInt:1] forKey:object.key error:nil];
+    NSNumber *secondHit = [nanoStore incrementAttribute:@"Hits" byAmount:[NSNumber numberWithInt:2] forKey:object.key error:nil];
+    NSError *missingKeyError = nil;
+    NSNumber *missingKey = [nanoStore incrementAttribute:@"Hits" byAmount:[NSNumber numberWithInt:1] forKey:@"NoSuchKey" error:&missingKeyError];
+    NSError *notANumberError = nil;
+    NSNumber *notANumber = [nanoStore incrementAttribute:@"FirstName" byAmount:[NSNumber numberWithInt:1] forKey:object.key error:&notANumberError];
+    
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Hits";
+    search.match = NSFEqualTo;
+    search.value = [NSNumber numberWithInt:3];
+    NSUInteger indexedCount = [[search searchObjectsWithReturnType:NSFReturnKeys error:nil]count];
+    
+    NSFNanoObject *reloadedObject = [[nanoStore objectsWithKeysInArray:[NSArray arrayWithObject:object.key]]lastObject];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue ((1 == [firstHit integerValue]) && (3 == [secondHit integerValue]), @"Expected the counter to go from 1 to 3.");
+    STAssertTrue ((nil == missingKey) && (nil != missingKeyError), @"Expected an error for a missing object.");
+    STAssertTrue ((nil == notANumber) && (nil != notANumberError), @"Expected an error for a non-numeric attribute.");
+    STAssertTrue (1 == indexedCount, @"Expected the new value to be indexed.");
+    STAssertTrue ((3 == [[reloadedObject objectForKey:@"Hits"]integerValue]) && [[reloadedObject objectForKey:@"FirstName"]isEqualToString:@"Tito"], @"Expected the stored plist to be patched.");
+}
+
+- (void)testStoreIncrementLargeIntegerAttribute
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    // 2^53: from here on, not every integer has a double of its own
+    NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObject:[NSNumber numberWithLongLong:9007199254740992LL] forKey:@"Hits"]];
+    [nanoStore addObject:object error:nil];
+    
+    [nanoStore incrementAttribute:@"Hits" byAmount:[NSNumber numberWithInt:1] forKey:object.key error:nil];
+    NSNumber *secondHit = [nanoStore incrementAttribute:@"Hits" byAmount:[NSNumber numberWithInt:1] forKey:object.key error:nil];
+    
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT %@ FROM %@ WHERE %@ = 'Hits';", NSFValue, NSFValues, NSFAttribute];
+    NSString *indexedValue = [[nanoStore _executeSQL:theSQLStatement]firstValue];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue (9007199254740994LL == [secondHit longLongValue], @"Expected the counter to be incremented exactly.");
+    STAssertTrue ([indexedValue isEqualToString:@"9007199254740994"], @"Expected the exact value to be indexed.");
+}
+
+- (void)testStoreIncrementAttributeWithPeriod
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [nanoStore addObject:object error:nil];
+    
+    BOOL hasRaised = NO;
+    @try {
+        [nanoStore incrementAttribute:@"Stats.hits" byAmount:[NSNumber numberWithInt:1] forKey:object.key error:nil];
+    } @catch (NSException *e) {
+        hasRaised = [[e name]isEqualToString:NSFUnexpectedParameterException];
+    }
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue (hasRaised, @"Expected an attribute containing a period to be rejected.");
+}
+
+- (void)testStoreOrderedObjectsWithKeysInArray
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSMutableArray *objects = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 100; i++) {
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+    
+    // Reversed, with a missing key in the middle and a duplicate at the end
+    NSMutableArray *keys = [[[[objects valueForKey:@"key"]reverseObjectEnumerator]allObjects]mutableCopy];
+    [keys insertObject:@"NoSuchKey" atIndex:50];
+    [keys addObject:[keys objectAtIndex:0]];
+    
+    NSArray *orderedObjects = [nanoStore orderedObjectsWithKeysInArray:keys];
+    NSArray *foundObjects = [nanoStore objectsWithKeysInArray:keys];
+    
+    [nanoStore closeWithError:nil];
+    
+    BOOL isOrdered = ([orderedObjects count] == [keys count]);
+    for (NSUInteger i = 0; (YES == isOrdered) && (i < [keys count]); i++) {
+        id object = [orderedObjects objectAtIndex:i];
+        if (50 == i) {
+            isOrdered = (object == [NSNull null]);
+        } else {
+            isOrdered = [[object key]isEqualToString:[keys objectAtIndex:i]] && [[object info]isEqualToDictionary:_defaultTestInfo];
+        }
+    }
+    
+    STAssertTrue (isOrdered, @"Expected the objects in the order of the keys, with NSNull for the missing one.");
+    STAssertTrue ((100 == [foundObjects count]) && [[[foundObjects objectAtIndex:0]key]isEqualToString:[keys objectAtIndex:0]], @"Expected each object once, in the order of the keys.");
+}
+
+- (void)testMaterializedAggregates
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    
+    NSFNanoObject *first = [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObjectsAndKeys:@"Tito", @"Owner", [NSNumber numberWithInt:10], @"Amount", nil]];
+    NSFNanoObject *second = [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObjectsAndKeys:@"Tito", @"Owner", [NSNumber numberWithInt:5], @"Amount", nil]];
+    [nanoStore addObjectsFromArray:[NSArray arrayWithObjects:first, second, nil] error:nil];
+    
+    // Registered after the first objects, which must be accounted for
+    BOOL registered = [nanoStore materializeAggregateNamed:@"AmountByOwner" function:NSFTotal onAttribute:@"Amount" groupedByAttribute:@"Owner" error:nil];
+    registered &= [nanoStore materializeAggregateNamed:@"ObjectsByClass" function:NSFCount onAttribute:nil groupedByAttribute:nil error:nil];
+    
+    NSFNanoObject *third = [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObjectsAndKeys:@"Nana", @"Owner", [NSNumber numberWithInt:7], @"Amount", nil]];
+    [nanoStore addObject:third error:nil];
+    [nanoStore removeObject:second error:nil];
+    [first setObject:[NSNumber numberWithInt:20] forKey:@"Amount"];
+    [nanoStore addObject:first error:nil];
+    
+    NSNumber *titoTotal = [nanoStore valueOfMaterializedAggregateNamed:@"AmountByOwner" forGroup:@"Tito"];
+    NSNumber *nanaTotal = [nanoStore valueOfMaterializedAggregateNamed:@"AmountByOwner" forGroup:@"Nana"];
+    NSDictionary *maintainedTotals = [nanoStore valuesOfMaterializedAggregateNamed:@"AmountByOwner"];
+    long long objectCount = [nanoStore countOfObjectsOfClassNamed:@"NSFNanoObject"];
+    BOOL rebuilt = [nanoStore rebuildMaterializedAggregatesAndReturnError:nil];
+    NSDictionary *rebuiltTotals = [nanoStore valuesOfMaterializedAggregateNamed:@"AmountByOwner"];
+    NSNumber *unknown = [nanoStore valueOfMaterializedAggregateNamed:@"NoSuchAggregate" forGroup:@"Tito"];
+    
+    [nanoStore removeAllObjectsFromStoreAndReturnError:nil];
+    NSNumber *clearedTotal = [nanoStore valueOfMaterializedAggregateNamed:@"AmountByOwner" forGroup:@"Tito"];
+    [nanoStore addObject:third error:nil];
+    NSNumber *reinstalledTotal = [nanoStore valueOfMaterializedAggregateNamed:@"AmountByOwner" forGroup:@"Nana"];
+    
+    [nanoStore closeWithError:nil];
+    
+    STAssertTrue (YES == registered, @"Expected the aggregates to be registered.");
+    STAssertTrue ((20 == [titoTotal integerValue]) && (7 == [nanaTotal integerValue]), @"Expected the totals to follow the additions, updates and removals.");
+    STAssertTrue (2 == objectCount, @"Expected the count of objects to be read from the materialized aggregate.");
+    STAssertTrue ((YES == rebuilt) && [maintainedTotals isEqualToDictionary:rebuiltTotals], @"Expected the maintained totals to match the rebuilt ones.");
+    STAssertTrue (nil == unknown, @"Expected nil for an aggregate which doesn't exist.");
+    STAssertTrue ((0 == [clearedTotal integerValue]) && (7 == [reinstalledTotal integerValue]), @"Expected the aggregates to survive the removal of all objects.");
+}
+
 - (void)testStoreObjectsWithBadKeyBadAttributeBadValueAndReturnObjectsWithSomeAttributes
 {
     NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
@@ -836,6 +1393,226 @@
     STAssertTrue ([indexes count] > 0, @"Expected the indexes to be rebuilt.");
 }
 
+- (void)testDocumentCompressionWithTrainedDictionary
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+
+    NSMutableArray *objects = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 20; i++) {
+        NSMutableDictionary *info = [NSMutableDictionary dictionaryWithDictionary:_defaultTestInfo];
+        [info setObject:[NSString stringWithFormat:@"Index %lu", (unsigned long)i] forKey:@"Index"];
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:info]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT count(*) FROM %@ WHERE typeof(%@) = 'blob';", NSFKeys, NSFPlist];
+    long long compressedBefore = [[[nanoStore _executeSQL:theSQLStatement]firstValue]longLongValue];
+
+    BOOL trained = [nanoStore trainCompressionDictionaryWithSampleSize:10 error:nil];
+    nanoStore.documentCompressionEnabled = YES;
+    BOOL recompressed = [nanoStore recompressStoredDocumentsAndReturnError:nil];
+    long long compressedAfter = [[[nanoStore _executeSQL:theSQLStatement]firstValue]longLongValue];
+
+    // Objects written from now on are compressed too, and everything reads back the same
+    NSFNanoObject *addedObject = [NSFNanoObject nanoObjectWithDictionary:_defaultTestInfo];
+    [nanoStore addObject:addedObject error:nil];
+    [nanoStore clearCache];
+
+    NSFNanoObject *firstObject = [objects objectAtIndex:0];
+    NSFNanoObject *reloadedObject = [[nanoStore objectsWithKeysInArray:[NSArray arrayWithObject:firstObject.key]]lastObject];
+    NSFNanoObject *reloadedAddedObject = [[nanoStore objectsWithKeysInArray:[NSArray arrayWithObject:addedObject.key]]lastObject];
+
+    NSFNanoSearch *search = [NSFNanoSearch searchWithStore:nanoStore];
+    search.attribute = @"Index";
+    search.match = NSFEqualTo;
+    search.value = @"Index 5";
+    NSFNanoObject *foundObject = [[[search searchObjectsWithReturnType:NSFReturnObjects error:nil]allValues]lastObject];
+
+    // Turning compression off and rewriting the documents brings the plain XML back
+    nanoStore.documentCompressionEnabled = NO;
+    [nanoStore recompressStoredDocumentsAndReturnError:nil];
+    long long compressedAtTheEnd = [[[nanoStore _executeSQL:theSQLStatement]firstValue]longLongValue];
+
+    [nanoStore closeWithError:nil];
+
+    STAssertTrue (trained && recompressed, @"Expected the dictionary to be trained and the documents to be recompressed.");
+    STAssertTrue ((0 == compressedBefore) && (20 == compressedAfter) && (0 == compressedAtTheEnd), @"Expected the documents to be compressed only while compression was enabled.");
+    STAssertTrue ([reloadedObject.info isEqualToDictionary:firstObject.info], @"Expected the compressed document to read back unchanged.");
+    STAssertTrue ([reloadedAddedObject.info isEqualToDictionary:addedObject.info], @"Expected the document added with compression enabled to read back unchanged.");
+    STAssertTrue ([[foundObject.info objectForKey:@"Index"]isEqualToString:@"Index 5"], @"Expected searches to return the compressed documents.");
+}
+
+- (void)testSaveCompressedMemoryStoreToDirectory
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+
+    NSMutableArray *objects = [NSMutableArray array];
+    for (NSUInteger i = 0; i < 20; i++) {
+        NSMutableDictionary *info = [NSMutableDictionary dictionaryWithDictionary:_defaultTestInfo];
+        [info setObject:[NSString stringWithFormat:@"Index %lu", (unsigned long)i] forKey:@"Index"];
+        [objects addObject:[NSFNanoObject nanoObjectWithDictionary:info]];
+    }
+    [nanoStore addObjectsFromArray:objects error:nil];
+    [nanoStore trainCompressionDictionaryWithSampleSize:10 error:nil];
+    nanoStore.documentCompressionEnabled = YES;
+    [nanoStore recompressStoredDocumentsAndReturnError:nil];
+
+    NSString *backupPath = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSFNanoEngine stringWithUUID]];
+    BOOL saved = [nanoStore saveStoreToDirectoryAtPath:backupPath compactDatabase:NO error:nil];
+    [nanoStore closeWithError:nil];
+
+    // The backup carries the dictionaries along with the documents compressed with them
+    NSFNanoStore *backupStore = [NSFNanoStore createAndOpenStoreWithType:NSFPersistentStoreType path:backupPath error:nil];
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT count(*) FROM %@;", NSFP_CompressionDictionariesTable];
+    long long numberOfDictionaries = [[[backupStore _executeSQL:theSQLStatement]firstValue]longLongValue];
+    NSFNanoObject *firstObject = [objects objectAtIndex:0];
+    NSFNanoObject *reloadedObject = [[backupStore objectsWithKeysInArray:[NSArray arrayWithObject:firstObject.key]]lastObject];
+    [backupStore closeWithError:nil];
+    [[NSFileManager defaultManager]removeItemAtPath:backupPath error:nil];
+
+    STAssertTrue (saved, @"Expected the memory store to be saved.");
+    STAssertTrue (1 == numberOfDictionaries, @"Expected the backup to keep the compression dictionary.");
+    STAssertTrue ([reloadedObject.info isEqualToDictionary:firstObject.info], @"Expected the backup to read back the compressed documents unchanged.");
+}
+
+- (void)testExecuteSQLReturnsDataValuesThatLookCompressed
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+
+    // The value starts like a compressed document, but it's just data stored by the user
+    NSData *data = [@"NSFZ0000 not a document" dataUsingEncoding:NSUTF8StringEncoding];
+    NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObject:data forKey:@"Data"]];
+    [nanoStore addObject:object error:nil];
+
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT %@ FROM %@ WHERE %@ = 'Data';", NSFValue, NSFValues, NSFAttribute];
+    NSString *value = [[nanoStore _executeSQL:theSQLStatement]firstValue];
+
+    [nanoStore closeWithError:nil];
+
+    STAssertTrue ([value isEqualToString:@"NSFZ0000 not a document"], @"Expected the data value to be returned as stored.");
+}
+
+- (void)testOutOfLineBlobs
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    nanoStore.blobSizeThreshold = 1024;
+
+    NSMutableData *data = [NSMutableData dataWithLength:4096];
+    for (NSUInteger i = 0; i < [data length]; i++) {
+        ((uint8_t *)[data mutableBytes])[i] = (uint8_t)(i % 251);
+    }
+
+    // Both objects share the same bytes, which are only stored once. The small value stays inline.
+    NSFNanoObject *firstObject = [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObjectsAndKeys:data, @"Attachment", [NSData dataWithBytes:"abc" length:3], @"Thumbnail", nil]];
+    NSFNanoObject *secondObject = [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObject:[NSArray arrayWithObject:data] forKey:@"Attachments"]];
+    [nanoStore addObjectsFromArray:[NSArray arrayWithObjects:firstObject, secondObject, nil] error:nil];
+
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"SELECT count(*) FROM %@;", NSFBlobs];
+    long long numberOfBlobs = [[[nanoStore _executeSQL:theSQLStatement]firstValue]longLongValue];
+
+    [nanoStore clearCache];
+    NSFNanoObject *reloadedObject = [[nanoStore objectsWithKeysInArray:[NSArray arrayWithObject:firstObject.key]]lastObject];
+    NSFNanoObject *reloadedSecondObject = [[nanoStore objectsWithKeysInArray:[NSArray arrayWithObject:secondObject.key]]lastObject];
+    NSFNanoBlob *blob = [reloadedObject.info objectForKey:@"Attachment"];
+    NSFNanoBlob *secondBlob = [[reloadedSecondObject.info objectForKey:@"Attachments"]lastObject];
+
+    NSData *blobData = [nanoStore dataOfBlob:blob error:nil];
+    NSData *rangeData = [nanoStore dataOfBlob:blob inRange:NSMakeRange(1000, 10) error:nil];
+
+    NSOutputStream *outputStream = [NSOutputStream outputStreamToMemory];
+    BOOL written = [nanoStore writeBlob:blob toOutputStream:outputStream error:nil];
+    NSData *streamedData = [outputStream propertyForKey:NSStreamDataWrittenToMemoryStreamKey];
+    [outputStream close];
+
+    // Streaming the same bytes in doesn't add a copy
+    NSInputStream *inputStream = [NSInputStream inputStreamWithData:data];
+    NSFNanoBlob *streamedBlob = [nanoStore addBlobFromInputStream:inputStream length:[data length] error:nil];
+    [inputStream close];
+    long long numberOfBlobsAfterStreaming = [[[nanoStore _executeSQL:theSQLStatement]firstValue]longLongValue];
+    NSFNanoObject *thirdObject = [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObject:streamedBlob forKey:@"Attachment"]];
+    [nanoStore addObject:thirdObject error:nil];
+
+    // The blob survives as long as an object references it
+    [nanoStore removeObject:firstObject error:nil];
+    [nanoStore removeUnreferencedBlobsAndReturnError:nil];
+    long long numberOfBlobsWhileReferenced = [[[nanoStore _executeSQL:theSQLStatement]firstValue]longLongValue];
+    [nanoStore removeObjectsInArray:[NSArray arrayWithObjects:secondObject, thirdObject, nil] error:nil];
+    BOOL removed = [nanoStore removeUnreferencedBlobsAndReturnError:nil];
+    long long numberOfBlobsAtTheEnd = [[[nanoStore _executeSQL:theSQLStatement]firstValue]longLongValue];
+
+    [nanoStore closeWithError:nil];
+
+    STAssertTrue (1 == numberOfBlobs, @"Expected the shared bytes to be stored once.");
+    STAssertTrue ([blob isKindOfClass:[NSFNanoBlob class]] && (4096 == blob.length) && [blob isEqualToBlob:secondBlob], @"Expected both objects to reference the same blob.");
+    STAssertTrue ([[reloadedObject.info objectForKey:@"Thumbnail"]isKindOfClass:[NSData class]], @"Expected the small value to stay inline.");
+    STAssertTrue ([blobData isEqualToData:data], @"Expected the blob to read back unchanged.");
+    STAssertTrue ([rangeData isEqualToData:[data subdataWithRange:NSMakeRange(1000, 10)]], @"Expected the range of the blob to read back unchanged.");
+    STAssertTrue (written && [streamedData isEqualToData:data], @"Expected the blob to be written to the stream unchanged.");
+    STAssertTrue ([streamedBlob isEqualToBlob:blob] && (1 == numberOfBlobsAfterStreaming), @"Expected the streamed bytes to be deduplicated.");
+    STAssertTrue (removed && (1 == numberOfBlobsWhileReferenced) && (0 == numberOfBlobsAtTheEnd), @"Expected only the unreferenced blobs to be removed.");
+}
+
+
+- (void)testRemoveUnreferencedBlobsKeepsBlobsAwaitingTheirObject
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+
+    NSFNanoBlob *savedBlob = [nanoStore addBlobWithData:[NSData dataWithBytes:"saved" length:5] error:nil];
+    NSFNanoObject *savedObject = [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObject:savedBlob forKey:@"Attachment"]];
+    [nanoStore addObject:savedObject error:nil];
+    [nanoStore removeObject:savedObject error:nil];
+
+    // A NULL value anywhere in the store mustn't keep the sweep from removing anything
+    NSString *theSQLStatement = [[NSString alloc]initWithFormat:@"INSERT INTO %@(%@, %@, %@) VALUES ('Unrelated', 'Nothing', NULL);", NSFValues, NSFKey, NSFAttribute, NSFValue];
+    [nanoStore _executeSQL:theSQLStatement];
+
+    // The object referencing this blob hasn't been saved yet
+    NSFNanoBlob *pendingBlob = [nanoStore addBlobWithData:[NSData dataWithBytes:"pending" length:7] error:nil];
+    [nanoStore removeUnreferencedBlobsAndReturnError:nil];
+    BOOL savedBlobRemoved = (nil == [nanoStore dataOfBlob:savedBlob error:nil]);
+    BOOL pendingBlobKept = (nil != [nanoStore dataOfBlob:pendingBlob error:nil]);
+
+    NSFNanoObject *pendingObject = [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObject:pendingBlob forKey:@"Attachment"]];
+    [nanoStore addObject:pendingObject error:nil];
+    [nanoStore removeObject:pendingObject error:nil];
+    [nanoStore removeUnreferencedBlobsAndReturnError:nil];
+    BOOL pendingBlobRemoved = (nil == [nanoStore dataOfBlob:pendingBlob error:nil]);
+
+    [nanoStore closeWithError:nil];
+
+    STAssertTrue (savedBlobRemoved, @"Expected the unreferenced blob to be removed despite the NULL value.");
+    STAssertTrue (pendingBlobKept, @"Expected the blob awaiting its object to be kept.");
+    STAssertTrue (pendingBlobRemoved, @"Expected the blob to be removed once its object was saved and removed.");
+}
+
+- (void)testSaveMemoryStoreWithBlobsToDirectory
+{
+    NSFNanoStore *nanoStore = [NSFNanoStore createAndOpenStoreWithType:NSFMemoryStoreType path:nil error:nil];
+    nanoStore.blobSizeThreshold = 1024;
+
+    NSMutableData *data = [NSMutableData dataWithLength:4096];
+    for (NSUInteger i = 0; i < [data length]; i++) {
+        ((uint8_t *)[data mutableBytes])[i] = (uint8_t)(i % 251);
+    }
+
+    NSFNanoObject *object = [NSFNanoObject nanoObjectWithDictionary:[NSDictionary dictionaryWithObject:data forKey:@"Attachment"]];
+    [nanoStore addObject:object error:nil];
+
+    NSString *backupPath = [NSTemporaryDirectory() stringByAppendingPathComponent:[NSFNanoEngine stringWithUUID]];
+    BOOL saved = [nanoStore saveStoreToDirectoryAtPath:backupPath compactDatabase:NO error:nil];
+    [nanoStore closeWithError:nil];
+
+    // The object in the backup only holds a reference: the bytes have to come along
+    NSFNanoStore *backupStore = [NSFNanoStore createAndOpenStoreWithType:NSFPersistentStoreType path:backupPath error:nil];
+    NSFNanoObject *reloadedObject = [[backupStore objectsWithKeysInArray:[NSArray arrayWithObject:object.key]]lastObject];
+    NSFNanoBlob *blob = [reloadedObject.info objectForKey:@"Attachment"];
+    NSData *blobData = [backupStore dataOfBlob:blob error:nil];
+    [backupStore closeWithError:nil];
+    [[NSFileManager defaultManager]removeItemAtPath:backupPath error:nil];
+
+    STAssertTrue (saved, @"Expected the memory store to be saved.");
+    STAssertTrue ([blobData isEqualToData:data], @"Expected the backup to keep the bytes of the blob.");
+}
 
 - (void)testNanoStoreEngineDatabase
 {